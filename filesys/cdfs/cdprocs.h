@@ -83,8 +83,10 @@ Abstract:
 #define TAG_IRP_CONTEXT_LITE    'lidC'      //  Irp Context lite
 #define TAG_MCB_ARRAY           'amdC'      //  Mcb array
 #define TAG_PATH_ENTRY_NAME     'nPdC'      //  CdName in path entry
+#define TAG_PATH_INDEX          'iPdC'      //  Path table index
 #define TAG_PREFIX_ENTRY        'epdC'      //  Prefix Entry
 #define TAG_PREFIX_NAME         'npdC'      //  Prefix Entry name
+#define TAG_PREFIX_TABLE        'tpdC'      //  Prefix name table buckets
 #define TAG_SPANNING_PATH_TABLE 'psdC'      //  Buffer for spanning path table
 #define TAG_UPCASE_NAME         'nudC'      //  Buffer for upcased name
 #define TAG_VOL_DESC            'dvdC'      //  Buffer for volume descriptor
@@ -730,6 +732,11 @@ CdUpdatePathEntryName (
     _In_ BOOLEAN IgnoreCase
     );
 
+VOID
+CdDeletePathIndex (
+    _Inout_ PVCB Vcb
+    );
+
 //
 //  VOID
 //  CdInitializeCompoundPathEntry (
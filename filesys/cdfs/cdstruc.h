@@ -253,18 +253,38 @@ typedef struct _CD_NAME {
 typedef CD_NAME *PCD_NAME;
 
 //
-//  Following is the splay link structure for the prefix lookup.
+//  Following is the hash link structure for the prefix lookup.
 //  The names can be in either Unicode string or Ansi string format.
 //
 
 typedef struct _NAME_LINK {
 
-    RTL_SPLAY_LINKS Links;
+    struct _NAME_LINK *Next;
+    ULONG Hash;
     UNICODE_STRING FileName;
 
 } NAME_LINK;
 typedef NAME_LINK *PNAME_LINK;
 
+//
+//  Each directory keeps the names of its open children in two of these
+//  hash tables, one for exact case and one for upcased names.  A lookup
+//  only reads the table, unlike the splay trees these replace which were
+//  restructured on every successful find.  The bucket array is allocated
+//  on the first insert and doubled as the table fills.
+//
+
+#define NAME_TABLE_INITIAL_BUCKETS      (16)
+
+typedef struct _NAME_TABLE {
+
+    PNAME_LINK *Buckets;
+    ULONG BucketCount;
+    ULONG EntryCount;
+
+} NAME_TABLE;
+typedef NAME_TABLE *PNAME_TABLE;
+
 
 //
 //  Prefix entry.  There is one of these for each name in the prefix table.
@@ -556,6 +576,15 @@ typedef struct _VCB {
     struct _FCB *RootIndexFcb;
     struct _FCB *PathTableFcb;
 
+    //
+    //  Hash index over the path table, built by the first path table search
+    //  on a large enough path table.  PathIndexStarted is set by whoever
+    //  takes on building it, so that it is built at most once.
+    //
+
+    struct _PATH_INDEX *PathIndex;
+    __volatile LONG PathIndexStarted;
+
     //
     //  Location of current session and offset of volume descriptors.
     //
@@ -840,11 +869,11 @@ typedef struct _FCB_INDEX {
     ULONG ChildOrdinal;
 
     //
-    //  Root of splay trees for exact and ignore case prefix trees.
+    //  Hash tables for exact and ignore case prefix names.
     //
 
-    PRTL_SPLAY_LINKS ExactCaseRoot;
-    PRTL_SPLAY_LINKS IgnoreCaseRoot;
+    NAME_TABLE ExactCaseTable;
+    NAME_TABLE IgnoreCaseTable;
 
 } FCB_INDEX;
 typedef FCB_INDEX *PFCB_INDEX;
@@ -1526,6 +1555,44 @@ typedef struct _COMPOUND_PATH_ENTRY {
 } COMPOUND_PATH_ENTRY;
 typedef COMPOUND_PATH_ENTRY *PCOMPOUND_PATH_ENTRY;
 
+
+//
+//  Path table index.  Finding a directory in the path table otherwise means
+//  walking all the children of its parent, and on discs with tens of
+//  thousands of directories that walk dominates deep opens.  The index
+//  hashes each entry on its parent ordinal and upcased name, and records
+//  where the entry is so a search can go straight to its few candidates.
+//  The path table never changes for the life of the Vcb, so once built
+//  the index is read without any locking.
+//
+//  Entries are linked through their position in the Entries array plus
+//  one, with zero ending a chain.
+//
+
+#define PATH_INDEX_MINIMUM_SIZE         (2 * SECTOR_SIZE)
+
+typedef struct _PATH_INDEX_ENTRY {
+
+    ULONG Next;
+    ULONG Hash;
+    ULONG ParentOrdinal;
+    ULONG Ordinal;
+    ULONG PathTableOffset;
+
+} PATH_INDEX_ENTRY;
+typedef PATH_INDEX_ENTRY *PPATH_INDEX_ENTRY;
+
+typedef struct _PATH_INDEX {
+
+    ULONG BucketMask;
+    ULONG EntryCount;
+
+    PULONG Buckets;
+    PPATH_INDEX_ENTRY Entries;
+
+} PATH_INDEX;
+typedef PATH_INDEX *PPATH_INDEX;
+
 
 //
 //  The following is used for enumerating through a directory via the
@@ -1717,22 +1717,44 @@ Return Value:
             CurrentByteCount = SectorTruncate( CurrentByteCount );
 
             //
-            //  Read these sectors from the disk.
+            //  If the previous run also went straight into the user's buffer
+            //  and ends on the disk where this one starts, as the extents of
+            //  a multi-extent file usually do, then just extend it.  This
+            //  keeps the device request count down and leaves the IoRun
+            //  entry free for a later run.
             //
 
-            ThisIoRun->DiskOffset = DiskOffset;
-            ThisIoRun->DiskByteCount = CurrentByteCount;
+            if ((ThisIoRun != IoRuns) &&
+                ((ThisIoRun - 1)->TransferByteCount == 0) &&
+                ((ThisIoRun - 1)->DiskOffset + (ThisIoRun - 1)->DiskByteCount == DiskOffset)) {
 
-            //
-            //  Use the user's buffer and Mdl as our transfer buffer
-            //  and Mdl.
-            //
+                ThisIoRun->UserBuffer = NULL;
+
+                ThisIoRun -= 1;
+                *RunCount -= 1;
+
+                ThisIoRun->DiskByteCount += CurrentByteCount;
+
+            } else {
+
+                //
+                //  Read these sectors from the disk.
+                //
+
+                ThisIoRun->DiskOffset = DiskOffset;
+                ThisIoRun->DiskByteCount = CurrentByteCount;
+
+                //
+                //  Use the user's buffer and Mdl as our transfer buffer
+                //  and Mdl.
+                //
 
-            ThisIoRun->TransferBuffer = CurrentUserBuffer;
-            ThisIoRun->TransferMdl = Irp->MdlAddress;
-            ThisIoRun->TransferVirtualAddress = Add2Ptr( Irp->UserBuffer,
-                                                         CurrentUserBufferOffset,
-                                                         PVOID );
+                ThisIoRun->TransferBuffer = CurrentUserBuffer;
+                ThisIoRun->TransferMdl = Irp->MdlAddress;
+                ThisIoRun->TransferVirtualAddress = Add2Ptr( Irp->UserBuffer,
+                                                             CurrentUserBufferOffset,
+                                                             PVOID );
+            }
         }
 
         //
@@ -34,7 +34,8 @@ main (argc, argv)
     printf("\n");
     {
         NAME_LINK d;
-        doit( NAME_LINK, Links );
+        doit( NAME_LINK, Next );
+        doit( NAME_LINK, Hash );
         doit( NAME_LINK, FileName );
     }
     printf("\n");
@@ -138,8 +139,8 @@ main (argc, argv)
         doit( FCB_INDEX, Ordinal );
         doit( FCB_INDEX, ChildPathTableOffset );
         doit( FCB_INDEX, ChildOrdinal );
-        doit( FCB_INDEX, ExactCaseRoot );
-        doit( FCB_INDEX, IgnoreCaseRoot );
+        doit( FCB_INDEX, ExactCaseTable );
+        doit( FCB_INDEX, IgnoreCaseTable );
     }
     printf("\n");
     {
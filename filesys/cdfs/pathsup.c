@@ -100,6 +100,25 @@ Abstract:
 //  Local support routines
 //
 
+ULONG
+CdPathIndexHash (
+    _In_ ULONG ParentOrdinal,
+    _In_ PUNICODE_STRING Name,
+    _In_ BOOLEAN Upcase
+    );
+
+PPATH_INDEX
+CdGetPathIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PVCB Vcb
+    );
+
+PPATH_INDEX
+CdBuildPathIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PVCB Vcb
+    );
+
 VOID
 CdMapPathTableBlock (
     _In_ PIRP_CONTEXT IrpContext,
@@ -119,10 +138,14 @@ CdUpdatePathEntryFromRawPathEntry (
     );
 
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, CdBuildPathIndex)
+#pragma alloc_text(PAGE, CdDeletePathIndex)
 #pragma alloc_text(PAGE, CdFindPathEntry)
+#pragma alloc_text(PAGE, CdGetPathIndex)
 #pragma alloc_text(PAGE, CdLookupPathEntry)
 #pragma alloc_text(PAGE, CdLookupNextPathEntry)
 #pragma alloc_text(PAGE, CdMapPathTableBlock)
+#pragma alloc_text(PAGE, CdPathIndexHash)
 #pragma alloc_text(PAGE, CdUpdatePathEntryFromRawPathEntry)
 #pragma alloc_text(PAGE, CdUpdatePathEntryName)
 #endif
@@ -341,6 +364,8 @@ Return Value:
     ULONG StartingOffset;
     ULONG StartingOrdinal;
 
+    PPATH_INDEX PathIndex;
+
     PAGED_CODE();
 
     //
@@ -367,6 +392,55 @@ Return Value:
 		CdRaiseStatus( IrpContext, STATUS_DISK_CORRUPT_ERROR );
 	}
 
+    //
+    //  If the path table is indexed then only look at the entries under
+    //  this parent whose name hashes the same.  The index holds every
+    //  entry, so if none of them matches the name is not there.
+    //
+
+    PathIndex = CdGetPathIndex( IrpContext, ParentFcb->Vcb );
+
+    if (PathIndex != NULL) {
+
+        ULONG Hash;
+        ULONG Next;
+
+        Hash = CdPathIndexHash( ParentFcb->Ordinal, &DirName->FileName, TRUE );
+
+        for (Next = PathIndex->Buckets[Hash & PathIndex->BucketMask];
+             Next != 0;
+             Next = PathIndex->Entries[Next - 1].Next) {
+
+            PPATH_INDEX_ENTRY IndexEntry = &PathIndex->Entries[Next - 1];
+
+            if ((IndexEntry->Hash != Hash) ||
+                (IndexEntry->ParentOrdinal != ParentFcb->Ordinal)) {
+
+                continue;
+            }
+
+            CdLookupPathEntry( IrpContext,
+                               IndexEntry->PathTableOffset,
+                               IndexEntry->Ordinal,
+                               FALSE,
+                               CompoundPathEntry );
+
+            CdUpdatePathEntryName( IrpContext, &CompoundPathEntry->PathEntry, IgnoreCase );
+
+            if (CdIsNameInExpression( IrpContext,
+                                      &CompoundPathEntry->PathEntry.CdCaseDirName,
+                                      DirName,
+                                      0,
+                                      FALSE )) {
+
+                Found = TRUE;
+                break;
+            }
+        }
+
+        return Found;
+    }
+
     CdLockFcb( IrpContext, ParentFcb );
 
     if (ParentFcb->ChildPathTableOffset != 0) {
@@ -524,10 +598,12 @@ Return Value:
     
     //
     //  Map the new block and set the enumeration context to this
-    //  point.  Allocate an auxilary buffer if necessary.
+    //  point.  Allocate an auxilary buffer if necessary.  Note that
+    //  we may be moving back from the last block of the path table.
     //
 
     CurrentLength = 2 * SECTOR_SIZE;
+    PathContext->LastDataBlock = FALSE;
 
     if (CurrentLength >= (ULONG) (Fcb->FileSize.QuadPart - BaseOffset)) {
 
@@ -999,3 +1075,326 @@ Return Value:
 }
 
 
+//
+//  Local support routine
+//
+
+ULONG
+CdPathIndexHash (
+    _In_ ULONG ParentOrdinal,
+    _In_ PUNICODE_STRING Name,
+    _In_ BOOLEAN Upcase
+    )
+
+/*++
+
+Routine Description:
+
+    This routine computes the path index hash of a directory name under a
+    given parent.  The hash is always of the upcased name so that exact and
+    ignore case searches find the same candidates.
+
+Arguments:
+
+    ParentOrdinal - Ordinal of the parent directory.
+
+    Name - The directory name.
+
+    Upcase - Indicates if the name still needs to be upcased.
+
+Return Value:
+
+    ULONG - The hash value.
+
+--*/
+
+{
+    ULONG Hash = 2166136261;
+    ULONG Index;
+    WCHAR Char;
+
+    PAGED_CODE();
+
+    Hash = (Hash ^ ParentOrdinal) * 16777619;
+
+    for (Index = 0; Index < Name->Length / sizeof( WCHAR ); Index++) {
+
+        Char = Name->Buffer[Index];
+
+        if (Upcase) {
+
+            Char = RtlUpcaseUnicodeChar( Char );
+        }
+
+        Hash = (Hash ^ Char) * 16777619;
+    }
+
+    return Hash;
+}
+
+
+//
+//  Local support routine
+//
+
+PPATH_INDEX
+CdGetPathIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PVCB Vcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the path table index for the volume, building it
+    if this is the first search of a large enough path table.  Only one
+    thread builds the index; anyone else searching meanwhile, or after a
+    failed build, walks the path table as before.  A build which raises,
+    for instance on a corrupt path table, is abandoned and the caller
+    walks the path table, which raises in turn only if the caller's search
+    reaches the corrupt entry.
+
+Arguments:
+
+    Vcb - Vcb for the volume.
+
+Return Value:
+
+    PPATH_INDEX - The index, or NULL if there is none.
+
+--*/
+
+{
+    PPATH_INDEX PathIndex = Vcb->PathIndex;
+
+    PAGED_CODE();
+
+    if ((PathIndex != NULL) ||
+        (Vcb->PathIndexStarted != 0) ||
+        (Vcb->PathTableFcb->FileSize.QuadPart < PATH_INDEX_MINIMUM_SIZE) ||
+        (InterlockedCompareExchange( &Vcb->PathIndexStarted, 1, 0 ) != 0)) {
+
+        return PathIndex;
+    }
+
+    try {
+
+        PathIndex = CdBuildPathIndex( IrpContext, Vcb );
+
+#pragma warning(suppress: 6320)
+    } except( FsRtlIsNtstatusExpected( GetExceptionCode() ) ?
+              EXCEPTION_EXECUTE_HANDLER :
+              EXCEPTION_CONTINUE_SEARCH ) {
+
+        //
+        //  CdBuildPathIndex has freed the entries it collected.  Forget
+        //  the status we raised, since this request carries on.
+        //
+
+        PathIndex = NULL;
+        IrpContext->ExceptionStatus = STATUS_SUCCESS;
+    }
+
+    if (PathIndex != NULL) {
+
+        InterlockedExchangePointer( (PVOID *) &Vcb->PathIndex, PathIndex );
+    }
+
+    return PathIndex;
+}
+
+
+//
+//  Local support routine
+//
+
+PPATH_INDEX
+CdBuildPathIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PVCB Vcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks the whole path table once and builds a hash index
+    over its entries.
+
+Arguments:
+
+    Vcb - Vcb for the volume.
+
+Return Value:
+
+    PPATH_INDEX - The new index, or NULL if we could not allocate it.
+        This routine may raise if the path table is corrupt.
+
+--*/
+
+{
+    COMPOUND_PATH_ENTRY CompoundPathEntry;
+    PPATH_ENTRY PathEntry = &CompoundPathEntry.PathEntry;
+
+    PPATH_INDEX PathIndex = NULL;
+    PPATH_INDEX_ENTRY Entries = NULL;
+    PPATH_INDEX_ENTRY NewEntries;
+    ULONG MaximumEntries = 0;
+    ULONG EntryCount = 0;
+    ULONG BucketCount;
+    ULONG Bucket;
+    ULONG Index;
+
+    PAGED_CODE();
+
+    CdInitializeCompoundPathEntry( IrpContext, &CompoundPathEntry );
+
+    try {
+
+        //
+        //  Start at the root, which we don't index since it has no name.
+        //
+
+        CdLookupPathEntry( IrpContext,
+                           CdQueryFidPathTableOffset( Vcb->RootIndexFcb->FileId ),
+                           Vcb->RootIndexFcb->Ordinal,
+                           FALSE,
+                           &CompoundPathEntry );
+
+        while (CdLookupNextPathEntry( IrpContext,
+                                      &CompoundPathEntry.PathContext,
+                                      PathEntry )) {
+
+            //
+            //  Grow the entry array as needed.
+            //
+
+            if (EntryCount == MaximumEntries) {
+
+                MaximumEntries = (MaximumEntries == 0) ? 256 : MaximumEntries * 2;
+
+                NewEntries = ExAllocatePoolZero( CdPagedPool,
+                                                 MaximumEntries * sizeof( PATH_INDEX_ENTRY ),
+                                                 TAG_PATH_INDEX );
+
+                if (NewEntries == NULL) {
+
+                    try_leave( NOTHING );
+                }
+
+                if (Entries != NULL) {
+
+                    RtlCopyMemory( NewEntries, Entries, EntryCount * sizeof( PATH_INDEX_ENTRY ));
+                    CdFreePool( &Entries );
+                }
+
+                Entries = NewEntries;
+            }
+
+            CdUpdatePathEntryName( IrpContext, PathEntry, TRUE );
+
+            Entries[EntryCount].Hash = CdPathIndexHash( PathEntry->ParentOrdinal,
+                                                        &PathEntry->CdCaseDirName.FileName,
+                                                        FALSE );
+            Entries[EntryCount].ParentOrdinal = PathEntry->ParentOrdinal;
+            Entries[EntryCount].Ordinal = PathEntry->Ordinal;
+            Entries[EntryCount].PathTableOffset = PathEntry->PathTableOffset;
+
+            EntryCount += 1;
+        }
+
+        if (EntryCount == 0) {
+
+            try_leave( NOTHING );
+        }
+
+        //
+        //  Size the bucket array to the next power of two and chain the
+        //  entries in, last to first, so that each chain is in path table
+        //  order.
+        //
+
+        for (BucketCount = 16; BucketCount < EntryCount; BucketCount *= 2) {
+
+            NOTHING;
+        }
+
+        PathIndex = ExAllocatePoolZero( CdPagedPool,
+                                        sizeof( PATH_INDEX ),
+                                        TAG_PATH_INDEX );
+
+        if (PathIndex == NULL) {
+
+            try_leave( NOTHING );
+        }
+
+        PathIndex->Buckets = ExAllocatePoolZero( CdPagedPool,
+                                                 BucketCount * sizeof( ULONG ),
+                                                 TAG_PATH_INDEX );
+
+        if (PathIndex->Buckets == NULL) {
+
+            CdFreePool( &PathIndex );
+            try_leave( NOTHING );
+        }
+
+        PathIndex->BucketMask = BucketCount - 1;
+        PathIndex->EntryCount = EntryCount;
+
+        for (Index = EntryCount; Index != 0; Index--) {
+
+            Bucket = Entries[Index - 1].Hash & PathIndex->BucketMask;
+
+            Entries[Index - 1].Next = PathIndex->Buckets[Bucket];
+            PathIndex->Buckets[Bucket] = Index;
+        }
+
+        PathIndex->Entries = Entries;
+        Entries = NULL;
+
+    } finally {
+
+        CdCleanupCompoundPathEntry( IrpContext, &CompoundPathEntry );
+
+        if (Entries != NULL) {
+
+            CdFreePool( &Entries );
+        }
+    }
+
+    return PathIndex;
+}
+
+
+VOID
+CdDeletePathIndex (
+    _Inout_ PVCB Vcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the path table index for a volume, if it has one.
+
+Arguments:
+
+    Vcb - Vcb for the volume.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PAGED_CODE();
+
+    if (Vcb->PathIndex != NULL) {
+
+        CdFreePool( &Vcb->PathIndex->Buckets );
+        CdFreePool( &Vcb->PathIndex->Entries );
+        CdFreePool( &Vcb->PathIndex );
+    }
+}
@@ -25,17 +25,29 @@ Abstract:
 //  Local support routines.
 //
 
+ULONG
+CdNameLinkHash (
+    _In_ PUNICODE_STRING Name
+    );
+
 PNAME_LINK
 CdFindNameLink (
     _In_ PIRP_CONTEXT IrpContext,
-    _In_ PRTL_SPLAY_LINKS *RootNode,
+    _In_ PNAME_TABLE NameTable,
     _In_ PUNICODE_STRING Name
     );
 
 BOOLEAN
 CdInsertNameLink (
     _In_ PIRP_CONTEXT IrpContext,
-    _Inout_ PRTL_SPLAY_LINKS *RootNode,
+    _Inout_ PNAME_TABLE NameTable,
+    _Inout_ PNAME_LINK NameLink
+    );
+
+VOID
+CdRemoveNameLink (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PNAME_TABLE NameTable,
     _In_ PNAME_LINK NameLink
     );
 
@@ -44,10 +56,12 @@ CdInsertNameLink (
 #pragma alloc_text(PAGE, CdFindPrefix)
 #pragma alloc_text(PAGE, CdInsertNameLink)
 #pragma alloc_text(PAGE, CdInsertPrefix)
+#pragma alloc_text(PAGE, CdNameLinkHash)
+#pragma alloc_text(PAGE, CdRemoveNameLink)
 #pragma alloc_text(PAGE, CdRemovePrefix)
 #endif
 
-
+
 VOID
 CdInsertPrefix (
     _In_ PIRP_CONTEXT IrpContext,
@@ -88,7 +102,7 @@ Return Value:
     ULONG PrefixFlags;
     PNAME_LINK NameLink;
     PPREFIX_ENTRY PrefixEntry;
-    PRTL_SPLAY_LINKS *TreeRoot;
+    PNAME_TABLE NameTable;
 
     PWCHAR NameBuffer;
 
@@ -124,13 +138,13 @@ Return Value:
 
         PrefixFlags = PREFIX_FLAG_IGNORE_CASE_IN_TREE;
         NameLink = &PrefixEntry->IgnoreCaseName;
-        TreeRoot = &ParentFcb->IgnoreCaseRoot;
+        NameTable = &ParentFcb->IgnoreCaseTable;
 
     } else {
 
         PrefixFlags = PREFIX_FLAG_EXACT_CASE_IN_TREE;
         NameLink = &PrefixEntry->ExactCaseName;
-        TreeRoot = &ParentFcb->ExactCaseRoot;
+        NameTable = &ParentFcb->ExactCaseTable;
     }
 
     //
@@ -189,12 +203,26 @@ Return Value:
                        Name->FileName.Buffer,
                        Name->FileName.Length );
 
-        CdInsertNameLink( IrpContext,
-                          TreeRoot,
-                          NameLink );
+        if (CdInsertNameLink( IrpContext,
+                              NameTable,
+                              NameLink )) {
+
+            PrefixEntry->Fcb = Fcb;
+            SetFlag( PrefixEntry->PrefixFlags, PrefixFlags );
 
-        PrefixEntry->Fcb = Fcb;
-        SetFlag( PrefixEntry->PrefixFlags, PrefixFlags );
+        //
+        //  If the name could not go in and this prefix entry holds no other
+        //  name then give back any buffer we allocated for it, since the
+        //  next insert will allocate a fresh one.
+        //
+
+        } else if (!FlagOn( PrefixEntry->PrefixFlags,
+                            PREFIX_FLAG_EXACT_CASE_IN_TREE | PREFIX_FLAG_IGNORE_CASE_IN_TREE ) &&
+                   (PrefixEntry->ExactCaseName.FileName.Buffer != (PWCHAR) PrefixEntry->FileNameBuffer)) {
+
+            CdFreePool( &PrefixEntry->ExactCaseName.FileName.Buffer );
+            PrefixEntry->IgnoreCaseName.FileName.Buffer = NULL;
+        }
     }
 
     return;
@@ -227,8 +255,6 @@ Return Value:
 {
     PAGED_CODE();
 
-    UNREFERENCED_PARAMETER( IrpContext );
-
     //
     //  Start with the short name prefix entry.
     //
@@ -237,12 +263,16 @@ Return Value:
 
         if (FlagOn( Fcb->ShortNamePrefix->PrefixFlags, PREFIX_FLAG_IGNORE_CASE_IN_TREE )) {
 
-            Fcb->ParentFcb->IgnoreCaseRoot = RtlDelete( &Fcb->ShortNamePrefix->IgnoreCaseName.Links );
+            CdRemoveNameLink( IrpContext,
+                              &Fcb->ParentFcb->IgnoreCaseTable,
+                              &Fcb->ShortNamePrefix->IgnoreCaseName );
         }
 
         if (FlagOn( Fcb->ShortNamePrefix->PrefixFlags, PREFIX_FLAG_EXACT_CASE_IN_TREE )) {
 
-            Fcb->ParentFcb->ExactCaseRoot = RtlDelete( &Fcb->ShortNamePrefix->ExactCaseName.Links );
+            CdRemoveNameLink( IrpContext,
+                              &Fcb->ParentFcb->ExactCaseTable,
+                              &Fcb->ShortNamePrefix->ExactCaseName );
         }
 
         ClearFlag( Fcb->ShortNamePrefix->PrefixFlags,
@@ -255,12 +285,16 @@ Return Value:
 
     if (FlagOn( Fcb->FileNamePrefix.PrefixFlags, PREFIX_FLAG_IGNORE_CASE_IN_TREE )) {
 
-        Fcb->ParentFcb->IgnoreCaseRoot = RtlDelete( &Fcb->FileNamePrefix.IgnoreCaseName.Links );
+        CdRemoveNameLink( IrpContext,
+                          &Fcb->ParentFcb->IgnoreCaseTable,
+                          &Fcb->FileNamePrefix.IgnoreCaseName );
     }
 
     if (FlagOn( Fcb->FileNamePrefix.PrefixFlags, PREFIX_FLAG_EXACT_CASE_IN_TREE )) {
 
-        Fcb->ParentFcb->ExactCaseRoot = RtlDelete( &Fcb->FileNamePrefix.ExactCaseName.Links );
+        CdRemoveNameLink( IrpContext,
+                          &Fcb->ParentFcb->ExactCaseTable,
+                          &Fcb->FileNamePrefix.ExactCaseName );
     }
 
     ClearFlag( Fcb->FileNamePrefix.PrefixFlags,
@@ -297,7 +331,7 @@ Routine Description:
 
     This routine begins from the given CurrentFcb and walks through all of
     components of the name looking for the longest match in the prefix
-    splay trees.  The search is relative to the starting Fcb so the
+    hash tables.  The search is relative to the starting Fcb so the
     full name may not begin with a '\'.  On return this routine will
     update Current Fcb with the lowest point it has travelled in the
     tree.  It will also hold only that resource on return and it must
@@ -363,13 +397,13 @@ Return Value:
                        &FinalName );
 
         //
-        //  Check if this name is in the splay tree for this Scb.
+        //  Check if this name is in the name table for this Fcb.
         //
 
         if (IgnoreCase) {
 
             NameLink = CdFindNameLink( IrpContext,
-                                       &(*CurrentFcb)->IgnoreCaseRoot,
+                                       &(*CurrentFcb)->IgnoreCaseTable,
                                        &FinalName );
 
             //
@@ -384,7 +418,7 @@ Return Value:
         } else {
 
             NameLink = CdFindNameLink( IrpContext,
-                                       &(*CurrentFcb)->ExactCaseRoot,
+                                       &(*CurrentFcb)->ExactCaseTable,
                                        &FinalName );
 
             PrefixEntry = (PPREFIX_ENTRY) CONTAINING_RECORD( NameLink,
@@ -459,10 +493,8 @@ Return Value:
 //  Local support routine
 //
 
-PNAME_LINK
-CdFindNameLink (
-    _In_ PIRP_CONTEXT IrpContext,
-    _In_ PRTL_SPLAY_LINKS *RootNode,
+ULONG
+CdNameLinkHash (
     _In_ PUNICODE_STRING Name
     )
 
@@ -470,81 +502,85 @@ CdFindNameLink (
 
 Routine Description:
 
-    This routine searches through a splay link tree looking for a match for the
-    input name.  If we find the corresponding name we will rebalance the
-    tree.
+    This routine hashes a name for the prefix name tables.  Names going into
+    or looked up in the ignore case table are already upcased, so a plain
+    hash of the characters serves both tables.
 
 Arguments:
 
-    RootNode - Supplies the parent to search.
-
-    Name - This is the name to search for.  Note if we are doing a case
-        insensitive search the name would have been upcased already.
+    Name - This is the name to hash.
 
 Return Value:
 
-    PNAME_LINK - The name link found or NULL if there is no match.
+    ULONG - The hash value.
 
 --*/
 
 {
-    FSRTL_COMPARISON_RESULT Comparison;
-    PNAME_LINK Node;
-    PRTL_SPLAY_LINKS Links;
+    ULONG Hash = 2166136261;
+    ULONG Index;
 
     PAGED_CODE();
 
-    Links = *RootNode;
+    for (Index = 0; Index < Name->Length / sizeof( WCHAR ); Index++) {
 
-    while (Links != NULL) {
+        Hash = (Hash ^ Name->Buffer[Index]) * 16777619;
+    }
 
-        Node = CONTAINING_RECORD( Links, NAME_LINK, Links );
+    return Hash;
+}
 
-        //
-        //  Compare the prefix in the tree with the full name
-        //
 
-        Comparison = CdFullCompareNames( IrpContext, &Node->FileName, Name );
+//
+//  Local support routine
+//
 
-        //
-        //  See if they don't match
-        //
+PNAME_LINK
+CdFindNameLink (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PNAME_TABLE NameTable,
+    _In_ PUNICODE_STRING Name
+    )
 
-        if (Comparison == GreaterThan) {
+/*++
 
-            //
-            //  The prefix is greater than the full name
-            //  so we go down the left child
-            //
+Routine Description:
 
-            Links = RtlLeftChild( Links );
+    This routine searches a name table looking for a match for the input
+    name.  The table is not modified.
 
-            //
-            //  And continue searching down this tree
-            //
+Arguments:
 
-        } else if (Comparison == LessThan) {
+    NameTable - Supplies the table to search.
 
-            //
-            //  The prefix is less than the full name
-            //  so we go down the right child
-            //
+    Name - This is the name to search for.  Note if we are doing a case
+        insensitive search the name would have been upcased already.
 
-            Links = RtlRightChild( Links );
+Return Value:
 
-            //
-            //  And continue searching down this tree
-            //
+    PNAME_LINK - The name link found or NULL if there is no match.
 
-        } else {
+--*/
 
-            //
-            //  We found it.
-            //
-            //  Splay the tree and save the new root.
-            //
+{
+    PNAME_LINK Node;
+    ULONG Hash;
+
+    PAGED_CODE();
+
+    if (NameTable->Buckets == NULL) {
+
+        return NULL;
+    }
+
+    Hash = CdNameLinkHash( Name );
 
-            *RootNode = RtlSplay( Links );
+    for (Node = NameTable->Buckets[Hash & (NameTable->BucketCount - 1)];
+         Node != NULL;
+         Node = Node->Next) {
+
+        if ((Node->Hash == Hash) &&
+            (CdFullCompareNames( IrpContext, &Node->FileName, Name ) == EqualTo)) {
 
             return Node;
         }
@@ -557,7 +593,7 @@ Return Value:
     return NULL;
 }
 
-
+
 //
 //  Local support routine
 //
@@ -565,23 +601,24 @@ Return Value:
 BOOLEAN
 CdInsertNameLink (
     _In_ PIRP_CONTEXT IrpContext,
-    _Inout_ PRTL_SPLAY_LINKS *RootNode,
-    _In_ PNAME_LINK NameLink
+    _Inout_ PNAME_TABLE NameTable,
+    _Inout_ PNAME_LINK NameLink
     )
 
 /*++
 
 Routine Description:
 
-    This routine will insert a name in the splay tree pointed to
-    by RootNode.
+    This routine will insert a name in a name table, allocating or growing
+    the bucket array as needed.
 
-    The name could already exist in this tree for a case-insensitive tree.
-    In that case we simply return FALSE and do nothing.
+    The name could already exist in this table for a case-insensitive table.
+    In that case we simply return FALSE and do nothing.  We also return FALSE
+    if we could not allocate the bucket array for an empty table.
 
 Arguments:
 
-    RootNode - Supplies a pointer to the table.
+    NameTable - Supplies a pointer to the table.
 
     NameLink - Contains the new link to enter.
 
@@ -592,122 +629,123 @@ Return Value:
 --*/
 
 {
-    FSRTL_COMPARISON_RESULT Comparison;
+    PNAME_LINK *Buckets;
     PNAME_LINK Node;
+    PNAME_LINK Next;
+    ULONG BucketCount;
+    ULONG Index;
 
     PAGED_CODE();
 
-    RtlInitializeSplayLinks( &NameLink->Links );
+    NameLink->Hash = CdNameLinkHash( &NameLink->FileName );
+
+    if (CdFindNameLink( IrpContext, NameTable, &NameLink->FileName ) != NULL) {
+
+        return FALSE;
+    }
 
     //
-    //  If we are the first entry in the tree, just become the root.
+    //  Allocate the bucket array on the first insert, and double it once
+    //  the table averages two names a bucket.  If we can't grow the table
+    //  we simply carry on with longer chains.
     //
 
-    if (*RootNode == NULL) {
+    if ((NameTable->Buckets == NULL) ||
+        (NameTable->EntryCount >= NameTable->BucketCount * 2)) {
 
-        *RootNode = &NameLink->Links;
+        BucketCount = (NameTable->Buckets == NULL) ?
+                      NAME_TABLE_INITIAL_BUCKETS :
+                      NameTable->BucketCount * 2;
 
-        return TRUE;
-    }
+        Buckets = ExAllocatePoolZero( CdPagedPool,
+                                      BucketCount * sizeof( PNAME_LINK ),
+                                      TAG_PREFIX_TABLE );
 
-    Node = CONTAINING_RECORD( *RootNode, NAME_LINK, Links );
+        if (Buckets != NULL) {
 
-    while (TRUE) {
+            for (Index = 0; Index < NameTable->BucketCount; Index++) {
 
-        //
-        //  Compare the prefix in the tree with the prefix we want
-        //  to insert.
-        //
+                for (Node = NameTable->Buckets[Index]; Node != NULL; Node = Next) {
 
-        Comparison = CdFullCompareNames( IrpContext, &Node->FileName, &NameLink->FileName );
+                    Next = Node->Next;
 
-        //
-        //  If we found the entry, return immediately.
-        //
+                    Node->Next = Buckets[Node->Hash & (BucketCount - 1)];
+                    Buckets[Node->Hash & (BucketCount - 1)] = Node;
+                }
+            }
 
-        if (Comparison == EqualTo) { return FALSE; }
+            CdFreePool( &NameTable->Buckets );
 
-        //
-        //  If the tree prefix is greater than the new prefix then
-        //  we go down the left subtree
-        //
+            NameTable->Buckets = Buckets;
+            NameTable->BucketCount = BucketCount;
 
-        if (Comparison == GreaterThan) {
+        } else if (NameTable->Buckets == NULL) {
 
-            //
-            //  We want to go down the left subtree, first check to see
-            //  if we have a left subtree
-            //
+            return FALSE;
+        }
+    }
 
-            if (RtlLeftChild( &Node->Links ) == NULL) {
+    Index = NameLink->Hash & (NameTable->BucketCount - 1);
 
-                //
-                //  there isn't a left child so we insert ourselves as the
-                //  new left child
-                //
+    NameLink->Next = NameTable->Buckets[Index];
+    NameTable->Buckets[Index] = NameLink;
+    NameTable->EntryCount += 1;
 
-                RtlInsertAsLeftChild( &Node->Links, &NameLink->Links );
+    return TRUE;
+}
 
-                //
-                //  and exit the while loop
-                //
 
-                break;
+//
+//  Local support routine
+//
 
-            } else {
+VOID
+CdRemoveNameLink (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PNAME_TABLE NameTable,
+    _In_ PNAME_LINK NameLink
+    )
 
-                //
-                //  there is a left child so simply go down that path, and
-                //  go back to the top of the loop
-                //
+/*++
 
-                Node = CONTAINING_RECORD( RtlLeftChild( &Node->Links ),
-                                          NAME_LINK,
-                                          Links );
-            }
+Routine Description:
 
-        } else {
+    This routine removes a name link from the name table it was inserted in.
 
-            //
-            //  The tree prefix is either less than or a proper prefix
-            //  of the new string.  We treat both cases as less than when
-            //  we do insert.  So we want to go down the right subtree,
-            //  first check to see if we have a right subtree
-            //
+Arguments:
 
-            if (RtlRightChild( &Node->Links ) == NULL) {
+    NameTable - Supplies a pointer to the table.
 
-                //
-                //  These isn't a right child so we insert ourselves as the
-                //  new right child
-                //
+    NameLink - The link to remove.
 
-                RtlInsertAsRightChild( &Node->Links, &NameLink->Links );
+Return Value:
 
-                //
-                //  and exit the while loop
-                //
+    None.
 
-                break;
+--*/
 
-            } else {
+{
+    PNAME_LINK *Link;
 
-                //
-                //  there is a right child so simply go down that path, and
-                //  go back to the top of the loop
-                //
+    PAGED_CODE();
 
-                Node = CONTAINING_RECORD( RtlRightChild( &Node->Links ),
-                                          NAME_LINK,
-                                          Links );
-            }
-        }
-    }
+    UNREFERENCED_PARAMETER( IrpContext );
 
-    return TRUE;
-}
+    NT_ASSERT( NameTable->Buckets != NULL );
 
+    for (Link = &NameTable->Buckets[NameLink->Hash & (NameTable->BucketCount - 1)];
+         *Link != NULL;
+         Link = &(*Link)->Next) {
 
+        if (*Link == NameLink) {
 
+            *Link = NameLink->Next;
+            NameLink->Next = NULL;
+            NameTable->EntryCount -= 1;
 
+            return;
+        }
+    }
 
+    NT_ASSERT( FALSE );
+}
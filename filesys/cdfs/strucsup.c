@@ -929,6 +929,8 @@ Return Value:
     CdFreePool( &Vcb->XASector );
     CdFreePool( &Vcb->SectorCacheBuffer);
 
+    CdDeletePathIndex( Vcb );
+
     if (Vcb->SectorCacheIrp != NULL) {
 
         IoFreeIrp( Vcb->SectorCacheIrp);
@@ -2493,6 +2495,16 @@ Return Value:
             Vcb->PathTableFcb = NULL;
         }
 
+        //
+        //  All of the children are gone, so the name tables are empty.
+        //
+
+        NT_ASSERT( Fcb->ExactCaseTable.EntryCount == 0 );
+        NT_ASSERT( Fcb->IgnoreCaseTable.EntryCount == 0 );
+
+        CdFreePool( &Fcb->ExactCaseTable.Buckets );
+        CdFreePool( &Fcb->IgnoreCaseTable.Buckets );
+
         CdDeallocateFcbIndex( IrpContext, Fcb );
         break;
 
@@ -28,6 +28,7 @@ Abstract:
 #define Dbg                              (DEBUG_TRACE_ALLOCSUP)
 
 #define FatMin(a, b)    ((a) < (b) ? (a) : (b))
+#define FatMax(a, b)    ((a) > (b) ? (a) : (b))
 
 //
 //  Define prefetch page count for the FAT
@@ -48,6 +49,14 @@ FatLookupFatEntry(
     IN OUT PFAT_ENUMERATION_CONTEXT Context
     );
 
+ULONG
+FatLookupContiguousFatEntries(
+    IN PVCB Vcb,
+    IN ULONG FatIndex,
+    IN ULONG MaximumCount,
+    IN PFAT_ENUMERATION_CONTEXT Context
+    );
+
 VOID
 FatSetFatRun(
     IN PIRP_CONTEXT IrpContext,
@@ -62,6 +71,24 @@ FatLogOf(
     IN ULONG Value
     );
 
+VOID
+FatRebuildWindowSummary(
+    IN PVCB Vcb
+    );
+
+VOID
+FatUpdateWindowSummary(
+    IN PVCB Vcb,
+    IN PFAT_WINDOW Window
+    );
+
+ULONG
+FatFindWindowInSummary(
+    IN PVCB Vcb,
+    IN ULONG MinimumClustersFree,
+    IN BOOLEAN FindEmpty
+    );
+
 //
 //  Note that the KdPrint below will ONLY fire when the assert does. Leave it
 //  alone.
@@ -257,18 +284,22 @@ FatLogOf(
 #pragma alloc_text(PAGE, FatAllocateDiskSpace)
 #pragma alloc_text(PAGE, FatDeallocateDiskSpace)
 #pragma alloc_text(PAGE, FatExamineFatEntries)
+#pragma alloc_text(PAGE, FatFindWindowInSummary)
 #pragma alloc_text(PAGE, FatInterpretClusterType)
 #pragma alloc_text(PAGE, FatLogOf)
+#pragma alloc_text(PAGE, FatLookupContiguousFatEntries)
 #pragma alloc_text(PAGE, FatLookupFatEntry)
 #pragma alloc_text(PAGE, FatLookupFileAllocation)
 #pragma alloc_text(PAGE, FatLookupFileAllocationSize)
 #pragma alloc_text(PAGE, FatMergeAllocation)
+#pragma alloc_text(PAGE, FatRebuildWindowSummary)
 #pragma alloc_text(PAGE, FatSetFatEntry)
 #pragma alloc_text(PAGE, FatSetFatRun)
 #pragma alloc_text(PAGE, FatSetupAllocationSupport)
 #pragma alloc_text(PAGE, FatSplitAllocation)
 #pragma alloc_text(PAGE, FatTearDownAllocationSupport)
 #pragma alloc_text(PAGE, FatTruncateFileAllocation)
+#pragma alloc_text(PAGE, FatUpdateWindowSummary)
 #endif
 
 
@@ -286,6 +317,9 @@ Routine Description:
     1.  First window with >50% free clusters
     2.  First empty window
     3.  Window with greatest number of free clusters.
+
+    The choice is made by descending the window summary tree, so the cost
+    is logarithmic in the number of windows.
         
 Arguments:
 
@@ -297,62 +331,233 @@ Return Value:
 
 --*/
 {
-    ULONG i, Fave = 0;
-    ULONG MaxFree = 0;
-    ULONG FirstEmpty = (ULONG)-1;
+    ULONG Fave;
+    ULONG MaxFree;
     ULONG ClustersPerWindow = MAX_CLUSTER_BITMAP_SIZE;
 
     NT_ASSERT( 1 != Vcb->NumberOfWindows);
-    
-    for (i = 0; i < Vcb->NumberOfWindows; i++) {
+    NT_ASSERT( Vcb->WindowSummary != NULL );
 
-        if (Vcb->Windows[i].ClustersFree == ClustersPerWindow)  {
-        
-            if (-1 == FirstEmpty)  {
-            
-                //
-                //  Keep note of the first empty window on the disc
-                //
-                
-                FirstEmpty = i;
-            }
-        }
-        else if (Vcb->Windows[i].ClustersFree > MaxFree)  {
+    //
+    //  Take the first partially used window with 50% or more freespace.
+    //
 
-            //
-            //  This window has the most free clusters,  so far
-            //
-            
-            MaxFree = Vcb->Windows[i].ClustersFree;
-            Fave = i;
+    Fave = FatFindWindowInSummary( Vcb, ClustersPerWindow >> 1, FALSE );
 
-            //
-            //  If this window has >50% free clusters,  then we will take it,
-            //  so don't bother considering more windows.
-            //
-            
-            if (MaxFree >= (ClustersPerWindow >> 1))  {
-            
-                break;
-            }
-        }
+    if (-1 != Fave) {
+
+        return Fave;
     }
 
     //
     //  If there were no windows with 50% or more freespace,  then select the
     //  first empty window on the disc,  if any - otherwise we'll just go with
-    //  the one with the most free clusters.
+    //  the first one with the most free clusters.
     //
-    
-    if ((MaxFree < (ClustersPerWindow >> 1)) && (-1 != FirstEmpty))  {
 
-        Fave = FirstEmpty;
+    if (0 != Vcb->WindowSummary[1].EmptyWindows) {
+
+        return FatFindWindowInSummary( Vcb, 0, TRUE );
     }
 
-    return Fave;
+    MaxFree = Vcb->WindowSummary[1].MaxClustersFree;
+
+    if (0 == MaxFree) {
+
+        return 0;
+    }
+
+    return FatFindWindowInSummary( Vcb, MaxFree, FALSE );
 }
 
-
+
+VOID
+FatRebuildWindowSummary(
+    IN PVCB Vcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine recomputes every node of the window summary tree from the
+    free cluster counts currently recorded in Vcb->Windows[].
+
+Arguments:
+
+    Vcb - Supplies the Vcb for the volume
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ULONG Node;
+    ULONG Leaves = Vcb->WindowSummaryLeaves;
+    PFAT_WINDOW_SUMMARY Summary = Vcb->WindowSummary;
+
+    PAGED_CODE();
+
+    if (Summary == NULL) {
+
+        return;
+    }
+
+    RtlZeroMemory( Summary, 2 * Leaves * sizeof(FAT_WINDOW_SUMMARY) );
+
+    for (Node = 0; Node < Vcb->NumberOfWindows; Node++) {
+
+        if (Vcb->Windows[Node].ClustersFree == MAX_CLUSTER_BITMAP_SIZE) {
+
+            Summary[Leaves + Node].EmptyWindows = 1;
+
+        } else {
+
+            Summary[Leaves + Node].MaxClustersFree = Vcb->Windows[Node].ClustersFree;
+        }
+    }
+
+    for (Node = Leaves - 1; Node > 0; Node--) {
+
+        Summary[Node].MaxClustersFree = FatMax( Summary[2 * Node].MaxClustersFree,
+                                                Summary[2 * Node + 1].MaxClustersFree );
+
+        Summary[Node].EmptyWindows = Summary[2 * Node].EmptyWindows +
+                                     Summary[2 * Node + 1].EmptyWindows;
+    }
+}
+
+
+VOID
+FatUpdateWindowSummary(
+    IN PVCB Vcb,
+    IN PFAT_WINDOW Window
+    )
+
+/*++
+
+Routine Description:
+
+    This routine propagates a change in a window's free cluster count up the
+    window summary tree.  It must be called with the free cluster bitmap
+    locked, after every adjustment of Window->ClustersFree.
+
+Arguments:
+
+    Vcb - Supplies the Vcb for the volume
+
+    Window - Supplies the window whose free cluster count changed
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ULONG Node;
+    PFAT_WINDOW_SUMMARY Summary = Vcb->WindowSummary;
+
+    PAGED_CODE();
+
+    if (Summary == NULL) {
+
+        return;
+    }
+
+    Node = Vcb->WindowSummaryLeaves + (ULONG)(Window - Vcb->Windows);
+
+    NT_ASSERT( (ULONG)(Window - Vcb->Windows) < Vcb->NumberOfWindows );
+
+    if (Window->ClustersFree == MAX_CLUSTER_BITMAP_SIZE) {
+
+        Summary[Node].MaxClustersFree = 0;
+        Summary[Node].EmptyWindows = 1;
+
+    } else {
+
+        Summary[Node].MaxClustersFree = Window->ClustersFree;
+        Summary[Node].EmptyWindows = 0;
+    }
+
+    for (Node >>= 1; Node > 0; Node >>= 1) {
+
+        Summary[Node].MaxClustersFree = FatMax( Summary[2 * Node].MaxClustersFree,
+                                                Summary[2 * Node + 1].MaxClustersFree );
+
+        Summary[Node].EmptyWindows = Summary[2 * Node].EmptyWindows +
+                                     Summary[2 * Node + 1].EmptyWindows;
+    }
+}
+
+
+ULONG
+FatFindWindowInSummary(
+    IN PVCB Vcb,
+    IN ULONG MinimumClustersFree,
+    IN BOOLEAN FindEmpty
+    )
+
+/*++
+
+Routine Description:
+
+    This routine descends the window summary tree to find the lowest numbered
+    window matching the caller's criteria.
+
+Arguments:
+
+    Vcb - Supplies the Vcb for the volume
+
+    MinimumClustersFree - Supplies the number of free clusters a partially used
+        window must have to match, ignored if FindEmpty is TRUE.
+
+    FindEmpty - Indicates that we are looking for a completely free window
+        rather than a partially used one.
+
+Return Value:
+
+    The index of the window into Vcb->Windows[], or -1 if no window matches.
+
+--*/
+
+{
+    ULONG Node = 1;
+    ULONG Leaves = Vcb->WindowSummaryLeaves;
+    PFAT_WINDOW_SUMMARY Summary = Vcb->WindowSummary;
+
+    PAGED_CODE();
+
+    if (FindEmpty ? (Summary[1].EmptyWindows == 0) :
+                    (Summary[1].MaxClustersFree < MinimumClustersFree)) {
+
+        return (ULONG)-1;
+    }
+
+    //
+    //  Go left whenever the left subtree can satisfy us, so that we end up
+    //  on the first matching window.
+    //
+
+    while (Node < Leaves) {
+
+        Node <<= 1;
+
+        if (FindEmpty ? (Summary[Node].EmptyWindows == 0) :
+                        (Summary[Node].MaxClustersFree < MinimumClustersFree)) {
+
+            Node += 1;
+        }
+    }
+
+    NT_ASSERT( Node - Leaves < Vcb->NumberOfWindows );
+
+    return Node - Leaves;
+}
+
+
 VOID
 FatSetupAllocationSupport (
     IN PIRP_CONTEXT IrpContext,
@@ -486,6 +691,22 @@ Arguments:
                                   NULL,
                                   NULL);
 
+            //
+            //  Build the summary tree over the window free counts.
+            //
+
+            for (Vcb->WindowSummaryLeaves = 1;
+                 Vcb->WindowSummaryLeaves < Vcb->NumberOfWindows;
+                 Vcb->WindowSummaryLeaves <<= 1) {
+
+                NOTHING;
+            }
+
+            Vcb->WindowSummary = FsRtlAllocatePoolWithTag( PagedPool,
+                                                           2 * Vcb->WindowSummaryLeaves * sizeof(FAT_WINDOW_SUMMARY),
+                                                           TAG_FAT_WINDOW );
+
+            FatRebuildWindowSummary( Vcb );
 
             //
             //  Pick a window to begin allocating from
@@ -583,6 +804,13 @@ Return Value:
         Vcb->Windows = NULL;
     }
 
+    if ( Vcb->WindowSummary != NULL ) {
+
+        ExFreePool( Vcb->WindowSummary );
+        Vcb->WindowSummary = NULL;
+        Vcb->WindowSummaryLeaves = 0;
+    }
+
     //
     //  Free the memory associated with the free cluster bitmap.
     //
@@ -826,6 +1054,37 @@ Arguments:
 
         while ( !LastCluster ) {
 
+            //
+            //  If we are in the middle of a run, skip over the stretch of the
+            //  pinned fat page that simply chains each cluster to the next one.
+            //  These entries cannot change the run, so there is no reason to
+            //  look at them one at a time.  We stop short of anything that the
+            //  loop check below would reject and let the slow path raise.
+            //
+
+            if (FirstLboOfCurrentRun != 0) {
+
+                ULONG Skip;
+                ULONGLONG SkipLimit;
+
+                SkipLimit = (BytesOnVolume.HighPart == 0) ? BytesOnVolume.LowPart : MAXULONG;
+
+                Skip = (CurrentVbo < SkipLimit) ?
+                       (ULONG)((SkipLimit - CurrentVbo) / BytesPerCluster) : 0;
+
+                if (Skip > 0) {
+
+                    Skip = FatLookupContiguousFatEntries( Vcb,
+                                                          FatEntry,
+                                                          Skip - 1,
+                                                          &Context );
+
+                    FatEntry += Skip;
+                    CurrentLbo += Skip * BytesPerCluster;
+                    CurrentVbo += Skip * BytesPerCluster;
+                }
+            }
+
             //
             //  Get the next fat entry, and update our Current variables.
             //
@@ -2056,6 +2315,7 @@ Arguments:
         FatReserveClusters(IrpContext, Vcb, StartingCluster, ClusterCount);
 
         Window->ClustersFree -= ClusterCount;
+        FatUpdateWindowSummary( Vcb, Window );
 
         StartingCluster += Window->FirstCluster;
         StartingCluster -= 2;
@@ -2111,6 +2371,7 @@ Arguments:
                 }
 
                 Window->ClustersFree += ClusterCount;
+                FatUpdateWindowSummary( Vcb, Window );
                 Vcb->AllocationSupport.NumberOfFreeClusters += ClusterCount;
 
                 FatUnlockFreeClusterBitMap( Vcb );
@@ -2439,6 +2700,7 @@ Arguments:
                     Cluster = Index + Window->FirstCluster;
                     
                     Window->ClustersFree -= ClustersFound;
+                    FatUpdateWindowSummary( Vcb, Window );
                     NT_ASSERT( PreviousClear - ClustersFound == Window->ClustersFree );
 
                     FatUnlockFreeClusterBitMap( Vcb );
@@ -2542,6 +2804,7 @@ Arguments:
                     //
 
                     Window->ClustersFree += ClustersFound;
+                    FatUpdateWindowSummary( Vcb, Window );
                     Vcb->AllocationSupport.NumberOfFreeClusters += ClustersFound;
 
                     FatUnlockFreeClusterBitMap( Vcb );
@@ -3020,6 +3283,7 @@ Return Value:
 
                 count = FatMin(Window->LastCluster - MyStart + 1, MyLength);
                 Window->ClustersFree += count;
+                FatUpdateWindowSummary( Vcb, Window );
 
                 //
                 //  If this was not the last window this allocation spanned,
@@ -3731,6 +3995,129 @@ Arguments:
 }
 
 
+ULONG
+FatLookupContiguousFatEntries (
+    IN PVCB Vcb,
+    IN ULONG FatIndex,
+    IN ULONG MaximumCount,
+    IN PFAT_ENUMERATION_CONTEXT Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine counts how many fat entries, starting at FatIndex, simply
+    point at the following cluster.  Only the page of fat already pinned in
+    the enumeration context is examined, so this never does I/O; the caller
+    falls back to FatLookupFatEntry for the entry that ends the stretch.
+
+    This lets FatLookupFileAllocation walk a contiguous run a page of fat
+    at a time rather than a cluster at a time.
+
+Arguments:
+
+    Vcb - Supplies the Vcb to examine.
+
+    FatIndex - Supplies the first fat index to examine.
+
+    MaximumCount - Supplies the largest count the caller can accept.
+
+    Context - Supplies the pinned page of fat from a previous lookup.
+
+Return Value:
+
+    The number of consecutive entries N such that the entry for
+    FatIndex + i is FatIndex + i + 1 for all i < N.
+
+--*/
+
+{
+    ULONG Count = 0;
+    ULONG PageEntryOffset;
+    ULONG EntriesPerPage;
+    ULONG OffsetIntoVolumeFile;
+    ULONG LastValidIndex;
+
+    PAGED_CODE();
+
+    //
+    //  12 bit fats are small enough that the per-cluster path is fine, and
+    //  we need something pinned to look at.
+    //
+
+    if ((Vcb->AllocationSupport.FatIndexBitSize == 12) ||
+        (Context->Bcb == NULL)) {
+
+        return 0;
+    }
+
+    //
+    //  Never walk past the last cluster on the volume.
+    //
+
+    LastValidIndex = Vcb->AllocationSupport.NumberOfClusters + 1;
+
+    if (FatIndex >= LastValidIndex) {
+
+        return 0;
+    }
+
+    MaximumCount = FatMin( MaximumCount, LastValidIndex - FatIndex );
+
+    if (Vcb->AllocationSupport.FatIndexBitSize == 32) {
+
+        PULONG Entries;
+
+        OffsetIntoVolumeFile = FatReservedBytes(&Vcb->Bpb) + FatIndex * sizeof(FAT_ENTRY);
+
+        if (OffsetIntoVolumeFile / PAGE_SIZE != Context->VboOfPinnedPage / PAGE_SIZE) {
+
+            return 0;
+        }
+
+        PageEntryOffset = (OffsetIntoVolumeFile % PAGE_SIZE) / sizeof(FAT_ENTRY);
+        EntriesPerPage = PAGE_SIZE / sizeof(FAT_ENTRY);
+
+        MaximumCount = FatMin( MaximumCount, EntriesPerPage - PageEntryOffset );
+
+        Entries = (PULONG)Context->PinnedPage + PageEntryOffset;
+
+        while ((Count < MaximumCount) &&
+               ((Entries[Count] & FAT32_ENTRY_MASK) == FatIndex + Count + 1)) {
+
+            Count += 1;
+        }
+
+    } else {
+
+        PUSHORT Entries;
+
+        OffsetIntoVolumeFile = FatReservedBytes(&Vcb->Bpb) + FatIndex * sizeof(USHORT);
+
+        if (OffsetIntoVolumeFile / PAGE_SIZE != Context->VboOfPinnedPage / PAGE_SIZE) {
+
+            return 0;
+        }
+
+        PageEntryOffset = (OffsetIntoVolumeFile % PAGE_SIZE) / sizeof(USHORT);
+        EntriesPerPage = PAGE_SIZE / sizeof(USHORT);
+
+        MaximumCount = FatMin( MaximumCount, EntriesPerPage - PageEntryOffset );
+
+        Entries = (PUSHORT)Context->PinnedPage + PageEntryOffset;
+
+        while ((Count < MaximumCount) &&
+               (Entries[Count] == FatIndex + Count + 1)) {
+
+            Count += 1;
+        }
+    }
+
+    return Count;
+}
+
+
 _Requires_lock_held_(_Global_critical_region_)
 VOID
 FatSetFatEntry (
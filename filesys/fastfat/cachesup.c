@@ -28,6 +28,25 @@ Abstract:
 
 #define Dbg                              (DEBUG_TRACE_CACHESUP)
 
+#if (NTDDI_VERSION >= NTDDI_WIN8)
+
+NTSTATUS
+FatPrefetchPagesAtPriority (
+    IN PFILE_OBJECT FileObject,
+    IN ULONG StartingPage,
+    IN ULONG PageCount,
+    IN ULONG PagePriority
+    );
+
+WORKER_THREAD_ROUTINE FatDeferredPrefetchDirectory;
+
+VOID
+FatDeferredPrefetchDirectory (
+    _In_ PVOID Parameter
+    );
+
+#endif
+
 #if DBG
 
 BOOLEAN
@@ -53,6 +72,11 @@ FatIsCurrentOperationSynchedForDcbTeardown (
 #pragma alloc_text(PAGE, FatUnpinRepinnedBcbs)
 #pragma alloc_text(PAGE, FatZeroData)
 #pragma alloc_text(PAGE, FatPrefetchPages)
+#pragma alloc_text(PAGE, FatPrefetchDirectory)
+#if (NTDDI_VERSION >= NTDDI_WIN8)
+#pragma alloc_text(PAGE, FatPrefetchPagesAtPriority)
+#pragma alloc_text(PAGE, FatDeferredPrefetchDirectory)
+#endif
 #if DBG
 #pragma alloc_text(PAGE, FatIsCurrentOperationSynchedForDcbTeardown)
 #endif
@@ -404,6 +428,12 @@ Arguments:
 
     NT_ASSERT( ByteCount != 0 );
 
+    //
+    //  Keep the pages ahead of the scan coming in.
+    //
+
+    FatPrefetchDirectory( IrpContext, Dcb, StartingVbo );
+
     //
     //  Call the Cache manager to attempt the transfer.
     //
@@ -431,11 +461,24 @@ Arguments:
         // Could not read the data without waiting (cache miss).
         //
 
+        InterlockedIncrement( &FatData.DirectoryReadMisses );
+
         *Bcb = NULL;
         *Buffer = NULL;
         FatRaiseStatus( IrpContext, STATUS_CANT_WAIT );
     }
 
+    //
+    //  A request that cannot wait only gets here if the data was already in
+    //  memory.  A request that can wait tells us nothing, and may have just
+    //  prefetched the data itself, so it is not counted.
+    //
+
+    if (!FlagOn(IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT)) {
+
+        InterlockedIncrement( &FatData.DirectoryReadHits );
+    }
+
     DbgDoit( IrpContext->PinCount += 1 )
 
     *Status = STATUS_SUCCESS;
@@ -1916,23 +1959,24 @@ Arguments:
 
 #if (NTDDI_VERSION >= NTDDI_WIN8)
 
+//
+//  Local support routine
+//
+
 NTSTATUS
-FatPrefetchPages (
-    IN PIRP_CONTEXT IrpContext,
+FatPrefetchPagesAtPriority (
     IN PFILE_OBJECT FileObject,
     IN ULONG StartingPage,
-    IN ULONG PageCount
+    IN ULONG PageCount,
+    IN ULONG PagePriority
     )
 {
-    IO_PRIORITY_INFO PriorityInformation = {0};
     MM_PREFETCH_FLAGS PrefetchFlags;
     ULONG PageNo;
     NTSTATUS Status;
 
     PREAD_LIST ReadList = NULL;
 
-    UNREFERENCED_PARAMETER( IrpContext );
-
     PAGED_CODE();
 
     //
@@ -1951,18 +1995,6 @@ FatPrefetchPages (
 
     ASSERT( PageCount < (PFN_NUMBER)MAXULONG );
 
-    IoInitializePriorityInfo( &PriorityInformation );
-
-    Status = IoRetrievePriorityInfo( IrpContext->OriginatingIrp,
-                                     FileObject,
-                                     IrpContext->OriginatingIrp->Tail.Overlay.Thread,
-                                     &PriorityInformation );
-
-    if (!NT_SUCCESS( Status)) {
-
-        goto Cleanup;
-    }
-
     ReadList = ExAllocatePoolZero( PagedPool,
                                    FIELD_OFFSET( READ_LIST, List ) + PageCount * sizeof( FILE_SEGMENT_ELEMENT ),
                                    ' taF' );
@@ -1982,7 +2014,7 @@ FatPrefetchPages (
     ReadList->NumberOfEntries = PageCount;
 
     PrefetchFlags.AllFlags = 0;
-    PrefetchFlags.Flags.Priority = PriorityInformation.PagePriority;
+    PrefetchFlags.Flags.Priority = PagePriority;
     PrefetchFlags.Flags.RepurposePriority = SYSTEM_PAGE_PRIORITY_LEVELS - 1;
     PrefetchFlags.Flags.PriorityProtection = 1;
     ReadList->List[0].Alignment = StartingPage * PAGE_SIZE;
@@ -2004,5 +2036,258 @@ Cleanup:
 
     return Status;
 }
+
+
+NTSTATUS
+FatPrefetchPages (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFILE_OBJECT FileObject,
+    IN ULONG StartingPage,
+    IN ULONG PageCount
+    )
+{
+    IO_PRIORITY_INFO PriorityInformation = {0};
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    //
+    //  Succeed zero page prefetch requests.
+    //
+
+    if (PageCount == 0) {
+
+        return STATUS_SUCCESS;
+    }
+
+    IoInitializePriorityInfo( &PriorityInformation );
+
+    Status = IoRetrievePriorityInfo( IrpContext->OriginatingIrp,
+                                     FileObject,
+                                     IrpContext->OriginatingIrp->Tail.Overlay.Thread,
+                                     &PriorityInformation );
+
+    if (!NT_SUCCESS( Status)) {
+
+        return Status;
+    }
+
+    return FatPrefetchPagesAtPriority( FileObject,
+                                       StartingPage,
+                                       PageCount,
+                                       PriorityInformation.PagePriority );
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+FatDeferredPrefetchDirectory (
+    _In_ PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the prefetch queued by FatPrefetchDirectory, with
+    no locks held, and drops the reference on the directory file.
+
+Arguments:
+
+    Parameter - Contains the directory prefetch context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDIRECTORY_PREFETCH_CONTEXT PrefetchContext = (PDIRECTORY_PREFETCH_CONTEXT)Parameter;
+
+    PAGED_CODE();
+
+    //
+    //  Make us appear as a top level FSP request, like any other deferred
+    //  work against the volume.
+    //
+
+    IoSetTopLevelIrp( (PIRP)FSRTL_FSP_TOP_LEVEL_IRP );
+
+    FatPrefetchPagesAtPriority( PrefetchContext->File,
+                                PrefetchContext->StartingPage,
+                                PrefetchContext->PageCount,
+                                PrefetchContext->PagePriority );
+
+    IoSetTopLevelIrp( NULL );
+
+    ObDereferenceObject( PrefetchContext->File );
+
+    ExFreePool( PrefetchContext );
+}
+#endif
+
+
+VOID
+FatPrefetchDirectory (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN VBO StartingVbo
+    )
+
+/*++
+
+Routine Description:
+
+    This routine keeps a window of the directory stream ahead of a scan
+    in memory.  When the scan starts outside the window we last fetched,
+    or gets past its first half, we prefetch the next
+    FatData.DirectoryPrefetchPages pages in a single request.  Mm issues
+    the pages that are not yet resident together and our paging read
+    path turns each run of the directory's allocation into one large
+    transfer, so a fragmented directory costs one round trip per window
+    rather than one per cluster.
+
+    The caller holds the directory, so the prefetch itself is handed to a
+    worker thread, at the priority of the originating request, and the
+    scan never waits for it.  Prefetch is only a hint and any failure is
+    ignored.
+
+Arguments:
+
+    Dcb - Pointer to the DCB for the directory, whose directory file is
+        already open.
+
+    StartingVbo - The offset the scan is about to read.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+#if (NTDDI_VERSION >= NTDDI_WIN8)
+
+    ULONG WindowSize = FatData.DirectoryPrefetchPages * PAGE_SIZE;
+    ULONG AllocationSize = Dcb->Header.AllocationSize.LowPart;
+    IO_PRIORITY_INFO PriorityInformation = {0};
+    PDIRECTORY_PREFETCH_CONTEXT PrefetchContext;
+    VBO StartVbo;
+    VBO EndVbo;
+
+    PAGED_CODE();
+
+    //
+    //  Only prefetch when there is a request to take the priority from.
+    //
+
+    if ((WindowSize == 0) ||
+        (IrpContext->OriginatingIrp == NULL) ||
+        (Dcb->Specific.Dcb.DirectoryFile == NULL)) {
+
+        return;
+    }
+
+    StartVbo = StartingVbo & ~(PAGE_SIZE - 1);
+
+    if ((StartingVbo >= Dcb->Specific.Dcb.PrefetchStartVbo) &&
+        (StartingVbo < Dcb->Specific.Dcb.PrefetchEndVbo)) {
+
+        //
+        //  Nothing to do while we are still in the first half of the window,
+        //  or if the window already reaches the end of the directory.
+        //
+
+        if ((StartingVbo - Dcb->Specific.Dcb.PrefetchStartVbo < WindowSize / 2) ||
+            (Dcb->Specific.Dcb.PrefetchEndVbo >= AllocationSize)) {
+
+            return;
+        }
+
+        //
+        //  The rest of the window is already on its way in.
+        //
+
+        StartVbo = Dcb->Specific.Dcb.PrefetchEndVbo;
+    }
+
+    EndVbo = (AllocationSize - StartVbo > WindowSize) ?
+             StartVbo + WindowSize :
+             AllocationSize;
+
+    //
+    //  Note the window first; if we race with another scan the worst we do
+    //  is skip or repeat a prefetch.
+    //
+
+    Dcb->Specific.Dcb.PrefetchStartVbo = StartingVbo & ~(PAGE_SIZE - 1);
+    Dcb->Specific.Dcb.PrefetchEndVbo = EndVbo;
+
+    if (EndVbo <= StartVbo) {
+
+        return;
+    }
+
+    //
+    //  The originating request is gone by the time the worker runs, so
+    //  capture its priority now.
+    //
+
+    IoInitializePriorityInfo( &PriorityInformation );
+
+    if (!NT_SUCCESS( IoRetrievePriorityInfo( IrpContext->OriginatingIrp,
+                                             Dcb->Specific.Dcb.DirectoryFile,
+                                             IrpContext->OriginatingIrp->Tail.Overlay.Thread,
+                                             &PriorityInformation ))) {
+
+        return;
+    }
+
+    PrefetchContext = ExAllocatePoolWithTag( NonPagedPoolNx,
+                                             sizeof( DIRECTORY_PREFETCH_CONTEXT ),
+                                             TAG_DIRECTORY_PREFETCH_CONTEXT );
+
+    if (PrefetchContext == NULL) {
+
+        return;
+    }
+
+    //
+    //  Hold the directory file across the prefetch, since the directory
+    //  may be torn down once we drop it.
+    //
+
+    ObReferenceObject( Dcb->Specific.Dcb.DirectoryFile );
+
+    PrefetchContext->File = Dcb->Specific.Dcb.DirectoryFile;
+    PrefetchContext->StartingPage = StartVbo / PAGE_SIZE;
+    PrefetchContext->PageCount = (EndVbo - StartVbo + PAGE_SIZE - 1) / PAGE_SIZE;
+    PrefetchContext->PagePriority = PriorityInformation.PagePriority;
+
+    InterlockedIncrement( &FatData.DirectoryPrefetches );
+
+#pragma prefast( suppress: 28155, "the function prototype is correct ")
+#pragma warning( suppress:4996 )
+    ExInitializeWorkItem( &PrefetchContext->Item,
+                          FatDeferredPrefetchDirectory,
+                          PrefetchContext );
+
+#pragma prefast( suppress:28159, "prefast indicates this API is obsolete, but it's ok for fastfat to keep using it" )
+#pragma warning( suppress:4996 )
+    ExQueueWorkItem( &PrefetchContext->Item, DelayedWorkQueue );
+
+#else
+
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Dcb );
+    UNREFERENCED_PARAMETER( StartingVbo );
+
+    PAGED_CODE();
+
 #endif
+}
 
@@ -1145,7 +1145,7 @@ Return Value:
                 FatEnsureStringBufferEnough( &OemFinalName,
                                              FinalName.Length);
 
-                Status = RtlUpcaseUnicodeStringToCountedOemString( &OemFinalName, &FinalName, FALSE );
+                Status = FatUpcaseUnicodeToCountedOem( &OemFinalName, &FinalName );
 
 
                 if (NT_SUCCESS(Status)) {
@@ -1545,7 +1545,7 @@ Return Value:
                 FatEnsureStringBufferEnough( &OemFinalName,
                                              FinalName.Length);
 
-                Status = RtlUpcaseUnicodeStringToCountedOemString( &OemFinalName, &FinalName, FALSE );
+                Status = FatUpcaseUnicodeToCountedOem( &OemFinalName, &FinalName );
             }
 
             if (NT_SUCCESS(Status)) {
@@ -170,6 +170,59 @@ FatDefragDirectory (
     IN ULONG DirentsNeeded
     );
 
+_Requires_lock_held_(_Global_critical_region_)
+BOOLEAN
+FatLookupDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN PCCB Ccb,
+    IN BOOLEAN MatchLfn,
+    OUT PVBO Candidates,
+    OUT PULONG CandidateCount
+    );
+
+INLINE
+VOID
+FatSkipToDirentCandidate (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN PVBO Candidates,
+    IN ULONG CandidateCount,
+    IN OUT PULONG NextCandidate,
+    IN VBO MinimumVbo,
+    IN OUT PDIRENT *Dirent,
+    IN OUT PBCB *Bcb,
+    IN OUT PVBO ByteOffset
+    );
+
+ULONG
+FatDirentIndexShortNameHash (
+    IN PUCHAR FileName
+    );
+
+VOID
+FatFreeDirentIndexContents (
+    IN PFAT_DIRENT_INDEX Index
+    );
+
+BOOLEAN
+FatInsertDirentIndexEntry (
+    IN PFAT_DIRENT_INDEX Index,
+    IN ULONG Hash,
+    IN VBO LfnOffset
+    );
+
+_Requires_lock_held_(_Global_critical_region_)
+BOOLEAN
+FatIndexDirents (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN PFAT_DIRENT_INDEX Index,
+    IN VBO StartingVbo,
+    IN BOOLEAN SingleFile,
+    OUT PBOOLEAN Complete
+    );
+
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FatComputeLfnChecksum)
@@ -178,16 +231,26 @@ FatDefragDirectory (
 #pragma alloc_text(PAGE, FatCreateNewDirent)
 #pragma alloc_text(PAGE, FatDefragDirectory)
 #pragma alloc_text(PAGE, FatDeleteDirent)
+#pragma alloc_text(PAGE, FatDeleteDirentIndex)
+#pragma alloc_text(PAGE, FatDirentIndexShortNameHash)
+#pragma alloc_text(PAGE, FatFreeDirentIndexContents)
 #pragma alloc_text(PAGE, FatGetDirentFromFcbOrDcb)
+#pragma alloc_text(PAGE, FatGetShortNameTailHint)
+#pragma alloc_text(PAGE, FatIndexDirents)
 #pragma alloc_text(PAGE, FatInitializeDirectoryDirent)
+#pragma alloc_text(PAGE, FatInsertDirentIndexEntry)
+#pragma alloc_text(PAGE, FatInvalidateDirentIndex)
 #pragma alloc_text(PAGE, FatIsDirectoryEmpty)
 #pragma alloc_text(PAGE, FatLfnDirentExists)
 #pragma alloc_text(PAGE, FatLocateDirent)
 #pragma alloc_text(PAGE, FatLocateSimpleOemDirent)
 #pragma alloc_text(PAGE, FatLocateVolumeLabel)
+#pragma alloc_text(PAGE, FatLookupDirentIndex)
+#pragma alloc_text(PAGE, FatNoteDirentIndexChange)
 #pragma alloc_text(PAGE, FatRescanDirectory)
 #pragma alloc_text(PAGE, FatSetFileSizeInDirent)
 #pragma alloc_text(PAGE, FatSetFileSizeInDirentNoRaise)
+#pragma alloc_text(PAGE, FatSetShortNameTailHint)
 #pragma alloc_text(PAGE, FatTunnelFcbOrDcb)
 #pragma alloc_text(PAGE, FatUpdateDirentFromFcb)
 
@@ -540,6 +603,12 @@ Return Value:
     ParentDirectory->Specific.Dcb.UnusedDirentVbo = UnusedVbo;
     ParentDirectory->Specific.Dcb.DeletedDirentHint = DeletedHint;
 
+    //
+    //  Let the name index know a file is going in here.
+    //
+
+    FatNoteDirentIndexChange( ParentDirectory, ByteOffset );
+
     DebugTrace(-1, Dbg, "FatCreateNewDirent -> (VOID)\n", 0);
 
     return ByteOffset;
@@ -954,6 +1023,15 @@ Return Value:
                       FcbOrDcb->LfnOffsetWithinDirectory / sizeof(DIRENT),
                       DirentsToDelete );
 
+        //
+        //  The name index still points here; just count it as stale.
+        //
+
+        if (FcbOrDcb->ParentDcb->Specific.Dcb.DirentIndex != NULL) {
+
+            InterlockedIncrement( &FcbOrDcb->ParentDcb->Specific.Dcb.DirentIndex->StaleCount );
+        }
+
         //
         //  Now, if the caller specified a DeleteContext, use it.
         //
@@ -1142,6 +1220,11 @@ Return Value:
     UCHAR Ordinal = 0;
     VBO LfnByteOffset = 0;
 
+    BOOLEAN UseIndex = FALSE;
+    VBO Candidates[FAT_DIRENT_INDEX_MAX_CANDIDATES];
+    ULONG CandidateCount = 0;
+    ULONG NextCandidate = 0;
+
     TimerStart(Dbg);
 
     PAGED_CODE();
@@ -1246,6 +1329,39 @@ Return Value:
 
     try {
 
+        //
+        //  If we are looking up a constant name from the top of a large
+        //  directory, let the name index tell us which files are worth
+        //  looking at.  We still verify each of them below, and if the index
+        //  has nothing for us we step straight to the end of the directory.
+        //
+
+        if ((OffsetToStartSearchFrom == 0) &&
+            !Ccb->ContainsWildCards &&
+            !FlagOn( Ccb->Flags, CCB_FLAG_MATCH_ALL | CCB_FLAG_MATCH_VOLUME_ID )) {
+
+            UseIndex = FatLookupDirentIndex( IrpContext,
+                                             ParentDirectory,
+                                             Ccb,
+                                             (BOOLEAN)(FatData.ChicagoMode &&
+                                                       ARGUMENT_PRESENT( LongFileName )),
+                                             Candidates,
+                                             &CandidateCount );
+
+            if (UseIndex) {
+
+                FatSkipToDirentCandidate( IrpContext,
+                                          ParentDirectory,
+                                          Candidates,
+                                          CandidateCount,
+                                          &NextCandidate,
+                                          0,
+                                          Dirent,
+                                          Bcb,
+                                          ByteOffset );
+            }
+        }
+
         while ( TRUE ) {
 
             BOOLEAN FoundValidLfn;
@@ -1689,6 +1805,29 @@ Return Value:
 
 GetNextDirent:
 
+            //
+            //  If we are working from the name index and have finished with
+            //  this file, move on to the next candidate.
+            //
+
+            if (UseIndex &&
+                (((*Dirent)->Attributes != FAT_DIRENT_ATTR_LFN) ||
+                 ((*Dirent)->FileName[0] == FAT_DIRENT_DELETED))) {
+
+                LfnInProgress = FALSE;
+
+                FatSkipToDirentCandidate( IrpContext,
+                                          ParentDirectory,
+                                          Candidates,
+                                          CandidateCount,
+                                          &NextCandidate,
+                                          *ByteOffset + sizeof(DIRENT),
+                                          Dirent,
+                                          Bcb,
+                                          ByteOffset );
+                continue;
+            }
+
             //
             //  Move on to the next dirent.
             //
@@ -1712,6 +1851,62 @@ GetNextDirent:
 }
 
 
+INLINE
+VOID
+FatSkipToDirentCandidate (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN PVBO Candidates,
+    IN ULONG CandidateCount,
+    IN OUT PULONG NextCandidate,
+    IN VBO MinimumVbo,
+    IN OUT PDIRENT *Dirent,
+    IN OUT PBCB *Bcb,
+    IN OUT PVBO ByteOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves a FatLocateDirent scan to the first candidate offset
+    at or beyond MinimumVbo, keeping the pinned page if the candidate is on
+    it.  If there are no more candidates, the scan is moved to the end of
+    the directory so that it terminates as not found.
+
+--*/
+
+{
+    VBO Target = Dcb->Header.AllocationSize.LowPart;
+
+    while ((*NextCandidate < CandidateCount) &&
+           (Candidates[*NextCandidate] < MinimumVbo)) {
+
+        *NextCandidate += 1;
+    }
+
+    if (*NextCandidate < CandidateCount) {
+
+        Target = Candidates[*NextCandidate];
+        *NextCandidate += 1;
+    }
+
+    if (*Bcb != NULL) {
+
+        if ((Target / PAGE_SIZE) == (*ByteOffset / PAGE_SIZE)) {
+
+            *Dirent += (Target - *ByteOffset) / sizeof(DIRENT);
+
+        } else {
+
+            FatUnpinBcb( IrpContext, *Bcb );
+        }
+    }
+
+    *ByteOffset = Target;
+}
+
+
 _Requires_lock_held_(_Global_critical_region_)    
 VOID
 FatLocateSimpleOemDirent (
@@ -3355,6 +3550,13 @@ Return Value:
 
     PAGED_CODE();
 
+    //
+    //  We are about to shuffle the dirents, so the name index is useless.
+    //
+
+    FatInvalidateDirentIndex( Dcb );
+
+
     //
     //  We assume we own the Vcb.
     //
@@ -3782,3 +3984,927 @@ Return Value:
 
 
 
+
+
+//
+//  Local support routines for the dirent name index.
+//
+
+INLINE
+ULONG
+FatDirentIndexMix (
+    IN ULONG Value
+    )
+
+/*++
+
+Routine Description:
+
+    This routine scrambles the bits of a 32 bit value.  It is used both to
+    hash individual name characters and to finish off the name hashes.
+
+--*/
+
+{
+    Value ^= Value >> 16;
+    Value *= 0x85ebca6b;
+    Value ^= Value >> 13;
+    Value *= 0xc2b2ae35;
+    Value ^= Value >> 16;
+
+    return Value;
+}
+
+//
+//  The long name hash is the sum of the hashes of each upcased character
+//  combined with its position.  Because the sum does not depend on order we
+//  can accumulate it directly from the LFN dirents, which are laid out on
+//  disk last piece first, without assembling the name.
+//
+
+#define FatDirentIndexLfnCharHash(POS,CHAR) \
+    FatDirentIndexMix( ((ULONG)(POS) << 16) | (ULONG)RtlUpcaseUnicodeChar( (CHAR) ) )
+
+#define FatDirentIndexLfnHash(SUM,LENGTH) \
+    FatDirentIndexMix( (SUM) ^ ((ULONG)(LENGTH) * 0x9e3779b1) )
+
+//
+//  A built index is thrown away and built again once too many of its
+//  entries are stale, or once it has outgrown its buckets.
+//
+
+#define FatDirentIndexNeedsRebuild(INDEX) \
+    (((INDEX)->StaleCount > (LONG)((INDEX)->EntryCount / 2 + 64)) || \
+     ((INDEX)->EntryCount > 4 * ((INDEX)->BucketMask + 1)))
+
+
+ULONG
+FatDirentIndexShortNameHash (
+    IN PUCHAR FileName
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hashes an 11 byte short name in its dirent form.
+
+Arguments:
+
+    FileName - Supplies the name, as it appears in DIRENT.FileName.
+
+Return Value:
+
+    The hash of the name.
+
+--*/
+
+{
+    ULONG i;
+    ULONG Hash = 0x811c9dc5;
+
+    PAGED_CODE();
+
+    for (i = 0; i < 11; i++) {
+
+        Hash = (Hash ^ FileName[i]) * 0x01000193;
+    }
+
+    return FatDirentIndexMix( Hash );
+}
+
+
+VOID
+FatFreeDirentIndexContents (
+    IN PFAT_DIRENT_INDEX Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine throws away the buckets and entries of a dirent index,
+    leaving it to be rebuilt by the next lookup.  The index resource must
+    be held exclusive.
+
+Arguments:
+
+    Index - Supplies the index to empty.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX_CHUNK Chunk;
+
+    PAGED_CODE();
+
+    while (Index->Chunks != NULL) {
+
+        Chunk = Index->Chunks;
+        Index->Chunks = Chunk->Next;
+
+        ExFreePool( Chunk );
+    }
+
+    if (Index->Buckets != NULL) {
+
+        ExFreePool( Index->Buckets );
+        Index->Buckets = NULL;
+    }
+
+    Index->Built = FALSE;
+    Index->BucketMask = 0;
+    Index->EntryCount = 0;
+    Index->StaleCount = 0;
+    Index->PendingCount = 0;
+}
+
+
+BOOLEAN
+FatInsertDirentIndexEntry (
+    IN PFAT_DIRENT_INDEX Index,
+    IN ULONG Hash,
+    IN VBO LfnOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a name hash to the index.  The index resource must be
+    held exclusive.
+
+Arguments:
+
+    Index - Supplies the index.
+
+    Hash - Supplies the hash of the short or long name.
+
+    LfnOffset - Supplies the offset of the first dirent of the file.
+
+Return Value:
+
+    FALSE if we could not allocate memory for the entry, TRUE otherwise.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX_CHUNK Chunk = Index->Chunks;
+    PFAT_DIRENT_INDEX_ENTRY Entry;
+
+    PAGED_CODE();
+
+    if ((Chunk == NULL) || (Chunk->EntriesUsed == FAT_DIRENT_INDEX_CHUNK_ENTRIES)) {
+
+        Chunk = ExAllocatePoolZero( PagedPool,
+                                    sizeof(FAT_DIRENT_INDEX_CHUNK),
+                                    TAG_DIRENT_INDEX );
+
+        if (Chunk == NULL) {
+
+            return FALSE;
+        }
+
+        Chunk->Next = Index->Chunks;
+        Index->Chunks = Chunk;
+    }
+
+    Entry = &Chunk->Entries[Chunk->EntriesUsed];
+    Chunk->EntriesUsed += 1;
+
+    Entry->Hash = Hash;
+    Entry->LfnOffset = LfnOffset;
+    Entry->Next = Index->Buckets[Hash & Index->BucketMask];
+    Index->Buckets[Hash & Index->BucketMask] = Entry;
+
+    Index->EntryCount += 1;
+
+    return TRUE;
+}
+
+
+_Requires_lock_held_(_Global_critical_region_)
+BOOLEAN
+FatIndexDirents (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN PFAT_DIRENT_INDEX Index,
+    IN VBO StartingVbo,
+    IN BOOLEAN SingleFile,
+    OUT PBOOLEAN Complete
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks the dirents of a directory, starting at StartingVbo,
+    and adds the names it finds to the index.  It mirrors the way
+    FatLocateDirent assembles long names closely enough that any name
+    FatLocateDirent would match gets the same hash here; it does not need to
+    be as strict about malformed LFN piles, since extra entries only cost a
+    wasted probe.
+
+Arguments:
+
+    Dcb - Supplies the directory being indexed.
+
+    Index - Supplies the index, whose resource is held exclusive.
+
+    StartingVbo - Supplies the offset of the first dirent to look at.
+
+    SingleFile - Indicates that we should stop after the first file, which
+        must start at StartingVbo.  This is used to fold in pending dirents.
+
+    Complete - Receives FALSE if, in the SingleFile case, there is not yet a
+        complete file at StartingVbo.
+
+Return Value:
+
+    FALSE if we ran out of memory, TRUE otherwise.
+
+--*/
+
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PBCB Bcb = NULL;
+    PDIRENT Dirent = NULL;
+    VBO Vbo;
+
+    BOOLEAN LfnInProgress = FALSE;
+    VBO LfnStart = 0;
+    ULONG LfnSize = 0;
+    ULONG LfnSum = 0;
+
+    BOOLEAN Result = TRUE;
+
+    PAGED_CODE();
+
+    *Complete = FALSE;
+
+    try {
+
+        for (Vbo = StartingVbo; TRUE; Vbo += sizeof(DIRENT), Dirent += 1) {
+
+            FatReadDirent( IrpContext,
+                           Dcb,
+                           Vbo,
+                           &Bcb,
+                           &Dirent,
+                           &Status );
+
+            if ((Status == STATUS_END_OF_FILE) ||
+                (Dirent->FileName[0] == FAT_DIRENT_NEVER_USED)) {
+
+                //
+                //  When indexing the whole directory, reaching the end is
+                //  success.
+                //
+
+                if (!SingleFile) {
+
+                    *Complete = TRUE;
+                }
+
+                break;
+            }
+
+            if (Dirent->FileName[0] == FAT_DIRENT_DELETED) {
+
+                if (SingleFile) {
+
+                    break;
+                }
+
+                LfnInProgress = FALSE;
+                continue;
+            }
+
+            if (Dirent->Attributes == FAT_DIRENT_ATTR_LFN) {
+
+                PLFN_DIRENT Lfn = (PLFN_DIRENT)Dirent;
+                ULONG Ordinal = Lfn->Ordinal & ~FAT_LAST_LONG_ENTRY;
+                ULONG Base;
+                ULONG i;
+                WCHAR Chars[13];
+
+                if ((Ordinal == 0) || (Ordinal > MAX_LFN_DIRENTS)) {
+
+                    LfnInProgress = FALSE;
+                    continue;
+                }
+
+                RtlCopyMemory( &Chars[0], &Lfn->Name1[0], 5 * sizeof(WCHAR) );
+                RtlCopyMemory( &Chars[5], &Lfn->Name2[0], 6 * sizeof(WCHAR) );
+                RtlCopyMemory( &Chars[11], &Lfn->Name3[0], 2 * sizeof(WCHAR) );
+
+                Base = (Ordinal - 1) * 13;
+
+                //
+                //  The last piece of the name comes first and tells us how long
+                //  the name is.
+                //
+
+                if (FlagOn( Lfn->Ordinal, FAT_LAST_LONG_ENTRY )) {
+
+                    LfnInProgress = TRUE;
+                    LfnStart = Vbo;
+                    LfnSum = 0;
+                    LfnSize = Ordinal * 13;
+
+                    for (i = 0; i < 13; i++) {
+
+                        if (Chars[i] == 0) {
+
+                            LfnSize = Base + i;
+                            break;
+                        }
+                    }
+                }
+
+                if (LfnInProgress) {
+
+                    for (i = 0; (i < 13) && (Base + i < LfnSize); i++) {
+
+                        LfnSum += FatDirentIndexLfnCharHash( Base + i, Chars[i] );
+                    }
+                }
+
+                continue;
+            }
+
+            if (FlagOn( Dirent->Attributes, FAT_DIRENT_ATTR_VOLUME_ID )) {
+
+                if (SingleFile) {
+
+                    *Complete = TRUE;
+                    break;
+                }
+
+                LfnInProgress = FALSE;
+                continue;
+            }
+
+            //
+            //  This is a short dirent, closing off a file.
+            //
+
+            if (!LfnInProgress) {
+
+                LfnStart = Vbo;
+            }
+
+            if (!FatInsertDirentIndexEntry( Index,
+                                            FatDirentIndexShortNameHash( (PUCHAR)&Dirent->FileName[0] ),
+                                            LfnStart )) {
+
+                Result = FALSE;
+                break;
+            }
+
+            if (LfnInProgress &&
+                !FatInsertDirentIndexEntry( Index,
+                                            FatDirentIndexLfnHash( LfnSum, LfnSize ),
+                                            LfnStart )) {
+
+                Result = FALSE;
+                break;
+            }
+
+            LfnInProgress = FALSE;
+
+            if (SingleFile) {
+
+                *Complete = TRUE;
+                break;
+            }
+        }
+
+    } finally {
+
+        FatUnpinBcb( IrpContext, Bcb );
+    }
+
+    return Result;
+}
+
+
+_Requires_lock_held_(_Global_critical_region_)
+BOOLEAN
+FatLookupDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN PCCB Ccb,
+    IN BOOLEAN MatchLfn,
+    OUT PVBO Candidates,
+    OUT PULONG CandidateCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine uses the name index of a directory to find the offsets of
+    the files that may match a constant name, building the index first if
+    need be.  It is called by FatLocateDirent, which then only has to look
+    at those files.
+
+Arguments:
+
+    Dcb - Supplies the directory to search.
+
+    Ccb - Supplies the query templates, as for FatLocateDirent.
+
+    MatchLfn - Indicates that the caller will match long names, and so that
+        the unicode query template is valid.
+
+    Candidates - Receives the candidate offsets, in ascending order.  This
+        must have room for FAT_DIRENT_INDEX_MAX_CANDIDATES entries.
+
+    CandidateCount - Receives the number of candidates.
+
+Return Value:
+
+    TRUE if the candidates are authoritative, FALSE if the caller must scan
+    the directory the hard way.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index;
+    PFAT_DIRENT_INDEX_ENTRY Entry;
+    BOOLEAN Complete;
+    BOOLEAN Result = FALSE;
+
+    ULONG Hashes[2];
+    ULONG HashCount = 0;
+    ULONG Buckets;
+    ULONG i, j;
+
+    PAGED_CODE();
+
+    *CandidateCount = 0;
+
+    //
+    //  Small directories are cheap enough to scan.
+    //
+
+    if (Dcb->Header.AllocationSize.LowPart < FAT_DIRENT_INDEX_MINIMUM_SIZE) {
+
+        return FALSE;
+    }
+
+    Index = Dcb->Specific.Dcb.DirentIndex;
+
+    if (Index == NULL) {
+
+        Index = ExAllocatePoolZero( NonPagedPoolNx,
+                                    sizeof(FAT_DIRENT_INDEX),
+                                    TAG_DIRENT_INDEX );
+
+        if (Index == NULL) {
+
+            return FALSE;
+        }
+
+        ExInitializeResourceLite( &Index->Resource );
+
+        //
+        //  We may be racing another lookup holding the directory shared.
+        //
+
+        if (InterlockedCompareExchangePointer( (PVOID *)&Dcb->Specific.Dcb.DirentIndex,
+                                               Index,
+                                               NULL ) != NULL) {
+
+            ExDeleteResourceLite( &Index->Resource );
+            ExFreePool( Index );
+
+            Index = Dcb->Specific.Dcb.DirentIndex;
+        }
+    }
+
+    //
+    //  Lookups only read the index and share it.  We go exclusive only if
+    //  the index has to be built, rebuilt or extended with pending files,
+    //  and come back down to shared for the lookup itself.
+    //
+
+    ExAcquireResourceSharedLite( &Index->Resource, TRUE );
+
+    try {
+
+        if (!Index->Built ||
+            (Index->PendingCount != 0) ||
+            FatDirentIndexNeedsRebuild( Index )) {
+
+            ExReleaseResourceLite( &Index->Resource );
+            ExAcquireResourceExclusiveLite( &Index->Resource, TRUE );
+
+            //
+            //  If the index has gone stale or outgrown its buckets, start
+            //  over.
+            //
+
+            if (Index->Built && FatDirentIndexNeedsRebuild( Index )) {
+
+                FatFreeDirentIndexContents( Index );
+            }
+
+            if (!Index->Built) {
+
+                FatFreeDirentIndexContents( Index );
+
+                //
+                //  Size the table for the directory as it stands, which holds at
+                //  most one short name per dirent.
+                //
+
+                for (Buckets = 64;
+                     Buckets < Dcb->Header.AllocationSize.LowPart / sizeof(DIRENT) / 2;
+                     Buckets <<= 1) {
+
+                    NOTHING;
+                }
+
+                Index->Buckets = ExAllocatePoolZero( PagedPool,
+                                                     Buckets * sizeof(PFAT_DIRENT_INDEX_ENTRY),
+                                                     TAG_DIRENT_INDEX );
+
+                if (Index->Buckets == NULL) {
+
+                    try_return( NOTHING );
+                }
+
+                Index->BucketMask = Buckets - 1;
+
+                if (!FatIndexDirents( IrpContext, Dcb, Index, 0, FALSE, &Complete ) ||
+                    !Complete) {
+
+                    FatFreeDirentIndexContents( Index );
+                    try_return( NOTHING );
+                }
+
+                Index->Built = TRUE;
+            }
+
+            //
+            //  Fold in the files created since the last lookup.  Any that have
+            //  not had their names written yet stay pending.
+            //
+
+            for (i = 0, j = 0; i < Index->PendingCount; i++) {
+
+                if (!FatIndexDirents( IrpContext, Dcb, Index, Index->Pending[i], TRUE, &Complete )) {
+
+                    FatFreeDirentIndexContents( Index );
+                    try_return( NOTHING );
+                }
+
+                if (!Complete) {
+
+                    Index->Pending[j++] = Index->Pending[i];
+                }
+            }
+
+            Index->PendingCount = j;
+
+            ExConvertExclusiveToSharedLite( &Index->Resource );
+        }
+
+        //
+        //  Now collect every file whose short or long name hashes the same
+        //  as what we are looking for.
+        //
+
+        if (!FlagOn( Ccb->Flags, CCB_FLAG_SKIP_SHORT_NAME_COMPARE )) {
+
+            Hashes[HashCount++] = FatDirentIndexShortNameHash( (PUCHAR)&Ccb->OemQueryTemplate.Constant[0] );
+        }
+
+        if (MatchLfn) {
+
+            ULONG Sum = 0;
+            ULONG Length = Ccb->UnicodeQueryTemplate.Length / sizeof(WCHAR);
+
+            for (i = 0; i < Length; i++) {
+
+                Sum += FatDirentIndexLfnCharHash( i, Ccb->UnicodeQueryTemplate.Buffer[i] );
+            }
+
+            Hashes[HashCount++] = FatDirentIndexLfnHash( Sum, Length );
+        }
+
+        for (i = 0; i < HashCount; i++) {
+
+            for (Entry = Index->Buckets[Hashes[i] & Index->BucketMask];
+                 Entry != NULL;
+                 Entry = Entry->Next) {
+
+                if (Entry->Hash != Hashes[i]) {
+
+                    continue;
+                }
+
+                //
+                //  Insert in sorted order, dropping duplicates.  If there are
+                //  too many, give up and let the caller scan.
+                //
+
+                for (j = *CandidateCount; j > 0 && Candidates[j - 1] > Entry->LfnOffset; j--) {
+
+                    NOTHING;
+                }
+
+                if ((j > 0) && (Candidates[j - 1] == Entry->LfnOffset)) {
+
+                    continue;
+                }
+
+                if (*CandidateCount == FAT_DIRENT_INDEX_MAX_CANDIDATES) {
+
+                    try_return( NOTHING );
+                }
+
+                RtlMoveMemory( &Candidates[j + 1],
+                               &Candidates[j],
+                               (*CandidateCount - j) * sizeof(VBO) );
+
+                Candidates[j] = Entry->LfnOffset;
+                *CandidateCount += 1;
+            }
+        }
+
+        Result = TRUE;
+
+    try_exit: NOTHING;
+    } finally {
+
+        ExReleaseResourceLite( &Index->Resource );
+    }
+
+    return Result;
+}
+
+
+VOID
+FatNoteDirentIndexChange (
+    IN PDCB Dcb,
+    IN VBO LfnOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tells the name index of a directory that a file is about
+    to be, or has just been, written starting at LfnOffset.  The file will be
+    added to the index on the next lookup.  The caller must not have any
+    dirents pinned.
+
+Arguments:
+
+    Dcb - Supplies the directory.
+
+    LfnOffset - Supplies the offset of the first dirent of the file.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index = Dcb->Specific.Dcb.DirentIndex;
+
+    PAGED_CODE();
+
+    if (Index == NULL) {
+
+        return;
+    }
+
+    ExAcquireResourceExclusiveLite( &Index->Resource, TRUE );
+
+    if (Index->Built) {
+
+        if (Index->PendingCount < FAT_DIRENT_INDEX_MAX_PENDING) {
+
+            Index->Pending[Index->PendingCount++] = LfnOffset;
+
+        } else {
+
+            FatFreeDirentIndexContents( Index );
+        }
+    }
+
+    ExReleaseResourceLite( &Index->Resource );
+}
+
+
+VOID
+FatInvalidateDirentIndex (
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine discards the contents of a directory's name index when its
+    dirents have been moved around or may have changed underneath us.
+
+Arguments:
+
+    Dcb - Supplies the directory.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index = Dcb->Specific.Dcb.DirentIndex;
+
+    PAGED_CODE();
+
+    if (Index == NULL) {
+
+        return;
+    }
+
+    ExAcquireResourceExclusiveLite( &Index->Resource, TRUE );
+
+    FatFreeDirentIndexContents( Index );
+
+    ExReleaseResourceLite( &Index->Resource );
+}
+
+
+VOID
+FatDeleteDirentIndex (
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a directory's name index when the Dcb is deleted.
+
+Arguments:
+
+    Dcb - Supplies the directory.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index = Dcb->Specific.Dcb.DirentIndex;
+
+    PAGED_CODE();
+
+    if (Index == NULL) {
+
+        return;
+    }
+
+    FatFreeDirentIndexContents( Index );
+
+    ExDeleteResourceLite( &Index->Resource );
+    ExFreePool( Index );
+
+    Dcb->Specific.Dcb.DirentIndex = NULL;
+}
+
+
+ULONG
+FatGetShortNameTailHint (
+    IN PDCB Dcb,
+    IN ULONG Key
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the first short name tail not yet handed out for
+    a generated short name base in this directory, if we remember one.
+
+Arguments:
+
+    Dcb - Supplies the directory.
+
+    Key - Supplies the hash of the short name base.
+
+Return Value:
+
+    The next tail index to try, or 0 if we have no hint.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index = Dcb->Specific.Dcb.DirentIndex;
+    ULONG NextIndex = 0;
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (Index == NULL) {
+
+        return 0;
+    }
+
+    ExAcquireResourceSharedLite( &Index->Resource, TRUE );
+
+    for (i = 0; i < FAT_SHORT_NAME_TAIL_HINTS; i++) {
+
+        if ((Index->TailHints[i].NextIndex != 0) &&
+            (Index->TailHints[i].Key == Key)) {
+
+            NextIndex = Index->TailHints[i].NextIndex;
+            break;
+        }
+    }
+
+    ExReleaseResourceLite( &Index->Resource );
+
+    return NextIndex;
+}
+
+
+VOID
+FatSetShortNameTailHint (
+    IN PDCB Dcb,
+    IN ULONG Key,
+    IN ULONG NextIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records the first short name tail not yet handed out for a
+    generated short name base in this directory.  Only directories large
+    enough to have a name index keep these hints.
+
+Arguments:
+
+    Dcb - Supplies the directory.
+
+    Key - Supplies the hash of the short name base.
+
+    NextIndex - Supplies the next tail index to try.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index = Dcb->Specific.Dcb.DirentIndex;
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (Index == NULL) {
+
+        return;
+    }
+
+    ExAcquireResourceExclusiveLite( &Index->Resource, TRUE );
+
+    for (i = 0; i < FAT_SHORT_NAME_TAIL_HINTS; i++) {
+
+        if ((Index->TailHints[i].NextIndex != 0) &&
+            (Index->TailHints[i].Key == Key)) {
+
+            break;
+        }
+    }
+
+    //
+    //  If this base is new, take over the oldest slot.
+    //
+
+    if (i == FAT_SHORT_NAME_TAIL_HINTS) {
+
+        i = Index->NextTailHint;
+        Index->NextTailHint = (Index->NextTailHint + 1) % FAT_SHORT_NAME_TAIL_HINTS;
+    }
+
+    Index->TailHints[i].Key = Key;
+    Index->TailHints[i].NextIndex = NextIndex;
+
+    ExReleaseResourceLite( &Index->Resource );
+}
+
@@ -90,6 +90,13 @@ extern LOGICAL FatDiskAccountingEnabled;
 
 #define READ_AHEAD_GRANULARITY           (0x10000)
 
+//
+//  Default and maximum number of pages read ahead of a directory scan.
+//
+
+#define FAT_DEFAULT_DIRECTORY_PREFETCH_PAGES    (32)
+#define FAT_MAX_DIRECTORY_PREFETCH_PAGES        (0x100)
+
 //
 //  Define maximum number of parallel Reads or Writes that will be generated
 //  per one request.
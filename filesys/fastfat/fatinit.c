@@ -49,6 +49,7 @@ FatIsFujitsuFMR (
 #define COMPATIBILITY_MODE_KEY_NAME L"\\Registry\\Machine\\System\\CurrentControlSet\\Control\\FileSystem"
 #define COMPATIBILITY_MODE_VALUE_NAME L"Win31FileSystem"
 #define CODE_PAGE_INVARIANCE_VALUE_NAME L"FatDisableCodePageInvariance"
+#define DIRECTORY_PREFETCH_VALUE_NAME L"FatDirectoryPrefetchPages"
 
 
 #define KEY_WORK_AREA ((sizeof(KEY_VALUE_FULL_INFORMATION) + \
@@ -363,6 +364,28 @@ Return Value:
         FatData.CodePageInvariant = TRUE;
     }
 
+    //
+    //  Read the registry to determine how far ahead of a directory scan we
+    //  prefetch.
+    //
+
+    ValueName.Buffer = DIRECTORY_PREFETCH_VALUE_NAME;
+    ValueName.Length = sizeof(DIRECTORY_PREFETCH_VALUE_NAME) - sizeof(WCHAR);
+    ValueName.MaximumLength = sizeof(DIRECTORY_PREFETCH_VALUE_NAME);
+
+    Status = FatGetCompatibilityModeValue( &ValueName, &Value );
+
+    if (NT_SUCCESS(Status)) {
+
+        FatData.DirectoryPrefetchPages = (Value > FAT_MAX_DIRECTORY_PREFETCH_PAGES) ?
+                                         FAT_MAX_DIRECTORY_PREFETCH_PAGES :
+                                         Value;
+
+    } else {
+
+        FatData.DirectoryPrefetchPages = FAT_DEFAULT_DIRECTORY_PREFETCH_PAGES;
+    }
+
     //
     //  Initialize our global resource and fire up the lookaside lists.
     //
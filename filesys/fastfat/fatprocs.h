@@ -488,6 +488,13 @@ FatPrefetchPages (
     IN ULONG PageCount
     );
 
+VOID
+FatPrefetchDirectory (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN VBO StartingVbo
+    );
+
 //
 // VOID
 // FatUnpinBcb (
@@ -705,6 +712,35 @@ FatLocateDirent (
     IN OUT PUNICODE_STRING OrigLfn OPTIONAL        
     );
 
+VOID
+FatNoteDirentIndexChange (
+    IN PDCB Dcb,
+    IN VBO LfnOffset
+    );
+
+VOID
+FatInvalidateDirentIndex (
+    IN PDCB Dcb
+    );
+
+VOID
+FatDeleteDirentIndex (
+    IN PDCB Dcb
+    );
+
+ULONG
+FatGetShortNameTailHint (
+    IN PDCB Dcb,
+    IN ULONG Key
+    );
+
+VOID
+FatSetShortNameTailHint (
+    IN PDCB Dcb,
+    IN ULONG Key,
+    IN ULONG NextIndex
+    );
+
 _Requires_lock_held_(_Global_critical_region_)
 VOID
 FatLocateSimpleOemDirent (
@@ -1264,6 +1300,12 @@ FatUnicodeToUpcaseOem (
     IN PUNICODE_STRING UnicodeString
     );
 
+NTSTATUS
+FatUpcaseUnicodeToCountedOem (
+    IN OUT POEM_STRING OemString,
+    IN PUNICODE_STRING UnicodeString
+    );
+
 _Requires_lock_held_(_Global_critical_region_)
 VOID
 FatSelectNames (
@@ -158,6 +158,19 @@ typedef struct _FAT_DATA {
 
     PVOID ZeroPage;
 
+    //
+    //  The number of pages of a directory we read ahead of a scan, from the
+    //  registry (0 disables directory prefetch), and counters for how often
+    //  the directory pages pinned by requests that cannot wait were already
+    //  in memory.
+    //
+
+    ULONG DirectoryPrefetchPages;
+
+    __volatile LONG DirectoryPrefetches;
+    __volatile LONG DirectoryReadHits;
+    __volatile LONG DirectoryReadMisses;
+
 } FAT_DATA;
 typedef FAT_DATA *PFAT_DATA;
 
@@ -173,6 +186,110 @@ typedef struct _FAT_WINDOW {
 } FAT_WINDOW;
 typedef FAT_WINDOW *PFAT_WINDOW;
 
+//
+//  On volumes with more than one FAT window we keep a summary tree over the
+//  windows' free cluster counts so that picking a new window does not require
+//  walking the whole window array.  The tree is stored as an implicit binary
+//  heap (root at index 1, leaves following the interior nodes), and each node
+//  summarizes the windows beneath it.
+//
+
+typedef struct _FAT_WINDOW_SUMMARY {
+
+    ULONG MaxClustersFree;    // Greatest ClustersFree of any partially used window below.
+    ULONG EmptyWindows;       // The number of completely free windows below.
+
+} FAT_WINDOW_SUMMARY;
+typedef FAT_WINDOW_SUMMARY *PFAT_WINDOW_SUMMARY;
+
+//
+//  Large directories get an in-memory hash index over the names of their
+//  dirents, built on the first lookup.  Each file contributes up to two
+//  entries, one for its short name and one for its long name, both pointing
+//  at the first dirent (LFN or short) of the file.  The index only supplies
+//  candidate offsets; FatLocateDirent still verifies every candidate against
+//  the dirents on disk, so stale entries are harmless.
+//
+//  Dirents allocated after the index was built are remembered as pending
+//  offsets and folded into the index on the next lookup, once their names
+//  have been written.
+//
+
+#define FAT_DIRENT_INDEX_MINIMUM_SIZE    (0x4000)
+#define FAT_DIRENT_INDEX_MAX_PENDING     (32)
+#define FAT_DIRENT_INDEX_MAX_CANDIDATES  (16)
+#define FAT_DIRENT_INDEX_CHUNK_ENTRIES   (255)
+#define FAT_SHORT_NAME_TAIL_HINTS        (8)
+
+typedef struct _FAT_DIRENT_INDEX_ENTRY {
+
+    struct _FAT_DIRENT_INDEX_ENTRY *Next;
+    ULONG Hash;
+    VBO LfnOffset;
+
+} FAT_DIRENT_INDEX_ENTRY;
+typedef FAT_DIRENT_INDEX_ENTRY *PFAT_DIRENT_INDEX_ENTRY;
+
+typedef struct _FAT_DIRENT_INDEX_CHUNK {
+
+    struct _FAT_DIRENT_INDEX_CHUNK *Next;
+    ULONG EntriesUsed;
+    FAT_DIRENT_INDEX_ENTRY Entries[FAT_DIRENT_INDEX_CHUNK_ENTRIES];
+
+} FAT_DIRENT_INDEX_CHUNK;
+typedef FAT_DIRENT_INDEX_CHUNK *PFAT_DIRENT_INDEX_CHUNK;
+
+typedef struct _FAT_DIRENT_INDEX {
+
+    //
+    //  Lookups hold this shared; building, extending and invalidating the
+    //  index hold it exclusive.  This structure is allocated from non-paged
+    //  pool for the resource; the buckets and entries themselves are paged.
+    //
+
+    ERESOURCE Resource;
+
+    BOOLEAN Built;
+
+    ULONG BucketMask;
+    PFAT_DIRENT_INDEX_ENTRY *Buckets;
+    PFAT_DIRENT_INDEX_CHUNK Chunks;
+
+    ULONG EntryCount;
+
+    //
+    //  The number of files deleted from the directory since the index was
+    //  built.  Their entries are left behind, and once there are enough of
+    //  them we throw the index away and build it again.
+    //
+
+    __volatile LONG StaleCount;
+
+    ULONG PendingCount;
+    VBO Pending[FAT_DIRENT_INDEX_MAX_PENDING];
+
+    //
+    //  When many files with similar long names go into the directory, the
+    //  generated short names all share a base and differ only in their ~N
+    //  tail.  We remember, for the last few bases, the first tail that has
+    //  not been handed out, so that FatSelectNames can start probing there
+    //  instead of at ~1.  These are only hints; every generated name is
+    //  still checked against the directory.  They survive rebuilds of the
+    //  index itself.
+    //
+
+    struct {
+
+        ULONG Key;
+        ULONG NextIndex;
+
+    } TailHints[FAT_SHORT_NAME_TAIL_HINTS];
+
+    ULONG NextTailHint;
+
+} FAT_DIRENT_INDEX;
+typedef FAT_DIRENT_INDEX *PFAT_DIRENT_INDEX;
+
 //
 //  Forward reference some circular referenced structures.
 //
@@ -288,6 +405,15 @@ typedef struct _VCB {
     PFAT_WINDOW Windows;
     PFAT_WINDOW CurrentWindow;
 
+    //
+    //  The summary tree over Windows[], only present if NumberOfWindows > 1.
+    //  WindowSummaryLeaves is NumberOfWindows rounded up to a power of two.
+    //  Both are protected by the FreeClusterBitMapMutex.
+    //
+
+    PFAT_WINDOW_SUMMARY WindowSummary;
+    ULONG WindowSummaryLeaves;
+
     //
     //  A count of the number of file objects that have opened the volume
     //  for direct access, and their share access state.
@@ -1034,6 +1160,21 @@ typedef struct _FCB {
             PRTL_SPLAY_LINKS RootOemNode;
             PRTL_SPLAY_LINKS RootUnicodeNode;
 
+            //
+            //  The name hash index for this directory, allocated on the first
+            //  lookup in a large enough directory.  See FAT_DIRENT_INDEX.
+            //
+
+            PFAT_DIRENT_INDEX DirentIndex;
+
+            //
+            //  The range of the directory stream we last prefetched.  See
+            //  FatPrefetchDirectory.
+            //
+
+            VBO PrefetchStartVbo;
+            VBO PrefetchEndVbo;
+
             //
             //  The following field keeps track of free dirents, i.e.,
             //  dirents that are either unallocated for deleted.
@@ -1679,6 +1820,24 @@ typedef struct _DEFERRED_FLUSH_CONTEXT {
 
 typedef DEFERRED_FLUSH_CONTEXT *PDEFERRED_FLUSH_CONTEXT;
 
+//
+//  This record is used to hand a directory prefetch to a worker thread, so
+//  that it runs without the directory held.
+//
+
+typedef struct _DIRECTORY_PREFETCH_CONTEXT {
+
+    WORK_QUEUE_ITEM Item;
+
+    PFILE_OBJECT File;
+    ULONG StartingPage;
+    ULONG PageCount;
+    ULONG PagePriority;
+
+} DIRECTORY_PREFETCH_CONTEXT;
+
+typedef DIRECTORY_PREFETCH_CONTEXT *PDIRECTORY_PREFETCH_CONTEXT;
+
 //
 //  This structure is used for the FatMarkVolumeClean callbacks.
 //
@@ -3704,6 +3704,16 @@ Return Value:
         Fcb->LfnOffsetWithinDirectory = NewOffset;
         Fcb->DirentOffsetWithinDirectory = ShortDirentOffset;
 
+        //
+        //  If we rewrote the name in place, the directory's name index has to
+        //  pick up the new one.  New dirents were noted when they were made.
+        //
+
+        if (!DeleteSourceDirent) {
+
+            FatNoteDirentIndexChange( TargetDcb, NewOffset );
+        }
+
         RemoveEntryList( &Fcb->ParentDcbLinks );
 
         //
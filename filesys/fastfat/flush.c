@@ -868,24 +868,48 @@ Return Value:
     //  off writes that don't correspond to dirty ranges of the FAT).
     //  For FAT32, this would be a *lot* of reading.
     //
+    //  The DirtyFatMcb holds the sorted set of dirty Fat sectors, so
+    //  the walk only needs to cover the pages from the first dirty sector
+    //  to the last one rather than the whole Fat.
+    //
 
     if (Vcb->AllocationSupport.FatIndexBitSize != 12) {
 
-        //
-        //  Walk through the Fat, one page at a time.
-        //
+        VBO DirtyVbo;
+        LBO DirtyLbo;
+        ULONG DirtyByteCount;
+        VBO StartingDirtyVbo = 0;
+        VBO EndingDirtyVbo = 0;
+        ULONG RunIndex;
+
+        for (RunIndex = 0;
+             FatGetNextMcbEntry( Vcb, &Vcb->DirtyFatMcb, RunIndex, &DirtyVbo, &DirtyLbo, &DirtyByteCount );
+             RunIndex++) {
+
+            //
+            //  Holes are clean.
+            //
+
+            if (DirtyLbo == 0) {
 
-        ULONG NumberOfPages;
-        ULONG Page;
+                continue;
+            }
+
+            if (EndingDirtyVbo == 0) {
+
+                StartingDirtyVbo = DirtyVbo;
+            }
 
-        NumberOfPages = ( FatReservedBytes(&Vcb->Bpb) +
-                          FatBytesPerFat(&Vcb->Bpb) +
-                          (PAGE_SIZE - 1) ) / PAGE_SIZE;
+            EndingDirtyVbo = DirtyVbo + DirtyByteCount;
+        }
 
+        //
+        //  Walk through the dirty part of the Fat, one page at a time.
+        //
 
-        for ( Page = 0, Offset.QuadPart = 0;
-              Page < NumberOfPages;
-              Page++, Offset.LowPart += PAGE_SIZE ) {
+        for ( Offset.QuadPart = StartingDirtyVbo & ~(PAGE_SIZE - 1);
+              Offset.QuadPart < EndingDirtyVbo;
+              Offset.QuadPart += PAGE_SIZE ) {
 
             try {
 
@@ -17,6 +17,16 @@ Abstract:
 
 #define Dbg                              (DEBUG_TRACE_NAMESUP)
 
+ULONG
+FatShortNameTailKey (
+    IN PUNICODE_STRING ShortName
+    );
+
+ULONG
+FatShortNameTailIndex (
+    IN PUNICODE_STRING ShortName
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, Fat8dot3ToString)
 #pragma alloc_text(PAGE, FatIsNameInExpression)
@@ -24,7 +34,10 @@ Abstract:
 #pragma alloc_text(PAGE, FatSetFullFileNameInFcb)
 #pragma alloc_text(PAGE, FatGetUnicodeNameFromFcb)
 #pragma alloc_text(PAGE, FatUnicodeToUpcaseOem)
+#pragma alloc_text(PAGE, FatUpcaseUnicodeToCountedOem)
 #pragma alloc_text(PAGE, FatSelectNames)
+#pragma alloc_text(PAGE, FatShortNameTailKey)
+#pragma alloc_text(PAGE, FatShortNameTailIndex)
 #pragma alloc_text(PAGE, FatEvaluateNameCase)
 #pragma alloc_text(PAGE, FatSpaceInName)
 #pragma alloc_text(PAGE, FatUnicodeRestoreShortNameCase)
@@ -662,9 +675,7 @@ Return Value:
 
     PAGED_CODE();
 
-    Status = RtlUpcaseUnicodeStringToCountedOemString( OemString,
-                                                       UnicodeString,
-                                                       FALSE );
+    Status = FatUpcaseUnicodeToCountedOem( OemString, UnicodeString );
 
     if (Status == STATUS_BUFFER_OVERFLOW) {
 
@@ -693,6 +704,184 @@ Return Value:
 }
 
 
+ULONG
+FatShortNameTailKey (
+    IN PUNICODE_STRING ShortName
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hashes the base and extension of a generated short name,
+    so that we can keep a tail hint for them.  The base is the upcased
+    first six characters of the name, ahead of the ~N tail.
+
+Arguments:
+
+    ShortName - Supplies a generated short name with a tail below 10, so
+        that its base has all six characters.
+
+Return Value:
+
+    ULONG - The hash of the base and extension.
+
+--*/
+
+{
+    ULONG Key = 2166136261;
+    ULONG Length = ShortName->Length / sizeof(WCHAR);
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; (i < Length) && (i < 6) && (ShortName->Buffer[i] != L'~'); i++) {
+
+        Key = (Key ^ ShortName->Buffer[i]) * 16777619;
+    }
+
+    while ((i < Length) && (ShortName->Buffer[i] != L'.')) {
+
+        i++;
+    }
+
+    for (; i < Length; i++) {
+
+        Key = (Key ^ ShortName->Buffer[i]) * 16777619;
+    }
+
+    return Key;
+}
+
+
+ULONG
+FatShortNameTailIndex (
+    IN PUNICODE_STRING ShortName
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the number in the ~N tail of a generated short
+    name.
+
+Arguments:
+
+    ShortName - Supplies the short name.
+
+Return Value:
+
+    ULONG - The tail number, or 0 if the name has no tail.
+
+--*/
+
+{
+    ULONG Length = ShortName->Length / sizeof(WCHAR);
+    ULONG TailIndex = 0;
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; (i < Length) && (ShortName->Buffer[i] != L'~'); i++) {
+
+        NOTHING;
+    }
+
+    for (i += 1; (i < Length) && (ShortName->Buffer[i] >= L'0') && (ShortName->Buffer[i] <= L'9'); i++) {
+
+        TailIndex = TailIndex * 10 + (ShortName->Buffer[i] - L'0');
+    }
+
+    return TailIndex;
+}
+
+
+NTSTATUS
+FatUpcaseUnicodeToCountedOem (
+    IN OUT POEM_STRING OemString,
+    IN PUNICODE_STRING UnicodeString
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is a drop-in for RtlUpcaseUnicodeStringToCountedOemString()
+    with the destination already allocated.  Nearly every name we see is
+    plain 7 bit ASCII, which every OEM code page maps to itself, so we
+    handle that case here four characters at a time and leave everything
+    else to the NLS tables.
+
+Arguments:
+
+    OemString - Supplies the destination string, with its buffer.
+
+    UnicodeString - Supplies the source string.
+
+Return Value:
+
+    NTSTATUS - As for RtlUpcaseUnicodeStringToCountedOemString().
+
+--*/
+
+{
+    ULONG Count = UnicodeString->Length / sizeof(WCHAR);
+    PWCHAR Source = UnicodeString->Buffer;
+    PUCHAR Destination = (PUCHAR)OemString->Buffer;
+    ULONG i;
+
+    PAGED_CODE();
+
+    if ((Count > OemString->MaximumLength) || (Count > MAXUSHORT)) {
+
+        return RtlUpcaseUnicodeStringToCountedOemString( OemString, UnicodeString, FALSE );
+    }
+
+    //
+    //  Take four characters at a time.  For a lane known to be below 0x80,
+    //  adding 0x1f sets bit 7 if it is at least 'a' and adding 0x05 sets
+    //  bit 7 if it is beyond 'z', so the difference picks out exactly the
+    //  lower case letters, whose 0x20 bit we then clear.
+    //
+
+    for (i = 0; i + 4 <= Count; i += 4) {
+
+        ULONGLONG Chars = *(ULONGLONG UNALIGNED *)&Source[i];
+        ULONGLONG Lower;
+
+        if ((Chars & 0xff80ff80ff80ff80) != 0) {
+
+            return RtlUpcaseUnicodeStringToCountedOemString( OemString, UnicodeString, FALSE );
+        }
+
+        Lower = ((Chars + 0x001f001f001f001f) & ~(Chars + 0x0005000500050005)) & 0x0080008000800080;
+        Chars ^= Lower >> 2;
+
+        Destination[i + 0] = (UCHAR)(Chars);
+        Destination[i + 1] = (UCHAR)(Chars >> 16);
+        Destination[i + 2] = (UCHAR)(Chars >> 32);
+        Destination[i + 3] = (UCHAR)(Chars >> 48);
+    }
+
+    for (; i < Count; i++) {
+
+        if (Source[i] >= 0x80) {
+
+            return RtlUpcaseUnicodeStringToCountedOemString( OemString, UnicodeString, FALSE );
+        }
+
+        Destination[i] = (UCHAR)(((Source[i] >= L'a') && (Source[i] <= L'z')) ?
+                                 (Source[i] - (L'a' - L'A')) :
+                                 Source[i]);
+    }
+
+    OemString->Length = (USHORT)Count;
+
+    return STATUS_SUCCESS;
+}
+
+
 _Requires_lock_held_(_Global_critical_region_)
 VOID
 FatSelectNames (
@@ -762,6 +951,10 @@ Return Value:
         UNICODE_STRING ShortUnicodeName;
         GENERATE_NAME_CONTEXT Context;
         BOOLEAN TrySuggestedShortName;
+        BOOLEAN TailHintApplied = FALSE;
+        ULONG TailKey = 0;
+        ULONG TailIndex;
+        ULONG NextIndex;
 
         PDIRENT Dirent;
         PBCB Bcb = NULL;
@@ -804,6 +997,40 @@ Return Value:
                 } else {
 
                     RtlGenerate8dot3Name( UnicodeName, TRUE, &Context, &ShortUnicodeName );
+
+                    //
+                    //  Once the generator has fallen back to a checksummed
+                    //  base, jump ahead past the tails we have already handed
+                    //  out for it rather than colliding with each of them in
+                    //  turn.  The generator is only ever driven forward, so
+                    //  the candidates are exactly the ones it would produce.
+                    //
+
+                    if (Context.CheckSumInserted && !TailHintApplied) {
+
+                        TailHintApplied = TRUE;
+                        TailKey = FatShortNameTailKey( &ShortUnicodeName );
+                        NextIndex = FatGetShortNameTailHint( Parent, TailKey );
+
+                        TailIndex = FatShortNameTailIndex( &ShortUnicodeName );
+
+                        while (TailIndex < NextIndex) {
+
+                            RtlGenerate8dot3Name( UnicodeName, TRUE, &Context, &ShortUnicodeName );
+
+                            //
+                            //  Stop if the generator ran out of tails and
+                            //  started over.
+                            //
+
+                            if (FatShortNameTailIndex( &ShortUnicodeName ) <= TailIndex) {
+
+                                break;
+                            }
+
+                            TailIndex = FatShortNameTailIndex( &ShortUnicodeName );
+                        }
+                    }
                 }
 
                 //
@@ -826,6 +1053,18 @@ Return Value:
 
                 if (Bcb == NULL) {
 
+                    //
+                    //  If we had to go into the ~N tails of a checksummed base,
+                    //  remember where we got to for the next similar name.
+                    //
+
+                    if (TailHintApplied) {
+
+                        FatSetShortNameTailHint( Parent,
+                                                 TailKey,
+                                                 FatShortNameTailIndex( &ShortUnicodeName ) + 1 );
+                    }
+
                     leave;
 
                 }
@@ -157,6 +157,7 @@ typedef CSHORT NODE_BYTE_SIZE;
 #define TAG_BCB                         'btaF'
 #define TAG_DIRENT                      'DtaF'
 #define TAG_DIRENT_BITMAP               'TtaF'
+#define TAG_DIRENT_INDEX                'HtaF'
 #define TAG_EA_DATA                     'dtaF'
 #define TAG_EA_SET_HEADER               'etaF'
 #define TAG_EVENT                       'ttaF'
@@ -170,6 +171,7 @@ typedef CSHORT NODE_BYTE_SIZE;
 #define TAG_STASHED_BPB                 'StaF'
 #define TAG_VCB_STATS                   'VtaF'
 #define TAG_DEFERRED_FLUSH_CONTEXT      'ftaF'
+#define TAG_DIRECTORY_PREFETCH_CONTEXT  'ptaF'
 
 #define TAG_VPB                         'vtaF'
 
@@ -1981,6 +1981,12 @@ Return Value:
             ExFreePool(Fcb->Specific.Dcb.FreeDirentBitmap.Buffer);
         }
 
+        //
+        //  Free the name index, if one was built.
+        //
+
+        FatDeleteDirentIndex( Fcb );
+
 #if (NTDDI_VERSION >= NTDDI_WIN8)
         //
         //  Uninitialize the oplock.
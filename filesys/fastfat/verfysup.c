@@ -1472,6 +1472,12 @@ Return Value:
 
         Fcb->Specific.Dcb.UnusedDirentVbo = 0xffffffff;
         Fcb->Specific.Dcb.DeletedDirentHint = 0xffffffff;
+
+        //
+        //  And drop the name index, since the dirents may have changed.
+        //
+
+        FatInvalidateDirentIndex( Fcb );
     }
 }
 
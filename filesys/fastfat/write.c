@@ -45,6 +45,13 @@ Abstract:
 
 BOOLEAN FatNoAsync = FALSE;
 
+//
+//  The most a file that keeps being extended by writes may grow its
+//  allocation by in one step, once it outgrows the write-size based chunk.
+//
+
+#define FAT_MAX_WRITE_GROWTH             (0x1000000)
+
 //
 //  Local support routines
 //
@@ -1940,6 +1947,34 @@ Return Value:
                             // a single write can be a max of 4GB.
                             AddedAllocation = Multiplier * (ClusterAlignedFileSize - FcbOrDcb->Header.AllocationSize.LowPart);
 
+                            //
+                            //  A file being appended to in small writes (a log, say)
+                            //  would otherwise grow by the same small chunk every
+                            //  time, and end up in as many fragments, interleaved
+                            //  with whatever else is being written.  Let such a file
+                            //  grow by its current allocation instead, so the number
+                            //  of extensions only grows logarithmically with its
+                            //  size, as long as that is still a small fraction of
+                            //  the free space.  Whatever we do not use is trimmed
+                            //  when the file is closed, as for the chunk above.
+                            //
+
+                            if (FcbOrDcb->Header.AllocationSize.LowPart > AddedAllocation) {
+
+                                ULONG Growth = FcbOrDcb->Header.AllocationSize.LowPart;
+
+                                if (Growth > FAT_MAX_WRITE_GROWTH) {
+
+                                    Growth = FAT_MAX_WRITE_GROWTH;
+                                }
+
+                                if ((Growth > AddedAllocation) &&
+                                    ((Growth / BytesPerCluster) <= (Vcb->AllocationSupport.NumberOfFreeClusters / 32))) {
+
+                                    AddedAllocation = Growth;
+                                }
+                            }
+
                             TargetAllocation = FcbOrDcb->Header.AllocationSize.LowPart + AddedAllocation;
     
                             //
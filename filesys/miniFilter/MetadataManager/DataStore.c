@@ -33,6 +33,18 @@ Environment:
 #pragma alloc_text(PAGE, FmmSetMetadataOpenTriggerFileObject)
 #pragma alloc_text(PAGE, FmmBeginFileSystemOperation)
 #pragma alloc_text(PAGE, FmmEndFileSystemOperation)
+#pragma alloc_text(PAGE, FmmInitializeJournal)
+#pragma alloc_text(PAGE, FmmDeleteJournal)
+#pragma alloc_text(PAGE, FmmJournalFindEntry)
+#pragma alloc_text(PAGE, FmmJournalChecksum)
+#pragma alloc_text(PAGE, FmmJournalRecordIsValid)
+#pragma alloc_text(PAGE, FmmLoadJournalTail)
+#pragma alloc_text(PAGE, FmmCompactJournal)
+#pragma alloc_text(PAGE, FmmJournalUpdate)
+#pragma alloc_text(PAGE, FmmRecordFileUpdate)
+#pragma alloc_text(PAGE, FmmWriteJournal)
+#pragma alloc_text(PAGE, FmmJournalWorker)
+#pragma alloc_text(PAGE, FmmHoldJournalWrites)
 #endif
 
 _Requires_lock_held_(_Global_critical_region_)
@@ -363,6 +375,23 @@ FmmOpenMetadataCleanup:
 
         SetFlag( InstanceContext->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED );
 
+        //
+        //  The journal reads the tail of the metadata file again before it
+        //  next writes to it
+        //
+
+        InstanceContext->MetadataOpenCount += 1;
+
+        //
+        //  Let the journal write to the file again if it was held when the
+        //  file was closed
+        //
+
+        if (InstanceContext->Journal.HeldForClose) {
+
+            InstanceContext->Journal.HeldForClose = FALSE;
+            FmmResumeJournalWrites( InstanceContext );
+        }
     }
 
     if (fileName.Buffer != NULL) {
@@ -477,6 +506,7 @@ Note:
 {
     NTSTATUS status = STATUS_SUCCESS;
     PFMM_INSTANCE_CONTEXT instanceContext = NULL;
+    BOOLEAN holdJournal = FALSE;
 
     PAGED_CODE();
 
@@ -494,6 +524,16 @@ Note:
         goto FmmReleaseMetadataFileReferencesCleanup;
     }
 
+    //
+    //  Write out the pending metadata updates before the metadata file is
+    //  closed, and hold the journal so that no write work item references
+    //  the file while or after it is closed.  The updates which cannot be
+    //  written stay pending and are written once the metadata file is
+    //  re-opened
+    //
+
+    FmmHoldJournalWrites( instanceContext );
+
     //
     //  Acquire exclusive access to the instance context
     //
@@ -542,6 +582,16 @@ Note:
             //
 
             instanceContext->MetadataOpenTriggerFileObject = Cbd->Iopb->TargetFileObject;
+
+            //
+            //  Keep the journal held until the metadata file is re-opened
+            //
+
+            if (!instanceContext->Journal.HeldForClose) {
+
+                instanceContext->Journal.HeldForClose = TRUE;
+                holdJournal = TRUE;
+            }
         } else {
 
             DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS,
@@ -559,6 +609,11 @@ Note:
 
     FmmReleaseResource( &instanceContext->MetadataResource );
 
+    if (!holdJournal) {
+
+        FmmResumeJournalWrites( instanceContext );
+    }
+
 
 FmmReleaseMetadataFileReferencesCleanup:
 
@@ -675,6 +730,16 @@ Note:
                 status = FmmOpenMetadata( instanceContext,
                                                  FALSE );
 
+                //
+                //  Write the updates recorded while the metadata file was closed
+                //
+
+                if (NT_SUCCESS( status ) &&
+                    (instanceContext->Journal.PendingCount != 0)) {
+
+                    FmmQueueJournalWrite( instanceContext );
+                }
+
                 //
                 //  Reset the trigger file object since the volume open failed.
                 //
@@ -960,6 +1025,1299 @@ Note:
 
 
 
+/*************************************************************************
+    Metadata journal.
+*************************************************************************/
+
+_IRQL_requires_max_(APC_LEVEL)
+VOID
+FmmInitializeJournal (
+    _Out_ PFMM_JOURNAL Journal
+    )
+/*++
+
+Routine Description:
+
+    This routine initializes the journal of an instance.
+
+Arguments:
+
+    Journal             - Supplies the journal to initialize.  It must be in
+                          non paged pool.
+
+Return Value:
+
+    Void.
+
+--*/
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    RtlZeroMemory( Journal, sizeof( FMM_JOURNAL ) );
+
+    ExInitializeResourceLite( &Journal->Resource );
+    ExInitializeResourceLite( &Journal->WriteResource );
+
+    InitializeListHead( &Journal->PendingList );
+
+    Journal->CompactSize = FMM_JOURNAL_COMPACT_SIZE;
+
+    for (i = 0; i < FMM_JOURNAL_BUCKET_COUNT; i++) {
+
+        InitializeListHead( &Journal->Buckets[i] );
+    }
+}
+
+
+_IRQL_requires_max_(APC_LEVEL)
+VOID
+FmmDeleteJournal (
+    _Inout_ PFMM_JOURNAL Journal
+    )
+/*++
+
+Routine Description:
+
+    This routine frees the updates still pending in the journal of an
+    instance and deletes its resources.
+
+Arguments:
+
+    Journal             - Supplies the journal to delete.
+
+Return Value:
+
+    Void.
+
+Note:
+
+    Updates which were not written by the time the instance is torn down
+    could not be written and are lost.
+
+--*/
+{
+    PFMM_JOURNAL_ENTRY entry;
+    PLIST_ENTRY link;
+
+    PAGED_CODE();
+
+    if (Journal->PendingCount != 0) {
+
+        DebugTrace( DEBUG_TRACE_ERROR | DEBUG_TRACE_METADATA_OPERATIONS,
+                    ("[Fmm]: Discarding %u unwritten metadata updates (Journal = %p)\n",
+                     Journal->PendingCount,
+                     Journal) );
+    }
+
+    while (!IsListEmpty( &Journal->PendingList )) {
+
+        link = RemoveHeadList( &Journal->PendingList );
+        entry = CONTAINING_RECORD( link, FMM_JOURNAL_ENTRY, ListEntry );
+
+        ExFreePoolWithTag( entry, FMM_JOURNAL_TAG );
+    }
+
+    Journal->PendingCount = 0;
+
+    ExDeleteResourceLite( &Journal->WriteResource );
+    ExDeleteResourceLite( &Journal->Resource );
+}
+
+
+_Requires_lock_held_(Journal->Resource)
+PFMM_JOURNAL_ENTRY
+FmmJournalFindEntry (
+    _In_ PFMM_JOURNAL Journal,
+    _In_ PLARGE_INTEGER FileId,
+    _Out_ PLIST_ENTRY *Bucket
+    )
+/*++
+
+Routine Description:
+
+    This routine finds the pending update of a file.
+
+Arguments:
+
+    Journal             - Supplies the journal to search.
+    FileId              - Supplies the file id of the file.
+    Bucket              - Receives the hash bucket of the file.
+
+Return Value:
+
+    The pending update of the file, or NULL if it has none.
+
+Note:
+
+    The caller must hold the journal resource.
+
+--*/
+{
+    PFMM_JOURNAL_ENTRY entry;
+    PLIST_ENTRY bucket;
+    PLIST_ENTRY link;
+
+    PAGED_CODE();
+
+    //
+    //  The low bits of a file id are often an index which most files of a
+    //  directory share the high bits of, so mix all of them into the hash.
+    //
+
+    bucket = &Journal->Buckets[(ULONG)(((ULONGLONG)FileId->QuadPart * 0x9E3779B97F4A7C15ull) >> 32) &
+                               (FMM_JOURNAL_BUCKET_COUNT - 1)];
+
+    *Bucket = bucket;
+
+    for (link = bucket->Flink; link != bucket; link = link->Flink) {
+
+        entry = CONTAINING_RECORD( link, FMM_JOURNAL_ENTRY, BucketEntry );
+
+        if (entry->FileId.QuadPart == FileId->QuadPart) {
+
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+ULONG
+FmmJournalChecksum (
+    _In_ PFMM_METADATA_RECORD Record
+    )
+/*++
+
+Routine Description:
+
+    This routine computes the checksum of a metadata record.
+
+Arguments:
+
+    Record              - Supplies the record.  Its checksum field must be
+                          zero.
+
+Return Value:
+
+    The checksum of the record.
+
+--*/
+{
+    PULONG data = (PULONG) Record;
+    ULONG checksum = 0;
+    ULONG i;
+
+    FLT_ASSERT( Record->Checksum == 0 );
+
+    for (i = 0; i < sizeof( FMM_METADATA_RECORD ) / sizeof( ULONG ); i++) {
+
+        checksum = RotateLeft32( checksum, 7 ) ^ data[i];
+    }
+
+    return checksum;
+}
+
+
+BOOLEAN
+FmmJournalRecordIsValid (
+    _In_ PFMM_METADATA_RECORD Record
+    )
+/*++
+
+Routine Description:
+
+    This routine checks the signature and checksum of a metadata record read
+    from the metadata file.
+
+Arguments:
+
+    Record              - Supplies the record.
+
+Return Value:
+
+    TRUE if the record was written whole, FALSE if it was torn.
+
+--*/
+{
+    FMM_METADATA_RECORD record;
+
+    PAGED_CODE();
+
+    if (Record->Signature != FMM_METADATA_RECORD_SIGNATURE) {
+
+        return FALSE;
+    }
+
+    record = *Record;
+    record.Checksum = 0;
+
+    return (FmmJournalChecksum( &record ) == Record->Checksum);
+}
+
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmLoadJournalTail (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ PFILE_OBJECT FileObject
+    )
+/*++
+
+Routine Description:
+
+    This routine finds the last valid record of the metadata file.  The
+    sequence numbers of the records written from now on follow its
+    sequence number, so they win over the records already in the file, and
+    the records are written after it.  A torn tail following it is
+    truncated.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    FileObject          - Supplies the file object of the metadata file.
+
+Return Value:
+
+    Returns the status of this operation.
+
+Note:
+
+    The caller must hold the journal write resource exclusive.
+
+--*/
+{
+    PFMM_JOURNAL journal = &InstanceContext->Journal;
+    PFMM_METADATA_RECORD records = NULL;
+    FILE_STANDARD_INFORMATION standardInformation;
+    FILE_END_OF_FILE_INFORMATION endOfFileInformation;
+    LARGE_INTEGER byteOffset;
+    LONGLONG validEnd = 0;
+    LONGLONG windowEnd;
+    ULONG length;
+    ULONG bytesRead;
+    ULONG i;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    status = FltQueryInformationFile( InstanceContext->Instance,
+                                      FileObject,
+                                      &standardInformation,
+                                      sizeof( standardInformation ),
+                                      FileStandardInformation,
+                                      NULL );
+
+    if (!NT_SUCCESS( status )) {
+
+        goto FmmLoadJournalTailCleanup;
+    }
+
+    records = ExAllocatePoolZero( PagedPool,
+                                  FMM_JOURNAL_MAX_WRITE,
+                                  FMM_JOURNAL_TAG );
+
+    if (records == NULL) {
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto FmmLoadJournalTailCleanup;
+    }
+
+    //
+    //  Only the last write can have been torn by a crash, but look further
+    //  back a write at a time until a valid record is found.
+    //
+
+    windowEnd = standardInformation.EndOfFile.QuadPart -
+                (standardInformation.EndOfFile.QuadPart % sizeof( FMM_METADATA_RECORD ));
+
+    while ((windowEnd > 0) && (validEnd == 0)) {
+
+        length = (ULONG) min( windowEnd, FMM_JOURNAL_MAX_WRITE );
+        byteOffset.QuadPart = windowEnd - length;
+
+        status = FltReadFile( InstanceContext->Instance,
+                              FileObject,
+                              &byteOffset,
+                              length,
+                              records,
+                              0,
+                              &bytesRead,
+                              NULL,
+                              NULL );
+
+        if (!NT_SUCCESS( status )) {
+
+            goto FmmLoadJournalTailCleanup;
+        }
+
+        if (bytesRead != length) {
+
+            status = STATUS_FILE_CORRUPT_ERROR;
+            goto FmmLoadJournalTailCleanup;
+        }
+
+        for (i = length / sizeof( FMM_METADATA_RECORD ); i > 0; i--) {
+
+            if (FmmJournalRecordIsValid( &records[i - 1] )) {
+
+                validEnd = byteOffset.QuadPart + i * sizeof( FMM_METADATA_RECORD );
+
+                if (records[i - 1].Sequence >= journal->NextSequence) {
+
+                    journal->NextSequence = records[i - 1].Sequence + 1;
+                }
+
+                break;
+            }
+        }
+
+        windowEnd = byteOffset.QuadPart;
+    }
+
+    if (validEnd != standardInformation.EndOfFile.QuadPart) {
+
+        DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS,
+                    ("[Fmm]: Truncating the metadata file from %I64d to %I64d bytes (Volume = %p)\n",
+                     standardInformation.EndOfFile.QuadPart,
+                     validEnd,
+                     InstanceContext->Volume) );
+
+        endOfFileInformation.EndOfFile.QuadPart = validEnd;
+
+        status = FltSetInformationFile( InstanceContext->Instance,
+                                        FileObject,
+                                        &endOfFileInformation,
+                                        sizeof( endOfFileInformation ),
+                                        FileEndOfFileInformation );
+
+        if (!NT_SUCCESS( status )) {
+
+            goto FmmLoadJournalTailCleanup;
+        }
+    }
+
+    journal->FileSize = validEnd;
+
+FmmLoadJournalTailCleanup:
+
+    if (records != NULL) {
+
+        ExFreePoolWithTag( records, FMM_JOURNAL_TAG );
+    }
+
+    return status;
+}
+
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmCompactJournal (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ PFILE_OBJECT FileObject
+    )
+/*++
+
+Routine Description:
+
+    This routine rewrites the metadata file with only the last record of
+    each file, in the order they were written.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    FileObject          - Supplies the file object of the metadata file.
+
+Return Value:
+
+    Returns the status of this operation.
+
+Note:
+
+    The caller must hold the journal write resource exclusive.
+
+    The compacted records are first appended to the file and flushed, then
+    written over its start and flushed again before the file is truncated.
+    If the system crashes at any point, the last record of every file is
+    either in its compacted copy at the end of the file or in the records
+    written before it, so it is still found by its sequence number.
+
+--*/
+{
+    PFMM_JOURNAL journal = &InstanceContext->Journal;
+    PFMM_METADATA_RECORD records = NULL;
+    PULONG table = NULL;
+    FILE_END_OF_FILE_INFORMATION endOfFileInformation;
+    LARGE_INTEGER byteOffset;
+    ULONG length;
+    ULONG bytesRead;
+    ULONG bytesWritten;
+    ULONG count;
+    ULONG kept;
+    ULONG tableSize;
+    ULONG slot;
+    ULONG i;
+    BOOLEAN appended = FALSE;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (journal->FileSize > MAXULONG / 2) {
+
+        status = STATUS_FILE_TOO_LARGE;
+        goto FmmCompactJournalCleanup;
+    }
+
+    length = (ULONG) journal->FileSize;
+    count = length / sizeof( FMM_METADATA_RECORD );
+
+    //
+    //  An open addressing hash table of record indexes plus one, at most
+    //  half full.
+    //
+
+    for (tableSize = FMM_JOURNAL_BUCKET_COUNT; tableSize < 2 * count; tableSize *= 2) {
+
+        NOTHING;
+    }
+
+    records = ExAllocatePoolZero( PagedPool,
+                                  length,
+                                  FMM_JOURNAL_TAG );
+
+    table = ExAllocatePoolZero( PagedPool,
+                                tableSize * sizeof( ULONG ),
+                                FMM_JOURNAL_TAG );
+
+    if ((records == NULL) || (table == NULL)) {
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto FmmCompactJournalCleanup;
+    }
+
+    byteOffset.QuadPart = 0;
+
+    status = FltReadFile( InstanceContext->Instance,
+                          FileObject,
+                          &byteOffset,
+                          length,
+                          records,
+                          0,
+                          &bytesRead,
+                          NULL,
+                          NULL );
+
+    if (!NT_SUCCESS( status )) {
+
+        goto FmmCompactJournalCleanup;
+    }
+
+    if (bytesRead != length) {
+
+        status = STATUS_FILE_CORRUPT_ERROR;
+        goto FmmCompactJournalCleanup;
+    }
+
+    //
+    //  Walk the records from the last one, dropping the records of files
+    //  already seen.
+    //
+
+    for (i = count; i > 0; i--) {
+
+        if (!FmmJournalRecordIsValid( &records[i - 1] )) {
+
+            status = STATUS_FILE_CORRUPT_ERROR;
+            goto FmmCompactJournalCleanup;
+        }
+
+        slot = (ULONG)(((ULONGLONG)records[i - 1].FileId.QuadPart * 0x9E3779B97F4A7C15ull) >> 32) &
+               (tableSize - 1);
+
+        while ((table[slot] != 0) &&
+               (records[table[slot] - 1].FileId.QuadPart != records[i - 1].FileId.QuadPart)) {
+
+            slot = (slot + 1) & (tableSize - 1);
+        }
+
+        if (table[slot] != 0) {
+
+            records[i - 1].Signature = 0;
+
+        } else {
+
+            table[slot] = i;
+        }
+    }
+
+    for (i = 0, kept = 0; i < count; i++) {
+
+        if (records[i].Signature != 0) {
+
+            records[kept++] = records[i];
+        }
+    }
+
+    if (kept == count) {
+
+        goto FmmCompactJournalCleanup;
+    }
+
+    length = kept * sizeof( FMM_METADATA_RECORD );
+
+    //
+    //  Append the compacted copy, then write it over the start of the file.
+    //
+
+    byteOffset.QuadPart = journal->FileSize;
+
+    status = FltWriteFile( InstanceContext->Instance,
+                           FileObject,
+                           &byteOffset,
+                           length,
+                           records,
+                           0,
+                           &bytesWritten,
+                           NULL,
+                           NULL );
+
+    if (NT_SUCCESS( status )) {
+
+        status = FltFlushBuffers( InstanceContext->Instance, FileObject );
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        appended = TRUE;
+        byteOffset.QuadPart = 0;
+
+        status = FltWriteFile( InstanceContext->Instance,
+                               FileObject,
+                               &byteOffset,
+                               length,
+                               records,
+                               0,
+                               &bytesWritten,
+                               NULL,
+                               NULL );
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        status = FltFlushBuffers( InstanceContext->Instance, FileObject );
+    }
+
+    if (!NT_SUCCESS( status )) {
+
+        //
+        //  Once the compacted copy is on disk, the start of the file may
+        //  hold only some of it, so append after the copy from now on.
+        //  Otherwise the next write overwrites what was appended.
+        //
+
+        if (appended) {
+
+            journal->FileSize += length;
+        }
+
+        goto FmmCompactJournalCleanup;
+    }
+
+    endOfFileInformation.EndOfFile.QuadPart = length;
+
+    status = FltSetInformationFile( InstanceContext->Instance,
+                                    FileObject,
+                                    &endOfFileInformation,
+                                    sizeof( endOfFileInformation ),
+                                    FileEndOfFileInformation );
+
+    if (!NT_SUCCESS( status )) {
+
+        journal->FileSize += length;
+        goto FmmCompactJournalCleanup;
+    }
+
+    DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS,
+                ("[Fmm]: Compacted the metadata file from %u to %u records (Volume = %p)\n",
+                 count,
+                 kept,
+                 InstanceContext->Volume) );
+
+    journal->FileSize = length;
+
+    InterlockedIncrement64( &journal->Compactions );
+
+FmmCompactJournalCleanup:
+
+    //
+    //  Compact again once the file has doubled, so the cost of compacting
+    //  stays proportional to the records written.
+    //
+
+    journal->CompactSize = max( FMM_JOURNAL_COMPACT_SIZE, 2 * journal->FileSize );
+
+    if (table != NULL) {
+
+        ExFreePoolWithTag( table, FMM_JOURNAL_TAG );
+    }
+
+    if (records != NULL) {
+
+        ExFreePoolWithTag( records, FMM_JOURNAL_TAG );
+    }
+
+    return status;
+}
+
+
+_IRQL_requires_max_(APC_LEVEL)
+NTSTATUS
+FmmJournalUpdate (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ PLARGE_INTEGER FileId,
+    _In_ PLARGE_INTEGER ModifiedTime
+    )
+/*++
+
+Routine Description:
+
+    This routine records an update to the metadata of a file and queues
+    a write of the journal.  If the file already has an update pending,
+    the new update replaces it.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    FileId              - Supplies the file id of the file.
+    ModifiedTime        - Supplies the time the file was modified.
+
+Return Value:
+
+    Returns the status of this operation.
+
+--*/
+{
+    PFMM_JOURNAL journal = &InstanceContext->Journal;
+    PFMM_JOURNAL_ENTRY entry;
+    PLIST_ENTRY bucket;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    InterlockedIncrement64( &journal->Updates );
+
+    FmmAcquireResourceExclusive( &journal->Resource );
+
+    entry = FmmJournalFindEntry( journal, FileId, &bucket );
+
+    if (entry != NULL) {
+
+        entry->ModifiedTime = *ModifiedTime;
+
+        InterlockedIncrement64( &journal->Coalesced );
+
+    } else {
+
+        entry = ExAllocatePoolZero( PagedPool,
+                                    sizeof( FMM_JOURNAL_ENTRY ),
+                                    FMM_JOURNAL_TAG );
+
+        if (entry == NULL) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+
+        } else {
+
+            entry->FileId = *FileId;
+            entry->ModifiedTime = *ModifiedTime;
+
+            InsertTailList( &journal->PendingList, &entry->ListEntry );
+            InsertTailList( bucket, &entry->BucketEntry );
+            journal->PendingCount += 1;
+        }
+    }
+
+    FmmReleaseResource( &journal->Resource );
+
+    if (NT_SUCCESS( status )) {
+
+        FmmQueueJournalWrite( InstanceContext );
+    }
+
+    return status;
+}
+
+
+_IRQL_requires_max_(APC_LEVEL)
+NTSTATUS
+FmmRecordFileUpdate (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    )
+/*++
+
+Routine Description:
+
+    This routine records in the journal that the file was modified now.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    FltObjects          - Supplies the objects of the operation on the file.
+
+Return Value:
+
+    Returns the status of this operation.
+
+--*/
+{
+    FILE_INTERNAL_INFORMATION internalInformation;
+    LARGE_INTEGER modifiedTime;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    status = FltQueryInformationFile( FltObjects->Instance,
+                                      FltObjects->FileObject,
+                                      &internalInformation,
+                                      sizeof( internalInformation ),
+                                      FileInternalInformation,
+                                      NULL );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    KeQuerySystemTime( &modifiedTime );
+
+    return FmmJournalUpdate( InstanceContext,
+                             &internalInformation.IndexNumber,
+                             &modifiedTime );
+}
+
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmWriteJournal (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ BOOLEAN Durable
+    )
+/*++
+
+Routine Description:
+
+    This routine appends the pending updates to the metadata file, as many
+    as fit in each write.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    Durable             - Supplies if the metadata file must be flushed after
+                          the updates are written.  This makes the call a
+                          barrier: every update recorded before it is on
+                          disk when it returns successfully.
+
+Return Value:
+
+    Returns the status of this operation.
+
+Note:
+
+    The caller must not hold the metadata resource.
+
+--*/
+{
+    PFMM_JOURNAL journal = &InstanceContext->Journal;
+    PFMM_METADATA_RECORD records = NULL;
+    PFILE_OBJECT fileObject = NULL;
+    PFMM_JOURNAL_ENTRY entry;
+    PLIST_ENTRY bucket;
+    PLIST_ENTRY link;
+    LIST_ENTRY batch;
+    LARGE_INTEGER byteOffset;
+    ULONG bytesWritten;
+    ULONG count;
+    ULONG openCount = 0;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    FmmAcquireResourceExclusive( &journal->WriteResource );
+
+    if (journal->WritesHeld) {
+
+        //
+        //  A snapshot of the volume is being taken.  The updates are
+        //  written once it has been taken.
+        //
+
+        status = STATUS_FILE_LOCK_CONFLICT;
+        goto FmmWriteJournalCleanup;
+    }
+
+    //
+    //  There is nothing to do if no update is pending and, for a barrier,
+    //  every record written is already flushed.  An update recorded after
+    //  the count is read queues its own write
+    //
+
+    if ((journal->PendingCount == 0) &&
+        (!Durable || !journal->FlushNeeded)) {
+
+        goto FmmWriteJournalCleanup;
+    }
+
+    //
+    //  Reference the metadata file object so it can be written without
+    //  holding the metadata resource.  If the metadata file is closed
+    //  meanwhile, the write fails and the updates stay pending.
+    //
+
+    FmmAcquireResourceShared( &InstanceContext->MetadataResource );
+
+    if (FlagOn( InstanceContext->Flags, INSTANCE_CONTEXT_F_TRANSITION )) {
+
+        status = STATUS_FILE_LOCK_CONFLICT;
+
+    } else if (!FlagOn( InstanceContext->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED )) {
+
+        status = STATUS_FILE_CLOSED;
+
+    } else {
+
+        fileObject = InstanceContext->MetadataFileObject;
+        ObReferenceObject( fileObject );
+        openCount = InstanceContext->MetadataOpenCount;
+    }
+
+    FmmReleaseResource( &InstanceContext->MetadataResource );
+
+    if (!NT_SUCCESS( status )) {
+
+        goto FmmWriteJournalCleanup;
+    }
+
+    //
+    //  The first write after the metadata file is opened continues its
+    //  sequence numbers and appends after its last valid record.
+    //
+
+    if (journal->LoadedOpenCount != openCount) {
+
+        status = FmmLoadJournalTail( InstanceContext, fileObject );
+
+        if (!NT_SUCCESS( status )) {
+
+            DebugTrace( DEBUG_TRACE_ERROR | DEBUG_TRACE_METADATA_OPERATIONS,
+                        ("[Fmm]: Failed to read the tail of the metadata file (Volume = %p, Status = 0x%x)\n",
+                         InstanceContext->Volume,
+                         status) );
+
+            goto FmmWriteJournalCleanup;
+        }
+
+        journal->LoadedOpenCount = openCount;
+    }
+
+    records = ExAllocatePoolZero( PagedPool,
+                                  FMM_JOURNAL_MAX_WRITE,
+                                  FMM_JOURNAL_TAG );
+
+    if (records == NULL) {
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto FmmWriteJournalCleanup;
+    }
+
+#pragma warning(push)
+#pragma warning(disable:4127) //  Conditional expression is constant
+    while (TRUE) {
+
+#pragma warning(pop)
+
+        //
+        //  Take the oldest pending updates off the journal.  Updates made
+        //  from here on are pending again and go in a later write.
+        //
+
+        InitializeListHead( &batch );
+        count = 0;
+
+        FmmAcquireResourceExclusive( &journal->Resource );
+
+        while ((count < FMM_JOURNAL_MAX_WRITE / sizeof( FMM_METADATA_RECORD )) &&
+               !IsListEmpty( &journal->PendingList )) {
+
+            link = RemoveHeadList( &journal->PendingList );
+            entry = CONTAINING_RECORD( link, FMM_JOURNAL_ENTRY, ListEntry );
+
+            RemoveEntryList( &entry->BucketEntry );
+            InsertTailList( &batch, &entry->ListEntry );
+
+            records[count].Signature = FMM_METADATA_RECORD_SIGNATURE;
+            records[count].Checksum = 0;
+            records[count].Sequence = journal->NextSequence + count;
+            records[count].FileId = entry->FileId;
+            records[count].ModifiedTime = entry->ModifiedTime;
+            records[count].Checksum = FmmJournalChecksum( &records[count] );
+
+            count += 1;
+        }
+
+        journal->PendingCount -= count;
+
+        FmmReleaseResource( &journal->Resource );
+
+        if (count == 0) {
+
+            break;
+        }
+
+        byteOffset.QuadPart = journal->FileSize;
+
+        status = FltWriteFile( InstanceContext->Instance,
+                               fileObject,
+                               &byteOffset,
+                               count * sizeof( FMM_METADATA_RECORD ),
+                               records,
+                               0,
+                               &bytesWritten,
+                               NULL,
+                               NULL );
+
+        if (!NT_SUCCESS( status )) {
+
+            DebugTrace( DEBUG_TRACE_ERROR | DEBUG_TRACE_METADATA_OPERATIONS,
+                        ("[Fmm]: Failed to write %u metadata records (Volume = %p, Status = 0x%x)\n",
+                         count,
+                         InstanceContext->Volume,
+                         status) );
+
+            //
+            //  Put the updates back at the head of the journal, unless the
+            //  file was updated again while they were being written.
+            //
+
+            FmmAcquireResourceExclusive( &journal->Resource );
+
+            while (!IsListEmpty( &batch )) {
+
+                link = RemoveTailList( &batch );
+                entry = CONTAINING_RECORD( link, FMM_JOURNAL_ENTRY, ListEntry );
+
+                if (FmmJournalFindEntry( journal, &entry->FileId, &bucket ) != NULL) {
+
+                    ExFreePoolWithTag( entry, FMM_JOURNAL_TAG );
+
+                } else {
+
+                    InsertHeadList( &journal->PendingList, &entry->ListEntry );
+                    InsertTailList( bucket, &entry->BucketEntry );
+                    journal->PendingCount += 1;
+                }
+            }
+
+            FmmReleaseResource( &journal->Resource );
+
+            goto FmmWriteJournalCleanup;
+        }
+
+        journal->NextSequence += count;
+        journal->FileSize += count * sizeof( FMM_METADATA_RECORD );
+        journal->FlushNeeded = TRUE;
+
+        InterlockedIncrement64( &journal->Writes );
+        InterlockedAdd64( &journal->RecordsWritten, count );
+
+        while (!IsListEmpty( &batch )) {
+
+            link = RemoveHeadList( &batch );
+            entry = CONTAINING_RECORD( link, FMM_JOURNAL_ENTRY, ListEntry );
+
+            ExFreePoolWithTag( entry, FMM_JOURNAL_TAG );
+        }
+    }
+
+    if (journal->FileSize >= journal->CompactSize) {
+
+        //
+        //  A failed compaction leaves every record in the file, so it does
+        //  not fail the write.
+        //
+
+        status = FmmCompactJournal( InstanceContext, fileObject );
+
+        if (!NT_SUCCESS( status )) {
+
+            DebugTrace( DEBUG_TRACE_ERROR | DEBUG_TRACE_METADATA_OPERATIONS,
+                        ("[Fmm]: Failed to compact the metadata file (Volume = %p, Status = 0x%x)\n",
+                         InstanceContext->Volume,
+                         status) );
+
+            status = STATUS_SUCCESS;
+        }
+    }
+
+    if (Durable) {
+
+        status = FltFlushBuffers( InstanceContext->Instance, fileObject );
+
+        if (NT_SUCCESS( status )) {
+
+            journal->FlushNeeded = FALSE;
+            InterlockedIncrement64( &journal->Barriers );
+        }
+    }
+
+FmmWriteJournalCleanup:
+
+    //
+    //  Drop the reference to the metadata file object before the write
+    //  resource, so that once a hold is taken no reference is left that
+    //  would keep the file from being closed
+    //
+
+    if (fileObject != NULL) {
+
+        ObDereferenceObject( fileObject );
+    }
+
+    FmmReleaseResource( &journal->WriteResource );
+
+    if (records != NULL) {
+
+        ExFreePoolWithTag( records, FMM_JOURNAL_TAG );
+    }
+
+    return status;
+}
+
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+FmmQueueJournalWrite (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Routine Description:
+
+    This routine queues a work item to write the journal, unless one is
+    already queued.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+
+Return Value:
+
+    Void.
+
+Note:
+
+    Updates recorded while the work item is queued are written by it, so
+    a burst of updates costs a few large writes.
+
+--*/
+{
+    PFLT_GENERIC_WORKITEM workItem;
+    NTSTATUS status;
+
+    if (InterlockedCompareExchange( &InstanceContext->Journal.WriteQueued, 1, 0 ) != 0) {
+
+        return;
+    }
+
+    workItem = FltAllocateGenericWorkItem();
+
+    if (workItem == NULL) {
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto FmmQueueJournalWriteCleanup;
+    }
+
+    //
+    //  The work item holds a reference to the instance context until it
+    //  has run.
+    //
+
+    FltReferenceContext( InstanceContext );
+
+    status = FltQueueGenericWorkItem( workItem,
+                                      InstanceContext->Instance,
+                                      FmmJournalWorker,
+                                      DelayedWorkQueue,
+                                      InstanceContext );
+
+    if (!NT_SUCCESS( status )) {
+
+        FltReleaseContext( InstanceContext );
+        FltFreeGenericWorkItem( workItem );
+    }
+
+FmmQueueJournalWriteCleanup:
+
+    if (!NT_SUCCESS( status )) {
+
+        //
+        //  The updates stay pending until the next update or barrier.
+        //
+
+        DebugTrace( DEBUG_TRACE_ERROR | DEBUG_TRACE_METADATA_OPERATIONS,
+                    ("[Fmm]: Failed to queue a metadata journal write (Volume = %p, Status = 0x%x)\n",
+                     InstanceContext->Volume,
+                     status) );
+
+        InterlockedExchange( &InstanceContext->Journal.WriteQueued, 0 );
+    }
+}
+
+
+VOID
+FmmJournalWorker (
+    _In_ PFLT_GENERIC_WORKITEM FltWorkItem,
+    _In_ PVOID FltObject,
+    _In_opt_ PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    This routine is the work item which writes the journal.
+
+Arguments:
+
+    FltWorkItem         - Supplies the work item.
+    FltObject           - Supplies the instance.
+    Context             - Supplies the instance context for this instance.
+
+Return Value:
+
+    Void.
+
+--*/
+{
+    PFMM_INSTANCE_CONTEXT instanceContext = Context;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER( FltObject );
+
+    PAGED_CODE();
+
+    FLT_ASSERT( instanceContext != NULL );
+
+    //
+    //  Clear the flag before writing, so an update recorded after the
+    //  pending updates are taken queues another write.
+    //
+
+    InterlockedExchange( &instanceContext->Journal.WriteQueued, 0 );
+
+    status = FmmWriteJournal( instanceContext, FALSE );
+
+    if (!NT_SUCCESS( status )) {
+
+        DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS,
+                    ("[Fmm]: Metadata journal write deferred (Volume = %p, Status = 0x%x)\n",
+                     instanceContext->Volume,
+                     status) );
+    }
+
+    FltReleaseContext( instanceContext );
+    FltFreeGenericWorkItem( FltWorkItem );
+}
+
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+FmmHoldJournalWrites (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Routine Description:
+
+    This routine writes and flushes the pending updates, then stops the
+    journal from being written until FmmResumeJournalWrites is called.  It
+    is called before a snapshot of the volume is taken, so the snapshot
+    has every update recorded so far, and before the metadata file is
+    closed, so no write uses the file while or after it is closed.
+
+    Holds nest, each one is ended by a call to FmmResumeJournalWrites.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+
+Return Value:
+
+    Void.
+
+--*/
+{
+    PFMM_JOURNAL journal = &InstanceContext->Journal;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    //
+    //  Hold the write resource across the barrier, so no write starts
+    //  between the barrier and the hold.  FmmWriteJournal acquires it
+    //  again recursively.
+    //
+
+    FmmAcquireResourceExclusive( &journal->WriteResource );
+
+    status = FmmWriteJournal( InstanceContext, TRUE );
+
+    if (!NT_SUCCESS( status )) {
+
+        DebugTrace( DEBUG_TRACE_ERROR | DEBUG_TRACE_METADATA_OPERATIONS,
+                    ("[Fmm]: Failed to flush the metadata journal before holding it (Volume = %p, Status = 0x%x)\n",
+                     InstanceContext->Volume,
+                     status) );
+    }
+
+    InterlockedIncrement( &journal->WritesHeld );
+
+    FmmReleaseResource( &journal->WriteResource );
+}
+
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+FmmResumeJournalWrites (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Routine Description:
+
+    This routine ends a hold taken by FmmHoldJournalWrites.  Once no hold
+    is left, it queues a write of the updates recorded while the journal
+    was held.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+
+Return Value:
+
+    Void.
+
+--*/
+{
+    if ((InterlockedDecrement( &InstanceContext->Journal.WritesHeld ) == 0) &&
+        (InstanceContext->Journal.PendingCount != 0)) {
+
+        FmmQueueJournalWrite( InstanceContext );
+    }
+}
+
+
 #if VERIFY_METADATA_OPENED
 
 NTSTATUS
@@ -174,10 +174,15 @@ FLT_OPERATION_REGISTRATION Callbacks[] = {
       FmmPostCreate },
 
     { IRP_MJ_CLEANUP,
-      FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO | FLTFL_OPERATION_REGISTRATION_SKIP_NON_DASD_IO,
+      FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO,
       FmmPreCleanup,
       FmmPostCleanup },
 
+    { IRP_MJ_FLUSH_BUFFERS,
+      FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO,
+      FmmPreFlushBuffers,
+      NULL },
+
     { IRP_MJ_FILE_SYSTEM_CONTROL,
       FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO | FLTFL_OPERATION_REGISTRATION_SKIP_NON_DASD_IO,
       FmmPreFSControl,
@@ -598,6 +603,7 @@ FmmContextCleanup (
                     ("[Fmm]: Cleaning up instance context for volume (Context = %p)\n",
                     instanceContext) );
 
+        FmmDeleteJournal( &instanceContext->Journal );
         ExDeleteResourceLite( &instanceContext->MetadataResource );
 
         break;
@@ -745,6 +751,7 @@ Return Value:
     instanceContext->FilesystemType = VolumeFilesystemType;
     instanceContext->Volume = FltObjects->Volume;
     ExInitializeResourceLite( &instanceContext->MetadataResource );
+    FmmInitializeJournal( &instanceContext->Journal );
 
 
     //
@@ -935,7 +942,9 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER( FltObjects );
+    PFMM_INSTANCE_CONTEXT instanceContext;
+    NTSTATUS status;
+
     UNREFERENCED_PARAMETER( Flags );
 
     PAGED_CODE();
@@ -944,6 +953,21 @@ Return Value:
                 ("[Fmm]: Instance teardown start started (Instance = %p)\n",
                  FltObjects->Instance) );
 
+    status = FltGetInstanceContext( FltObjects->Instance,
+                                    &instanceContext );
+
+    if (NT_SUCCESS( status )) {
+
+        //
+        //  Write out the metadata updates still pending while the metadata
+        //  file can still be written, and hold the journal for good so that
+        //  no write work item uses the file once it is closed
+        //
+
+        FmmHoldJournalWrites( instanceContext );
+
+        FltReleaseContext( instanceContext );
+    }
 
     DebugTrace( DEBUG_TRACE_INSTANCES,
                 ("[Fmm]: Instance teardown start ended (Instance = %p)\n",
@@ -86,6 +86,13 @@ FmmPostDeviceControl (
     _In_ FLT_POST_OPERATION_FLAGS Flags
     );
 
+FLT_PREOP_CALLBACK_STATUS
+FmmPreFlushBuffers (
+    _Inout_ PFLT_CALLBACK_DATA Cbd,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
+    );
+
 FLT_PREOP_CALLBACK_STATUS
 FmmPreShutdown (
     _Inout_ PFLT_CALLBACK_DATA Cbd,
@@ -163,6 +170,94 @@ FmmEndFileSystemOperation (
     );
 
 
+VOID
+FmmInitializeJournal (
+    _Out_ PFMM_JOURNAL Journal
+    );
+
+VOID
+FmmDeleteJournal (
+    _Inout_ PFMM_JOURNAL Journal
+    );
+
+_Requires_lock_held_(Journal->Resource)
+PFMM_JOURNAL_ENTRY
+FmmJournalFindEntry (
+    _In_ PFMM_JOURNAL Journal,
+    _In_ PLARGE_INTEGER FileId,
+    _Out_ PLIST_ENTRY *Bucket
+    );
+
+ULONG
+FmmJournalChecksum (
+    _In_ PFMM_METADATA_RECORD Record
+    );
+
+BOOLEAN
+FmmJournalRecordIsValid (
+    _In_ PFMM_METADATA_RECORD Record
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmLoadJournalTail (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ PFILE_OBJECT FileObject
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmCompactJournal (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ PFILE_OBJECT FileObject
+    );
+
+NTSTATUS
+FmmJournalUpdate (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ PLARGE_INTEGER FileId,
+    _In_ PLARGE_INTEGER ModifiedTime
+    );
+
+_IRQL_requires_max_(APC_LEVEL)
+NTSTATUS
+FmmRecordFileUpdate (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmWriteJournal (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ BOOLEAN Durable
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+FmmQueueJournalWrite (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    );
+
+VOID
+FmmJournalWorker (
+    _In_ PFLT_GENERIC_WORKITEM FltWorkItem,
+    _In_ PVOID FltObject,
+    _In_opt_ PVOID Context
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+FmmHoldJournalWrites (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+FmmResumeJournalWrites (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    );
+
 #if VERIFY_METADATA_OPENED
     
 NTSTATUS
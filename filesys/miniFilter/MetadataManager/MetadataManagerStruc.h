@@ -33,6 +33,7 @@ Environment:
 
 #define FMM_STRING_TAG                        'tSmF'
 #define FMM_INSTANCE_CONTEXT_TAG              'cImF'
+#define FMM_JOURNAL_TAG                       'lJmF'
 
 
 //
@@ -86,6 +87,181 @@ extern FMM_GLOBAL_DATA Globals;
 #define INSTANCE_CONTEXT_F_METADATA_OPENED      0x00000002
 
 
+//
+//  Metadata journal
+//
+//  Updates to the metadata are not written to the metadata file as they
+//  are made.  They are kept in memory, one pending update per file, so a
+//  file updated many times before the journal is written costs a single
+//  record.  A work item appends the pending records to the end of the
+//  metadata file in large sequential writes, and a barrier writes them
+//  and flushes the file whenever the metadata must be on disk: before the
+//  metadata file is closed, before a snapshot is taken, when the volume
+//  or a file is flushed, when a write-through file is cleaned up and when
+//  the instance is torn down.
+//
+//  Before the first write after the metadata file is opened, its last
+//  valid record is read back so sequence numbers carry on from it, and a torn tail is truncated so
+//  the records appended after it can be read.  The file only grows by
+//  appending; it is compacted to the last record of each file whenever it
+//  reaches FMM_JOURNAL_COMPACT_SIZE or twice its size after the previous
+//  compaction, whichever is larger.
+//
+
+//
+//  A record in the metadata file.  Records are appended in sequence order;
+//  when the file is read back, the record with the highest sequence number
+//  for a file wins.  A record whose signature or checksum does not match
+//  was torn by a crash and ends the valid part of the file.
+//
+
+#define FMM_METADATA_RECORD_SIGNATURE           'rMmF'
+
+typedef struct _FMM_METADATA_RECORD {
+
+    ULONG Signature;
+
+    //
+    //  Checksum of the record, computed with this field set to zero.
+    //
+
+    ULONG Checksum;
+
+    LONGLONG Sequence;
+
+    //
+    //  File id of the file, and the time it was last seen modified.
+    //
+
+    LARGE_INTEGER FileId;
+    LARGE_INTEGER ModifiedTime;
+
+} FMM_METADATA_RECORD, *PFMM_METADATA_RECORD;
+
+//
+//  An update waiting to be written.
+//
+
+typedef struct _FMM_JOURNAL_ENTRY {
+
+    //
+    //  Links the entry in the pending list, in the order the files were
+    //  first updated, and in its hash bucket.
+    //
+
+    LIST_ENTRY ListEntry;
+    LIST_ENTRY BucketEntry;
+
+    LARGE_INTEGER FileId;
+    LARGE_INTEGER ModifiedTime;
+
+} FMM_JOURNAL_ENTRY, *PFMM_JOURNAL_ENTRY;
+
+//
+//  Number of hash buckets used to coalesce updates, a power of 2.
+//
+
+#define FMM_JOURNAL_BUCKET_COUNT                64
+
+//
+//  Largest write issued to the metadata file.
+//
+
+#define FMM_JOURNAL_MAX_WRITE                   (64 * 1024)
+
+//
+//  Smallest size at which the metadata file is compacted.  Compacting
+//  reads the whole file into memory.
+//
+
+#define FMM_JOURNAL_COMPACT_SIZE                (1024 * 1024)
+
+typedef struct _FMM_JOURNAL {
+
+    //
+    //  Protects the pending list and the buckets.
+    //
+
+    ERESOURCE Resource;
+
+    //
+    //  Held exclusive while records are written, so writes are issued in
+    //  sequence order and a barrier waits for the write in progress.
+    //  WritesHeld is only raised while it is held.
+    //
+
+    ERESOURCE WriteResource;
+
+    LIST_ENTRY PendingList;
+    ULONG PendingCount;
+    LIST_ENTRY Buckets[FMM_JOURNAL_BUCKET_COUNT];
+
+    //
+    //  Sequence number of the next record written.
+    //
+
+    LONGLONG NextSequence;
+
+    //
+    //  Offset in the metadata file where the next record is written, and
+    //  the offset at which the file is compacted.
+    //
+
+    LONGLONG FileSize;
+    LONGLONG CompactSize;
+
+    //
+    //  The MetadataOpenCount of the instance when the tail of the metadata
+    //  file was last read.  NextSequence and FileSize are only valid for
+    //  that open of the file.
+    //
+
+    ULONG LoadedOpenCount;
+
+    //
+    //  Set while a write work item is queued.
+    //
+
+    volatile LONG WriteQueued;
+
+    //
+    //  The number of holds on the journal, while nothing may be written.
+    //  A hold is taken between the pre and post operations of
+    //  IOCTL_VOLSNAP_FLUSH_AND_HOLD_WRITES, while the metadata file is
+    //  closed for a volume lock or dismount, and from instance teardown on.
+    //
+
+    volatile LONG WritesHeld;
+
+    //
+    //  Set while the metadata file is closed by
+    //  FmmReleaseMetadataFileReferences, which leaves a hold on the journal
+    //  until the file is opened again.  Protected by the metadata resource.
+    //
+
+    BOOLEAN HeldForClose;
+
+    //
+    //  Set when records have been written since the metadata file was last
+    //  flushed.  Protected by WriteResource.
+    //
+
+    BOOLEAN FlushNeeded;
+
+    //
+    //  Counters, updated with interlocked operations.
+    //
+
+    volatile LONG64 Updates;
+    volatile LONG64 Coalesced;
+    volatile LONG64 Writes;
+    volatile LONG64 RecordsWritten;
+    volatile LONG64 Barriers;
+    volatile LONG64 Compactions;
+
+} FMM_JOURNAL, *PFMM_JOURNAL;
+
+
 typedef struct _FMM_INSTANCE_CONTEXT {
 
     //
@@ -132,6 +308,12 @@ typedef struct _FMM_INSTANCE_CONTEXT {
 
     PFILE_OBJECT MetadataFileObject;
 
+    //
+    //  Number of times the metadata file has been opened.
+    //
+
+    ULONG MetadataOpenCount;
+
     //
     //  The file object on cleanup or cancel removal of which we need to re-open
     //  our metadata file. This is basically the file object on which we received
@@ -141,6 +323,12 @@ typedef struct _FMM_INSTANCE_CONTEXT {
 
     PFILE_OBJECT MetadataOpenTriggerFileObject;
 
+    //
+    //  Updates to the metadata which have not been written yet.
+    //
+
+    FMM_JOURNAL Journal;
+
 } FMM_INSTANCE_CONTEXT, *PFMM_INSTANCE_CONTEXT;
 
 #define FMM_INSTANCE_CONTEXT_SIZE         sizeof( FMM_INSTANCE_CONTEXT )
@@ -44,6 +44,7 @@ Environment:
 #pragma alloc_text(PAGE, FmmPostFSControl)
 #pragma alloc_text(PAGE, FmmPreDeviceControl)
 #pragma alloc_text(NONPAGED, FmmPostDeviceControl)
+#pragma alloc_text(PAGE, FmmPreFlushBuffers)
 #pragma alloc_text(PAGE, FmmPreShutdown)
 #pragma alloc_text(PAGE, FmmPrePnp)
 #pragma alloc_text(PAGE, FmmPostPnp)
@@ -373,10 +374,11 @@ FmmPreCleanup (
     _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
     )
 {
+    FLT_PREOP_CALLBACK_STATUS callbackStatus = FLT_PREOP_SYNCHRONIZE;
+    PFMM_INSTANCE_CONTEXT instanceContext = NULL;
+    NTSTATUS status;
 
-    UNREFERENCED_PARAMETER( Cbd );
     UNREFERENCED_PARAMETER( CompletionContext );
-    UNREFERENCED_PARAMETER( FltObjects );
 
     PAGED_CODE();
 
@@ -385,13 +387,80 @@ FmmPreCleanup (
                  Cbd,
                  FltObjects->FileObject) );
 
+    //
+    //  Only the cleanup of a volume open needs a post-op, to see if the
+    //  metadata file must be re-opened
+    //
+
+    if (FmmTargetIsVolumeOpen( Cbd )) {
+
+        goto FmmPreCleanupCleanup;
+    }
+
+    callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+
+    //
+    //  The metadata this sample keeps is the last time each file was seen
+    //  modified.  Record it in the journal, which writes it to the metadata
+    //  file in the background
+    //
+
+    if (!FlagOn( FltObjects->FileObject->Flags, FO_FILE_MODIFIED )) {
+
+        goto FmmPreCleanupCleanup;
+    }
+
+    status = FltGetInstanceContext( FltObjects->Instance,
+                                    &instanceContext );
+
+    if (!NT_SUCCESS( status )) {
+
+        goto FmmPreCleanupCleanup;
+    }
+
+    status = FmmRecordFileUpdate( instanceContext, FltObjects );
+
+    if (!NT_SUCCESS( status )) {
+
+        DebugTrace( DEBUG_TRACE_ERROR | DEBUG_TRACE_METADATA_OPERATIONS,
+                    ("[Fmm]: FmmPreCleanup -> Failed to record metadata update (FileObject = %p, Status = 0x%x)\n",
+                     FltObjects->FileObject,
+                     status) );
+
+        goto FmmPreCleanupCleanup;
+    }
+
+    //
+    //  A write-through file expects its data on disk when it is closed, so
+    //  its update is written to the metadata file right away as well
+    //
+
+    if (FlagOn( FltObjects->FileObject->Flags, FO_WRITE_THROUGH )) {
+
+        status = FmmWriteJournal( instanceContext, TRUE );
+
+        if (!NT_SUCCESS( status )) {
+
+            DebugTrace( DEBUG_TRACE_ERROR | DEBUG_TRACE_METADATA_OPERATIONS,
+                        ("[Fmm]: FmmPreCleanup -> Failed to write the metadata journal (FileObject = %p, Status = 0x%x)\n",
+                         FltObjects->FileObject,
+                         status) );
+        }
+    }
+
+FmmPreCleanupCleanup:
+
+    if (instanceContext != NULL) {
+
+        FltReleaseContext( instanceContext );
+    }
 
     DebugTrace( DEBUG_TRACE_ALL_IO,
                 ("[Fmm]: FmmPreCleanup -> Exit (Cbd = %p, FileObject = %p)\n",
                  Cbd,
                  FltObjects->FileObject) );
 
-    return FLT_PREOP_SYNCHRONIZE;
+    return callbackStatus;
 }
 
 
@@ -956,11 +1025,12 @@ FmmPreDeviceControl (
         //  to its metadata file on disk until the post-op callback for 
         //  IOCTL_VOLSNAP_FLUSH_AND_HOLD_WRITES 
         //
-        //  The filter would do this by marking its instance context in some way
-        //  (say, by setting a flag) to indicate to other threads that they should 
-        //  not try to update the metadata file on the disk
+        //  The journal writes and flushes its pending updates, then holds
+        //  any later ones in memory until the post-op resumes its writes
         // 
 
+        FmmHoldJournalWrites( instanceContext );
+
         //
         //  Do not release the instance context but instead pass it to the PostOp
         //  The PostOp routine would need to unmark the instance context in some way
@@ -1072,11 +1142,12 @@ FmmPostDeviceControl (
         //  At this point, it is ok for the filter to send updates to its metadata
         //  file on disk
         //
-        //  The filter would do this by unmarking its instance context (say by,
-        //  resetting the flag that it set in the PreOp) to indicate to other threads 
-        //  that it is now ok to update the metadata file on the disk
+        //  Let the journal write the updates it held while the snapshot was
+        //  being taken
         // 
 
+        FmmResumeJournalWrites( instanceContext );
+
 
         //
         //  Release the instance context
@@ -1100,6 +1171,71 @@ FmmPostDeviceControl (
 
 
 
+FLT_PREOP_CALLBACK_STATUS
+FmmPreFlushBuffers (
+    _Inout_ PFLT_CALLBACK_DATA Cbd,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
+    )
+{
+    PFMM_INSTANCE_CONTEXT instanceContext;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER( CompletionContext );
+
+    PAGED_CODE();
+
+    DebugTrace( DEBUG_TRACE_ALL_IO,
+                ("[Fmm]: FmmPreFlushBuffers -> Enter (Cbd = %p, FileObject = %p)\n",
+                 Cbd,
+                 FltObjects->FileObject) );
+
+    //
+    //  A flush asks for everything written to the volume or the file so far
+    //  to be on disk, so it is a barrier for the metadata journal as well.
+    //  A modified file records its update first so that it is written too
+    //
+
+    status = FltGetInstanceContext( FltObjects->Instance,
+                                    &instanceContext );
+
+    if (NT_SUCCESS( status )) {
+
+        if (!FmmTargetIsVolumeOpen( Cbd ) &&
+            FlagOn( FltObjects->FileObject->Flags, FO_FILE_MODIFIED )) {
+
+            status = FmmRecordFileUpdate( instanceContext, FltObjects );
+
+            if (!NT_SUCCESS( status )) {
+
+                DebugTrace( DEBUG_TRACE_ERROR | DEBUG_TRACE_METADATA_OPERATIONS,
+                            ("[Fmm]: FmmPreFlushBuffers -> Failed to record metadata update (FileObject = %p, Status = 0x%x)\n",
+                             FltObjects->FileObject,
+                             status) );
+            }
+        }
+
+        status = FmmWriteJournal( instanceContext, TRUE );
+
+        if (!NT_SUCCESS( status )) {
+
+            DebugTrace( DEBUG_TRACE_ERROR | DEBUG_TRACE_METADATA_OPERATIONS,
+                        ("[Fmm]: FmmPreFlushBuffers -> Failed to write the metadata journal (Status = 0x%x)\n",
+                         status) );
+        }
+
+        FltReleaseContext( instanceContext );
+    }
+
+    DebugTrace( DEBUG_TRACE_ALL_IO,
+                ("[Fmm]: FmmPreFlushBuffers -> Exit (Cbd = %p, FileObject = %p)\n",
+                 Cbd,
+                 FltObjects->FileObject) );
+
+    return FLT_PREOP_SUCCESS_NO_CALLBACK;
+}
+
+
 FLT_PREOP_CALLBACK_STATUS
 FmmPreShutdown (
     _Inout_ PFLT_CALLBACK_DATA Cbd,
@@ -86,6 +86,14 @@ NcPreCreateCallback (
     _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
     );
 
+FLT_POSTOP_CALLBACK_STATUS
+NcPostCreateCallback (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    );
+
 FLT_PREOP_CALLBACK_STATUS
 NcPreCleanupCallback (
     _Unreferenced_parameter_ PFLT_CALLBACK_DATA Data,
@@ -140,6 +148,14 @@ NcPreSetInformationCallback (
     _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
     );
 
+FLT_POSTOP_CALLBACK_STATUS
+NcPostSetInformationCallback (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    );
+
 FLT_PREOP_CALLBACK_STATUS
 NcPreDirectoryControlCallback (
     _Inout_ PFLT_CALLBACK_DATA Data,
@@ -235,7 +251,7 @@ CONST FLT_OPERATION_REGISTRATION Callbacks[] = {
     { IRP_MJ_CREATE,
       0,
       NcPreCreateCallback,
-      NULL },
+      NcPostCreateCallback },
 
     { IRP_MJ_CLEANUP,
       0,
@@ -250,7 +266,7 @@ CONST FLT_OPERATION_REGISTRATION Callbacks[] = {
     { IRP_MJ_SET_INFORMATION,
       0,
       NcPreSetInformationCallback,
-      NULL },
+      NcPostSetInformationCallback },
 
     { IRP_MJ_DIRECTORY_CONTROL,
       0,
@@ -748,6 +764,8 @@ Logic:
     //  We have allocated an instance context. Now initialize it.
     //
 
+    NcDirCacheInitialize( &InstanceContext->DirectoryCache );
+
     //
     //  Now that we have a context,
     //  we need to generate the mapping
@@ -1130,6 +1148,46 @@ Logic:
                         CompletionContext );
 }
 
+FLT_POSTOP_CALLBACK_STATUS
+NcPostCreateCallback (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    This is the post create callback.  It is only called for creates which
+    may add an entry to a parent of either mapping, so that the directory
+    cache can be invalidated once the entry exists.
+
+Arguments:
+
+    Data - Pointer to the filter CallbackData that is passed to us.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - The referenced instance context.
+
+    Flags - The flags for this operation.
+
+Return Value:
+
+    Always FLT_POSTOP_FINISHED_PROCESSING.
+
+--*/
+{
+    UNREFERENCED_PARAMETER( FltObjects );
+
+    NcDirCacheCompleteInvalidate( Data, CompletionContext, Flags );
+
+    return FLT_POSTOP_FINISHED_PROCESSING;
+}
+
 FLT_PREOP_CALLBACK_STATUS
 NcPreCleanupCallback (
     _Unreferenced_parameter_ PFLT_CALLBACK_DATA Data,
@@ -1193,7 +1251,8 @@ Routine Description:
 
     This is the post cleanup callback.  It is called for every handle cleanup
     operation.  The role of this callback is to tear down any pending
-    directory change notification state attached to this handle.
+    directory change notification state attached to this handle, and to
+    invalidate the directory cache when a file is deleted.
 
 Arguments:
 
@@ -1218,6 +1277,7 @@ Return Value:
 {
     NTSTATUS Status;
     PNC_STREAM_HANDLE_CONTEXT HandleContext = NULL;
+    PNC_INSTANCE_CONTEXT InstanceContext = NULL;
 
     UNREFERENCED_PARAMETER( Data );
     UNREFERENCED_PARAMETER( CompletionContext );
@@ -1226,6 +1286,29 @@ Return Value:
 
     if (!FlagOn( Flags, FLTFL_POST_OPERATION_DRAINING )) {
 
+        //
+        //  A file marked for delete through this handle, or opened delete
+        //  on close, is removed from its directory by this cleanup.  The
+        //  pre set disposition and pre create callbacks invalidated the
+        //  directory cache before that, so an enumeration may have
+        //  recorded the entry since.  Finding out whether the file was in
+        //  a mapping parent would mean querying its name on every cleanup,
+        //  so invalidate for any delete.
+        //
+
+        if (FltObjects->FileObject->DeletePending ||
+            FlagOn( FltObjects->FileObject->Flags, FO_DELETE_ON_CLOSE )) {
+
+            Status = FltGetInstanceContext( FltObjects->Instance,
+                                            &InstanceContext );
+
+            if (NT_SUCCESS( Status )) {
+
+                NcDirCacheInvalidate( InstanceContext );
+                FltReleaseContext( InstanceContext );
+            }
+        }
+
         //
         //  Obtain our handle context.  We should only be called here
         //  if we really have one.
@@ -1672,6 +1755,47 @@ Return Value:
     return result;
 }
 
+FLT_POSTOP_CALLBACK_STATUS
+NcPostSetInformationCallback (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    This is the post set file information callback.  It is only called for
+    links and renames which change the entries of a parent of either
+    mapping, so that the directory cache can be invalidated once the change
+    is made.
+
+Arguments:
+
+    Data - Pointer to the filter CallbackData that is passed to us.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - The referenced instance context.
+
+    Flags - The flags for this operation.
+
+Return Value:
+
+    Always FLT_POSTOP_FINISHED_PROCESSING.
+
+--*/
+{
+    UNREFERENCED_PARAMETER( FltObjects );
+
+    NcDirCacheCompleteInvalidate( Data, CompletionContext, Flags );
+
+    return FLT_POSTOP_FINISHED_PROCESSING;
+}
+
 FLT_PREOP_CALLBACK_STATUS
 NcPreDirectoryControlCallback (
     _Inout_ PFLT_CALLBACK_DATA Data,
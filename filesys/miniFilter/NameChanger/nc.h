@@ -19,6 +19,7 @@
 #define NC_FILE_NAME_TAG              'NCfn' // Tag for strings which are allocated for file names in file objects
 #define NC_DIR_QRY_CACHE_TAG          'NCqc' // Tag for buffers which are allocated for directory enumeration cache and injection entries
 #define NC_DIR_QRY_SEARCH_STRING      'NCqs' // Tag for strings which are allocated for directory search strings
+#define NC_DIR_SNAPSHOT_TAG           'NCds' // Tag for snapshots of merged directory enumerations
 #define NC_SET_LINK_BUFFER_TAG        'NCsl' // Tag for munge buffer in Set Link operations
 #define NC_RENAME_BUFFER_TAG          'NCrn' // Tag for munge buffer in Rename operations
 
@@ -223,6 +224,93 @@ typedef union {
 } NC_PATH_OVERLAP, *PNC_PATH_OVERLAP;
 #pragma warning( pop )
 
+//
+//  A snapshot of a directory enumeration as it was returned to the user:
+//  with the real mapping removed, the user mapping injected, and the
+//  entries packed one after another, each with its NextEntryOffset set.
+//  A snapshot is filled in while a handle enumerates the directory, and
+//  once it is complete it is never changed again, so it can be shared by
+//  the handle and the directory cache.
+//
+
+typedef struct _NC_DIR_SNAPSHOT {
+
+    volatile LONG ReferenceCount;
+
+    // Which mapping parents the directory is, see NC_DIR_*_PARENT.
+    UCHAR Directory;
+    BOOLEAN IgnoreCase;
+    BOOLEAN Complete;
+    FILE_INFORMATION_CLASS InformationClass;
+
+    // The directory cache generation when the enumeration started, and
+    // the interrupt time, so we know when the snapshot becomes stale.
+    LONG Generation;
+    ULONGLONG CreationTime;
+
+    // The entries.
+    PUCHAR Entries;
+    ULONG Length;
+    ULONG AllocatedLength;
+
+} NC_DIR_SNAPSHOT, *PNC_DIR_SNAPSHOT;
+
+#define NC_DIR_USER_PARENT       0x1
+#define NC_DIR_REAL_PARENT       0x2
+
+//
+//  Number of snapshots the directory cache holds.  We only merge the
+//  parents of the mappings, so these are shared between at most two
+//  directories and case sensitivities.
+//
+
+#define NC_DIR_CACHE_SLOTS       4
+
+//
+//  Defaults for the DirectoryCacheSize (bytes) and DirectoryCacheLifetime
+//  (milliseconds) registry values.
+//
+
+#define NC_DIR_CACHE_DEFAULT_SIZE       (1024 * 1024)
+#define NC_DIR_CACHE_DEFAULT_LIFETIME   10000
+
+//
+//  The directory cache keeps the latest complete FileNamesInformation
+//  snapshot of each of the mapping parents, so that enumerations on new
+//  handles can be served from memory.  Snapshots taken before the
+//  generation changes are stale; it changes whenever a change
+//  notification completes on an ancestor of either mapping, or we see an
+//  entry of either parent created, renamed, linked or deleted, both
+//  before and after the change is made.
+//
+
+typedef struct _NC_DIR_CACHE {
+
+    // Protects Slots and NextSlot.
+    EX_PUSH_LOCK Lock;
+
+    volatile LONG Generation;
+
+    PNC_DIR_SNAPSHOT Slots[NC_DIR_CACHE_SLOTS];
+    ULONG NextSlot;
+
+    //
+    //  Counters, updated with interlocked operations.
+    //
+    //  Hits - Enumerations replayed from a snapshot.
+    //  Misses - Enumerations sent to the filesystem.
+    //  Invalidations - Changes to the generation.
+    //  Overflows - Snapshots abandoned because the directory was larger
+    //      than NcGlobalData.DirCacheMaxSnapshotSize.
+    //
+
+    volatile LONG64 Hits;
+    volatile LONG64 Misses;
+    volatile LONG64 Invalidations;
+    volatile LONG64 Overflows;
+
+} NC_DIR_CACHE, *PNC_DIR_CACHE;
+
 //
 //  Instance Context Defines
 //
@@ -235,6 +323,9 @@ typedef struct _NC_INSTANCE_CONTEXT {
     // The file system we're attached to
     FLT_FILESYSTEM_TYPE VolumeFilesystemType;
 
+    // Snapshots of enumerations of the mapping parents.
+    NC_DIR_CACHE DirectoryCache;
+
 } NC_INSTANCE_CONTEXT, *PNC_INSTANCE_CONTEXT;
 
 
@@ -264,6 +355,13 @@ typedef struct _NC_DIR_QRY_CONTEXT {
     // The information class which the user requested.
     FILE_INFORMATION_CLASS InformationClass;
 
+    // The snapshot being filled in by this enumeration, or if Replaying
+    // is set, the snapshot the enumeration is served from, and the offset
+    // of the next entry to return from it.
+    PNC_DIR_SNAPSHOT Snapshot;
+    BOOLEAN Replaying;
+    ULONG ReplayOffset;
+
 } NC_DIR_QRY_CONTEXT, *PNC_DIR_QRY_CONTEXT;
 
 //
@@ -472,6 +570,15 @@ typedef struct _NC_GLOBAL_DATA {
     UNICODE_STRING RealMappingPath;
     UNICODE_STRING RealMappingFinalComponent;
 
+    //
+    //  Largest snapshot of a directory enumeration we keep, in bytes, and
+    //  how long a snapshot may be replayed for, in 100ns units.  A size of
+    //  zero disables the directory cache.
+    //
+
+    ULONG          DirCacheMaxSnapshotSize;
+    ULONGLONG      DirCacheLifetime;
+
     PFLT_FILTER    FilterHandle;
 } NC_GLOBAL_DATA, *PNC_GLOBAL_DATA;
 
@@ -859,6 +966,7 @@ NcStreamHandleContextEnumSetup (
     _In_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ NC_PATH_OVERLAP UserMappingOverlap,
+    _In_ NC_PATH_OVERLAP RealMappingOverlap,
     _Out_ PBOOLEAN  FirstUsage
     );
 
@@ -867,6 +975,121 @@ NcStreamHandleContextEnumClose (
     _In_ PNC_DIR_QRY_CONTEXT DirContext
     );
 
+//
+//  The following functions exist in ncdircache.c
+//
+
+VOID
+NcDirCacheInitialize (
+    _Out_ PNC_DIR_CACHE Cache
+    );
+
+VOID
+NcDirCacheTeardown (
+    _Inout_ PNC_DIR_CACHE Cache
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+NcDirCacheInvalidate (
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext
+    );
+
+FLT_PREOP_CALLBACK_STATUS
+NcDirCacheInvalidateOnCompletion (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ FLT_PREOP_CALLBACK_STATUS ReturnValue,
+    _Inout_ PNC_INSTANCE_CONTEXT *InstanceContext,
+    _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+NcDirCacheCompleteInvalidate (
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    );
+
+PNC_DIR_SNAPSHOT
+NcDirCacheLookup (
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ UCHAR Directory,
+    _In_ FILE_INFORMATION_CLASS InformationClass,
+    _In_ BOOLEAN IgnoreCase
+    );
+
+VOID
+NcDirCachePublish (
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ PNC_DIR_SNAPSHOT Snapshot
+    );
+
+BOOLEAN
+NcDirCacheCheckAccess (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
+    _In_ FILE_INFORMATION_CLASS InformationClass,
+    _In_opt_ PUNICODE_STRING SearchString
+    );
+
+BOOLEAN
+NcDirSnapshotIsCurrent (
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ PNC_DIR_SNAPSHOT Snapshot
+    );
+
+BOOLEAN
+NcDirSearchMatchesAll (
+    _In_opt_ PUNICODE_STRING SearchString
+    );
+
+VOID
+NcDirSnapshotRelease (
+    _In_ PNC_DIR_SNAPSHOT Snapshot
+    );
+
+BOOLEAN
+NcDirEnumBeginSnapshot (
+    _Inout_ PNC_DIR_QRY_CONTEXT DirContext,
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
+    _In_ UCHAR Directory,
+    _In_opt_ PUNICODE_STRING SearchString,
+    _In_ BOOLEAN FirstUsage
+    );
+
+VOID
+NcDirEnumRecordEntry (
+    _Inout_ PNC_DIR_QRY_CONTEXT DirContext,
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ PVOID Entry,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets
+    );
+
+VOID
+NcDirEnumAbandonSnapshot (
+    _Inout_ PNC_DIR_QRY_CONTEXT DirContext
+    );
+
+VOID
+NcDirEnumCompleteSnapshot (
+    _Inout_ PNC_DIR_QRY_CONTEXT DirContext,
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext
+    );
+
+ULONG
+NcDirEnumReplaySnapshot (
+    _Inout_ PNC_DIR_QRY_CONTEXT DirContext,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
+    _Out_writes_bytes_(UserSize) PVOID UserBuffer,
+    _In_ ULONG UserSize,
+    _In_ BOOLEAN ReturnSingleEntry,
+    _Out_ PULONG UserOffset,
+    _Out_ PULONG LastEntryStart
+    );
+
 //
 //  The following functions exist in ncdirnotify.c
 //
@@ -84,11 +84,10 @@ Logic:
     UNICODE_STRING MungedName = EMPTY_UNICODE_STRING;
     BOOLEAN IgnoreCase = !BooleanFlagOn( Data->Iopb->OperationFlags, SL_CASE_SENSITIVE );
     UCHAR CreateDisposition = (UCHAR)(Data->Iopb->Parameters.Create.Options >> 24);
+    BOOLEAN DirCacheInvalidated = FALSE;
 
     PAGED_CODE();
 
-    UNREFERENCED_PARAMETER( CompletionContext );
-
     FLT_ASSERT( IoGetTopLevelIrp() == NULL );
 
     //
@@ -256,6 +255,19 @@ Logic:
         }
     }
 
+    //
+    //  A create of anything directly inside a mapping parent, or of the
+    //  user mapping itself, can add an entry to a merged enumeration.
+    //
+
+    if ((RealOverlap.Peer || UserOverlap.Peer || UserOverlap.Match) &&
+        (CreateDisposition != FILE_OPEN ||
+         FlagOn( Data->Iopb->Parameters.Create.Options, FILE_DELETE_ON_CLOSE ))) {
+
+        NcDirCacheInvalidate( InstanceContext );
+        DirCacheInvalidated = TRUE;
+    }
+
     //
     //  Name changer munges opens which occur down the user mapping path.
     //  Here we check to see if this is a name we want to change.
@@ -422,6 +434,14 @@ NcPreCreateCleanup:
         Data->IoStatus.Status = Status;
     }
 
+    if (DirCacheInvalidated) {
+
+        ReturnValue = NcDirCacheInvalidateOnCompletion( Data,
+                                                        ReturnValue,
+                                                        &InstanceContext,
+                                                        CompletionContext );
+    }
+
     //
     //  Clean up variables 
     //
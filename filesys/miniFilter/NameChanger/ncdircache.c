@@ -0,0 +1,942 @@
+/*++
+
+Copyright (c) 1999 - 2002  Microsoft Corporation
+
+Module Name:
+
+    ncdircache.c
+
+Abstract:
+
+    Contains routines to cache merged directory enumerations of the
+    parents of the mappings.  Enumerating either parent means querying
+    the filesystem, removing the real mapping and injecting the user
+    mapping, which is repeated in full by every handle that enumerates
+    the directory, and again when a handle restarts its scan.
+
+    While a handle enumerates one of these directories with a pattern
+    that matches every name, the entries we return are recorded in a
+    snapshot.  Once the enumeration reaches its end the snapshot is
+    complete and kept by the handle, and restarted scans on the handle
+    are served from it while it is current.
+
+    Snapshots of FileNamesInformation enumerations are also kept in the
+    instance's directory cache and served to later enumerations on other
+    handles.  Those carry nothing but names, and we see every change to
+    the names in the mapping parents.  The other classes carry sizes,
+    times and attributes, which change with every write to a file in the
+    directory, so they are only replayed on the handle which recorded
+    them.
+
+    A snapshot stops being current when any change is seen which might
+    affect the directory, or after NcGlobalData.DirCacheLifetime, which
+    bounds how stale it can be when the directory is changed by something
+    we do not see, such as another instance or a remote client.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "nc.h"
+
+//
+//  Size of the first allocation for the entries of a snapshot.
+//
+
+#define NC_DIR_SNAPSHOT_INITIAL_SIZE   4096
+
+//
+//  Size of the buffer used to check the caller may list the directory
+//  before serving it from the cache, leaving room for the longest name.
+//
+
+#define NC_DIR_CACHE_PROBE_NAME_SIZE   (256 * sizeof(WCHAR))
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, NcDirCacheInitialize)
+#pragma alloc_text(PAGE, NcDirCacheTeardown)
+#pragma alloc_text(PAGE, NcDirCacheInvalidateOnCompletion)
+#pragma alloc_text(PAGE, NcDirCacheLookup)
+#pragma alloc_text(PAGE, NcDirCachePublish)
+#pragma alloc_text(PAGE, NcDirCacheCheckAccess)
+#pragma alloc_text(PAGE, NcDirSnapshotIsCurrent)
+#pragma alloc_text(PAGE, NcDirSnapshotRelease)
+#pragma alloc_text(PAGE, NcDirSearchMatchesAll)
+#pragma alloc_text(PAGE, NcDirEnumBeginSnapshot)
+#pragma alloc_text(PAGE, NcDirEnumRecordEntry)
+#pragma alloc_text(PAGE, NcDirEnumAbandonSnapshot)
+#pragma alloc_text(PAGE, NcDirEnumCompleteSnapshot)
+#pragma alloc_text(PAGE, NcDirEnumReplaySnapshot)
+#endif
+
+VOID
+NcDirCacheInitialize (
+    _Out_ PNC_DIR_CACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    Initializes an instance's directory cache.
+
+Arguments:
+
+    Cache - Pointer to the directory cache.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    RtlZeroMemory( Cache, sizeof( NC_DIR_CACHE ));
+    FltInitializePushLock( &Cache->Lock );
+}
+
+VOID
+NcDirCacheTeardown (
+    _Inout_ PNC_DIR_CACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    Releases the snapshots held by an instance's directory cache.  Called
+    when the instance context is torn down, so nobody else can be using
+    the cache.
+
+Arguments:
+
+    Cache - Pointer to the directory cache.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG Index;
+
+    PAGED_CODE();
+
+    for (Index = 0; Index < NC_DIR_CACHE_SLOTS; Index++) {
+
+        if (Cache->Slots[Index] != NULL) {
+
+            NcDirSnapshotRelease( Cache->Slots[Index] );
+            Cache->Slots[Index] = NULL;
+        }
+    }
+
+    FltDeletePushLock( &Cache->Lock );
+}
+
+VOID
+NcDirCacheInvalidate (
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Routine Description:
+
+    Called when the contents of either mapping parent may have changed.
+    Every snapshot taken before this call stops being current.  They are
+    left where they are and replaced as new enumerations complete.  May be
+    called at DPC level.
+
+Arguments:
+
+    InstanceContext - Pointer to this instance's context.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    InterlockedIncrement( &InstanceContext->DirectoryCache.Generation );
+    InterlockedIncrement64( &InstanceContext->DirectoryCache.Invalidations );
+}
+
+FLT_PREOP_CALLBACK_STATUS
+NcDirCacheInvalidateOnCompletion (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ FLT_PREOP_CALLBACK_STATUS ReturnValue,
+    _Inout_ PNC_INSTANCE_CONTEXT *InstanceContext,
+    _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
+    )
+/*++
+
+Routine Description:
+
+    Called at the end of a pre-operation callback which invalidated the
+    directory cache because the operation changes a mapping parent.  An
+    enumeration started after that invalidation but before the change is
+    made would record the directory without it, so the cache is
+    invalidated again once the operation succeeds: here if we completed it
+    ourselves, or else in its post-operation callback.
+
+Arguments:
+
+    Data - Pointer to the filter CallbackData that is passed to us.
+
+    ReturnValue - The value the pre-operation callback is about to return.
+
+    InstanceContext - Pointer to this instance's context.  If the
+        invalidation is left to the post-operation callback, the reference
+        is handed to it and this is set to NULL.
+
+    CompletionContext - The context for the completion routine for this
+        operation.
+
+Return Value:
+
+    The value for the pre-operation callback to return.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (ReturnValue == FLT_PREOP_SUCCESS_NO_CALLBACK) {
+
+        *CompletionContext = *InstanceContext;
+        *InstanceContext = NULL;
+
+        return FLT_PREOP_SUCCESS_WITH_CALLBACK;
+    }
+
+    if (ReturnValue == FLT_PREOP_COMPLETE &&
+        NT_SUCCESS( Data->IoStatus.Status )) {
+
+        NcDirCacheInvalidate( *InstanceContext );
+    }
+
+    return ReturnValue;
+}
+
+VOID
+NcDirCacheCompleteInvalidate (
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    Post-operation half of NcDirCacheInvalidateOnCompletion.  May be called
+    at DPC level.
+
+Arguments:
+
+    Data - Pointer to the filter CallbackData that is passed to us.
+
+    CompletionContext - The referenced instance context handed over by the
+        pre-operation callback.
+
+    Flags - The flags for this operation.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PNC_INSTANCE_CONTEXT InstanceContext = CompletionContext;
+
+    if (!FlagOn( Flags, FLTFL_POST_OPERATION_DRAINING ) &&
+        NT_SUCCESS( Data->IoStatus.Status )) {
+
+        NcDirCacheInvalidate( InstanceContext );
+    }
+
+    FltReleaseContext( InstanceContext );
+}
+
+PNC_DIR_SNAPSHOT
+NcDirCacheLookup (
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ UCHAR Directory,
+    _In_ FILE_INFORMATION_CLASS InformationClass,
+    _In_ BOOLEAN IgnoreCase
+    )
+/*++
+
+Routine Description:
+
+    Finds a current snapshot of a directory in the directory cache.
+
+Arguments:
+
+    InstanceContext - Pointer to this instance's context.
+
+    Directory - Which mapping parents the directory is.
+
+    InformationClass - The information class of the enumeration.
+
+    IgnoreCase - Whether the enumeration ignores case.
+
+Return Value:
+
+    A referenced snapshot, which the caller must release with
+    NcDirSnapshotRelease, or NULL if there is none.
+
+--*/
+{
+    PNC_DIR_CACHE Cache = &InstanceContext->DirectoryCache;
+    PNC_DIR_SNAPSHOT Snapshot;
+    PNC_DIR_SNAPSHOT Found = NULL;
+    ULONG Index;
+
+    PAGED_CODE();
+
+    FltAcquirePushLockShared( &Cache->Lock );
+
+    for (Index = 0; Index < NC_DIR_CACHE_SLOTS; Index++) {
+
+        Snapshot = Cache->Slots[Index];
+
+        if (Snapshot != NULL &&
+            Snapshot->Directory == Directory &&
+            Snapshot->InformationClass == InformationClass &&
+            Snapshot->IgnoreCase == IgnoreCase &&
+            NcDirSnapshotIsCurrent( InstanceContext, Snapshot )) {
+
+            InterlockedIncrement( &Snapshot->ReferenceCount );
+            Found = Snapshot;
+            break;
+        }
+    }
+
+    FltReleasePushLock( &Cache->Lock );
+
+    return Found;
+}
+
+VOID
+NcDirCachePublish (
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ PNC_DIR_SNAPSHOT Snapshot
+    )
+/*++
+
+Routine Description:
+
+    Adds a complete snapshot to the directory cache, replacing any snapshot
+    of the same directory, information class and case sensitivity, or
+    else the oldest slot.
+
+Arguments:
+
+    InstanceContext - Pointer to this instance's context.
+
+    Snapshot - The snapshot.  The cache takes its own reference.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PNC_DIR_CACHE Cache = &InstanceContext->DirectoryCache;
+    PNC_DIR_SNAPSHOT Replaced;
+    ULONG Index;
+
+    PAGED_CODE();
+
+    FLT_ASSERT( Snapshot->Complete );
+
+    InterlockedIncrement( &Snapshot->ReferenceCount );
+
+    FltAcquirePushLockExclusive( &Cache->Lock );
+
+    for (Index = 0; Index < NC_DIR_CACHE_SLOTS; Index++) {
+
+        if (Cache->Slots[Index] != NULL &&
+            Cache->Slots[Index]->Directory == Snapshot->Directory &&
+            Cache->Slots[Index]->InformationClass == Snapshot->InformationClass &&
+            Cache->Slots[Index]->IgnoreCase == Snapshot->IgnoreCase) {
+
+            break;
+        }
+    }
+
+    if (Index == NC_DIR_CACHE_SLOTS) {
+
+        Index = Cache->NextSlot;
+        Cache->NextSlot = (Cache->NextSlot + 1) % NC_DIR_CACHE_SLOTS;
+    }
+
+    Replaced = Cache->Slots[Index];
+    Cache->Slots[Index] = Snapshot;
+
+    FltReleasePushLock( &Cache->Lock );
+
+    if (Replaced != NULL) {
+
+        NcDirSnapshotRelease( Replaced );
+    }
+}
+
+BOOLEAN
+NcDirCacheCheckAccess (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
+    _In_ FILE_INFORMATION_CLASS InformationClass,
+    _In_opt_ PUNICODE_STRING SearchString
+    )
+/*++
+
+Routine Description:
+
+    Before a handle's enumeration is served from a snapshot taken on
+    another handle, we ask the filesystem for a single entry on this
+    handle, so that the filesystem still gets to check that the handle
+    may list the directory, and to fix the handle's search pattern.
+
+Arguments:
+
+    FltObjects - FltObjects structure for this operation.
+
+    Offsets - Offsets structure for this enumeration class.
+
+    InformationClass - The information class of the enumeration.
+
+    SearchString - The search string the caller supplied.
+
+Return Value:
+
+    TRUE if the enumeration may be served from the snapshot.
+
+--*/
+{
+    NTSTATUS Status;
+    PVOID Buffer;
+    ULONG BufferLength = Offsets->FileNameDist + NC_DIR_CACHE_PROBE_NAME_SIZE;
+
+    PAGED_CODE();
+
+    if (SearchString != NULL && SearchString->Buffer == NULL) {
+
+        SearchString = NULL;
+    }
+
+    Buffer = ExAllocatePoolZero( PagedPool, BufferLength, NC_DIR_SNAPSHOT_TAG );
+
+    if (Buffer == NULL) {
+
+        return FALSE;
+    }
+
+    Status = NcQueryDirectoryFile( FltObjects->Instance,
+                                   FltObjects->FileObject,
+                                   Buffer,
+                                   BufferLength,
+                                   InformationClass,
+                                   TRUE,
+                                   SearchString,
+                                   FALSE,
+                                   NULL );
+
+    ExFreePoolWithTag( Buffer, NC_DIR_SNAPSHOT_TAG );
+
+    //
+    //  A buffer overflow still means the caller was allowed to read the
+    //  directory.
+    //
+
+    return (BOOLEAN)(NT_SUCCESS( Status ) ||
+                     Status == STATUS_BUFFER_OVERFLOW ||
+                     Status == STATUS_NO_MORE_FILES ||
+                     Status == STATUS_NO_SUCH_FILE);
+}
+
+BOOLEAN
+NcDirSnapshotIsCurrent (
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ PNC_DIR_SNAPSHOT Snapshot
+    )
+/*++
+
+Routine Description:
+
+    Determines whether a snapshot may be replayed.
+
+Arguments:
+
+    InstanceContext - Pointer to this instance's context.
+
+    Snapshot - The snapshot.
+
+Return Value:
+
+    TRUE if the snapshot is complete, no change has been seen since it was
+    started, and it is younger than the cache lifetime.
+
+--*/
+{
+    PAGED_CODE();
+
+    return (BOOLEAN)(Snapshot->Complete &&
+                     Snapshot->Generation == InstanceContext->DirectoryCache.Generation &&
+                     KeQueryInterruptTime() - Snapshot->CreationTime < NcGlobalData.DirCacheLifetime);
+}
+
+VOID
+NcDirSnapshotRelease (
+    _In_ PNC_DIR_SNAPSHOT Snapshot
+    )
+/*++
+
+Routine Description:
+
+    Drops a reference on a snapshot, freeing it when the last reference
+    goes away.
+
+Arguments:
+
+    Snapshot - The snapshot.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (InterlockedDecrement( &Snapshot->ReferenceCount ) == 0) {
+
+        if (Snapshot->Entries != NULL) {
+
+            ExFreePoolWithTag( Snapshot->Entries, NC_DIR_SNAPSHOT_TAG );
+        }
+
+        ExFreePoolWithTag( Snapshot, NC_DIR_SNAPSHOT_TAG );
+    }
+}
+
+BOOLEAN
+NcDirSearchMatchesAll (
+    _In_opt_ PUNICODE_STRING SearchString
+    )
+/*++
+
+Routine Description:
+
+    Only enumerations which return every name in the directory are
+    recorded and replayed.  The filesystem treats a missing search string
+    the same as "*".
+
+Arguments:
+
+    SearchString - The search string.
+
+Return Value:
+
+    TRUE if the search string matches every name.
+
+--*/
+{
+    PAGED_CODE();
+
+    return (BOOLEAN)(SearchString == NULL ||
+                     SearchString->Length == 0 ||
+                     (SearchString->Length == sizeof(WCHAR) &&
+                      SearchString->Buffer[0] == L'*'));
+}
+
+BOOLEAN
+NcDirEnumBeginSnapshot (
+    _Inout_ PNC_DIR_QRY_CONTEXT DirContext,
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
+    _In_ UCHAR Directory,
+    _In_opt_ PUNICODE_STRING SearchString,
+    _In_ BOOLEAN FirstUsage
+    )
+/*++
+
+Routine Description:
+
+    Called when a handle starts, or restarts, an enumeration of a mapping
+    parent.  Either sets the handle up to be served from a current
+    snapshot, or to record a new one as it goes.
+
+    The handle's search string and information class must already be set
+    up in DirContext.
+
+Arguments:
+
+    DirContext - Pointer to the directory context.
+
+    InstanceContext - Pointer to this instance's context.
+
+    FltObjects - FltObjects structure for this operation.
+
+    Offsets - Offsets structure for this enumeration class.
+
+    Directory - Which mapping parents the directory is.
+
+    SearchString - The search string supplied with this request.
+
+    FirstUsage - Whether this is the first enumeration on the handle.
+
+Return Value:
+
+    TRUE if the enumeration is to be served from a snapshot.  FALSE if it
+    is to be sent to the filesystem.
+
+--*/
+{
+    PNC_DIR_SNAPSHOT Snapshot = DirContext->Snapshot;
+    BOOLEAN IgnoreCase = !BooleanFlagOn( FltObjects->FileObject->Flags,
+                                         FO_OPENED_CASE_SENSITIVE );
+
+    PAGED_CODE();
+
+    DirContext->Snapshot = NULL;
+    DirContext->Replaying = FALSE;
+    DirContext->ReplayOffset = 0;
+
+    if (NcGlobalData.DirCacheMaxSnapshotSize == 0 ||
+        !NcDirSearchMatchesAll( &DirContext->SearchString ) ||
+        !NcDirSearchMatchesAll( SearchString )) {
+
+        if (Snapshot != NULL) {
+
+            NcDirSnapshotRelease( Snapshot );
+        }
+
+        return FALSE;
+    }
+
+    if (Snapshot != NULL) {
+
+        //
+        //  If the handle is restarting its scan and already has a current
+        //  snapshot, it can be replayed without asking the filesystem.
+        //
+
+        if (FirstUsage ||
+            !NcDirSnapshotIsCurrent( InstanceContext, Snapshot )) {
+
+            NcDirSnapshotRelease( Snapshot );
+            Snapshot = NULL;
+        }
+    }
+
+    if (Snapshot == NULL && FirstUsage &&
+        DirContext->InformationClass == FileNamesInformation) {
+
+        Snapshot = NcDirCacheLookup( InstanceContext,
+                                     Directory,
+                                     DirContext->InformationClass,
+                                     IgnoreCase );
+
+        if (Snapshot != NULL &&
+            !NcDirCacheCheckAccess( FltObjects,
+                                    Offsets,
+                                    DirContext->InformationClass,
+                                    SearchString )) {
+
+            NcDirSnapshotRelease( Snapshot );
+            Snapshot = NULL;
+        }
+    }
+
+    if (Snapshot != NULL) {
+
+        InterlockedIncrement64( &InstanceContext->DirectoryCache.Hits );
+
+        DirContext->Snapshot = Snapshot;
+        DirContext->Replaying = TRUE;
+        return TRUE;
+    }
+
+    InterlockedIncrement64( &InstanceContext->DirectoryCache.Misses );
+
+    //
+    //  Start recording.  If we can't, the enumeration carries on without a
+    //  snapshot.
+    //
+
+    Snapshot = ExAllocatePoolZero( PagedPool,
+                                   sizeof( NC_DIR_SNAPSHOT ),
+                                   NC_DIR_SNAPSHOT_TAG );
+
+    if (Snapshot != NULL) {
+
+        Snapshot->ReferenceCount = 1;
+        Snapshot->Directory = Directory;
+        Snapshot->IgnoreCase = IgnoreCase;
+        Snapshot->InformationClass = DirContext->InformationClass;
+        Snapshot->Generation = InstanceContext->DirectoryCache.Generation;
+        Snapshot->CreationTime = KeQueryInterruptTime();
+
+        DirContext->Snapshot = Snapshot;
+    }
+
+    return FALSE;
+}
+
+VOID
+NcDirEnumRecordEntry (
+    _Inout_ PNC_DIR_QRY_CONTEXT DirContext,
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ PVOID Entry,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets
+    )
+/*++
+
+Routine Description:
+
+    Appends an entry which is about to be returned to the user to the
+    handle's snapshot.  Entries are stored 8 byte aligned, each with its
+    NextEntryOffset pointing to the next.
+
+Arguments:
+
+    DirContext - Pointer to the directory context.
+
+    InstanceContext - Pointer to this instance's context.
+
+    Entry - The entry, in a kernel buffer.
+
+    Offsets - Offsets structure for this enumeration class.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PNC_DIR_SNAPSHOT Snapshot = DirContext->Snapshot;
+    ULONG EntrySize;
+    ULONG AlignedSize;
+    ULONG NewLength;
+    PUCHAR NewEntries;
+    PVOID Dest;
+
+    PAGED_CODE();
+
+    if (Snapshot == NULL || DirContext->Replaying || Snapshot->Complete) {
+
+        return;
+    }
+
+    EntrySize = Offsets->FileNameDist + NcGetFileNameLength( Entry, Offsets );
+    AlignedSize = AlignToSize( EntrySize, sizeof( LONGLONG ));
+
+    if (AlignedSize > NcGlobalData.DirCacheMaxSnapshotSize - Snapshot->Length) {
+
+        //
+        //  The directory is too large to keep.
+        //
+
+        InterlockedIncrement64( &InstanceContext->DirectoryCache.Overflows );
+        NcDirEnumAbandonSnapshot( DirContext );
+        return;
+    }
+
+    if (Snapshot->Length + AlignedSize > Snapshot->AllocatedLength) {
+
+        NewLength = Max( Snapshot->AllocatedLength * 2, NC_DIR_SNAPSHOT_INITIAL_SIZE );
+        NewLength = Max( NewLength, Snapshot->Length + AlignedSize );
+        NewLength = min( NewLength, NcGlobalData.DirCacheMaxSnapshotSize );
+
+        NewEntries = ExAllocatePoolZero( PagedPool, NewLength, NC_DIR_SNAPSHOT_TAG );
+
+        if (NewEntries == NULL) {
+
+            NcDirEnumAbandonSnapshot( DirContext );
+            return;
+        }
+
+        if (Snapshot->Entries != NULL) {
+
+            RtlCopyMemory( NewEntries, Snapshot->Entries, Snapshot->Length );
+            ExFreePoolWithTag( Snapshot->Entries, NC_DIR_SNAPSHOT_TAG );
+        }
+
+        Snapshot->Entries = NewEntries;
+        Snapshot->AllocatedLength = NewLength;
+    }
+
+    Dest = Add2Ptr( Snapshot->Entries, Snapshot->Length );
+
+    RtlCopyMemory( Dest, Entry, EntrySize );
+    RtlZeroMemory( Add2Ptr( Dest, EntrySize ), AlignedSize - EntrySize );
+    *(PULONG)Add2Ptr( Dest, Offsets->NextEntryOffsetDist ) = AlignedSize;
+
+    Snapshot->Length += AlignedSize;
+}
+
+VOID
+NcDirEnumAbandonSnapshot (
+    _Inout_ PNC_DIR_QRY_CONTEXT DirContext
+    )
+/*++
+
+Routine Description:
+
+    Stops recording the handle's enumeration, for example because an entry
+    could not be returned to the user after it was recorded.
+
+Arguments:
+
+    DirContext - Pointer to the directory context.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (DirContext->Snapshot != NULL && !DirContext->Replaying) {
+
+        NcDirSnapshotRelease( DirContext->Snapshot );
+        DirContext->Snapshot = NULL;
+    }
+}
+
+VOID
+NcDirEnumCompleteSnapshot (
+    _Inout_ PNC_DIR_QRY_CONTEXT DirContext,
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Routine Description:
+
+    Called when the handle's enumeration has returned its last entry.  The
+    snapshot is complete.  If it only holds names, it is published to the
+    directory cache when nothing has changed since it was started.
+
+Arguments:
+
+    DirContext - Pointer to the directory context.
+
+    InstanceContext - Pointer to this instance's context.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PNC_DIR_SNAPSHOT Snapshot = DirContext->Snapshot;
+
+    PAGED_CODE();
+
+    if (Snapshot == NULL || DirContext->Replaying || Snapshot->Complete) {
+
+        return;
+    }
+
+    Snapshot->Complete = TRUE;
+
+    if (Snapshot->InformationClass == FileNamesInformation &&
+        NcDirSnapshotIsCurrent( InstanceContext, Snapshot )) {
+
+        NcDirCachePublish( InstanceContext, Snapshot );
+    }
+}
+
+ULONG
+NcDirEnumReplaySnapshot (
+    _Inout_ PNC_DIR_QRY_CONTEXT DirContext,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
+    _Out_writes_bytes_(UserSize) PVOID UserBuffer,
+    _In_ ULONG UserSize,
+    _In_ BOOLEAN ReturnSingleEntry,
+    _Out_ PULONG UserOffset,
+    _Out_ PULONG LastEntryStart
+    )
+/*++
+
+Routine Description:
+
+    Copies the next entries of the handle's snapshot into the caller's
+    buffer.  Must be called inside a try/except, since the buffer is the
+    caller's.
+
+Arguments:
+
+    DirContext - Pointer to the directory context.
+
+    Offsets - Offsets structure for this enumeration class.
+
+    UserBuffer - Pointer to the caller's buffer.
+
+    UserSize - Size of the caller's buffer, in bytes.
+
+    ReturnSingleEntry - Whether to copy no more than one entry.
+
+    UserOffset - Receives the number of bytes written to the caller's
+        buffer.
+
+    LastEntryStart - Receives the offset of the last entry written to the
+        caller's buffer.
+
+Return Value:
+
+    The number of entries copied.
+
+--*/
+{
+    PNC_DIR_SNAPSHOT Snapshot = DirContext->Snapshot;
+    ULONG NumEntriesCopied = 0;
+    ULONG Offset = 0;
+    ULONG EntrySize;
+    ULONG CopySize;
+    PVOID Entry;
+
+    PAGED_CODE();
+
+    FLT_ASSERT( DirContext->Replaying && Snapshot->Complete );
+
+    *LastEntryStart = 0;
+
+    while (DirContext->ReplayOffset < Snapshot->Length) {
+
+        Entry = Add2Ptr( Snapshot->Entries, DirContext->ReplayOffset );
+        EntrySize = Offsets->FileNameDist + NcGetFileNameLength( Entry, Offsets );
+
+        if (UserSize - Offset < EntrySize) {
+
+            break;
+        }
+
+        //
+        //  Copy the alignment padding too, unless this entry fills the
+        //  caller's buffer.
+        //
+
+        CopySize = min( NcGetNextEntryOffset( Entry, Offsets ), UserSize - Offset );
+
+        RtlCopyMemory( Add2Ptr( UserBuffer, Offset ), Entry, CopySize );
+
+        *LastEntryStart = Offset;
+        Offset += CopySize;
+        DirContext->ReplayOffset += NcGetNextEntryOffset( Entry, Offsets );
+        NumEntriesCopied++;
+
+        if (ReturnSingleEntry) {
+
+            break;
+        }
+    }
+
+    *UserOffset = Offset;
+
+    return NumEntriesCopied;
+}
+
@@ -99,6 +99,7 @@ Return Value:
     ULONG LastEntryStart;
     BOOLEAN MoreRoom;
     PNC_CACHE_ENTRY NextEntry;
+    PVOID Element;
 
     DIRECTORY_CONTROL_OFFSETS Offsets;
 
@@ -246,6 +247,7 @@ Return Value:
                                              Data,
                                              FltObjects,
                                              UserOverlap,
+                                             RealOverlap,
                                              &FirstQuery );
 
     if (!NT_SUCCESS( Status )) {
@@ -269,96 +271,140 @@ Return Value:
     NumEntriesCopied = 0;
     UserBufferOffset = 0;
 
-    do {
+    if (DirCtx->Replaying) {
 
         //
-        //  If there is no cache entry, populate it.
+        //  The enumeration is served from a snapshot.
         //
 
-        if (DirCtx->Cache.Buffer == NULL) {
+        try {
 
-            Status = NcPopulateCacheEntry( FltObjects->Instance,
-                                           FltObjects->FileObject,
-                                           Data->Iopb->Parameters.DirectoryControl.QueryDirectory.Length,
-                                           Data->Iopb->Parameters.DirectoryControl.QueryDirectory.FileInformationClass,
-                                           Data->Iopb->Parameters.DirectoryControl.QueryDirectory.FileName,
-                                           Reset,
-                                           &DirCtx->Cache);
+            NumEntriesCopied = NcDirEnumReplaySnapshot( DirCtx,
+                                                        &Offsets,
+                                                        UserBuffer,
+                                                        BufferSize,
+                                                        Single,
+                                                        &UserBufferOffset,
+                                                        &LastEntryStart );
 
-            //
-            //  We only want to reset the cache once.
-            //
+        } except (NcExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+            Status = STATUS_INVALID_USER_BUFFER;
+            ReturnValue = FLT_PREOP_COMPLETE;
+            goto NcEnumerateDirectoryCleanup;
+        }
+
+    } else {
 
-            Reset = FALSE;
+        do {
 
             //
-            //  There was a problem populating cache, pass up to user.
+            //  If there is no cache entry, populate it.
             //
 
-            if (!NT_SUCCESS( Status )) {
+            if (DirCtx->Cache.Buffer == NULL) {
+
+                Status = NcPopulateCacheEntry( FltObjects->Instance,
+                                               FltObjects->FileObject,
+                                               Data->Iopb->Parameters.DirectoryControl.QueryDirectory.Length,
+                                               Data->Iopb->Parameters.DirectoryControl.QueryDirectory.FileInformationClass,
+                                               Data->Iopb->Parameters.DirectoryControl.QueryDirectory.FileName,
+                                               Reset,
+                                               &DirCtx->Cache);
+
+                //
+                //  We only want to reset the cache once.
+                //
+
+                Reset = FALSE;
+
+                //
+                //  There was a problem populating cache, pass up to user.
+                //
+
+                if (!NT_SUCCESS( Status )) {
+
+                    ReturnValue = FLT_PREOP_COMPLETE;
+                    goto NcEnumerateDirectoryCleanup;
+                }
 
-                ReturnValue = FLT_PREOP_COMPLETE;
-                goto NcEnumerateDirectoryCleanup;
             }
 
-        }
+            NextEntry = NcDirEnumSelectNextEntry( DirCtx, &Offsets, IgnoreCase );
 
-        NextEntry = NcDirEnumSelectNextEntry( DirCtx, &Offsets, IgnoreCase );
+            if (NextEntry == NULL) {
 
-        if (NextEntry == NULL) {
+                //
+                //  There are no more entries.  Whatever we recorded is the
+                //  whole directory.
+                //
 
-            //
-            //  There are no more entries.
-            //
+                NcDirEnumCompleteSnapshot( DirCtx, InstanceContext );
+                break;
+            }
 
-            break;
-        }
+            if (NcSkipName( &Offsets,
+                            DirCtx,
+                            RealOverlap,
+                            &InstanceContext->Mapping,
+                            IgnoreCase )) {
 
-        if (NcSkipName( &Offsets,
-                        DirCtx,
-                        RealOverlap,
-                        &InstanceContext->Mapping,
-                        IgnoreCase )) {
+                //
+                //  This entry is the real mapping path. That means we have to mask it...
+                //  We will say there is more room and continue.
+                //
 
-            //
-            //  This entry is the real mapping path. That means we have to mask it...
-            //  We will say there is more room and continue.
-            //
+                MoreRoom = TRUE;
 
-            MoreRoom = TRUE;
+            } else {
 
-        } else {
+                //
+                //  We are keeping this entry!  If it is going to fit, add it
+                //  to the snapshot before it is copied, since copying may
+                //  free its buffer.
+                //
 
-            //
-            //  We are keeping this entry!
-            //
+                Element = Add2Ptr( NextEntry->Buffer, NextEntry->CurrentOffset );
 
-            try {
+                if (BufferSize - UserBufferOffset >= NcGetEntrySize( Element, &Offsets )) {
 
-                LastEntryStart = UserBufferOffset;
-                UserBufferOffset = NcCopyDirEnumEntry( UserBuffer,
-                                                       UserBufferOffset,
-                                                       BufferSize,
-                                                       NextEntry,
-                                                       &Offsets,
-                                                       &MoreRoom );
+                    NcDirEnumRecordEntry( DirCtx, InstanceContext, Element, &Offsets );
+                }
 
-            } except (NcExceptionFilter( GetExceptionInformation(), TRUE )) {
+                try {
 
-                Status = STATUS_INVALID_USER_BUFFER;
-                ReturnValue = FLT_PREOP_COMPLETE;
-                goto NcEnumerateDirectoryCleanup;
-            }
+                    LastEntryStart = UserBufferOffset;
+                    UserBufferOffset = NcCopyDirEnumEntry( UserBuffer,
+                                                           UserBufferOffset,
+                                                           BufferSize,
+                                                           NextEntry,
+                                                           &Offsets,
+                                                           &MoreRoom );
 
-            if (MoreRoom) {
+                } except (NcExceptionFilter( GetExceptionInformation(), TRUE )) {
 
-                NumEntriesCopied++;
-            }
+                    //
+                    //  The entry is recorded but was not returned, and will be
+                    //  returned again by the next query.
+                    //
+
+                    NcDirEnumAbandonSnapshot( DirCtx );
+
+                    Status = STATUS_INVALID_USER_BUFFER;
+                    ReturnValue = FLT_PREOP_COMPLETE;
+                    goto NcEnumerateDirectoryCleanup;
+                }
+
+                if (MoreRoom) {
 
-        }// end of "we are copying entry"
+                    NumEntriesCopied++;
+                }
 
-    } while (MoreRoom &&
-             (Single ? (NumEntriesCopied < 1) : TRUE));
+            }// end of "we are copying entry"
+
+        } while (MoreRoom &&
+                 (Single ? (NumEntriesCopied < 1) : TRUE));
+    }
 
     if (NumEntriesCopied > 0) {
 
@@ -1163,6 +1209,9 @@ Return Value:
     Context->SearchString.Length = 0;
     Context->SearchString.MaximumLength = 0;
     Context->SearchString.Buffer = NULL;
+    Context->Snapshot = NULL;
+    Context->Replaying = FALSE;
+    Context->ReplayOffset = 0;
 
     return Status;
 }
@@ -1176,6 +1225,7 @@ NcStreamHandleContextEnumSetup (
     _In_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ NC_PATH_OVERLAP UserMappingOverlap,
+    _In_ NC_PATH_OVERLAP RealMappingOverlap,
     _Out_ PBOOLEAN FirstUsage
     )
 /*++
@@ -1200,6 +1250,9 @@ Arguments:
     UserMappingOverlap - The overlap between the user mapping and this file
         object.
 
+    RealMappingOverlap - The overlap between the real mapping and this file
+        object.
+
     FirstUsage - Weather or not this is the first usage of this handle in a
         directory enumeration.
 
@@ -1216,6 +1269,7 @@ Return Value:
     BOOLEAN ResetSearch = BooleanFlagOn( Data->Iopb->OperationFlags, SL_RESTART_SCAN );
     BOOLEAN IgnoreCase = !BooleanFlagOn( FltObjects->FileObject->Flags,
                                          FO_OPENED_CASE_SENSITIVE );
+    UCHAR Directory = 0;
 
     PAGED_CODE();
 
@@ -1317,14 +1371,37 @@ Return Value:
             DirContext->InjectionEntry.CurrentOffset = 0;
         }
 
+        //
+        //  See if we can serve this enumeration from a snapshot, or else
+        //  start recording one.
+        //
+
+        if (UserMappingOverlap.Parent) {
+
+            SetFlag( Directory, NC_DIR_USER_PARENT );
+        }
+
+        if (RealMappingOverlap.Parent) {
+
+            SetFlag( Directory, NC_DIR_REAL_PARENT );
+        }
+
+        NcDirEnumBeginSnapshot( DirContext,
+                                InstanceContext,
+                                FltObjects,
+                                Offsets,
+                                Directory,
+                                SearchString,
+                                (BOOLEAN)!DirContext->InUse );
+
         //
         //  Now that the cache is clear we can set up the injection entry.
         //  The injection entry is the user mapping itself. Thus it only needs
         //  to be injected if the directory being enumerated is the parent of
-        //  the user mapping.
+        //  the user mapping.  A snapshot already has it.
         //
 
-        if (UserMappingOverlap.Parent) {
+        if (UserMappingOverlap.Parent && !DirContext->Replaying) {
 
             Status = NcEnumerateDirectorySetupInjection( DirContext,
                                                          FltObjects,
@@ -1415,6 +1492,12 @@ Return Value:
 
         DirContext->SearchString.Buffer = NULL;
     }
+
+    if (DirContext->Snapshot != NULL) {
+
+        NcDirSnapshotRelease( DirContext->Snapshot );
+        DirContext->Snapshot = NULL;
+    }
 }
 
 
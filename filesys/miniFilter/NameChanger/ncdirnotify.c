@@ -2277,6 +2277,18 @@ Return Value:
         Data->IoStatus.Status = STATUS_CANCELLED;
     }
 
+    //
+    //  Anything reported here may be a change to a mapping parent, so
+    //  stop serving enumerations from snapshots taken before it.
+    //
+
+    if (NotCtx->InstanceContext != NULL &&
+        NT_SUCCESS( Data->IoStatus.Status ) &&
+        Data->IoStatus.Status != STATUS_NOTIFY_CLEANUP) {
+
+        NcDirCacheInvalidate( NotCtx->InstanceContext );
+    }
+
     //
     //  Flow any failures back to the user's request, if we have one.
     //
@@ -1341,9 +1341,16 @@ Return Value:
     }
 
     //
-    //  The file is ok to mark for delete.
+    //  The file is ok to mark for delete.  If it is directly inside a
+    //  mapping parent, or is the user mapping, its entry is about to go
+    //  away.
     //
 
+    if (RealOverlap.Peer || UserOverlap.Peer || UserOverlap.Match) {
+
+        NcDirCacheInvalidate( InstanceContext );
+    }
+
     Status = STATUS_SUCCESS;
     goto NcPreSetDispositionCleanup;
 
@@ -1418,13 +1425,12 @@ Return Value:
     UNICODE_STRING MungedName = EMPTY_UNICODE_STRING;
     BOOLEAN IgnoreCase = !BooleanFlagOn( FltObjects->FileObject->Flags,
                                          FO_OPENED_CASE_SENSITIVE );
+    BOOLEAN DirCacheInvalidated = FALSE;
 
     PAGED_CODE();
 
     FLT_ASSERT( IoGetTopLevelIrp() == NULL );
 
-    UNREFERENCED_PARAMETER( CompletionContext );
-
     Status = FltGetInstanceContext( FltObjects->Instance,
                                     &InstanceContext);
 
@@ -1513,6 +1519,17 @@ Return Value:
         goto NcPreSetLinkInformationCleanup;
     }
 
+    //
+    //  A link directly inside a mapping parent, or in place of the user
+    //  mapping, adds an entry to a merged enumeration.
+    //
+
+    if (RealOverlap.Peer || UserOverlap.Peer || UserOverlap.Match) {
+
+        NcDirCacheInvalidate( InstanceContext );
+        DirCacheInvalidated = TRUE;
+    }
+
     //
     //  If the destination path is outside the mapping then we can pass it
     //  through without a problem.
@@ -1594,6 +1611,14 @@ NcPreSetLinkInformationCleanup:
         Data->IoStatus.Status = Status;
     }
 
+    if (DirCacheInvalidated) {
+
+        ReturnValue = NcDirCacheInvalidateOnCompletion( Data,
+                                                        ReturnValue,
+                                                        &InstanceContext,
+                                                        CompletionContext );
+    }
+
     if (MungedLinkInfo != NULL) {
 
         ExFreePoolWithTag( MungedLinkInfo, NC_SET_LINK_BUFFER_TAG );
@@ -1708,6 +1733,7 @@ Return Value:
 
     FILE_INFORMATION_CLASS fileInformationClass;
     BOOLEAN ReplaceIfExists;
+    BOOLEAN DirCacheInvalidated = FALSE;
 
     fileInformationClass = Data->Iopb->Parameters.SetFileInformation.FileInformationClass;
     ReplaceIfExists = (fileInformationClass == FileRenameInformationEx) ?
@@ -1717,8 +1743,6 @@ Return Value:
 
     PAGED_CODE();
 
-    UNREFERENCED_PARAMETER( CompletionContext );
-
     FLT_ASSERT( IoGetTopLevelIrp() == NULL );
 
     FLT_ASSERT( (fileInformationClass == FileRenameInformation) ||
@@ -1861,6 +1885,17 @@ Return Value:
         goto NcPreRenameCleanup;
     }
 
+    //
+    //  A rename into or out of a mapping parent, or of the user mapping,
+    //  changes the entries of a merged enumeration.
+    //
+
+    if (SrcRealOverlap.Peer || SrcUserOverlap.Peer || SrcUserOverlap.Match ||
+        TargetRealOverlap.Peer || TargetUserOverlap.Peer || TargetUserOverlap.Match) {
+
+        NcDirCacheInvalidate( InstanceContext );
+        DirCacheInvalidated = TRUE;
+    }
 
     //
     //  If the target is in the user mapping, then we need to munge the
@@ -1957,6 +1992,14 @@ NcPreRenameCleanup:
         Data->IoStatus.Status = Status;
     }
 
+    if (DirCacheInvalidated) {
+
+        ReturnValue = NcDirCacheInvalidateOnCompletion( Data,
+                                                        ReturnValue,
+                                                        &InstanceContext,
+                                                        CompletionContext );
+    }
+
     if (InstanceContext != NULL) {
 
         FltReleaseContext( InstanceContext );
@@ -9,6 +9,14 @@ NcLoadRegistryString (
     _Out_ PUNICODE_STRING OutputString
     );
 
+NTSTATUS
+NcLoadRegistryUlong (
+    _In_ HANDLE Key,
+    _In_ PCWSTR valueName,
+    _In_ ULONG DefaultValue,
+    _Out_ PULONG OutputValue
+    );
+
 BOOLEAN
 NcIs8DOT3Compatible (
     _In_ PUNICODE_STRING TestName,
@@ -42,6 +50,7 @@ NcOpenServiceParametersKey (
 #pragma alloc_text(INIT, NcOpenServiceParametersKey)
 #pragma alloc_text(INIT, NcInitializeMapping)
 #pragma alloc_text(INIT, NcLoadRegistryString)
+#pragma alloc_text(INIT, NcLoadRegistryUlong)
 #pragma alloc_text(INIT, NcIs8DOT3Compatible)
 #endif
 
@@ -201,6 +210,74 @@ NcLoadRegistryStringCleanup:
     return Status;
 }
 
+NTSTATUS
+NcLoadRegistryUlong (
+    _In_ HANDLE Key,
+    _In_ PCWSTR valueName,
+    _In_ ULONG DefaultValue,
+    _Out_ PULONG OutputValue
+    )
+/*++
+
+Routine Description:
+
+    Reads an optional REG_DWORD value.
+
+Arguments:
+
+    Key - The key to read the value from.
+
+    valueName - The name of the value.
+
+    DefaultValue - The value to return if the value does not exist.
+
+    OutputValue - Receives the value.
+
+Return Value:
+
+    The return value is the Status of the operation.
+
+--*/
+{
+    UCHAR Buffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + sizeof( ULONG )];
+    PKEY_VALUE_PARTIAL_INFORMATION Information = (PKEY_VALUE_PARTIAL_INFORMATION) Buffer;
+    ULONG ResultLength;
+    UNICODE_STRING ValueString;
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    RtlInitUnicodeString( &ValueString, valueName );
+
+    Status = ZwQueryValueKey( Key,
+                              &ValueString,
+                              KeyValuePartialInformation,
+                              Information,
+                              sizeof( Buffer ),
+                              &ResultLength );
+
+    if (Status == STATUS_OBJECT_NAME_NOT_FOUND) {
+
+        *OutputValue = DefaultValue;
+        return STATUS_SUCCESS;
+    }
+
+    if (!NT_SUCCESS( Status )) {
+
+        return Status;
+    }
+
+    if (Information->Type != REG_DWORD ||
+        Information->DataLength != sizeof( ULONG )) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *OutputValue = *(PULONG) Information->Data;
+
+    return STATUS_SUCCESS;
+}
+
 BOOLEAN
 NcIs8DOT3Compatible (
     _In_ PUNICODE_STRING TestName,
@@ -470,6 +547,7 @@ Return Value:
     HANDLE DriverRegKey = NULL;
     UNICODE_STRING TempPath = EMPTY_UNICODE_STRING;
     USHORT Index;
+    ULONG DirCacheLifetime;
 
     PAGED_CODE();
 
@@ -607,6 +685,30 @@ Return Value:
         goto NcInitializeMappingCleanup;
     }
 
+    //
+    //  Settings of the directory cache.  Both are optional.
+    //
+
+    Status = NcLoadRegistryUlong( DriverRegKey,
+                                  L"DirectoryCacheSize",
+                                  NC_DIR_CACHE_DEFAULT_SIZE,
+                                  &NcGlobalData.DirCacheMaxSnapshotSize );
+
+    if (!NT_SUCCESS( Status )) {
+        goto NcInitializeMappingCleanup;
+    }
+
+    Status = NcLoadRegistryUlong( DriverRegKey,
+                                  L"DirectoryCacheLifetime",
+                                  NC_DIR_CACHE_DEFAULT_LIFETIME,
+                                  &DirCacheLifetime );
+
+    if (!NT_SUCCESS( Status )) {
+        goto NcInitializeMappingCleanup;
+    }
+
+    NcGlobalData.DirCacheLifetime = (ULONGLONG) DirCacheLifetime * 10000;
+
 NcInitializeMappingCleanup:
 
 
@@ -414,31 +414,26 @@ Return Value:
     instanceContext->IsOnCsvMDS = isOnCsv;
 
     //
-    //  There will be a file state cache table for each NTFS volume instance.
+    //  There will be a file state cache for each NTFS volume instance.
     //  As for other file systems, file id is not unique, and thus we do
     //  not have cache for other kinds of file systems. Since the cache
-    //  table is not mandatory to implement an anti-virus filter, we
+    //  is not mandatory to implement an anti-virus filter, we
     //  only have the volatile cache for NTFS, CSVFS and REFS.
     //
-    //  It is worth mentioning that the table is potentially very large.
-    //  We use an AVL tree to improve insertion and query times. We do not
-    //  set an upper bound for the size of the tree which is not optimal.
-    //  Consider limiting the size of the tree for a production filter.
+    //  The cache is a sharded hash table of bounded size, see cache.h.
+    //  If we cannot allocate it, the volume simply goes without.
     //
 
     if (FS_SUPPORTS_FILE_STATE_CACHE( VolumeFilesystemType )) {
 
-        //
-        //  Initialize file state cache in the instance context.
-        //
+        status = AvCreateFileStateCache( &instanceContext->FileStateCache );
 
-        ExInitializeResourceLite( &instanceContext->Resource );
+        if (!NT_SUCCESS( status )) {
 
-        RtlInitializeGenericTable( &instanceContext->FileStateCacheTable,
-                                    AvCompareEntry,
-                                    AvAllocateGenericTableEntry,
-                                    AvFreeGenericTableEntry,
-                                   NULL );
+            AV_DBG_PRINT( AVDBG_TRACE_ERROR,
+                      ("[AV] AvInstanceSetup: create file state cache failed. status = 0x%x\n", status) );
+            instanceContext->FileStateCache = NULL;
+        }
     }
 
     status = FltSetInstanceContext( FltObjects->Instance,
@@ -607,26 +602,9 @@ Return Value:
     AvReleaseResource( &Globals.ScanCtxListLock );
 
     //
-    //  Clean up the cache table if the volume supports one.
+    //  The file state cache, if any, is freed with the instance context.
     //
 
-    if (FS_SUPPORTS_FILE_STATE_CACHE( instanceContext->VolumeFSType )) {
-        PAV_GENERIC_TABLE_ENTRY entry = NULL;
-        AvAcquireResourceExclusive( &instanceContext->Resource );
-
-        while (!RtlIsGenericTableEmpty( &instanceContext->FileStateCacheTable ) ) {
-            entry = RtlGetElementGenericTable(&instanceContext->FileStateCacheTable, 0);
-            AV_DBG_PRINT( AVDBG_TRACE_ROUTINES,
-                  ("[AV] AvInstanceTeardownStart: %I64x,%I64x requesting deletion, state:%d\n",
-                        entry->FileId.FileId64.UpperZeroes,
-                        entry->FileId.FileId64.Value,
-                        entry->InfectedState) );
-            RtlDeleteElementGenericTable(&instanceContext->FileStateCacheTable, entry);
-        }
-
-        AvReleaseResource( &instanceContext->Resource );
-    }
-
     FltReleaseContext( instanceContext );
 
     FltDeleteInstanceContext( FltObjects->Instance, NULL );
@@ -1193,8 +1171,6 @@ Return Value:
 {
     NTSTATUS status = STATUS_SUCCESS;
     PAV_INSTANCE_CONTEXT instanceContext = NULL;
-    AV_GENERIC_TABLE_ENTRY query = {0};
-    PAV_GENERIC_TABLE_ENTRY entry = NULL;
 
     PAGED_CODE();
 
@@ -1213,29 +1189,18 @@ Return Value:
         return status;
     }
 
-    if (! FS_SUPPORTS_FILE_STATE_CACHE( instanceContext->VolumeFSType )) {
+    if (instanceContext->FileStateCache == NULL) {
 
         status = STATUS_NOT_FOUND;
         goto Cleanup;
     }
 
-    RtlCopyMemory( &query.FileId, FileId, sizeof(query.FileId) );
-
-    AvAcquireResourceShared( &instanceContext->Resource );
-
-    entry = RtlLookupElementGenericTable( &instanceContext->FileStateCacheTable,
-                                          &query );
-
-    if (entry != NULL) {
-        *State = entry->InfectedState;
-        *VolumeRevision = entry->VolumeRevision;
-        *CacheRevision = entry->CacheRevision;
-        *FileRevision = entry->FileRevision;
-    } else {
-        status = STATUS_NOT_FOUND;
-    }
-
-    AvReleaseResource( &instanceContext->Resource );
+    status = AvCacheLookup( instanceContext->FileStateCache,
+                            FileId,
+                            State,
+                            VolumeRevision,
+                            CacheRevision,
+                            FileRevision );
 
 Cleanup:
 
@@ -1268,9 +1233,6 @@ Return Value:
 --*/
 {
     NTSTATUS  status = STATUS_SUCCESS;
-    BOOLEAN   inserted = FALSE;
-    AV_GENERIC_TABLE_ENTRY entry = {0};
-    PAV_GENERIC_TABLE_ENTRY pEntry = NULL;
     PAV_INSTANCE_CONTEXT   instanceContext = NULL;
 
     PAGED_CODE();
@@ -1290,10 +1252,11 @@ Return Value:
     }
 
     //
-    //  If the file system is not NTFS, CSVFS or REFS, do nothing
+    //  If the file system is not NTFS, CSVFS or REFS, or the cache could
+    //  not be allocated, do nothing
     //
 
-    if (!FS_SUPPORTS_FILE_STATE_CACHE( instanceContext->VolumeFSType )) {
+    if (instanceContext->FileStateCache == NULL) {
         goto Cleanup;
     }
 
@@ -1308,45 +1271,24 @@ Return Value:
 
     //
     //  If the file system is NTFS, CSVFS or REFS, overwrite the entry in the
-    //  cache table if exists
+    //  cache if exists
     //
 
-    RtlCopyMemory( &entry.FileId, &StreamContext->FileId, sizeof(entry.FileId) );
-
-    AvAcquireResourceExclusive( &instanceContext->Resource );
-
-    pEntry = RtlInsertElementGenericTable( &instanceContext->FileStateCacheTable,
-                                          (PVOID) &entry,
-                                          AV_GENERIC_TABLE_ENTRY_SIZE,
-                                          &inserted);
-    if (pEntry) {
-
-        //
-        //  Note the cache may become stale as files are modified.
-        //
-
-        //
-        //  It is possible that after entering the following else-if
-        //  branch, thread A modifies the file, and before thread A
-        //  closes the handle, thread B opens the same file. This
-        //  is fine because in such a case, the streamcontext exists
-        //  AvLoadFileStateFromCache would return the state in stream
-        //  context. Thus, thread B will need to scan the file.
-        //
-
-        pEntry->InfectedState = StreamContext->State;
-        pEntry->VolumeRevision = StreamContext->VolumeRevision;
-        pEntry->CacheRevision = StreamContext->CacheRevision;
-        pEntry->FileRevision = StreamContext->FileRevision;
-
-    }
-
-    AvReleaseResource( &instanceContext->Resource );
+    //
+    //  It is possible that after entering the following else-if
+    //  branch, thread A modifies the file, and before thread A
+    //  closes the handle, thread B opens the same file. This
+    //  is fine because in such a case, the streamcontext exists
+    //  AvLoadFileStateFromCache would return the state in stream
+    //  context. Thus, thread B will need to scan the file.
+    //
 
-    if (!pEntry) {
-        AV_DBG_PRINT( AVDBG_TRACE_ERROR,
-              ("[AV] AvSyncCache: RtlInsertElementGenericTable failed.\n") );
-    }
+    AvCacheUpdate( instanceContext->FileStateCache,
+                   &StreamContext->FileId,
+                   StreamContext->State,
+                   StreamContext->VolumeRevision,
+                   StreamContext->CacheRevision,
+                   StreamContext->FileRevision );
 
 Cleanup:
 
@@ -30,6 +30,7 @@ Environment:
 #include <dontuse.h>
 #include <suppress.h>
 #include "utility.h"
+#include "cache.h"
 #include "context.h"
 #include "scan.h"
 #include "csvfs.h"
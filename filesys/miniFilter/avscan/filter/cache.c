@@ -0,0 +1,488 @@
+/*++
+
+Copyright (c) 2011  Microsoft Corporation
+
+Module Name:
+
+    cache.c
+
+Abstract:
+
+    File state cache module implementation.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "avscan.h"
+
+//
+//  Local routines
+//
+
+PAV_CACHE_ENTRY
+AvCacheFindEntry (
+    _In_ PAV_CACHE_SHARD Shard,
+    _In_ ULONG Bucket,
+    _In_ PAV_FILE_REFERENCE FileId
+    );
+
+VOID
+AvCacheUnlinkEntry (
+    _Inout_ PAV_CACHE_SHARD Shard,
+    _In_ ULONG Index
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, AvCreateFileStateCache)
+#pragma alloc_text(PAGE, AvDeleteFileStateCache)
+#pragma alloc_text(PAGE, AvCacheLookup)
+#pragma alloc_text(PAGE, AvCacheUpdate)
+#pragma alloc_text(PAGE, AvCacheQueryStatistics)
+#pragma alloc_text(PAGE, AvCacheFindEntry)
+#pragma alloc_text(PAGE, AvCacheUnlinkEntry)
+#endif
+
+//
+//  The shard of a file ID is given by the low bits of its hash, and its
+//  bucket within the shard by the bits above those.
+//
+
+#define AV_CACHE_SHARD_BITS     4
+
+C_ASSERT( AV_CACHE_SHARD_COUNT == (1 << AV_CACHE_SHARD_BITS) );
+C_ASSERT( (AV_CACHE_SHARD_CAPACITY & (AV_CACHE_SHARD_CAPACITY - 1)) == 0 );
+
+FORCEINLINE
+ULONG
+AvCacheHash (
+    _In_ PAV_FILE_REFERENCE FileId
+    )
+/*++
+
+Routine Description:
+
+    This routine hashes a file ID. File IDs are often sequential, so the
+    bits are mixed with a multiplicative hash before any of them are used.
+
+Arguments:
+
+    FileId - The file ID to hash.
+
+Return Value:
+
+    The hash of the file ID.
+
+--*/
+{
+    ULONGLONG hash;
+
+    hash = FileId->FileId64.Value ^ (FileId->FileId64.UpperZeroes * 0x9E3779B97F4A7C15ull);
+    hash *= 0x9E3779B97F4A7C15ull;
+
+    return (ULONG)(hash >> 32);
+}
+
+NTSTATUS
+AvCreateFileStateCache (
+    _Outptr_ PAV_FILE_STATE_CACHE *Cache
+    )
+/*++
+
+Routine Description:
+
+    This routine allocates an empty file state cache. The entries and
+    buckets of all the shards are carved out of the same allocation.
+
+Arguments:
+
+    Cache - Receives the cache.
+
+Return Value:
+
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES.
+
+--*/
+{
+    PAV_FILE_STATE_CACHE cache;
+    PAV_CACHE_ENTRY entries;
+    PULONG buckets;
+    ULONG i;
+
+    PAGED_CODE();
+
+    cache = ExAllocatePoolZero( PagedPool,
+                                sizeof( AV_FILE_STATE_CACHE ) +
+                                AV_CACHE_SHARD_COUNT * AV_CACHE_SHARD_CAPACITY *
+                                    (sizeof( AV_CACHE_ENTRY ) + sizeof( ULONG )),
+                                AV_CACHE_TAG );
+
+    if (NULL == cache) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    entries = (PAV_CACHE_ENTRY) (cache + 1);
+    buckets = (PULONG) (entries + AV_CACHE_SHARD_COUNT * AV_CACHE_SHARD_CAPACITY);
+
+    for (i = 0; i < AV_CACHE_SHARD_COUNT; i++) {
+
+        FltInitializePushLock( &cache->Shards[i].Lock );
+        cache->Shards[i].Entries = entries + i * AV_CACHE_SHARD_CAPACITY;
+        cache->Shards[i].Buckets = buckets + i * AV_CACHE_SHARD_CAPACITY;
+    }
+
+    *Cache = cache;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+AvDeleteFileStateCache (
+    _In_ _Post_invalid_ PAV_FILE_STATE_CACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    This routine frees a file state cache.
+
+Arguments:
+
+    Cache - The cache to free.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < AV_CACHE_SHARD_COUNT; i++) {
+
+        FltDeletePushLock( &Cache->Shards[i].Lock );
+    }
+
+    ExFreePoolWithTag( Cache, AV_CACHE_TAG );
+}
+
+PAV_CACHE_ENTRY
+AvCacheFindEntry (
+    _In_ PAV_CACHE_SHARD Shard,
+    _In_ ULONG Bucket,
+    _In_ PAV_FILE_REFERENCE FileId
+    )
+/*++
+
+Routine Description:
+
+    This routine looks for a file ID in a hash bucket of a shard. The
+    caller holds the shard lock.
+
+Arguments:
+
+    Shard - The shard.
+
+    Bucket - The bucket of the file ID.
+
+    FileId - The file ID to look for.
+
+Return Value:
+
+    The entry of the file, or NULL if it is not in the cache.
+
+--*/
+{
+    PAV_CACHE_ENTRY entry;
+    ULONG next;
+
+    PAGED_CODE();
+
+    for (next = Shard->Buckets[Bucket]; next != 0; next = entry->NextInBucket) {
+
+        entry = &Shard->Entries[next - 1];
+
+        if ((entry->FileId.FileId64.Value == FileId->FileId64.Value) &&
+            (entry->FileId.FileId64.UpperZeroes == FileId->FileId64.UpperZeroes)) {
+
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+VOID
+AvCacheUnlinkEntry (
+    _Inout_ PAV_CACHE_SHARD Shard,
+    _In_ ULONG Index
+    )
+/*++
+
+Routine Description:
+
+    This routine removes an entry from its hash bucket. The caller holds
+    the shard lock exclusive.
+
+Arguments:
+
+    Shard - The shard.
+
+    Index - The index of the entry.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAV_CACHE_ENTRY entry = &Shard->Entries[Index];
+    PULONG link;
+
+    PAGED_CODE();
+
+    link = &Shard->Buckets[(AvCacheHash( &entry->FileId ) >> AV_CACHE_SHARD_BITS) &
+                           (AV_CACHE_SHARD_CAPACITY - 1)];
+
+    while (*link != Index + 1) {
+
+        FLT_ASSERT( *link != 0 );
+        link = &Shard->Entries[*link - 1].NextInBucket;
+    }
+
+    *link = entry->NextInBucket;
+    entry->NextInBucket = 0;
+}
+
+NTSTATUS
+AvCacheLookup (
+    _In_ PAV_FILE_STATE_CACHE Cache,
+    _In_ PAV_FILE_REFERENCE FileId,
+    _Out_ LONG volatile *State,
+    _Out_ PLONGLONG VolumeRevision,
+    _Out_ PLONGLONG CacheRevision,
+    _Out_ PLONGLONG FileRevision
+    )
+/*++
+
+Routine Description:
+
+    This routine looks up the state of a file in the cache. Only the
+    shard of the file is locked, and only shared.
+
+Arguments:
+
+    Cache - The cache.
+
+    FileId - The ID to lookup in the cache
+
+    State - The cached state for the file
+
+    VolumeRevision, CacheRevision, FileRevision - The cached revision
+        numbers for the file
+
+Return Value:
+
+    STATUS_SUCCESS if the file is in the cache, STATUS_NOT_FOUND otherwise.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PAV_CACHE_SHARD shard;
+    PAV_CACHE_ENTRY entry;
+    ULONG hash;
+
+    PAGED_CODE();
+
+    hash = AvCacheHash( FileId );
+    shard = &Cache->Shards[hash & (AV_CACHE_SHARD_COUNT - 1)];
+
+    FltAcquirePushLockShared( &shard->Lock );
+
+    entry = AvCacheFindEntry( shard,
+                              (hash >> AV_CACHE_SHARD_BITS) & (AV_CACHE_SHARD_CAPACITY - 1),
+                              FileId );
+
+    if (entry != NULL) {
+
+        *State = entry->InfectedState;
+        *VolumeRevision = entry->VolumeRevision;
+        *CacheRevision = entry->CacheRevision;
+        *FileRevision = entry->FileRevision;
+
+        //
+        //  Readers racing to set the bit all store the same value. Only
+        //  store it if it is clear, so hot entries do not bounce their
+        //  cache line between processors.
+        //
+
+        if (!entry->Referenced) {
+
+            entry->Referenced = TRUE;
+        }
+
+    } else {
+
+        status = STATUS_NOT_FOUND;
+    }
+
+    FltReleasePushLock( &shard->Lock );
+
+    if (NT_SUCCESS( status )) {
+
+        InterlockedIncrement64( &shard->Hits );
+
+    } else {
+
+        InterlockedIncrement64( &shard->Misses );
+    }
+
+    return status;
+}
+
+VOID
+AvCacheUpdate (
+    _In_ PAV_FILE_STATE_CACHE Cache,
+    _In_ PAV_FILE_REFERENCE FileId,
+    _In_ LONG State,
+    _In_ LONGLONG VolumeRevision,
+    _In_ LONGLONG CacheRevision,
+    _In_ LONGLONG FileRevision
+    )
+/*++
+
+Routine Description:
+
+    This routine sets the state of a file in the cache, adding the file if
+    it is not there yet.
+
+    When the shard of the file is full, the clock hand sweeps its entries,
+    clearing the referenced bit of each until it finds one that is clear.
+    That entry, not looked up since the hand last passed it, is replaced.
+
+Arguments:
+
+    Cache - The cache.
+
+    FileId - The ID of the file.
+
+    State - The state of the file.
+
+    VolumeRevision, CacheRevision, FileRevision - The revision numbers for
+        the file.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAV_CACHE_SHARD shard;
+    PAV_CACHE_ENTRY entry;
+    ULONG hash;
+    ULONG bucket;
+    ULONG index;
+
+    PAGED_CODE();
+
+    hash = AvCacheHash( FileId );
+    shard = &Cache->Shards[hash & (AV_CACHE_SHARD_COUNT - 1)];
+    bucket = (hash >> AV_CACHE_SHARD_BITS) & (AV_CACHE_SHARD_CAPACITY - 1);
+
+    FltAcquirePushLockExclusive( &shard->Lock );
+
+    entry = AvCacheFindEntry( shard, bucket, FileId );
+
+    if (entry == NULL) {
+
+        if (shard->EntryCount < AV_CACHE_SHARD_CAPACITY) {
+
+            index = shard->EntryCount;
+            shard->EntryCount += 1;
+
+        } else {
+
+            while (shard->Entries[shard->ClockHand].Referenced) {
+
+                shard->Entries[shard->ClockHand].Referenced = FALSE;
+                shard->ClockHand = (shard->ClockHand + 1) & (AV_CACHE_SHARD_CAPACITY - 1);
+            }
+
+            index = shard->ClockHand;
+            shard->ClockHand = (shard->ClockHand + 1) & (AV_CACHE_SHARD_CAPACITY - 1);
+
+            AV_DBG_PRINT( AVDBG_TRACE_ROUTINES,
+                  ("[AV] AvCacheUpdate: %I64x,%I64x evicted, state:%d\n",
+                        shard->Entries[index].FileId.FileId64.UpperZeroes,
+                        shard->Entries[index].FileId.FileId64.Value,
+                        shard->Entries[index].InfectedState) );
+
+            AvCacheUnlinkEntry( shard, index );
+            InterlockedIncrement64( &shard->Evictions );
+        }
+
+        entry = &shard->Entries[index];
+        RtlCopyMemory( &entry->FileId, FileId, sizeof(entry->FileId) );
+        entry->Referenced = FALSE;
+        entry->NextInBucket = shard->Buckets[bucket];
+        shard->Buckets[bucket] = index + 1;
+
+        InterlockedIncrement64( &shard->Insertions );
+    }
+
+    //
+    //  Note the cache may become stale as files are modified.
+    //
+
+    entry->InfectedState = State;
+    entry->VolumeRevision = VolumeRevision;
+    entry->CacheRevision = CacheRevision;
+    entry->FileRevision = FileRevision;
+
+    FltReleasePushLock( &shard->Lock );
+}
+
+VOID
+AvCacheQueryStatistics (
+    _In_ PAV_FILE_STATE_CACHE Cache,
+    _Inout_ PAV_CACHE_STATISTICS Statistics
+    )
+/*++
+
+Routine Description:
+
+    This routine adds the counters of a cache to Statistics. The counters
+    are read without locking, so they may be slightly out of step with
+    each other.
+
+Arguments:
+
+    Cache - The cache.
+
+    Statistics - The statistics to add to.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < AV_CACHE_SHARD_COUNT; i++) {
+
+        Statistics->Hits += Cache->Shards[i].Hits;
+        Statistics->Misses += Cache->Shards[i].Misses;
+        Statistics->Insertions += Cache->Shards[i].Insertions;
+        Statistics->Evictions += Cache->Shards[i].Evictions;
+        Statistics->EntryCount += Cache->Shards[i].EntryCount;
+        Statistics->Capacity += AV_CACHE_SHARD_CAPACITY;
+    }
+}
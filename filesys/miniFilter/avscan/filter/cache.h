@@ -0,0 +1,145 @@
+/*++
+
+Copyright (c) 2011  Microsoft Corporation
+
+Module Name:
+
+    cache.h
+
+Abstract:
+
+    Header file which contains the structures, type definitions,
+    constants and function prototypes of the per-volume file state
+    cache.
+
+    The cache is a hash table keyed by file ID, split into shards with
+    a lock each so that opens of different files rarely contend. Each
+    shard holds a fixed number of entries; when it is full the entry to
+    replace is chosen with the CLOCK algorithm.
+
+Environment:
+
+    Kernel mode
+
+--*/
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "avlib.h"
+
+#define AV_CACHE_TAG                         'hCvA'
+
+//
+//  Number of shards, and entries per shard. Both must be powers of 2.
+//
+
+#define AV_CACHE_SHARD_COUNT                 16
+#define AV_CACHE_SHARD_CAPACITY              512
+
+//
+//  The cache entry data structure.
+//
+
+typedef struct _AV_CACHE_ENTRY {
+
+    AV_FILE_REFERENCE FileId;
+    ULONG      InfectedState;
+
+    //
+    //  Set when the entry is looked up, cleared as the clock hand passes.
+    //
+
+    BOOLEAN    Referenced;
+
+    //
+    //  Index plus one of the next entry in the same hash bucket, or 0.
+    //
+
+    ULONG      NextInBucket;
+
+    //
+    // Revision numbers for files on CSVFS
+    //
+    LONGLONG   VolumeRevision;
+    LONGLONG   CacheRevision;
+    LONGLONG   FileRevision;
+
+} AV_CACHE_ENTRY, *PAV_CACHE_ENTRY;
+
+typedef struct DECLSPEC_CACHEALIGN _AV_CACHE_SHARD {
+
+    //
+    //  Protects the entries and buckets of the shard.
+    //
+
+    EX_PUSH_LOCK  Lock;
+
+    //
+    //  Entries in use, and the entry the clock hand is on.
+    //
+
+    ULONG      EntryCount;
+    ULONG      ClockHand;
+
+    //
+    //  AV_CACHE_SHARD_CAPACITY entries, and as many hash buckets holding
+    //  the index plus one of their first entry, or 0.
+    //
+
+    PAV_CACHE_ENTRY  Entries;
+    PULONG     Buckets;
+
+    //
+    //  Counters, updated with interlocked operations.
+    //
+
+    volatile LONG64  Hits;
+    volatile LONG64  Misses;
+    volatile LONG64  Insertions;
+    volatile LONG64  Evictions;
+
+} AV_CACHE_SHARD, *PAV_CACHE_SHARD;
+
+typedef struct _AV_FILE_STATE_CACHE {
+
+    AV_CACHE_SHARD  Shards[AV_CACHE_SHARD_COUNT];
+
+} AV_FILE_STATE_CACHE, *PAV_FILE_STATE_CACHE;
+
+NTSTATUS
+AvCreateFileStateCache (
+    _Outptr_ PAV_FILE_STATE_CACHE *Cache
+    );
+
+VOID
+AvDeleteFileStateCache (
+    _In_ _Post_invalid_ PAV_FILE_STATE_CACHE Cache
+    );
+
+NTSTATUS
+AvCacheLookup (
+    _In_ PAV_FILE_STATE_CACHE Cache,
+    _In_ PAV_FILE_REFERENCE FileId,
+    _Out_ LONG volatile *State,
+    _Out_ PLONGLONG VolumeRevision,
+    _Out_ PLONGLONG CacheRevision,
+    _Out_ PLONGLONG FileRevision
+    );
+
+VOID
+AvCacheUpdate (
+    _In_ PAV_FILE_STATE_CACHE Cache,
+    _In_ PAV_FILE_REFERENCE FileId,
+    _In_ LONG State,
+    _In_ LONGLONG VolumeRevision,
+    _In_ LONGLONG CacheRevision,
+    _In_ LONGLONG FileRevision
+    );
+
+VOID
+AvCacheQueryStatistics (
+    _In_ PAV_FILE_STATE_CACHE Cache,
+    _Inout_ PAV_CACHE_STATISTICS Statistics
+    );
+
+#endif
@@ -82,7 +82,8 @@ AvUpdateStreamContextWithScanResult (
 NTSTATUS
 AvHandleCmdCreateSectionForDataScan (
     _Inout_ PAV_SCAN_CONTEXT ScanContext,
-    _Out_ PHANDLE SectionHandle
+    _Out_ PHANDLE SectionHandle,
+    _Out_ PLONGLONG SectionSize
     );
 
 NTSTATUS
@@ -91,6 +92,11 @@ AvHandleCmdCloseSectionForDataScan (
     _In_  AVSCAN_RESULT ScanResult
     );
 
+NTSTATUS
+AvHandleCmdQueryCacheStatistics (
+    _Out_ PAV_CACHE_STATISTICS Statistics
+    );
+
 #ifdef ALLOC_PRAGMA
     #pragma alloc_text(PAGE, AvMessageNotifyCallback)
     #pragma alloc_text(PAGE, AvConnectNotifyCallback)
@@ -106,6 +112,7 @@ AvHandleCmdCloseSectionForDataScan (
     #pragma alloc_text(PAGE, AvFinalizeSectionContext)
     #pragma alloc_text(PAGE, AvHandleCmdCreateSectionForDataScan)
     #pragma alloc_text(PAGE, AvHandleCmdCloseSectionForDataScan)
+    #pragma alloc_text(PAGE, AvHandleCmdQueryCacheStatistics)
 #endif
 
 NTSTATUS
@@ -563,7 +570,8 @@ Return Value
 NTSTATUS
 AvHandleCmdCreateSectionForDataScan (
     _Inout_ PAV_SCAN_CONTEXT ScanContext,
-    _Out_ PHANDLE SectionHandle
+    _Out_ PHANDLE SectionHandle,
+    _Out_ PLONGLONG SectionSize
     )
 /*++
 
@@ -581,6 +589,7 @@ Arguments:
     ScanContext - The scan context.
     ScanThreadId - The thread ID of the thread doing the scan
     SectionHandle - receives the section handle
+    SectionSize - receives the size of the file, or 0 if it is unknown
 
 Return Value:
 
@@ -718,6 +727,7 @@ Return Value:
     ScanContext->SectionContext = sectionContext;
 
     *SectionHandle = sectionHandle;
+    *SectionSize = sectionContext->FileSize;
 
 Cleanup:
 
@@ -786,6 +796,70 @@ Cleanup:
     return status;
 }
 
+NTSTATUS
+AvHandleCmdQueryCacheStatistics (
+    _Out_ PAV_CACHE_STATISTICS Statistics
+    )
+/*++
+
+Routine Description:
+
+    This function handles AvCmdQueryCacheStatistics message.
+    It adds up the statistics of the file state caches of all the
+    instances of the filter.
+
+Arguments:
+
+    Statistics - receives the statistics
+
+Return Value:
+
+    Returns the status of processing the message.
+
+--*/
+{
+    ULONG i;
+    NTSTATUS status = STATUS_SUCCESS;
+    PFLT_INSTANCE *instArray = NULL;
+    ULONG instCnt = 0;
+    PAV_INSTANCE_CONTEXT instCtx = NULL;
+
+    PAGED_CODE();
+
+    RtlZeroMemory( Statistics, sizeof(AV_CACHE_STATISTICS) );
+
+    status = AvEnumerateInstances ( &instArray, &instCnt );
+
+    if ( !NT_SUCCESS(status) ) {
+
+        AV_DBG_PRINT( AVDBG_TRACE_ERROR,
+            ("[AV] AvHandleCmdQueryCacheStatistics: Failed to enumerate instances. \n") );
+        return status;
+    }
+
+    for (i = 0; i < instCnt; i++) {
+
+        //
+        //  An instance being set up may not have a context yet.
+        //
+
+        if (!NT_SUCCESS( FltGetInstanceContext( instArray[i], &instCtx ) )) {
+
+            continue;
+        }
+
+        if (instCtx->FileStateCache != NULL) {
+
+            AvCacheQueryStatistics( instCtx->FileStateCache, Statistics );
+        }
+
+        FltReleaseContext( instCtx );
+    }
+
+    AvFreeInstances( instArray, instCnt );
+
+    return STATUS_SUCCESS;
+}
 
 NTSTATUS
 AvUpdateStreamContextWithScanResult (
@@ -1129,6 +1203,8 @@ Return Value:
     AVSCAN_RESULT scanResult = AvScanResultUndetermined;
     PAV_STREAM_CONTEXT streamContext;
     HANDLE sectionHandle;
+    LONGLONG sectionSize = 0;
+    AV_CACHE_STATISTICS cacheStatistics;
 
     PAGED_CODE();
 
@@ -1193,17 +1269,31 @@ Return Value:
             }
 
             status = AvHandleCmdCreateSectionForDataScan( scanContext,
-                                                          &sectionHandle );
+                                                          &sectionHandle,
+                                                          &sectionSize );
 
             if (NT_SUCCESS(status)) {
                 //
                 //  We succesfully created a section object/handle.
                 //  Try to set the handle in the OutputBuffer
                 //
+                //  User programs that pass room for an AV_SECTION_INFO
+                //  also get the file size, so they can map the section
+                //  a window at a time.
+                //
                 try {
 
-                    (*(PHANDLE)OutputBuffer) = sectionHandle;
-                    *ReturnOutputBufferLength = sizeof(HANDLE);
+                    if (OutputBufferSize >= sizeof(AV_SECTION_INFO)) {
+
+                        ((PAV_SECTION_INFO)OutputBuffer)->SectionHandle = sectionHandle;
+                        ((PAV_SECTION_INFO)OutputBuffer)->SectionSize = sectionSize;
+                        *ReturnOutputBufferLength = sizeof(AV_SECTION_INFO);
+
+                    } else {
+
+                        (*(PHANDLE)OutputBuffer) = sectionHandle;
+                        *ReturnOutputBufferLength = sizeof(HANDLE);
+                    }
 
                 }  except (AvExceptionFilter( GetExceptionInformation(), TRUE )) {
                     //
@@ -1323,6 +1413,38 @@ Return Value:
 
             break;
 
+        case AvCmdQueryCacheStatistics:
+
+            if ((OutputBufferSize < sizeof (AV_CACHE_STATISTICS)) ||
+                        (OutputBuffer == NULL)) {
+
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            if (!IS_ALIGNED(OutputBuffer,TYPE_ALIGNMENT(AV_CACHE_STATISTICS))) {
+
+                return STATUS_DATATYPE_MISALIGNMENT;
+            }
+
+            status = AvHandleCmdQueryCacheStatistics( &cacheStatistics );
+
+            if (!NT_SUCCESS(status)) {
+
+                break;
+            }
+
+            try {
+
+                RtlCopyMemory( OutputBuffer, &cacheStatistics, sizeof (AV_CACHE_STATISTICS) );
+                *ReturnOutputBufferLength = (ULONG) sizeof( AV_CACHE_STATISTICS );
+
+            } except (AvExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+                status = GetExceptionCode();
+            }
+
+            break;
+
         default:
             return STATUS_INVALID_PARAMETER;
     }
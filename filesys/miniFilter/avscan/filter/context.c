@@ -235,7 +235,7 @@ Routine Description:
     In this routine, the driver has to perform any needed cleanup, such as freeing
     additional memory that the minifilter driver allocated inside the context structure.
 
-    We delete the cache table if the file system supports one.
+    We delete the file state cache if the volume has one.
 
 Arguments:
 
@@ -259,11 +259,10 @@ Return Value:
     AV_DBG_PRINT( AVDBG_TRACE_ROUTINES,
                 ( "[Av]: AvInstanceContextCleanup context cleanup entered\n") );
 
-    if (FS_SUPPORTS_FILE_STATE_CACHE( instanceContext->VolumeFSType )) {
+    if (instanceContext->FileStateCache != NULL) {
 
-        FLT_ASSERTMSG( "[AV] AvInstanceContextCleanup: The generic table should be empty at cleanup.\n",
-                        RtlIsGenericTableEmpty( &instanceContext->FileStateCacheTable ) );
-        ExDeleteResourceLite( &instanceContext->Resource );
+        AvDeleteFileStateCache( instanceContext->FileStateCache );
+        instanceContext->FileStateCache = NULL;
     }
 }
 
@@ -294,17 +294,11 @@ typedef struct _AV_INSTANCE_CONTEXT {
     FLT_FILESYSTEM_TYPE VolumeFSType;
     
     //
-    //  If the file system is NTFS, then it will support a file state cache table 
-    //  that saves the state of the file.
+    //  If the file system is NTFS, CSVFS or REFS, the cache that saves the
+    //  state of the files. NULL if the volume has no cache.
     //
     
-    RTL_GENERIC_TABLE  FileStateCacheTable;
-    
-    //
-    //  The per-instance lock to protect the cache table above.
-    //
-    
-    ERESOURCE   Resource;
+    PAV_FILE_STATE_CACHE  FileStateCache;
 
     //
     //  When set this flag indicates that the filter is attached on the
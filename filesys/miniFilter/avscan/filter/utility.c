@@ -9,8 +9,7 @@ Module Name:
 Abstract:
 
     Utility module implementation.
-    1) Generic table routines
-    2) Query file information routines
+    1) Query file information routines
 
 Environment:
 
@@ -20,134 +19,6 @@ Environment:
 
 #include "avscan.h"
 
-//
-//  Generic table routines.
-//
-
-RTL_GENERIC_COMPARE_RESULTS
-NTAPI
-AvCompareEntry (
-    _In_ PRTL_GENERIC_TABLE Table,
-    _In_ PVOID Lhs,
-    _In_ PVOID Rhs
-    )
-/*++
-
-Routine Description:
-
-    This routine is the callback for the generic table routines.
-
-Arguments:
-
-    Table       - Table for which this is invoked.
-
-    FirstStruct - An element in the table to compare.
-
-    SecondStruct - Another element in the table to compare.
-
-Return Value:
-
-    RTL_GENERIC_COMPARE_RESULTS.
-
---*/
-{
-    PAV_GENERIC_TABLE_ENTRY lhs = (PAV_GENERIC_TABLE_ENTRY)Lhs;
-    PAV_GENERIC_TABLE_ENTRY rhs = (PAV_GENERIC_TABLE_ENTRY)Rhs;
-
-    UNREFERENCED_PARAMETER (Table);
-
-    //
-    //  Compare the 128 bit fileId in 64bit pieces for efficiency.
-    //  Compare the lower 64 bits Value first since that is used
-    //  in both 128 bit and 64 bit fileIds and doing so eliminates
-    //  and unnecessary comparison of the UpperZeros field in the
-    //  most common case. Note this comparison is not equivalent
-    //  to a memcmp on the 128 bit values but that doesn't matter
-    //  here since we just need the tree to be self-consistent.
-    //
-
-    if (lhs->FileId.FileId64.Value < rhs->FileId.FileId64.Value) {
-
-        return GenericLessThan;
-
-    } else if (lhs->FileId.FileId64.Value > rhs->FileId.FileId64.Value) {
-
-        return GenericGreaterThan;
-
-    } else if (lhs->FileId.FileId64.UpperZeroes < rhs->FileId.FileId64.UpperZeroes) {
-
-        return GenericLessThan;
-
-    } else if (lhs->FileId.FileId64.UpperZeroes > rhs->FileId.FileId64.UpperZeroes) {
-
-        return GenericGreaterThan;
-    }
-
-    return GenericEqual;
-}
-
-
-PVOID
-NTAPI
-AvAllocateGenericTableEntry (
-    _In_ PRTL_GENERIC_TABLE Table,
-    _In_ CLONG ByteSize
-    )
-/*++
-
-Routine Description:
-
-    This routine is the callback for allocation for entries in the generic table.
-
-Arguments:
-
-    Table       - Table for which this is invoked.
-
-    ByteSize    - Amount of memory to allocate.
-
-Return Value:
-
-    Pointer to allocated memory if successful, else NULL.
-
---*/
-{
-
-    UNREFERENCED_PARAMETER (Table);
-
-    return ExAllocatePoolZero( PagedPool, ByteSize, AV_TABLE_ENTRY_TAG );
-}
-
-VOID
-NTAPI
-AvFreeGenericTableEntry (
-    _In_ PRTL_GENERIC_TABLE Table,
-    _In_ __drv_freesMem(Mem) _Post_invalid_ PVOID Entry
-    )
-/*++
-
-Routine Description:
-
-    This routine is the callback for releasing memory for entries in the generic
-    table.
-
-Arguments:
-
-    Table       - Table for which this is invoked.
-
-    Entry       - Entry to free.
-
-Return Value:
-
-    None.
-
---*/
-{
-
-    UNREFERENCED_PARAMETER (Table);
-
-    ExFreePoolWithTag( Entry, AV_TABLE_ENTRY_TAG );
-}
-
 //
 //  Query File Information Routines
 //
@@ -51,7 +51,8 @@ typedef enum _AVSCAN_COMMAND {
 
     AvIsFileModified,
     AvCmdCreateSectionForDataScan,
-    AvCmdCloseSectionForDataScan
+    AvCmdCloseSectionForDataScan,
+    AvCmdQueryCacheStatistics
 
 } AVSCAN_COMMAND;
 
@@ -127,6 +128,57 @@ typedef struct _COMMAND_MESSAGE {
     
 } COMMAND_MESSAGE, *PCOMMAND_MESSAGE;
 
+//
+//  Reply to AvCmdCreateSectionForDataScan.  If the output buffer is too
+//  small for this structure, only the section handle is returned.
+//
+
+typedef struct _AV_SECTION_INFO {
+
+    //
+    //  Handle of the section, to be closed by the user program
+    //
+
+    HANDLE    SectionHandle;
+
+    //
+    //  Size of the file the section maps, or 0 if it is unknown
+    //
+
+    LONGLONG  SectionSize;
+
+} AV_SECTION_INFO, *PAV_SECTION_INFO;
+
+//
+//  Reply to AvCmdQueryCacheStatistics: the file state caches of all the
+//  volumes the filter is attached to, added together.
+//
+
+typedef struct _AV_CACHE_STATISTICS {
+
+    //
+    //  Lookups that found the file, and lookups that did not
+    //
+
+    ULONGLONG  Hits;
+    ULONGLONG  Misses;
+
+    //
+    //  Files added to the caches, and files evicted to make room
+    //
+
+    ULONGLONG  Insertions;
+    ULONGLONG  Evictions;
+
+    //
+    //  Files in the caches, and the most they can hold
+    //
+
+    ULONG      EntryCount;
+    ULONG      Capacity;
+
+} AV_CACHE_STATISTICS, *PAV_CACHE_STATISTICS;
+
 //
 //  Message: Kernel -> User Message
 //
@@ -32,8 +32,8 @@ Environment:
 
 int _cdecl
 main (
-    _Unreferenced_parameter_ int argc,
-    _Unreferenced_parameter_ char *argv[]
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
     )
 /*++
 
@@ -44,7 +44,7 @@ Routine Description:
 Arguments:
 
     argc - The number of arguments
-    argv - The arguments
+    argv - The arguments, argv[1] is an optional signature file
 
 Return Value:
 
@@ -58,9 +58,10 @@ Return Value:
     HRESULT hr = S_OK;
     USER_SCAN_CONTEXT userScanCtx = {0};
 
-    UNREFERENCED_PARAMETER( argc );
-    UNREFERENCED_PARAMETER( argv );
+    if (argc > 1) {
 
+        userScanCtx.SignatureFile = argv[1];
+    }
     
     //
     //  Initialize scan listening threads.
@@ -79,12 +80,17 @@ Return Value:
     
     for(;;) {
     
-        printf("press 'q' to quit: ");
+        printf("press 's' for cache statistics, 'q' to quit: ");
         c = (unsigned char) getchar();
         if (c == 'q') {
         
             break;
         }
+        
+        if (c == 's') {
+        
+            UserScanPrintCacheStatistics(&userScanCtx);
+        }
     }
     
     //
@@ -29,6 +29,93 @@ Environment:
 
 #define  USER_SCAN_THREAD_COUNT   6      // the number of scanning worker threads.
 
+//
+//  The scan checks for an abort request each time it has scanned this
+//  many bytes.
+//
+
+#define  USER_SCAN_ABORT_CHECK_SIZE   (64 * 1024)
+
+#define  USER_SCAN_DEFAULT_SIGNATURE_NAME   "AvScan-Default"
+
+//
+//  Sections are mapped and scanned a window at a time, so that scanning
+//  a large file only keeps a few windows resident. Views have to start
+//  on an allocation granularity boundary, which is 64KB.
+//
+
+#define  USER_SCAN_WINDOW_SIZE   (4 * 1024 * 1024)
+
+C_ASSERT( (USER_SCAN_WINDOW_SIZE % (64 * 1024)) == 0 );
+
+//
+//  Completion key of the packets a worker posts to the completion port
+//  to have idle workers help with the windows of a large file. The
+//  filter's messages complete with key 0.
+//
+
+#define  USER_SCAN_WINDOW_KEY   1
+
+//
+//  The windows of one section being scanned, shared by the worker that
+//  received the scan request and the workers helping it.
+//
+
+typedef struct _USER_SCAN_WINDOWS {
+
+    //
+    //  The section, its size, and the compiled signatures
+    //
+
+    HANDLE    SectionHandle;
+    LONGLONG  SectionSize;
+    PSIG_SET  Signatures;
+
+    //
+    //  Bytes each window extends into the next one, so that signatures
+    //  crossing a window boundary are found.
+    //
+
+    ULONG     Overlap;
+
+    //
+    //  Flags to unmap the views with.
+    //
+
+    DWORD     UnmapFlags;
+
+    //
+    //  Abort flag of the worker that received the scan request.
+    //
+
+    PBOOLEAN  pAbort;
+
+    //
+    //  The next window to scan, and the number of windows.
+    //
+
+    volatile LONG  NextWindow;
+    LONG      WindowCount;
+
+    //
+    //  AvScanResultClean until a window is infected or the scan is aborted.
+    //  Every worker stops as soon as this changes.
+    //
+
+    volatile LONG  Result;
+
+    //
+    //  Number of helping workers scanning windows, and the event the last
+    //  of them sets when it is done.
+    //
+
+    volatile LONG  ActiveHelpers;
+    HANDLE    IdleEvent;
+
+    volatile LONG  ReferenceCount;
+
+} USER_SCAN_WINDOWS, *PUSER_SCAN_WINDOWS;
+
 typedef struct _SCANNER_MESSAGE {
 
     //
@@ -78,13 +165,43 @@ typedef struct _SCANNER_REPLY_MESSAGE {
 //  Local routines
 //
 
+HRESULT
+UserScanLoadSignatures (
+    _Inout_  PUSER_SCAN_CONTEXT Context
+    );
+
 AVSCAN_RESULT
 UserScanMemoryStream(
+    _In_                      PSIG_SET Signatures,
     _In_reads_bytes_(Size)    PUCHAR   StartingAddress,
     _In_                      SIZE_T   Size,
     _Inout_                   PBOOLEAN pAbort
     );
     
+AVSCAN_RESULT
+UserScanSection (
+    _In_  PUSER_SCAN_CONTEXT Context,
+    _In_  HANDLE SectionHandle,
+    _In_  LONGLONG SectionSize,
+    _In_  DWORD UnmapFlags,
+    _In_  PSCANNER_THREAD_CONTEXT ThreadCtx
+    );
+
+VOID
+UserScanWindows (
+    _Inout_  PUSER_SCAN_WINDOWS Windows
+    );
+
+VOID
+UserScanHelpWithWindows (
+    _Inout_  PUSER_SCAN_WINDOWS Windows
+    );
+
+VOID
+UserScanReleaseWindows (
+    _Inout_  PUSER_SCAN_WINDOWS Windows
+    );
+
 HRESULT 
 UserScanHandleStartScanMsg(
     _In_  PUSER_SCAN_CONTEXT Context,
@@ -168,6 +285,18 @@ Return Value:
         return MAKE_HRESULT(SEVERITY_ERROR, 0, E_POINTER);
     }
     
+    //
+    //  Compile the signatures before any scan thread can use them.
+    //
+    
+    hr = UserScanLoadSignatures( Context );
+    if (FAILED(hr)) {
+    
+        fprintf(stderr, "[UserScanInit]: Failed to load the signatures.\n");
+        DisplayError(hr);
+        return hr;
+    }
+    
     //
     //  Create the abort listening thead.
     //  This thread is particularly listening the abortion event.
@@ -355,6 +484,9 @@ Cleanup:
         DisplayError(HRESULT_FROM_WIN32(GetLastError()));
     }
     
+    SigDeleteSet( Context->Signatures );
+    Context->Signatures = NULL;
+    
     return hr;
 }
 
@@ -395,6 +527,59 @@ Return Value:
     return hr;
 }
 
+HRESULT
+UserScanPrintCacheStatistics (
+    _In_  PUSER_SCAN_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    This routine asks the filter for the statistics of its file state
+    caches and prints them.
+
+Arguments:
+
+    Context    - User scan context, please see userscan.h
+
+Return Value:
+
+    S_OK if successful. Otherwise, it returns a HRESULT error value.
+
+--*/
+{
+    HRESULT  hr = S_OK;
+    DWORD    bytesReturned = 0;
+    COMMAND_MESSAGE commandMessage = {0};
+    AV_CACHE_STATISTICS statistics = {0};
+
+    commandMessage.Command = AvCmdQueryCacheStatistics;
+
+    hr = FilterSendMessage( Context->ConnectionPort,
+                            &commandMessage,
+                            sizeof( COMMAND_MESSAGE ),
+                            &statistics,
+                            sizeof( AV_CACHE_STATISTICS ),
+                            &bytesReturned );
+
+    if (FAILED(hr)) {
+
+        fprintf(stderr, "[UserScanPrintCacheStatistics]: Failed to query the cache statistics.\n");
+        DisplayError(hr);
+        return hr;
+    }
+
+    printf("File state cache: %u of %u entries, %I64u hits, %I64u misses, %I64u insertions, %I64u evictions\n",
+           statistics.EntryCount,
+           statistics.Capacity,
+           statistics.Hits,
+           statistics.Misses,
+           statistics.Insertions,
+           statistics.Evictions);
+
+    return hr;
+}
+
 
 //
 //  Implementation of local routines
@@ -630,52 +815,48 @@ Return Value:
     }
     HeapFree( GetProcessHeap(), 0, scanThreadCtxes );
     Context->ScanThreadCtxes = NULL;
+    
+    SigDeleteSet( Context->Signatures );
+    Context->Signatures = NULL;
     return hr;
 }
 
-AVSCAN_RESULT
-UserScanMemoryStream(
-    _In_reads_bytes_(Size)    PUCHAR   StartingAddress,
-    _In_                      SIZE_T   Size,
-    _Inout_                   PBOOLEAN pAbort
+HRESULT
+UserScanLoadSignatures (
+    _Inout_  PUSER_SCAN_CONTEXT Context
     )
 /*++
 
 Routine Description:
 
-    This routine is a naive search for virus signiture. 
-    Note that this function is by no means efficient and scalable, but 
-    this is not the focus of this example. Thus, an anti-virus 
-    vendor may want to focus on and expand this function.
-
-    It will reset the abort flag if it is aborted.
+    This routine builds the signature set used by all the scan threads.
+    It holds the default signature, decoded once here rather than on
+    every scan, plus the signatures of Context->SignatureFile if any.
 
 Arguments:
 
-    StartingAddress  - The starting address of the memory to be searched.
-    
-    Size   -  The size of the memory.
-    
-    pAbort  -  A pointer to a boolean that notifies the scanning should be canceled..
-    
-    Infected - TRUE if this file is infected. FALSE, otherwise.
+    Context    - User scan context, please see userscan.h
 
 Return Value:
-    
-    S_OK.
-    
+
+    S_OK if successful. Otherwise, it returns a HRESULT error value.
+
 --*/
 {
-    ULONG i;
+    HRESULT  hr = S_OK;
     UCHAR targetString[AV_DEFAULT_SEARCH_PATTERN_SIZE] = {0};
-    SIZE_T searchStringLength = AV_DEFAULT_SEARCH_PATTERN_SIZE-1;
+    ULONG searchStringLength = AV_DEFAULT_SEARCH_PATTERN_SIZE-1;
     ULONG ind;
-    PUCHAR p;
-    PUCHAR start = StartingAddress;
-    PUCHAR end = start + Size - searchStringLength;
+    PSIG_SET signatures = NULL;
+
+    hr = SigCreateSet( &signatures );
+    if (FAILED(hr)) {
+
+        return hr;
+    }
 
     //
-    //  Decode the target pattern. We could decode only once and cache it.
+    //  Decode the default pattern.
     //
     
     CopyMemory( (PVOID) targetString, 
@@ -688,16 +869,90 @@ Return Value:
          
          targetString[ind] = ((UCHAR)targetString[ind]) ^ AV_DEFAULT_PATTERN_XOR_KEY;
     }
-    targetString[searchStringLength] = '\0';
+
+    hr = SigAddPattern( signatures,
+                        USER_SCAN_DEFAULT_SIGNATURE_NAME,
+                        targetString,
+                        searchStringLength );
+    if (FAILED(hr)) {
+
+        goto Cleanup;
+    }
+
+    if (Context->SignatureFile != NULL) {
+
+        hr = SigAddPatternsFromFile( signatures, Context->SignatureFile );
+        if (FAILED(hr)) {
+
+            goto Cleanup;
+        }
+    }
+
+    hr = SigCompileSet( signatures );
+    if (FAILED(hr)) {
+
+        goto Cleanup;
+    }
+
+    Context->Signatures = signatures;
+    signatures = NULL;
+
+Cleanup:
+
+    SigDeleteSet( signatures );
+
+    return hr;
+}
+
+AVSCAN_RESULT
+UserScanMemoryStream(
+    _In_                      PSIG_SET Signatures,
+    _In_reads_bytes_(Size)    PUCHAR   StartingAddress,
+    _In_                      SIZE_T   Size,
+    _Inout_                   PBOOLEAN pAbort
+    )
+/*++
+
+Routine Description:
+
+    This routine searches the memory for all the signatures at once.
+    The memory is scanned in USER_SCAN_ABORT_CHECK_SIZE pieces so that an
+    abort request is noticed without having to check for it on every byte.
+
+    It will reset the abort flag if it is aborted.
+
+Arguments:
+
+    Signatures  - The compiled signature set.
+
+    StartingAddress  - The starting address of the memory to be searched.
+    
+    Size   -  The size of the memory.
+    
+    pAbort  -  A pointer to a boolean that notifies the scanning should be canceled..
+
+Return Value:
+    
+    AvScanResultInfected if a signature is found, AvScanResultUndetermined
+    if the scan was aborted, AvScanResultClean otherwise.
+    
+--*/
+{
+    SIG_SCAN_STATE scanState;
+    SIG_MATCH match;
+    SIZE_T offset;
+    SIZE_T length;
+
+    SigInitializeScanState( &scanState );
     
     //
-    //  Scan the memory stream for the target pattern.
+    //  Scan the memory stream for the signatures.
     //  If not cancelled.
     //
     
-    for (p = start, i = 1;
-         p <= end ;
-         p++, i++) {
+    for (offset = 0;
+         offset < Size;
+         offset += length) {
 
         //
         //  If (*pAbort == TRUE), then we abort the scanning in the loop.
@@ -708,9 +963,17 @@ Return Value:
             *pAbort = FALSE;
             return AvScanResultUndetermined;
         }
-        
-        if ( !memcmp( p, targetString, searchStringLength )) {
 
+        length = min( Size - offset, USER_SCAN_ABORT_CHECK_SIZE );
+        
+        if (SigScanBuffer( Signatures,
+                           &scanState,
+                           StartingAddress + offset,
+                           length,
+                           &match )) {
+
+            printf( "[UserScanMemoryStream]: Found signature %s.\n",
+                    SigGetPatternName( Signatures, match.PatternIndex ) );
             return AvScanResultInfected;
         }
     }
@@ -718,6 +981,310 @@ Return Value:
     return AvScanResultClean;
 }
 
+AVSCAN_RESULT
+UserScanSection (
+    _In_  PUSER_SCAN_CONTEXT Context,
+    _In_  HANDLE SectionHandle,
+    _In_  LONGLONG SectionSize,
+    _In_  DWORD UnmapFlags,
+    _In_  PSCANNER_THREAD_CONTEXT ThreadCtx
+    )
+/*++
+
+Routine Description:
+
+    This routine scans a section a window at a time, so that only the
+    windows being scanned are mapped.
+
+    If the section has more than one window, it posts packets to the
+    completion port so that idle scan workers help, each scanning
+    whichever window is next. Whichever worker finds a signature or
+    notices the scan was aborted stops the others.
+
+    It will reset the abort flag if it is aborted.
+
+Arguments:
+
+    Context   - The user scan context.
+
+    SectionHandle  - The section to scan.
+
+    SectionSize  - The size of the file the section maps.
+
+    UnmapFlags  - Flags to unmap the views with.
+
+    ThreadCtx - The scan thread context of the calling worker.
+
+Return Value:
+
+    AvScanResultInfected if a signature is found, AvScanResultUndetermined
+    if the scan was aborted or failed, AvScanResultClean otherwise.
+
+--*/
+{
+    PUSER_SCAN_WINDOWS windows;
+    LONGLONG windowCount;
+    LONG helpers;
+    LONG i;
+    AVSCAN_RESULT result;
+
+    windowCount = (SectionSize + USER_SCAN_WINDOW_SIZE - 1) / USER_SCAN_WINDOW_SIZE;
+
+    if (windowCount > MAXLONG) {
+
+        return AvScanResultUndetermined;
+    }
+
+    windows = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(USER_SCAN_WINDOWS) );
+    if (NULL == windows) {
+
+        fprintf(stderr, "[UserScanSection]: Failed to allocate the scan windows.\n");
+        return AvScanResultUndetermined;
+    }
+
+    windows->IdleEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+    if (NULL == windows->IdleEvent) {
+
+        fprintf(stderr, "[UserScanSection]: Failed to create the idle event.\n");
+        DisplayError(HRESULT_FROM_WIN32(GetLastError()));
+        HeapFree( GetProcessHeap(), 0, windows );
+        return AvScanResultUndetermined;
+    }
+
+    windows->SectionHandle = SectionHandle;
+    windows->SectionSize = SectionSize;
+    windows->Signatures = Context->Signatures;
+    windows->Overlap = SigGetMaxPatternLength( Context->Signatures ) - 1;
+    windows->UnmapFlags = UnmapFlags;
+    windows->pAbort = &ThreadCtx->Aborted;
+    windows->WindowCount = (LONG)windowCount;
+    windows->Result = AvScanResultClean;
+    windows->ReferenceCount = 1;
+
+    //
+    //  Ask for as many helpers as there are other windows, up to the
+    //  number of other workers.
+    //
+
+    helpers = min( windows->WindowCount - 1, USER_SCAN_THREAD_COUNT - 1 );
+
+    for (i = 0; i < helpers; i++) {
+
+        InterlockedIncrement( &windows->ReferenceCount );
+
+        if (!PostQueuedCompletionStatus( Context->Completion,
+                                         0,
+                                         USER_SCAN_WINDOW_KEY,
+                                         (LPOVERLAPPED)windows )) {
+
+            UserScanReleaseWindows( windows );
+            break;
+        }
+    }
+
+    UserScanWindows( windows );
+
+    //
+    //  Make sure no helper starts another window, then wait for those
+    //  still scanning one. Helpers that get their packet later find no
+    //  window left and only drop their reference.
+    //
+
+    InterlockedExchange( &windows->NextWindow, windows->WindowCount );
+
+    while (windows->ActiveHelpers != 0) {
+
+        WaitForSingleObject( windows->IdleEvent, INFINITE );
+    }
+
+    result = (AVSCAN_RESULT)windows->Result;
+
+    if (result == AvScanResultUndetermined) {
+
+        ThreadCtx->Aborted = FALSE;
+    }
+
+    UserScanReleaseWindows( windows );
+
+    return result;
+}
+
+VOID
+UserScanWindows (
+    _Inout_  PUSER_SCAN_WINDOWS Windows
+    )
+/*++
+
+Routine Description:
+
+    This routine scans windows of a section until there is none left or
+    the scan of the section is over.
+
+    Each window is scanned with a fresh scan state and extends Overlap bytes
+    into the next one, so every signature starting in a window is found
+    whichever worker scans the next window.
+
+Arguments:
+
+    Windows   - The windows of the section.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    LONG window;
+    LONGLONG offset;
+    SIZE_T length;
+    SIZE_T scanned;
+    SIZE_T piece;
+    PUCHAR view;
+    SIG_SCAN_STATE scanState;
+    SIG_MATCH match;
+    AVSCAN_RESULT result;
+
+    while (Windows->Result == AvScanResultClean) {
+
+        window = InterlockedIncrement( &Windows->NextWindow ) - 1;
+
+        if (window >= Windows->WindowCount) {
+
+            break;
+        }
+
+        offset = (LONGLONG)window * USER_SCAN_WINDOW_SIZE;
+        length = (SIZE_T)min( Windows->SectionSize - offset,
+                              (LONGLONG)USER_SCAN_WINDOW_SIZE + Windows->Overlap );
+
+        view = MapViewOfFile( Windows->SectionHandle,
+                              FILE_MAP_READ,
+                              (DWORD)(offset >> 32),
+                              (DWORD)offset,
+                              length );
+        if (NULL == view) {
+
+            fprintf(stderr, "[UserScanWindows]: Failed to map the view.\n");
+            DisplayError(HRESULT_FROM_WIN32(GetLastError()));
+            InterlockedCompareExchange( &Windows->Result, AvScanResultUndetermined, AvScanResultClean );
+            break;
+        }
+
+        result = AvScanResultClean;
+        SigInitializeScanState( &scanState );
+
+        for (scanned = 0;
+             scanned < length;
+             scanned += piece) {
+
+            //
+            //  Stop as soon as the scan is aborted or another window is
+            //  infected.
+            //
+
+            if (*Windows->pAbort) {
+
+                result = AvScanResultUndetermined;
+                break;
+            }
+
+            if (Windows->Result != AvScanResultClean) {
+
+                break;
+            }
+
+            piece = min( length - scanned, USER_SCAN_ABORT_CHECK_SIZE );
+
+            if (SigScanBuffer( Windows->Signatures,
+                               &scanState,
+                               view + scanned,
+                               piece,
+                               &match )) {
+
+                printf( "[UserScanWindows]: Found signature %s at offset %I64d.\n",
+                        SigGetPatternName( Windows->Signatures, match.PatternIndex ),
+                        offset + (LONGLONG)match.EndOffset );
+                result = AvScanResultInfected;
+                break;
+            }
+        }
+
+        if (!UnmapViewOfFileEx( view, Windows->UnmapFlags )) {
+
+            fprintf(stderr, "[UserScanWindows]: Failed to unmap the view.\n");
+            DisplayError(HRESULT_FROM_WIN32(GetLastError()));
+        }
+
+        if (result != AvScanResultClean) {
+
+            InterlockedCompareExchange( &Windows->Result, result, AvScanResultClean );
+            break;
+        }
+    }
+}
+
+VOID
+UserScanHelpWithWindows (
+    _Inout_  PUSER_SCAN_WINDOWS Windows
+    )
+/*++
+
+Routine Description:
+
+    This routine is called by a scan worker that dequeued a packet posted
+    by UserScanSection(...). It scans windows of the section and then drops
+    the reference the packet held.
+
+Arguments:
+
+    Windows   - The windows of the section.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    InterlockedIncrement( &Windows->ActiveHelpers );
+
+    UserScanWindows( Windows );
+
+    if (InterlockedDecrement( &Windows->ActiveHelpers ) == 0) {
+
+        SetEvent( Windows->IdleEvent );
+    }
+
+    UserScanReleaseWindows( Windows );
+}
+
+VOID
+UserScanReleaseWindows (
+    _Inout_  PUSER_SCAN_WINDOWS Windows
+    )
+/*++
+
+Routine Description:
+
+    This routine drops a reference to the windows of a section, and frees
+    them with the last reference.
+
+Arguments:
+
+    Windows   - The windows of the section.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    if (InterlockedDecrement( &Windows->ReferenceCount ) == 0) {
+
+        CloseHandle( Windows->IdleEvent );
+        HeapFree( GetProcessHeap(), 0, Windows );
+    }
+}
+
 HRESULT
 UserScanHandleStartScanMsg(
     _In_  PUSER_SCAN_CONTEXT Context,
@@ -742,6 +1309,9 @@ Routine Description:
     4) Send message to tell the filter the result of the scan
        and close the section object.
 
+    If the filter tells us the size of the file, steps 2 and 3 are done a
+    window at a time by UserScanSection(...) instead.
+
 Arguments:
 
     Context   - The user scan context.
@@ -758,6 +1328,7 @@ Return Value:
 {
     HRESULT  hr = S_OK;
     ULONG    bytesReturned = 0;
+    AV_SECTION_INFO sectionInfo = {0};
     HANDLE   sectionHandle = NULL;
     PVOID    scanAddress = NULL;
     MEMORY_BASIC_INFORMATION memoryInfo;
@@ -780,8 +1351,8 @@ Return Value:
     hr = FilterSendMessage( Context->ConnectionPort,
                             &commandMessage,
                             sizeof( COMMAND_MESSAGE ),
-                            &sectionHandle,
-                            sizeof( HANDLE ),
+                            &sectionInfo,
+                            sizeof( AV_SECTION_INFO ),
                             &bytesReturned );
 
     if (FAILED(hr)) {
@@ -792,6 +1363,33 @@ Return Value:
         return hr;
     }
 
+    sectionHandle = sectionInfo.SectionHandle;
+
+    //
+    //  If scanning on file open, give the pages a transient boost
+    //  since they may soon be accessed in read operations on the 
+    //  file. 
+    //
+
+    if (notification->Reason == AvScanOnOpen) {
+        flags = MEM_UNMAP_WITH_TRANSIENT_BOOST;
+    }
+
+    //
+    //  Scan the section a window at a time if we know its size.
+    //
+
+    if ((bytesReturned >= sizeof( AV_SECTION_INFO )) &&
+        (sectionInfo.SectionSize > 0)) {
+
+        commandMessage.ScanResult = UserScanSection( Context,
+                                                     sectionHandle,
+                                                     sectionInfo.SectionSize,
+                                                     flags,
+                                                     ThreadCtx );
+        goto Cleanup;
+    }
+
     scanAddress = MapViewOfFile( sectionHandle,
                                  FILE_MAP_READ,
                                  0L,
@@ -813,20 +1411,11 @@ Return Value:
     //  Data scan here.
     //
 
-    commandMessage.ScanResult = UserScanMemoryStream( (PUCHAR)scanAddress, 
+    commandMessage.ScanResult = UserScanMemoryStream( Context->Signatures,
+                                                       (PUCHAR)scanAddress, 
                                                        memoryInfo.RegionSize,
                                                        &ThreadCtx->Aborted );
 
-    //
-    //  If scanning on file open, give the pages a transient boost
-    //  since they may soon be accessed in read operations on the 
-    //  file. 
-    //
-
-    if (notification->Reason == AvScanOnOpen) {
-        flags = MEM_UNMAP_WITH_TRANSIENT_BOOST;
-    }
-
 Cleanup:
 
     if (scanAddress != NULL) {
@@ -886,6 +1475,8 @@ Routine Description:
     
     while(TRUE) {
         1) Get a overlap structure from the completion port.
+           If it is a request for help with the windows of a large file,
+           scan windows and start over.
         2) Obtain message from overlap structure.
         3) Process the message via calling UserScanHandleStartScanMsg(...)
         4) Pump overlap structure into completion port using FilterGetMessage(...)
@@ -963,6 +1554,18 @@ Return Value:
             break;
         }
         
+        //
+        //  Another worker wants help scanning the windows of a large file.
+        //  This packet did not consume one of our messages, so there is
+        //  nothing to pump back.
+        //
+
+        if (key == USER_SCAN_WINDOW_KEY) {
+
+            UserScanHelpWithWindows( (PUSER_SCAN_WINDOWS)pOvlp );
+            continue;
+        }
+
         //
         //  Recover message strcuture from overlapped structure.
         //  Remember we embedded overlapped structure inside SCANNER_MESSAGE.
@@ -23,6 +23,7 @@ Environment:
 #include <windows.h>
 #include <fltUser.h>
 #include "avlib.h"
+#include "sigscan.h"
 
 #ifndef MAKE_HRESULT
 #define MAKE_HRESULT(sev,fac,code) \
@@ -95,6 +96,19 @@ typedef struct _USER_SCAN_CONTEXT {
     
     HANDLE   Completion;
 
+    //
+    //  Optional signature file to load in addition to the default
+    //  signature, set by the caller before UserScanInit(...)
+    //
+
+    PCSTR    SignatureFile;
+
+    //
+    //  The compiled signatures, shared by all the scan threads
+    //
+
+    PSIG_SET Signatures;
+
 } USER_SCAN_CONTEXT, *PUSER_SCAN_CONTEXT;
     
 HRESULT UserScanInit (
@@ -105,5 +119,9 @@ HRESULT UserScanFinalize (
     _In_  PUSER_SCAN_CONTEXT Context
     );
 
+HRESULT UserScanPrintCacheStatistics (
+    _In_  PUSER_SCAN_CONTEXT Context
+    );
+
 #endif
 
@@ -0,0 +1,913 @@
+/*++
+
+Copyright (c) 2011  Microsoft Corporation
+
+Module Name:
+
+    sigscan.c
+
+Abstract:
+
+    The signature scanning engine shared by the scanner and avscan user
+    programs.
+
+    Patterns are compiled into an Aho-Corasick automaton stored as a full
+    transition table, so scanning costs one table lookup per byte however
+    many patterns there are.  To keep the table small, bytes that appear
+    in no pattern share a single input class.
+
+    Most of a clean buffer is scanned from the initial state, where only
+    the first byte of some pattern leaves that state.  There we skip ahead
+    to the next such byte, 16 bytes at a time with SSE2 when the patterns
+    start with only a few distinct bytes.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include "sigscan.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#include <intrin.h>
+#endif
+
+//
+//  Longest signature file line we accept.
+//
+
+#define SIG_MAX_LINE_LENGTH         (SIG_MAX_NAME_LENGTH + (3 * SIG_MAX_PATTERN_LENGTH) + 16)
+
+typedef struct _SIG_PATTERN {
+
+    PUCHAR Bytes;
+    ULONG Length;
+    CHAR Name[SIG_MAX_NAME_LENGTH];
+
+} SIG_PATTERN, *PSIG_PATTERN;
+
+struct _SIG_SET {
+
+    //
+    //  The patterns added to the set.
+    //
+
+    PSIG_PATTERN Patterns;
+    ULONG PatternCount;
+    ULONG PatternCapacity;
+    ULONG TotalLength;
+    ULONG MaxPatternLength;
+
+    //
+    //  The compiled automaton.  Next holds ClassCount transitions for each
+    //  state, Match the index plus one of a pattern ending in each state,
+    //  or zero.  State zero is the initial state.
+    //
+
+    BOOLEAN Compiled;
+    ULONG StateCount;
+    ULONG ClassCount;
+    USHORT ClassMap[256];
+    PULONG Next;
+    PULONG Match;
+
+    //
+    //  The bytes that leave the initial state.
+    //
+
+    BOOLEAN StartByte[256];
+    ULONG FirstByteCount;
+    UCHAR FirstBytes[SIG_PREFILTER_MAX_BYTES];
+};
+
+//
+//  Local routines
+//
+
+CONST UCHAR *
+SigSkipToStartByte (
+    _In_ PSIG_SET Set,
+    _In_ CONST UCHAR *Current,
+    _In_ CONST UCHAR *End
+    );
+
+LONG
+SigHexValue (
+    _In_ CHAR Digit
+    );
+
+HRESULT
+SigCreateSet (
+    _Outptr_ PSIG_SET *Set
+    )
+/*++
+
+Routine Description:
+
+    Creates an empty signature set.
+
+Arguments:
+
+    Set - Receives the new set.
+
+Return Value:
+
+    S_OK or E_OUTOFMEMORY.
+
+--*/
+{
+    *Set = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof( SIG_SET ) );
+
+    if (NULL == *Set) {
+
+        return E_OUTOFMEMORY;
+    }
+
+    return S_OK;
+}
+
+VOID
+SigDeleteSet (
+    _In_opt_ PSIG_SET Set
+    )
+/*++
+
+Routine Description:
+
+    Frees a signature set.
+
+Arguments:
+
+    Set - The set to free.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG i;
+
+    if (NULL == Set) {
+
+        return;
+    }
+
+    for (i = 0; i < Set->PatternCount; i++) {
+
+        HeapFree( GetProcessHeap(), 0, Set->Patterns[i].Bytes );
+    }
+
+    if (Set->Patterns) {
+
+        HeapFree( GetProcessHeap(), 0, Set->Patterns );
+    }
+
+    if (Set->Next) {
+
+        HeapFree( GetProcessHeap(), 0, Set->Next );
+    }
+
+    if (Set->Match) {
+
+        HeapFree( GetProcessHeap(), 0, Set->Match );
+    }
+
+    HeapFree( GetProcessHeap(), 0, Set );
+}
+
+HRESULT
+SigAddPattern (
+    _Inout_ PSIG_SET Set,
+    _In_z_ PCSTR Name,
+    _In_reads_bytes_(Length) CONST UCHAR *Pattern,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Adds a pattern to a set that has not been compiled yet.
+
+Arguments:
+
+    Set - The set to add to.
+
+    Name - The name reported for the pattern.  It is truncated to
+        SIG_MAX_NAME_LENGTH - 1 characters.
+
+    Pattern - The bytes to look for.
+
+    Length - The number of bytes in Pattern, from 1 to SIG_MAX_PATTERN_LENGTH.
+
+Return Value:
+
+    S_OK, E_INVALIDARG, E_OUTOFMEMORY, or ERROR_INVALID_STATE if the set is
+    already compiled.
+
+--*/
+{
+    PSIG_PATTERN patterns;
+    PSIG_PATTERN pattern;
+    ULONG capacity;
+
+    if (Set->Compiled) {
+
+        return HRESULT_FROM_WIN32( ERROR_INVALID_STATE );
+    }
+
+    if ((Length == 0) || (Length > SIG_MAX_PATTERN_LENGTH)) {
+
+        return E_INVALIDARG;
+    }
+
+    if (Set->PatternCount == Set->PatternCapacity) {
+
+        capacity = (Set->PatternCapacity == 0) ? 16 : Set->PatternCapacity * 2;
+
+        if (Set->Patterns == NULL) {
+
+            patterns = HeapAlloc( GetProcessHeap(), 0, capacity * sizeof( SIG_PATTERN ) );
+
+        } else {
+
+            patterns = HeapReAlloc( GetProcessHeap(), 0, Set->Patterns, capacity * sizeof( SIG_PATTERN ) );
+        }
+
+        if (NULL == patterns) {
+
+            return E_OUTOFMEMORY;
+        }
+
+        Set->Patterns = patterns;
+        Set->PatternCapacity = capacity;
+    }
+
+    pattern = &Set->Patterns[Set->PatternCount];
+
+    pattern->Bytes = HeapAlloc( GetProcessHeap(), 0, Length );
+
+    if (NULL == pattern->Bytes) {
+
+        return E_OUTOFMEMORY;
+    }
+
+    CopyMemory( pattern->Bytes, Pattern, Length );
+    pattern->Length = Length;
+    strncpy_s( pattern->Name, sizeof( pattern->Name ), Name, _TRUNCATE );
+
+    Set->PatternCount += 1;
+    Set->TotalLength += Length;
+
+    if (Length > Set->MaxPatternLength) {
+
+        Set->MaxPatternLength = Length;
+    }
+
+    return S_OK;
+}
+
+HRESULT
+SigAddPatternsFromFile (
+    _Inout_ PSIG_SET Set,
+    _In_z_ PCSTR FileName
+    )
+/*++
+
+Routine Description:
+
+    Adds the patterns of a signature file to a set that has not been
+    compiled yet.  See sigscan.h for the file format.
+
+Arguments:
+
+    Set - The set to add to.
+
+    FileName - The signature file.
+
+Return Value:
+
+    S_OK, ERROR_INVALID_DATA if a line of the file is not a valid signature,
+    or the reason the file could not be read or the patterns added.
+
+--*/
+{
+    CHAR line[SIG_MAX_LINE_LENGTH];
+    CHAR name[SIG_MAX_NAME_LENGTH];
+    UCHAR pattern[SIG_MAX_PATTERN_LENGTH];
+    FILE *file = NULL;
+    PCHAR p;
+    PCHAR start;
+    PCHAR end;
+    ULONG length;
+    ULONG lineNumber = 0;
+    LONG high, low;
+    HRESULT hr = S_OK;
+
+    if (fopen_s( &file, FileName, "r" ) != 0) {
+
+        fprintf(stderr, "[SigAddPatternsFromFile]: Failed to open %s.\n", FileName);
+        return HRESULT_FROM_WIN32( ERROR_FILE_NOT_FOUND );
+    }
+
+    while (fgets( line, sizeof( line ), file ) != NULL) {
+
+        lineNumber += 1;
+
+        if ((strchr( line, '\n' ) == NULL) && !feof( file )) {
+
+            hr = HRESULT_FROM_WIN32( ERROR_INVALID_DATA );
+            break;
+        }
+
+        p = line;
+
+        while (isspace( (UCHAR)*p )) {
+
+            p++;
+        }
+
+        if ((*p == '\0') || (*p == '#')) {
+
+            continue;
+        }
+
+        //
+        //  The name runs up to the first white space.
+        //
+
+        start = p;
+
+        while ((*p != '\0') && !isspace( (UCHAR)*p )) {
+
+            p++;
+        }
+
+        if ((ULONG)(p - start) >= SIG_MAX_NAME_LENGTH) {
+
+            hr = HRESULT_FROM_WIN32( ERROR_INVALID_DATA );
+            break;
+        }
+
+        CopyMemory( name, start, p - start );
+        name[p - start] = '\0';
+
+        while (isspace( (UCHAR)*p )) {
+
+            p++;
+        }
+
+        length = 0;
+
+        if (*p == '"') {
+
+            start = p + 1;
+            end = strrchr( start, '"' );
+
+            if ((end == NULL) || ((ULONG)(end - start) > SIG_MAX_PATTERN_LENGTH)) {
+
+                hr = HRESULT_FROM_WIN32( ERROR_INVALID_DATA );
+                break;
+            }
+
+            length = (ULONG)(end - start);
+            CopyMemory( pattern, start, length );
+
+        } else {
+
+            while (*p != '\0') {
+
+                if (isspace( (UCHAR)*p )) {
+
+                    p++;
+                    continue;
+                }
+
+                high = SigHexValue( p[0] );
+                low = (high < 0) ? -1 : SigHexValue( p[1] );
+
+                if ((low < 0) || (length == SIG_MAX_PATTERN_LENGTH)) {
+
+                    hr = HRESULT_FROM_WIN32( ERROR_INVALID_DATA );
+                    break;
+                }
+
+                pattern[length++] = (UCHAR)((high << 4) | low);
+                p += 2;
+            }
+
+            if (FAILED(hr)) {
+
+                break;
+            }
+        }
+
+        if (length == 0) {
+
+            hr = HRESULT_FROM_WIN32( ERROR_INVALID_DATA );
+            break;
+        }
+
+        hr = SigAddPattern( Set, name, pattern, length );
+
+        if (FAILED(hr)) {
+
+            break;
+        }
+    }
+
+    if (hr == HRESULT_FROM_WIN32( ERROR_INVALID_DATA )) {
+
+        fprintf(stderr, "[SigAddPatternsFromFile]: %s(%u): Invalid signature.\n", FileName, lineNumber);
+    }
+
+    fclose( file );
+
+    return hr;
+}
+
+HRESULT
+SigCompileSet (
+    _Inout_ PSIG_SET Set
+    )
+/*++
+
+Routine Description:
+
+    Compiles the patterns of a set into its automaton.  Once compiled, the
+    set can no longer be changed and can be used by any number of threads
+    at once.
+
+    The patterns are first laid out as a trie.  Then, breadth first, each
+    state gets a failure link to the state for the longest proper suffix of
+    its path that is also in the trie, inherits the match of that state if
+    it has none of its own, and has its missing transitions copied from it.
+
+Arguments:
+
+    Set - The set to compile.
+
+Return Value:
+
+    S_OK, E_OUTOFMEMORY or ERROR_INVALID_STATE if the set is already
+    compiled.
+
+--*/
+{
+    BOOLEAN used[256] = {0};
+    PULONG next = NULL;
+    PULONG match = NULL;
+    PULONG fail = NULL;
+    PULONG queue = NULL;
+    ULONG maxStates;
+    ULONG stateCount = 1;
+    ULONG classCount = 1;
+    ULONG head = 0;
+    ULONG tail = 0;
+    ULONG state;
+    ULONG target;
+    ULONG i, j, c;
+    ULONGLONG tableSize;
+    HRESULT hr = S_OK;
+
+    if (Set->Compiled) {
+
+        return HRESULT_FROM_WIN32( ERROR_INVALID_STATE );
+    }
+
+    //
+    //  Give each byte used by a pattern its own input class.
+    //
+
+    for (i = 0; i < Set->PatternCount; i++) {
+
+        for (j = 0; j < Set->Patterns[i].Length; j++) {
+
+            used[Set->Patterns[i].Bytes[j]] = TRUE;
+        }
+    }
+
+    for (c = 0; c < 256; c++) {
+
+        Set->ClassMap[c] = used[c] ? (USHORT)classCount++ : 0;
+    }
+
+    maxStates = Set->TotalLength + 1;
+    tableSize = (ULONGLONG)maxStates * classCount * sizeof( ULONG );
+
+    if (tableSize != (SIZE_T)tableSize) {
+
+        return E_OUTOFMEMORY;
+    }
+
+    next = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY, (SIZE_T)tableSize );
+    match = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY, maxStates * sizeof( ULONG ) );
+    fail = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY, maxStates * sizeof( ULONG ) );
+    queue = HeapAlloc( GetProcessHeap(), 0, maxStates * sizeof( ULONG ) );
+
+    if ((NULL == next) || (NULL == match) || (NULL == fail) || (NULL == queue)) {
+
+        hr = E_OUTOFMEMORY;
+        goto Cleanup;
+    }
+
+    //
+    //  Build the trie.  While building, a zero transition means there is
+    //  no edge, as nothing ever goes back to the initial state in a trie.
+    //
+
+    for (i = 0; i < Set->PatternCount; i++) {
+
+        state = 0;
+
+        for (j = 0; j < Set->Patterns[i].Length; j++) {
+
+            c = Set->ClassMap[Set->Patterns[i].Bytes[j]];
+
+            if (next[state * classCount + c] == 0) {
+
+                next[state * classCount + c] = stateCount++;
+            }
+
+            state = next[state * classCount + c];
+        }
+
+        if (match[state] == 0) {
+
+            match[state] = i + 1;
+        }
+    }
+
+    //
+    //  The missing transitions of the initial state stay on it.  Its
+    //  children fail back to it.
+    //
+
+    for (c = 0; c < classCount; c++) {
+
+        target = next[c];
+
+        if (target != 0) {
+
+            fail[target] = 0;
+            queue[tail++] = target;
+        }
+    }
+
+    while (head < tail) {
+
+        state = queue[head++];
+
+        for (c = 0; c < classCount; c++) {
+
+            target = next[state * classCount + c];
+
+            if (target != 0) {
+
+                fail[target] = next[fail[state] * classCount + c];
+
+                if (match[target] == 0) {
+
+                    match[target] = match[fail[target]];
+                }
+
+                queue[tail++] = target;
+
+            } else {
+
+                next[state * classCount + c] = next[fail[state] * classCount + c];
+            }
+        }
+    }
+
+    for (c = 0; c < 256; c++) {
+
+        if (next[Set->ClassMap[c]] != 0) {
+
+            Set->StartByte[c] = TRUE;
+
+            if (Set->FirstByteCount < SIG_PREFILTER_MAX_BYTES) {
+
+                Set->FirstBytes[Set->FirstByteCount] = (UCHAR)c;
+            }
+
+            Set->FirstByteCount += 1;
+        }
+    }
+
+    Set->Next = next;
+    Set->Match = match;
+    Set->StateCount = stateCount;
+    Set->ClassCount = classCount;
+    Set->Compiled = TRUE;
+
+    next = NULL;
+    match = NULL;
+
+Cleanup:
+
+    if (next) {
+
+        HeapFree( GetProcessHeap(), 0, next );
+    }
+
+    if (match) {
+
+        HeapFree( GetProcessHeap(), 0, match );
+    }
+
+    if (fail) {
+
+        HeapFree( GetProcessHeap(), 0, fail );
+    }
+
+    if (queue) {
+
+        HeapFree( GetProcessHeap(), 0, queue );
+    }
+
+    return hr;
+}
+
+ULONG
+SigGetMaxPatternLength (
+    _In_ PSIG_SET Set
+    )
+/*++
+
+Routine Description:
+
+    Returns the length of the longest pattern of the set.  Callers that
+    scan separate pieces of a stream with fresh scan states overlap the
+    pieces by one byte less than this to find every match.
+
+Arguments:
+
+    Set - The set.
+
+Return Value:
+
+    The length of the longest pattern, or zero if the set is empty.
+
+--*/
+{
+    return Set->MaxPatternLength;
+}
+
+PCSTR
+SigGetPatternName (
+    _In_ PSIG_SET Set,
+    _In_ ULONG PatternIndex
+    )
+/*++
+
+Routine Description:
+
+    Returns the name of a pattern of the set.
+
+Arguments:
+
+    Set - The set.
+
+    PatternIndex - The index of the pattern, as reported in SIG_MATCH.
+
+Return Value:
+
+    The name of the pattern, or an empty string if there is no such pattern.
+
+--*/
+{
+    if (PatternIndex >= Set->PatternCount) {
+
+        return "";
+    }
+
+    return Set->Patterns[PatternIndex].Name;
+}
+
+VOID
+SigInitializeScanState (
+    _Out_ PSIG_SCAN_STATE ScanState
+    )
+/*++
+
+Routine Description:
+
+    Prepares a scan state for the start of a new stream.
+
+Arguments:
+
+    ScanState - The state to initialize.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ScanState->State = 0;
+    ScanState->Offset = 0;
+}
+
+CONST UCHAR *
+SigSkipToStartByte (
+    _In_ PSIG_SET Set,
+    _In_ CONST UCHAR *Current,
+    _In_ CONST UCHAR *End
+    )
+/*++
+
+Routine Description:
+
+    Skips the bytes that leave the automaton in its initial state.
+
+Arguments:
+
+    Set - The compiled set.
+
+    Current - The first byte to look at.
+
+    End - The end of the buffer.
+
+Return Value:
+
+    The first byte at or after Current that starts some pattern, or End.
+
+--*/
+{
+#if defined(_M_IX86) || defined(_M_X64)
+    __m128i needles[SIG_PREFILTER_MAX_BYTES];
+    __m128i block;
+    __m128i hits;
+    ULONG mask;
+    ULONG bit;
+    ULONG i;
+#endif
+
+    if (Set->FirstByteCount == 0) {
+
+        return End;
+    }
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+    if (Set->FirstByteCount <= SIG_PREFILTER_MAX_BYTES) {
+
+        for (i = 0; i < Set->FirstByteCount; i++) {
+
+            needles[i] = _mm_set1_epi8( (CHAR)Set->FirstBytes[i] );
+        }
+
+        while ((SIZE_T)(End - Current) >= sizeof( __m128i )) {
+
+            block = _mm_loadu_si128( (CONST __m128i *)Current );
+            hits = _mm_cmpeq_epi8( block, needles[0] );
+
+            for (i = 1; i < Set->FirstByteCount; i++) {
+
+                hits = _mm_or_si128( hits, _mm_cmpeq_epi8( block, needles[i] ) );
+            }
+
+            mask = (ULONG)_mm_movemask_epi8( hits );
+
+            if (mask != 0) {
+
+                _BitScanForward( &bit, mask );
+                return Current + bit;
+            }
+
+            Current += sizeof( __m128i );
+        }
+    }
+
+#endif
+
+    while ((Current < End) && !Set->StartByte[*Current]) {
+
+        Current++;
+    }
+
+    return Current;
+}
+
+BOOLEAN
+SigScanBuffer (
+    _In_ PSIG_SET Set,
+    _Inout_ PSIG_SCAN_STATE ScanState,
+    _In_reads_bytes_(Size) CONST UCHAR *Buffer,
+    _In_ SIZE_T Size,
+    _Out_opt_ PSIG_MATCH Match
+    )
+/*++
+
+Routine Description:
+
+    Scans the next buffer of a stream for the patterns of a compiled set,
+    stopping at the first match.  Patterns split across the end of the
+    previous buffer and the start of this one are found.
+
+Arguments:
+
+    Set - The compiled set.
+
+    ScanState - Where the scan of the stream is up to.  Updated to the end
+        of the buffer, or to the end of the match if one is found.
+
+    Buffer - The next bytes of the stream.
+
+    Size - The number of bytes in Buffer.
+
+    Match - Receives the match, if one is found.
+
+Return Value:
+
+    TRUE if a pattern was found, FALSE otherwise.
+
+--*/
+{
+    CONST UCHAR *current = Buffer;
+    CONST UCHAR *end = Buffer + Size;
+    ULONG state = ScanState->State;
+    ULONG patternIndex;
+
+    assert( Set->Compiled );
+
+    while (current < end) {
+
+        if (state == 0) {
+
+            current = SigSkipToStartByte( Set, current, end );
+
+            if (current == end) {
+
+                break;
+            }
+        }
+
+        state = Set->Next[(SIZE_T)state * Set->ClassCount + Set->ClassMap[*current]];
+        current++;
+
+        patternIndex = Set->Match[state];
+
+        if (patternIndex != 0) {
+
+            if (Match != NULL) {
+
+                Match->PatternIndex = patternIndex - 1;
+                Match->EndOffset = ScanState->Offset + (current - Buffer);
+            }
+
+            ScanState->State = state;
+            ScanState->Offset += current - Buffer;
+            return TRUE;
+        }
+    }
+
+    ScanState->State = state;
+    ScanState->Offset += Size;
+    return FALSE;
+}
+
+LONG
+SigHexValue (
+    _In_ CHAR Digit
+    )
+/*++
+
+Routine Description:
+
+    Converts a hexadecimal digit to its value.
+
+Arguments:
+
+    Digit - The character to convert.
+
+Return Value:
+
+    The value of the digit, or -1 if it is not a hexadecimal digit.
+
+--*/
+{
+    if ((Digit >= '0') && (Digit <= '9')) {
+
+        return Digit - '0';
+    }
+
+    if ((Digit >= 'a') && (Digit <= 'f')) {
+
+        return Digit - 'a' + 10;
+    }
+
+    if ((Digit >= 'A') && (Digit <= 'F')) {
+
+        return Digit - 'A' + 10;
+    }
+
+    return -1;
+}
@@ -0,0 +1,136 @@
+/*++
+
+Copyright (c) 2011  Microsoft Corporation
+
+Module Name:
+
+    sigscan.h
+
+Abstract:
+
+    The signature scanning engine shared by the scanner and avscan user
+    programs.  A signature set is a list of byte patterns compiled into an
+    Aho-Corasick automaton, so that a buffer is scanned for all of them in
+    a single pass.  Scans can be split across any number of buffers by
+    carrying a SIG_SCAN_STATE from one to the next.
+
+    Signature files hold one signature per line:
+
+        # comment
+        <name> <hex bytes>
+        <name> "<text>"
+
+    Hex bytes may be separated by white space.  Text runs up to the last
+    double quote on the line and has no escapes.
+
+Environment:
+
+    User mode
+
+--*/
+
+#ifndef __SIGSCAN_H__
+#define __SIGSCAN_H__
+
+#include <windows.h>
+
+//
+//  Limits on the signatures of a set.
+//
+
+#define SIG_MAX_PATTERN_LENGTH      1024
+#define SIG_MAX_NAME_LENGTH         64
+
+//
+//  On x86 and x64, the bytes that cannot start a match are skipped 16 at a
+//  time with SSE2, comparing each block with every byte that can start one.
+//  That is only done for sets whose patterns start with at most this many
+//  distinct bytes.  Larger sets, such as those of thousands of signatures,
+//  skip a byte at a time through a table, since most bytes start a pattern
+//  and a block rarely has none of them.
+//
+
+#define SIG_PREFILTER_MAX_BYTES     4
+
+typedef struct _SIG_SET SIG_SET, *PSIG_SET;
+
+//
+//  Where a scan split across buffers is up to.  State is the automaton
+//  state after the last byte scanned and Offset the number of bytes
+//  scanned so far.
+//
+
+typedef struct _SIG_SCAN_STATE {
+
+    ULONG State;
+    ULONGLONG Offset;
+
+} SIG_SCAN_STATE, *PSIG_SCAN_STATE;
+
+//
+//  Describes the first match a scan found.  EndOffset is the offset, in
+//  the scanned stream, of the byte following the match.
+//
+
+typedef struct _SIG_MATCH {
+
+    ULONG PatternIndex;
+    ULONGLONG EndOffset;
+
+} SIG_MATCH, *PSIG_MATCH;
+
+HRESULT
+SigCreateSet (
+    _Outptr_ PSIG_SET *Set
+    );
+
+VOID
+SigDeleteSet (
+    _In_opt_ PSIG_SET Set
+    );
+
+HRESULT
+SigAddPattern (
+    _Inout_ PSIG_SET Set,
+    _In_z_ PCSTR Name,
+    _In_reads_bytes_(Length) CONST UCHAR *Pattern,
+    _In_ ULONG Length
+    );
+
+HRESULT
+SigAddPatternsFromFile (
+    _Inout_ PSIG_SET Set,
+    _In_z_ PCSTR FileName
+    );
+
+HRESULT
+SigCompileSet (
+    _Inout_ PSIG_SET Set
+    );
+
+ULONG
+SigGetMaxPatternLength (
+    _In_ PSIG_SET Set
+    );
+
+PCSTR
+SigGetPatternName (
+    _In_ PSIG_SET Set,
+    _In_ ULONG PatternIndex
+    );
+
+VOID
+SigInitializeScanState (
+    _Out_ PSIG_SCAN_STATE ScanState
+    );
+
+BOOLEAN
+SigScanBuffer (
+    _In_ PSIG_SET Set,
+    _Inout_ PSIG_SCAN_STATE ScanState,
+    _In_reads_bytes_(Size) CONST UCHAR *Buffer,
+    _In_ SIZE_T Size,
+    _Out_opt_ PSIG_MATCH Match
+    );
+
+#endif
@@ -130,8 +130,7 @@ Return Value:
 
         MiniSpyData.DriverObject = DriverObject;
 
-        InitializeListHead( &MiniSpyData.OutputBufferList );
-        KeInitializeSpinLock( &MiniSpyData.OutputBufferLock );
+        ExInitializeFastMutex( &MiniSpyData.LogConsumerLock );
 
         ExInitializeNPagedLookasideList( &MiniSpyData.FreeBufferList,
                                          NULL,
@@ -162,6 +161,34 @@ Return Value:
 
         SpyReadDriverParameters(RegistryPath);
 
+        //
+        //  The rings are sized from MaxRecords, so they can only be built
+        //  once the registry has been read.
+        //
+
+        status = SpyAllocateLogRings();
+
+        if (!NT_SUCCESS( status )) {
+
+           leave;
+        }
+
+        //
+        //  There is no shared log until user mode asks for one, so start
+        //  with its rundown protection already run down.
+        //
+
+        MiniSpyData.SharedLogRundown = ExAllocateCacheAwareRundownProtection( NonPagedPoolNx,
+                                                                              SPY_TAG );
+
+        if (MiniSpyData.SharedLogRundown == NULL) {
+
+           status = STATUS_INSUFFICIENT_RESOURCES;
+           leave;
+        }
+
+        ExWaitForRundownProtectionReleaseCacheAware( MiniSpyData.SharedLogRundown );
+
         //
         //  Now that our global configuration is complete, register with FltMgr.
         //
@@ -224,6 +251,11 @@ Return Value:
                  FltUnregisterFilter( MiniSpyData.Filter );
              }
 
+             if (NULL != MiniSpyData.SharedLogRundown) {
+                 ExFreeCacheAwareRundownProtection( MiniSpyData.SharedLogRundown );
+             }
+
+             SpyFreeLogRings();
              ExDeleteNPagedLookasideList( &MiniSpyData.FreeBufferList );
         }
     }
@@ -298,6 +330,12 @@ Return value
 
     UNREFERENCED_PARAMETER( ConnectionCookie );
 
+    //
+    //  Stop writing to the client's shared log, if it mapped one.
+    //
+
+    SpyUnmapSharedLog();
+
     //
     //  Close our handle
     //
@@ -343,7 +381,11 @@ Return Value:
 
     FltUnregisterFilter( MiniSpyData.Filter );
 
+    SpyUnmapSharedLog();
+    ExFreeCacheAwareRundownProtection( MiniSpyData.SharedLogRundown );
+
     SpyEmptyOutputBufferList();
+    SpyFreeLogRings();
     ExDeleteNPagedLookasideList( &MiniSpyData.FreeBufferList );
 
     return STATUS_SUCCESS;
@@ -419,6 +461,8 @@ Return Value:
 {
     MINISPY_COMMAND command;
     NTSTATUS status;
+    HANDLE event;
+    PVOID sharedLog;
 
     PAGED_CODE();
 
@@ -569,6 +613,68 @@ Return Value:
                 status = STATUS_SUCCESS;
                 break;
 
+            case MapMiniSpyLog:
+
+                //
+                //  Map the shared log into the caller and return its
+                //  address.  The log is laid out for callers of our own
+                //  bitness only.
+                //
+
+                if ((InputBufferSize < (FIELD_OFFSET( COMMAND_MESSAGE, Data ) +
+                                        sizeof( MINISPY_MAP_LOG ))) ||
+                    (OutputBufferSize < sizeof( PVOID )) ||
+                    (OutputBuffer == NULL)) {
+
+                    status = STATUS_INVALID_PARAMETER;
+                    break;
+                }
+
+#if defined(_WIN64)
+
+                if (IoIs32bitProcess( NULL )) {
+
+                    status = STATUS_NOT_SUPPORTED;
+                    break;
+                }
+
+#endif
+
+                if (!IS_ALIGNED(OutputBuffer,sizeof(PVOID))) {
+
+                    status = STATUS_DATATYPE_MISALIGNMENT;
+                    break;
+                }
+
+                try {
+
+                    event = ((PMINISPY_MAP_LOG)((PCOMMAND_MESSAGE) InputBuffer)->Data)->Event;
+
+                } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+                      return GetExceptionCode();
+                }
+
+                status = SpyMapSharedLog( event, &sharedLog );
+
+                if (!NT_SUCCESS( status )) {
+
+                    break;
+                }
+
+                try {
+
+                    *((PVOID *)OutputBuffer) = sharedLog;
+
+                } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+                      SpyUnmapSharedLog();
+                      return GetExceptionCode();
+                }
+
+                *ReturnOutputBufferLength = sizeof( PVOID );
+                break;
+
             default:
                 status = STATUS_INVALID_PARAMETER;
                 break;
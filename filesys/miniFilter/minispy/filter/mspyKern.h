@@ -111,6 +111,60 @@ typedef enum _ECP_TYPE {
 
 #endif
 
+//---------------------------------------------------------------------------
+//      Per-processor log rings
+//---------------------------------------------------------------------------
+
+//
+//  Completed log records are queued on a ring owned by the processor that
+//  logged them, so producers never share a lock or a cache line with each
+//  other.  Head is only advanced by producers on that processor (at
+//  DISPATCH_LEVEL), Tail is only advanced by the consumer.  A slot is
+//  published by storing the record pointer into it and is returned to the
+//  producer by storing NULL, so the consumer never sees a claimed but not
+//  yet filled slot.
+//
+
+typedef struct DECLSPEC_CACHEALIGN _SPY_LOG_RING {
+
+    __volatile LONG Head;
+    __volatile LONG Tail;
+
+    //
+    //  Records thrown away because this ring was full.
+    //
+
+    __volatile LONG RecordsDropped;
+
+    //
+    //  Our copy of this processor's WriteOffset in the shared log.  The
+    //  copy in the shared log is written by us but can be changed by the
+    //  consumer, so it is never read back.
+    //
+
+    ULONG SharedWriteOffset;
+
+    PRECORD_LIST __volatile *Slots;
+
+} SPY_LOG_RING, *PSPY_LOG_RING;
+
+//
+//  Bounds on the number of slots in each ring.  A ring is sized to hold
+//  every record we are allowed to allocate, within these limits.
+//
+
+#define SPY_LOG_RING_MIN_SLOTS      64
+#define SPY_LOG_RING_MAX_SLOTS      4096
+
+//
+//  Offset of the ring data in the shared log.  We always compute it rather
+//  than trust the copy in the shared log, which user mode can write to.
+//
+
+#define SPY_SHARED_LOG_DATA_OFFSET                                      \
+    ROUND_TO_PAGES( FIELD_OFFSET( MINISPY_SHARED_LOG, Rings ) +         \
+                    (MiniSpyData.LogRingCount * sizeof( MINISPY_SHARED_RING )) )
+
 //---------------------------------------------------------------------------
 //      Global variables
 //---------------------------------------------------------------------------
@@ -143,11 +197,34 @@ typedef struct _MINISPY_DATA {
     PFLT_PORT ClientPort;
 
     //
-    //  List of buffers with data to send to user mode.
+    //  Per-processor rings of records with data to send to user mode.
+    //  LogRingMask is the number of slots in each ring less one.
+    //
+
+    PSPY_LOG_RING LogRings;
+    ULONG LogRingCount;
+    ULONG LogRingMask;
+
+    //
+    //  Serializes the consumers draining the rings, and mapping and
+    //  unmapping the shared log.  Producers never take it.
+    //
+
+    FAST_MUTEX LogConsumerLock;
+
+    //
+    //  The log shared with the user mode application, if it asked for one.
+    //  SharedLog is the kernel mapping, SharedLogUserAddress the mapping in
+    //  SharedLogProcess.  Producers write to it under SharedLogRundown,
+    //  which is run down whenever there is no shared log.
     //
 
-    KSPIN_LOCK OutputBufferLock;
-    LIST_ENTRY OutputBufferList;
+    PMINISPY_SHARED_LOG SharedLog;
+    PMDL SharedLogMdl;
+    PVOID SharedLogUserAddress;
+    PEPROCESS SharedLogProcess;
+    PKEVENT SharedLogEvent;
+    PEX_RUNDOWN_REF_CACHE_AWARE SharedLogRundown;
 
     //
     //  Lookaside list used for allocating buffers.
@@ -402,6 +479,27 @@ SpyEmptyOutputBufferList (
     VOID
     );
 
+NTSTATUS
+SpyAllocateLogRings (
+    VOID
+    );
+
+NTSTATUS
+SpyMapSharedLog (
+    _In_ HANDLE Event,
+    _Outptr_ PVOID *UserAddress
+    );
+
+VOID
+SpyUnmapSharedLog (
+    VOID
+    );
+
+VOID
+SpyFreeLogRings (
+    VOID
+    );
+
 VOID
 SpyDeleteTxfContext (
     _Inout_ PFLT_CONTEXT  Context,
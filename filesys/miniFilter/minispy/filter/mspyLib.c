@@ -35,12 +35,41 @@ Environment:
 
 #ifdef ALLOC_PRAGMA
     #pragma alloc_text(INIT, SpyReadDriverParameters)
+    #pragma alloc_text(INIT, SpyAllocateLogRings)
+    #pragma alloc_text(PAGE, SpyFreeLogRings)
+    #pragma alloc_text(PAGE, SpyMapSharedLog)
+    #pragma alloc_text(PAGE, SpyUnmapSharedLog)
 #if MINISPY_VISTA
     #pragma alloc_text(PAGE, SpyBuildEcpDataString)
     #pragma alloc_text(PAGE, SpyParseEcps)
 #endif
 #endif
 
+//---------------------------------------------------------------------------
+//  Local prototypes
+//---------------------------------------------------------------------------
+
+PSPY_LOG_RING
+SpyFindOldestLogRing (
+    VOID
+    );
+
+PRECORD_LIST
+SpyTakeLogRingRecord (
+    _Inout_ PSPY_LOG_RING Ring
+    );
+
+VOID
+SpySetEmptyRecordName (
+    _Inout_ PLOG_RECORD LogRecord
+    );
+
+BOOLEAN
+SpyWriteSharedLog (
+    _In_ ULONG Processor,
+    _Inout_ PRECORD_LIST RecordList
+    );
+
 UCHAR TxNotificationToMinorCode (
     _In_ ULONG TxNotification
     )
@@ -1202,6 +1231,223 @@ Return Value:
 }
 
 
+NTSTATUS
+SpyAllocateLogRings (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine allocates one log ring per processor.  Each ring is sized
+    to hold every record we are allowed to allocate, plus the static
+    out-of-memory buffer and the few records the allocation limit can be
+    overrun by, within SPY_LOG_RING_MIN_SLOTS and SPY_LOG_RING_MAX_SLOTS.
+
+    This must be called after SpyReadDriverParameters.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES.
+
+--*/
+{
+    PSPY_LOG_RING rings;
+    PRECORD_LIST *slots;
+    ULONG ringCount;
+    ULONG slotCount;
+    ULONG index;
+
+#if MINISPY_WIN7
+    ringCount = KeQueryMaximumProcessorCountEx( ALL_PROCESSOR_GROUPS );
+#else
+    ringCount = KeNumberProcessors;
+#endif
+
+    slotCount = SPY_LOG_RING_MIN_SLOTS;
+
+    while ((slotCount < SPY_LOG_RING_MAX_SLOTS) &&
+           ((LONG)slotCount - 4 < MiniSpyData.MaxRecordsToAllocate)) {
+
+        slotCount <<= 1;
+    }
+
+    rings = ExAllocatePoolZero( NonPagedPoolNxCacheAligned,
+                                ringCount * sizeof( SPY_LOG_RING ),
+                                SPY_TAG );
+
+    slots = ExAllocatePoolZero( NonPagedPoolNx,
+                                ringCount * slotCount * sizeof( PRECORD_LIST ),
+                                SPY_TAG );
+
+    if ((rings == NULL) || (slots == NULL)) {
+
+        if (rings != NULL) {
+
+            ExFreePoolWithTag( rings, SPY_TAG );
+        }
+
+        if (slots != NULL) {
+
+            ExFreePoolWithTag( slots, SPY_TAG );
+        }
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (index = 0; index < ringCount; index += 1) {
+
+        rings[index].Slots = slots + (index * slotCount);
+    }
+
+    MiniSpyData.LogRings = rings;
+    MiniSpyData.LogRingCount = ringCount;
+    MiniSpyData.LogRingMask = slotCount - 1;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+SpyFreeLogRings (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine frees the log rings.  Any records still queued on them
+    must already have been freed by SpyEmptyOutputBufferList.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (MiniSpyData.LogRings != NULL) {
+
+        ExFreePoolWithTag( (PVOID)MiniSpyData.LogRings[0].Slots, SPY_TAG );
+        ExFreePoolWithTag( MiniSpyData.LogRings, SPY_TAG );
+        MiniSpyData.LogRings = NULL;
+    }
+}
+
+
+PSPY_LOG_RING
+SpyFindOldestLogRing (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the ring whose next record has the lowest sequence
+    number, so that draining the rings one record at a time returns the
+    records in the order they were created.  A slot that has been claimed
+    by a producer but not yet filled ends the scan of that ring.
+
+    The caller must hold MiniSpyData.LogConsumerLock.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    The ring to take the next record from, or NULL if all rings are empty.
+
+--*/
+{
+    PSPY_LOG_RING ring;
+    PSPY_LOG_RING oldestRing = NULL;
+    PRECORD_LIST record;
+    ULONG oldestSequence = 0;
+    ULONG index;
+
+    for (index = 0; index < MiniSpyData.LogRingCount; index += 1) {
+
+        ring = &MiniSpyData.LogRings[index];
+
+        if (ring->Tail == ring->Head) {
+
+            continue;
+        }
+
+        record = ring->Slots[ring->Tail & MiniSpyData.LogRingMask];
+
+        if (record == NULL) {
+
+            continue;
+        }
+
+        //
+        //  Sequence numbers wrap, so compare them by their difference.
+        //
+
+        if ((oldestRing == NULL) ||
+            ((LONG)(record->LogRecord.SequenceNumber - oldestSequence) < 0)) {
+
+            oldestRing = ring;
+            oldestSequence = record->LogRecord.SequenceNumber;
+        }
+    }
+
+    return oldestRing;
+}
+
+
+PRECORD_LIST
+SpyTakeLogRingRecord (
+    _Inout_ PSPY_LOG_RING Ring
+    )
+/*++
+
+Routine Description:
+
+    This routine removes the next record from a ring returned by
+    SpyFindOldestLogRing and hands its slot back to the producers.
+
+    The caller must hold MiniSpyData.LogConsumerLock.
+
+Arguments:
+
+    Ring - The ring to take the record from.
+
+Return Value:
+
+    The record removed from the ring.
+
+--*/
+{
+    PRECORD_LIST record;
+    LONG tail = Ring->Tail;
+
+    record = Ring->Slots[tail & MiniSpyData.LogRingMask];
+    FLT_ASSERT( record != NULL );
+
+    //
+    //  Empty the slot before moving the tail past it, producers treat any
+    //  slot behind the tail as free.
+    //
+
+    Ring->Slots[tail & MiniSpyData.LogRingMask] = NULL;
+    InterlockedExchange( &Ring->Tail, tail + 1 );
+
+    return record;
+}
+
+
 VOID
 SpyLog (
     _In_ PRECORD_LIST RecordList
@@ -1210,29 +1456,81 @@ SpyLog (
 
 Routine Description:
 
-    This routine inserts the given log record into the list to be sent
-    to the user mode application.
+    This routine queues the given log record on the current processor's
+    log ring to be sent to the user mode application.  If the ring is full
+    the record is freed and counted as dropped.
 
     NOTE:  This code must be NON-PAGED because it can be called on the
-           paging path or at DPC level and uses a spin-lock
+           paging path or at DPC level.
 
 Arguments:
 
-    RecordList - The record to append to the MiniSpyData.OutputBufferList
+    RecordList - The record to queue.
 
 Return Value:
 
-    The function returns STATUS_SUCCESS.
-
-
+    None.
 
 --*/
 {
+    PSPY_LOG_RING ring;
     KIRQL oldIrql;
+    ULONG index;
+    LONG head;
+
+    //
+    //  Stay on this processor between claiming a slot and filling it, so
+    //  that the consumer is never held up behind a preempted producer.
+    //
+
+    KeRaiseIrql( DISPATCH_LEVEL, &oldIrql );
 
-    KeAcquireSpinLock(&MiniSpyData.OutputBufferLock, &oldIrql);
-    InsertTailList(&MiniSpyData.OutputBufferList, &RecordList->List);
-    KeReleaseSpinLock(&MiniSpyData.OutputBufferLock, oldIrql);
+#if MINISPY_WIN7
+    index = KeGetCurrentProcessorNumberEx( NULL );
+#else
+    index = KeGetCurrentProcessorNumber();
+#endif
+
+    //
+    //  If user mode mapped a shared log, write the record straight into it.
+    //
+
+    if ((index < MiniSpyData.LogRingCount) &&
+        SpyWriteSharedLog( index, RecordList )) {
+
+        KeLowerIrql( oldIrql );
+
+        SpyFreeRecord( RecordList );
+        return;
+    }
+
+    ring = &MiniSpyData.LogRings[index % MiniSpyData.LogRingCount];
+
+    //
+    //  Claim the slot at the head.  Only this processor produces on the
+    //  ring, so the exchange is uncontended; it is there for a processor
+    //  added after the rings were sized and folded onto another's ring.
+    //
+
+    do {
+
+        head = ring->Head;
+
+        if ((ULONG)(head - ring->Tail) > MiniSpyData.LogRingMask) {
+
+            KeLowerIrql( oldIrql );
+
+            InterlockedIncrement( &ring->RecordsDropped );
+            SpyFreeRecord( RecordList );
+            return;
+        }
+
+    } while (InterlockedCompareExchange( &ring->Head, head + 1, head ) != head);
+
+    InterlockedExchangePointer( (PVOID __volatile *)&ring->Slots[head & MiniSpyData.LogRingMask],
+                                RecordList );
+
+    KeLowerIrql( oldIrql );
 }
 
 
@@ -1247,9 +1545,8 @@ SpyGetLog (
 Routine Description:
     This function fills OutputBuffer with as many LOG_RECORDs as possible.
     The LOG_RECORDs are variable sizes and are tightly packed in the
-    OutputBuffer.
-
-    NOTE:  This code must be NON-PAGED because it uses a spin-lock.
+    OutputBuffer.  Records are merged from the per-processor rings in
+    sequence number order.
 
 Arguments:
     OutputBuffer - The user's buffer to fill with the log data we have
@@ -1270,17 +1567,23 @@ Return Value:
 
 --*/
 {
-    PLIST_ENTRY pList;
+    PSPY_LOG_RING ring;
     ULONG bytesWritten = 0;
     PLOG_RECORD pLogRecord;
     NTSTATUS status = STATUS_NO_MORE_ENTRIES;
     PRECORD_LIST pRecordList;
-    KIRQL oldIrql;
     BOOLEAN recordsAvailable = FALSE;
 
-    KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+    ExAcquireFastMutex( &MiniSpyData.LogConsumerLock );
+
+    while (OutputBufferLength > 0) {
 
-    while (!IsListEmpty( &MiniSpyData.OutputBufferList ) && (OutputBufferLength > 0)) {
+        ring = SpyFindOldestLogRing();
+
+        if (ring == NULL) {
+
+            break;
+        }
 
         //
         //  Mark we have records
@@ -1289,58 +1592,36 @@ Return Value:
         recordsAvailable = TRUE;
 
         //
-        //  Get the next available record
+        //  Look at the next record.  It stays on its ring until it has
+        //  been copied, so there is nothing to put back if we stop here.
         //
 
-        pList = RemoveHeadList( &MiniSpyData.OutputBufferList );
-
-        pRecordList = CONTAINING_RECORD( pList, RECORD_LIST, List );
+        pRecordList = ring->Slots[ring->Tail & MiniSpyData.LogRingMask];
 
         pLogRecord = &pRecordList->LogRecord;
 
-        //
-        //  If no filename was set then make it into a NULL file name.
-        //
-
-        if (REMAINING_NAME_SPACE( pLogRecord ) == MAX_NAME_SPACE) {
-
-            //
-            //  We don't have a name, so return an empty string.
-            //  We have to always start a new log record on a PVOID aligned boundary.
-            //
-
-            pLogRecord->Length += ROUND_TO_SIZE( sizeof( UNICODE_NULL ), sizeof( PVOID ) );
-            pLogRecord->Name[0] = UNICODE_NULL;
-        }
+        SpySetEmptyRecordName( pLogRecord );
 
         //
-        //  Put it back if we've run out of room.
+        //  Stop if we've run out of room.
         //
 
         if (OutputBufferLength < pLogRecord->Length) {
 
-            InsertHeadList( &MiniSpyData.OutputBufferList, pList );
             break;
         }
 
-        KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
-
         //
-        //  The lock is released, return the data, adjust pointers.
-        //  Protect access to raw user-mode OutputBuffer with an exception handler
+        //  Return the data, adjust pointers.  Protect access to raw
+        //  user-mode OutputBuffer with an exception handler.  Producers
+        //  never take the consumer lock, so faulting here is safe.
         //
 
         try {
             RtlCopyMemory( OutputBuffer, pLogRecord, pLogRecord->Length );
         } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
 
-            //
-            //  Put the record back in
-            //
-
-            KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
-            InsertHeadList( &MiniSpyData.OutputBufferList, pList );
-            KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+            ExReleaseFastMutex( &MiniSpyData.LogConsumerLock );
 
             return GetExceptionCode();
 
@@ -1352,16 +1633,10 @@ Return Value:
 
         OutputBuffer += pLogRecord->Length;
 
-        SpyFreeRecord( pRecordList );
-
-        //
-        //  Relock the list
-        //
-
-        KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+        SpyFreeRecord( SpyTakeLogRingRecord( ring ) );
     }
 
-    KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+    ExReleaseFastMutex( &MiniSpyData.LogConsumerLock );
 
     //
     //  Set proper status
@@ -1400,11 +1675,361 @@ SpyEmptyOutputBufferList (
 
 Routine Description:
 
-    This routine frees all the remaining log records in the OutputBufferList
+    This routine frees all the remaining log records on the log rings
     that are not going to get sent up to the user mode application since
     MiniSpy is shutting down.
 
-    NOTE:  This code must be NON-PAGED because it uses a spin-lock
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSPY_LOG_RING ring;
+
+    ExAcquireFastMutex( &MiniSpyData.LogConsumerLock );
+
+    while ((ring = SpyFindOldestLogRing()) != NULL) {
+
+        SpyFreeRecord( SpyTakeLogRingRecord( ring ) );
+    }
+
+    ExReleaseFastMutex( &MiniSpyData.LogConsumerLock );
+}
+
+
+VOID
+SpySetEmptyRecordName (
+    _Inout_ PLOG_RECORD LogRecord
+    )
+/*++
+
+Routine Description:
+
+    If no filename was set in the record then make it into a NULL file
+    name, before the record is handed to user mode.
+
+Arguments:
+
+    LogRecord - The record about to be returned to user mode.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    if (REMAINING_NAME_SPACE( LogRecord ) == MAX_NAME_SPACE) {
+
+        //
+        //  We don't have a name, so return an empty string.
+        //  We have to always start a new log record on a PVOID aligned boundary.
+        //
+
+        LogRecord->Length += ROUND_TO_SIZE( sizeof( UNICODE_NULL ), sizeof( PVOID ) );
+        LogRecord->Name[0] = UNICODE_NULL;
+    }
+}
+
+
+BOOLEAN
+SpyWriteSharedLog (
+    _In_ ULONG Processor,
+    _Inout_ PRECORD_LIST RecordList
+    )
+/*++
+
+Routine Description:
+
+    This routine copies a log record into the given processor's ring of the
+    shared log, if there is one, and wakes the consumer if it is waiting.
+    If the ring is full the record is counted as dropped in the ring.
+
+    NOTE:  This must be called at DISPATCH_LEVEL on the given processor.
+           The offsets of a ring are only updated by its own processor,
+           which is what lets us write without a lock.
+
+Arguments:
+
+    Processor - The current processor.
+
+    RecordList - The record to write.  The caller still owns it.  An empty
+        name is filled in as it would be for SpyGetLog.
+
+Return Value:
+
+    FALSE if there is no shared log and the record must be queued for
+    SpyGetLog, TRUE otherwise.
+
+--*/
+{
+    PMINISPY_SHARED_LOG log;
+    PMINISPY_SHARED_RING sharedRing;
+    PSPY_LOG_RING ring;
+    PLOG_RECORD logRecord = &RecordList->LogRecord;
+    PUCHAR data;
+    ULONG writeOffset;
+    ULONG readOffset;
+    ULONG position;
+    ULONG skip = 0;
+
+    if (!ExAcquireRundownProtectionCacheAware( MiniSpyData.SharedLogRundown )) {
+
+        return FALSE;
+    }
+
+    log = MiniSpyData.SharedLog;
+    sharedRing = &log->Rings[Processor];
+    ring = &MiniSpyData.LogRings[Processor];
+    data = (PUCHAR)log + SPY_SHARED_LOG_DATA_OFFSET + (Processor * MINISPY_SHARED_RING_SIZE);
+
+    SpySetEmptyRecordName( logRecord );
+
+    writeOffset = ring->SharedWriteOffset;
+    readOffset = sharedRing->ReadOffset;
+    position = writeOffset & (MINISPY_SHARED_RING_SIZE - 1);
+
+    //
+    //  Records do not wrap.  If this one does not fit before the end of
+    //  the ring, the rest of the ring is skipped.
+    //
+
+    if (MINISPY_SHARED_RING_SIZE - position < logRecord->Length) {
+
+        skip = MINISPY_SHARED_RING_SIZE - position;
+    }
+
+    //
+    //  The consumer can store anything in ReadOffset, an offset that makes
+    //  no sense simply makes the ring look full.
+    //
+
+    if ((writeOffset - readOffset) > (MINISPY_SHARED_RING_SIZE - skip - logRecord->Length)) {
+
+        InterlockedIncrement( (LONG volatile *)&sharedRing->RecordsDropped );
+
+    } else {
+
+        if (skip != 0) {
+
+            *(PULONG)(data + position) = 0;
+            writeOffset += skip;
+            position = 0;
+        }
+
+        RtlCopyMemory( data + position, logRecord, logRecord->Length );
+
+        writeOffset += logRecord->Length;
+        ring->SharedWriteOffset = writeOffset;
+
+        InterlockedExchange( (LONG volatile *)&sharedRing->WriteOffset, (LONG)writeOffset );
+
+        //
+        //  The consumer sets ConsumerWaiting before it checks the rings a
+        //  last time and waits, so either it sees the record we just
+        //  published or we see it waiting.
+        //
+
+        if ((log->ConsumerWaiting != 0) &&
+            (InterlockedExchange( &log->ConsumerWaiting, 0 ) != 0)) {
+
+            KeSetEvent( MiniSpyData.SharedLogEvent, IO_NO_INCREMENT, FALSE );
+        }
+    }
+
+    ExReleaseRundownProtectionCacheAware( MiniSpyData.SharedLogRundown );
+
+    return TRUE;
+}
+
+
+NTSTATUS
+SpyMapSharedLog (
+    _In_ HANDLE Event,
+    _Outptr_ PVOID *UserAddress
+    )
+/*++
+
+Routine Description:
+
+    This routine builds the shared log, maps it into the calling process
+    and starts sending log records to it rather than queueing them for
+    SpyGetLog.  Records already queued are still returned by SpyGetLog.
+
+Arguments:
+
+    Event - Handle, in the calling process, of the event to signal when
+        records are written while the consumer is waiting.
+
+    UserAddress - Receives the address of the shared log in the calling
+        process.
+
+Return Value:
+
+    STATUS_SUCCESS, STATUS_ALREADY_REGISTERED if the log is already mapped,
+    or the reason the log could not be built or mapped.
+
+--*/
+{
+    PKEVENT event = NULL;
+    PMINISPY_SHARED_LOG log = NULL;
+    PMDL mdl = NULL;
+    PVOID userAddress = NULL;
+    ULONG logSize;
+    ULONG index;
+    ULONG pagePriority;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    *UserAddress = NULL;
+
+    status = ObReferenceObjectByHandle( Event,
+                                        EVENT_MODIFY_STATE,
+                                        *ExEventObjectType,
+                                        UserMode,
+                                        &event,
+                                        NULL );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    //
+    //  The header and each ring take whole pages, so that mapping the log
+    //  exposes nothing but the log to user mode.
+    //
+
+    logSize = SPY_SHARED_LOG_DATA_OFFSET +
+              (MiniSpyData.LogRingCount * MINISPY_SHARED_RING_SIZE);
+
+    ExAcquireFastMutex( &MiniSpyData.LogConsumerLock );
+
+    try {
+
+        if (MiniSpyData.SharedLog != NULL) {
+
+            status = STATUS_ALREADY_REGISTERED;
+            leave;
+        }
+
+        log = ExAllocatePoolZero( NonPagedPoolNx, logSize, SPY_TAG );
+
+        if (log == NULL) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            leave;
+        }
+
+        mdl = IoAllocateMdl( log, logSize, FALSE, FALSE, NULL );
+
+        if (mdl == NULL) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            leave;
+        }
+
+        MmBuildMdlForNonPagedPool( mdl );
+
+        log->Size = logSize;
+        log->RingCount = MiniSpyData.LogRingCount;
+        log->RingSize = MINISPY_SHARED_RING_SIZE;
+        log->DataOffset = SPY_SHARED_LOG_DATA_OFFSET;
+
+        //
+        //  Mapping into user mode raises on failure.  Only Win8 and later
+        //  understand no-execute mappings.
+        //
+
+#if MINISPY_WIN8
+        pagePriority = NormalPagePriority | MdlMappingNoExecute;
+#else
+        pagePriority = NormalPagePriority;
+#endif
+
+        try {
+
+            userAddress = MmMapLockedPagesSpecifyCache( mdl,
+                                                        UserMode,
+                                                        MmCached,
+                                                        NULL,
+                                                        FALSE,
+                                                        pagePriority );
+
+        } except (EXCEPTION_EXECUTE_HANDLER) {
+
+            status = GetExceptionCode();
+        }
+
+        if (!NT_SUCCESS( status )) {
+
+            leave;
+        }
+
+        for (index = 0; index < MiniSpyData.LogRingCount; index += 1) {
+
+            MiniSpyData.LogRings[index].SharedWriteOffset = 0;
+        }
+
+        MiniSpyData.SharedLog = log;
+        MiniSpyData.SharedLogMdl = mdl;
+        MiniSpyData.SharedLogUserAddress = userAddress;
+        MiniSpyData.SharedLogEvent = event;
+        MiniSpyData.SharedLogProcess = PsGetCurrentProcess();
+        ObReferenceObject( MiniSpyData.SharedLogProcess );
+
+        log = NULL;
+        mdl = NULL;
+        event = NULL;
+
+        //
+        //  Let the producers in.
+        //
+
+        ExReInitializeRundownProtectionCacheAware( MiniSpyData.SharedLogRundown );
+
+        *UserAddress = userAddress;
+
+    } finally {
+
+        ExReleaseFastMutex( &MiniSpyData.LogConsumerLock );
+
+        if (mdl != NULL) {
+
+            IoFreeMdl( mdl );
+        }
+
+        if (log != NULL) {
+
+            ExFreePoolWithTag( log, SPY_TAG );
+        }
+
+        if (event != NULL) {
+
+            ObDereferenceObject( event );
+        }
+    }
+
+    return status;
+}
+
+
+VOID
+SpyUnmapSharedLog (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine stops sending log records to the shared log, if there is
+    one, unmaps it from the process it was mapped into and frees it.
+    Records still in the shared log are lost.
 
 Arguments:
 
@@ -1416,25 +2041,53 @@ Return Value:
 
 --*/
 {
-    PLIST_ENTRY pList;
-    PRECORD_LIST pRecordList;
-    KIRQL oldIrql;
+    KAPC_STATE apcState;
+    BOOLEAN attached = FALSE;
 
-    KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+    PAGED_CODE();
 
-    while (!IsListEmpty( &MiniSpyData.OutputBufferList )) {
+    ExAcquireFastMutex( &MiniSpyData.LogConsumerLock );
 
-        pList = RemoveHeadList( &MiniSpyData.OutputBufferList );
-        KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+    if (MiniSpyData.SharedLog != NULL) {
 
-        pRecordList = CONTAINING_RECORD( pList, RECORD_LIST, List );
+        //
+        //  Wait for the producers writing to the log.  From now on they
+        //  queue their records for SpyGetLog.
+        //
+
+        ExWaitForRundownProtectionReleaseCacheAware( MiniSpyData.SharedLogRundown );
+
+        //
+        //  The user mapping must be removed in the process it was made in.
+        //  We are not in it when the filter unloads while still connected.
+        //
+
+        if (PsGetCurrentProcess() != MiniSpyData.SharedLogProcess) {
+
+            KeStackAttachProcess( MiniSpyData.SharedLogProcess, &apcState );
+            attached = TRUE;
+        }
+
+        MmUnmapLockedPages( MiniSpyData.SharedLogUserAddress, MiniSpyData.SharedLogMdl );
+
+        if (attached) {
+
+            KeUnstackDetachProcess( &apcState );
+        }
 
-        SpyFreeRecord( pRecordList );
+        IoFreeMdl( MiniSpyData.SharedLogMdl );
+        ExFreePoolWithTag( MiniSpyData.SharedLog, SPY_TAG );
+        ObDereferenceObject( MiniSpyData.SharedLogEvent );
+        ObDereferenceObject( MiniSpyData.SharedLogProcess );
 
-        KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+        MiniSpyData.SharedLog = NULL;
+        MiniSpyData.SharedLogMdl = NULL;
+        MiniSpyData.SharedLogUserAddress = NULL;
+        MiniSpyData.SharedLogEvent = NULL;
+        MiniSpyData.SharedLogProcess = NULL;
     }
 
-    KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+    ExReleaseFastMutex( &MiniSpyData.LogConsumerLock );
 }
 
 //---------------------------------------------------------------------------
@@ -54,7 +54,7 @@ Environment:
 //
 
 #define MINISPY_MAJ_VERSION 2
-#define MINISPY_MIN_VERSION 0
+#define MINISPY_MIN_VERSION 1
 
 typedef struct _MINISPYVER {
 
@@ -183,7 +183,8 @@ typedef struct _RECORD_LIST {
 typedef enum _MINISPY_COMMAND {
 
     GetMiniSpyLog,
-    GetMiniSpyVersion
+    GetMiniSpyVersion,
+    MapMiniSpyLog
 
 } MINISPY_COMMAND;
 
@@ -202,6 +203,87 @@ typedef struct _COMMAND_MESSAGE {
 
 #pragma warning(pop)
 
+//
+//  Data passed with the MapMiniSpyLog command.  Event is an auto-reset event
+//  the filter signals when it writes to the shared log while the consumer
+//  is waiting.  The filter returns the address of the MINISPY_SHARED_LOG it
+//  mapped into the caller's process in the output buffer.
+//
+
+typedef struct _MINISPY_MAP_LOG {
+
+    HANDLE Event;
+
+} MINISPY_MAP_LOG, *PMINISPY_MAP_LOG;
+
+//
+//  The shared log is made of one ring per processor.  The filter writes
+//  LOG_RECORDs into the ring of the processor they were logged on, exactly
+//  as GetMiniSpyLog would have returned them, and advances WriteOffset.
+//  The consumer reads up to WriteOffset and advances ReadOffset.  Both
+//  offsets only ever grow and are reduced modulo RingSize to find the
+//  record.  A record never wraps: a Length of zero means the rest of the
+//  ring is unused and the next record is at the start of the ring.
+//
+//  The records of all rings are merged by SequenceNumber to get them back
+//  in the order they were created.
+//
+
+#define MINISPY_SHARED_RING_SIZE    (64 * 1024)
+
+typedef struct _MINISPY_SHARED_RING {
+
+    volatile ULONG WriteOffset;
+    volatile ULONG ReadOffset;
+
+    //
+    //  Records the filter threw away because this ring was full.
+    //
+
+    volatile ULONG RecordsDropped;
+
+    //
+    //  Keep each ring's offsets on their own cache line.
+    //
+
+    ULONG Reserved[13];
+
+} MINISPY_SHARED_RING, *PMINISPY_SHARED_RING;
+
+#pragma warning(push)
+#pragma warning(disable:4200) // disable warnings for structures with zero length arrays.
+
+typedef struct _MINISPY_SHARED_LOG {
+
+    ULONG Size;
+    ULONG RingCount;
+    ULONG RingSize;
+
+    //
+    //  Offset from the start of this structure to the data of the first
+    //  ring.  The data of the rings follow each other.
+    //
+
+    ULONG DataOffset;
+
+    //
+    //  Set by the consumer before it waits on its event.  The filter clears
+    //  it and signals the event when it writes a record.
+    //
+
+    volatile LONG ConsumerWaiting;
+
+    ULONG Reserved[11];
+
+    MINISPY_SHARED_RING Rings[];
+
+} MINISPY_SHARED_LOG, *PMINISPY_SHARED_LOG;
+
+#pragma warning(pop)
+
+#define MINISPY_SHARED_RING_DATA(_log,_index) \
+    ((PUCHAR)(_log) + (_log)->DataOffset + ((SIZE_T)(_index) * (_log)->RingSize))
+
 //
 //  The maximum number of BYTES that can be used to store the file name in the
 //  RECORD_LIST structure
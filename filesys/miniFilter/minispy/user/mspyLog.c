@@ -92,6 +92,359 @@ Return Value:
 }
 
 
+BOOLEAN
+MapSharedLog (
+    _Inout_ PLOG_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    Asks the filter to map its shared log into this process, so that log
+    records no longer have to be fetched with FilterSendMessage.
+
+Arguments:
+
+    Context - The logging context to record the shared log in.
+
+Return Value:
+
+    TRUE if the shared log is mapped, FALSE if records must be polled for.
+
+--*/
+{
+    PVOID alignedMessage[(FIELD_OFFSET( COMMAND_MESSAGE, Data ) +
+                          sizeof( MINISPY_MAP_LOG ) +
+                          sizeof( PVOID ) - 1) / sizeof( PVOID )];
+    PCOMMAND_MESSAGE commandMessage = (PCOMMAND_MESSAGE) alignedMessage;
+    PMINISPY_SHARED_LOG log = NULL;
+    DWORD bytesReturned = 0;
+    HANDLE event;
+    HRESULT hResult;
+
+    event = CreateEvent( NULL, FALSE, FALSE, NULL );
+
+    if (event == NULL) {
+
+        return FALSE;
+    }
+
+    commandMessage->Command = MapMiniSpyLog;
+    ((PMINISPY_MAP_LOG) commandMessage->Data)->Event = event;
+
+    hResult = FilterSendMessage( Context->Port,
+                                 commandMessage,
+                                 sizeof( alignedMessage ),
+                                 &log,
+                                 sizeof( log ),
+                                 &bytesReturned );
+
+    if (IS_ERROR( hResult ) || (bytesReturned < sizeof( log )) || (log == NULL)) {
+
+        CloseHandle( event );
+        return FALSE;
+    }
+
+    //
+    //  The filter stopped queueing records for FilterSendMessage the moment
+    //  it mapped the log, so from here on we have to read the shared log.
+    //
+
+    if ((log->RingSize != MINISPY_SHARED_RING_SIZE) ||
+        (log->DataOffset + ((ULONGLONG)log->RingCount * log->RingSize) > log->Size)) {
+
+        printf( "UNEXPECTED shared log layout: rings=%d size=%d\n",
+                log->RingCount,
+                log->RingSize );
+        ExitProcess( 1 );
+    }
+
+    Context->SharedReadOffsets = calloc( log->RingCount, sizeof( ULONG ) );
+    Context->SharedWriteOffsets = calloc( log->RingCount, sizeof( ULONG ) );
+
+    if ((Context->SharedReadOffsets == NULL) || (Context->SharedWriteOffsets == NULL)) {
+
+        printf( "Could not allocate the shared log state\n" );
+        ExitProcess( 1 );
+    }
+
+    Context->SharedLog = log;
+    Context->SharedLogEvent = event;
+
+    return TRUE;
+}
+
+
+PLOG_RECORD
+PeekSharedLogRecord (
+    _In_ PMINISPY_SHARED_LOG Log,
+    _In_ ULONG Ring,
+    _Inout_ PULONG ReadOffset,
+    _In_ ULONG WriteOffset
+    )
+/*++
+
+Routine Description:
+
+    Returns the next record of a ring of the shared log, skipping the
+    unused space at the end of the ring.
+
+Arguments:
+
+    Log - The shared log.
+
+    Ring - The ring to look at.
+
+    ReadOffset - Where we have read the ring up to.  Updated to skip
+        the end of the ring.
+
+    WriteOffset - Where the ring was written up to when this batch started.
+
+Return Value:
+
+    The next record, or NULL if the ring holds no more records.
+
+--*/
+{
+    PUCHAR data = MINISPY_SHARED_RING_DATA( Log, Ring );
+    PLOG_RECORD pLogRecord;
+    ULONG position;
+
+    while (*ReadOffset != WriteOffset) {
+
+        position = *ReadOffset & (Log->RingSize - 1);
+        pLogRecord = (PLOG_RECORD) (data + position);
+
+        if (pLogRecord->Length == 0) {
+
+            *ReadOffset += Log->RingSize - position;
+            continue;
+        }
+
+        if ((pLogRecord->Length < (sizeof(LOG_RECORD)+sizeof(WCHAR))) ||
+            (pLogRecord->Length > Log->RingSize - position) ||
+            (pLogRecord->Length > WriteOffset - *ReadOffset)) {
+
+            printf( "UNEXPECTED LOG_RECORD->Length in shared log: length=%d\n",
+                    pLogRecord->Length );
+
+            //
+            //  Throw the rest of this ring's batch away.
+            //
+
+            *ReadOffset = WriteOffset;
+            break;
+        }
+
+        return pLogRecord;
+    }
+
+    return NULL;
+}
+
+
+ULONG
+DrainSharedLog (
+    _In_ PLOG_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    Outputs the records written to the shared log since the last call, in
+    sequence number order across all of its rings.  The space they used is
+    handed back to the filter once the whole batch is done.
+
+Arguments:
+
+    Context - The logging context.
+
+Return Value:
+
+    The number of records output.
+
+--*/
+{
+    PMINISPY_SHARED_LOG log = Context->SharedLog;
+    PLOG_RECORD pLogRecord;
+    PLOG_RECORD oldestRecord;
+    ULONG oldestRing = 0;
+    ULONG ring;
+    ULONG records = 0;
+
+    //
+    //  If the filter unloads, the log is unmapped under us.
+    //
+
+    __try {
+
+        for (ring = 0; ring < log->RingCount; ring += 1) {
+
+            Context->SharedWriteOffsets[ring] = log->Rings[ring].WriteOffset;
+        }
+
+        //
+        //  Do not look at any record before we have seen the offset
+        //  covering it.
+        //
+
+        MemoryBarrier();
+
+        for (;;) {
+
+            oldestRecord = NULL;
+
+            for (ring = 0; ring < log->RingCount; ring += 1) {
+
+                pLogRecord = PeekSharedLogRecord( log,
+                                                  ring,
+                                                  &Context->SharedReadOffsets[ring],
+                                                  Context->SharedWriteOffsets[ring] );
+
+                if ((pLogRecord != NULL) &&
+                    ((oldestRecord == NULL) ||
+                     ((LONG)(pLogRecord->SequenceNumber - oldestRecord->SequenceNumber) < 0))) {
+
+                    oldestRecord = pLogRecord;
+                    oldestRing = ring;
+                }
+            }
+
+            if (oldestRecord == NULL) {
+
+                break;
+            }
+
+            Context->SharedReadOffsets[oldestRing] += oldestRecord->Length;
+
+            DumpLogRecord( Context, oldestRecord );
+            records += 1;
+        }
+
+        for (ring = 0; ring < log->RingCount; ring += 1) {
+
+            if (log->Rings[ring].ReadOffset != Context->SharedReadOffsets[ring]) {
+
+                InterlockedExchange( (LONG volatile *) &log->Rings[ring].ReadOffset,
+                                     (LONG) Context->SharedReadOffsets[ring] );
+            }
+
+            if (log->Rings[ring].RecordsDropped != 0) {
+
+                printf( "M:  Ring %d dropped %d records\n",
+                        ring,
+                        InterlockedExchange( (LONG volatile *) &log->Rings[ring].RecordsDropped, 0 ) );
+            }
+        }
+
+    } __except ((GetExceptionCode() == EXCEPTION_ACCESS_VIOLATION) ?
+                EXCEPTION_EXECUTE_HANDLER :
+                EXCEPTION_CONTINUE_SEARCH) {
+
+        printf( "The kernel component of minispy has unloaded. Exiting\n" );
+        ExitProcess( 0 );
+    }
+
+    return records;
+}
+
+
+VOID
+DumpLogRecord (
+    _In_ PLOG_CONTEXT Context,
+    _Inout_ PLOG_RECORD LogRecord
+    )
+/*++
+
+Routine Description:
+
+    Converts one log record to text on the screen and/or in the log file.
+
+Arguments:
+
+    Context - The logging context.
+
+    LogRecord - The record to output.  Reparse point records are rewritten
+        in place.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PRECORD_DATA pRecordData = &LogRecord->Data;
+
+    //
+    //  See if a reparse point entry
+    //
+
+    if (FlagOn(LogRecord->RecordType,RECORD_TYPE_FILETAG)) {
+
+        if (!TranslateFileTag( LogRecord )){
+
+            //
+            // If this is a reparse point that can't be interpreted, move on.
+            //
+
+            return;
+        }
+    }
+
+    if (Context->LogToScreen) {
+
+        ScreenDump( LogRecord->SequenceNumber,
+                    LogRecord->Name,
+                    pRecordData );
+    }
+
+    if (Context->LogToFile) {
+
+        FileDump( LogRecord->SequenceNumber,
+                  LogRecord->Name,
+                  pRecordData,
+                  Context->OutputFile );
+    }
+
+    //
+    //  The RecordType could also designate that we are out of memory
+    //  or hit our program defined memory limit, so check for these
+    //  cases.
+    //
+
+    if (FlagOn(LogRecord->RecordType,RECORD_TYPE_FLAG_OUT_OF_MEMORY)) {
+
+        if (Context->LogToScreen) {
+
+            printf( "M:  %08X System Out of Memory\n",
+                    LogRecord->SequenceNumber );
+        }
+
+        if (Context->LogToFile) {
+
+            fprintf( Context->OutputFile,
+                     "M:\t0x%08X\tSystem Out of Memory\n",
+                     LogRecord->SequenceNumber );
+        }
+
+    } else if (FlagOn(LogRecord->RecordType,RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE)) {
+
+        if (Context->LogToScreen) {
+
+            printf( "M:  %08X Exceeded Mamimum Allowed Memory Buffers\n",
+                    LogRecord->SequenceNumber );
+        }
+
+        if (Context->LogToFile) {
+
+            fprintf( Context->OutputFile,
+                     "M:\t0x%08X\tExceeded Mamimum Allowed Memory Buffers\n",
+                     LogRecord->SequenceNumber );
+        }
+    }
+}
+
+
 DWORD
 WINAPI
 RetrieveLogRecords(
@@ -104,6 +457,11 @@ Routine Description:
     This runs as a separate thread.  Its job is to retrieve log records
     from the filter and then output them
 
+    If the filter can share its log with us, we only ask it for records
+    until we have the ones it queued before the log was mapped.  After that
+    we consume the shared log in batches and sleep on its event while it
+    is empty.
+
 Arguments:
 
     lpParameter - Contains context structure for synchronizing with the
@@ -122,11 +480,13 @@ Return Value:
     PCHAR buffer = (PCHAR) alignedBuffer;
     HRESULT hResult;
     PLOG_RECORD pLogRecord;
-    PRECORD_DATA pRecordData;
     COMMAND_MESSAGE commandMessage;
+    BOOLEAN sharedLogOnly = FALSE;
 
     //printf("Log: Starting up\n");
 
+    MapSharedLog( context );
+
 #pragma warning(push)
 #pragma warning(disable:4127) // conditional expression is constant
 
@@ -143,6 +503,28 @@ Return Value:
             break;
         }
 
+        if (sharedLogOnly) {
+
+            if (DrainSharedLog( context ) == 0) {
+
+                //
+                //  Tell the filter we are about to wait, then look one last
+                //  time so we do not miss a record written in between.
+                //
+
+                InterlockedExchange( &context->SharedLog->ConsumerWaiting, TRUE );
+
+                if (DrainSharedLog( context ) == 0) {
+
+                    WaitForSingleObject( context->SharedLogEvent, POLL_INTERVAL );
+                }
+
+                InterlockedExchange( &context->SharedLog->ConsumerWaiting, FALSE );
+            }
+
+            continue;
+        }
+
         //
         //  Request log data from MiniSpy.
         //
@@ -167,6 +549,11 @@ Return Value:
                 if (hResult != HRESULT_FROM_WIN32( ERROR_NO_MORE_ITEMS )) {
 
                     printf( "UNEXPECTED ERROR received: %x\n", hResult );
+
+                } else if (context->SharedLog != NULL) {
+
+                    sharedLogOnly = TRUE;
+                    continue;
                 }
 
                 Sleep( POLL_INTERVAL );
@@ -215,76 +602,7 @@ Return Value:
                 break;
             }
 
-            pRecordData = &pLogRecord->Data;
-
-            //
-            //  See if a reparse point entry
-            //
-
-            if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FILETAG)) {
-
-                if (!TranslateFileTag( pLogRecord )){
-
-                    //
-                    // If this is a reparse point that can't be interpreted, move on.
-                    //
-
-                    pLogRecord = (PLOG_RECORD)Add2Ptr(pLogRecord,pLogRecord->Length);
-                    continue;
-                }
-            }
-
-            if (context->LogToScreen) {
-
-                ScreenDump( pLogRecord->SequenceNumber,
-                            pLogRecord->Name,
-                            pRecordData );
-            }
-
-            if (context->LogToFile) {
-
-                FileDump( pLogRecord->SequenceNumber,
-                          pLogRecord->Name,
-                          pRecordData,
-                          context->OutputFile );
-            }
-
-            //
-            //  The RecordType could also designate that we are out of memory
-            //  or hit our program defined memory limit, so check for these
-            //  cases.
-            //
-
-            if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FLAG_OUT_OF_MEMORY)) {
-
-                if (context->LogToScreen) {
-
-                    printf( "M:  %08X System Out of Memory\n",
-                            pLogRecord->SequenceNumber );
-                }
-
-                if (context->LogToFile) {
-
-                    fprintf( context->OutputFile,
-                             "M:\t0x%08X\tSystem Out of Memory\n",
-                             pLogRecord->SequenceNumber );
-                }
-
-            } else if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE)) {
-
-                if (context->LogToScreen) {
-
-                    printf( "M:  %08X Exceeded Mamimum Allowed Memory Buffers\n",
-                            pLogRecord->SequenceNumber );
-                }
-
-                if (context->LogToFile) {
-
-                    fprintf( context->OutputFile,
-                             "M:\t0x%08X\tExceeded Mamimum Allowed Memory Buffers\n",
-                             pLogRecord->SequenceNumber );
-                }
-            }
+            DumpLogRecord( context, pLogRecord );
 
             //
             // Move to next LOG_RECORD
@@ -303,6 +621,14 @@ Return Value:
         }
     }
 
+    if (context->SharedLogEvent != NULL) {
+
+        CloseHandle( context->SharedLogEvent );
+    }
+
+    free( context->SharedReadOffsets );
+    free( context->SharedWriteOffsets );
+
     printf( "Log: Shutting down\n" );
     ReleaseSemaphore( context->ShutDown, 1, NULL );
     printf( "Log: All done\n" );
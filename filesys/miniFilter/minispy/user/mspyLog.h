@@ -45,6 +45,17 @@ typedef struct _LOG_CONTEXT {
     BOOLEAN CleaningUp;
     HANDLE  ShutDown;
 
+    //
+    //  The log the filter shares with us, if it could map one, the event
+    //  it signals when we wait for records, and where we have read each
+    //  of its rings up to.
+    //
+
+    PMINISPY_SHARED_LOG SharedLog;
+    HANDLE SharedLogEvent;
+    PULONG SharedReadOffsets;
+    PULONG SharedWriteOffsets;
+
 } LOG_CONTEXT, *PLOG_CONTEXT;
 
 //
@@ -56,6 +67,12 @@ RetrieveLogRecords(
     _In_ LPVOID lpParameter
     );
 
+VOID
+DumpLogRecord (
+    _In_ PLOG_CONTEXT Context,
+    _Inout_ PLOG_RECORD LogRecord
+    );
+
 VOID
 FileDump (
     _In_ ULONG SequenceNumber,
@@ -230,6 +230,10 @@ Return Value:
     context.LogToScreen = FALSE;        //don't start logging yet
     context.NextLogToScreen = TRUE;
     context.OutputFile = NULL;
+    context.SharedLog = NULL;
+    context.SharedLogEvent = NULL;
+    context.SharedReadOffsets = NULL;
+    context.SharedWriteOffsets = NULL;
 
     if (context.ShutDown == NULL) {
 
@@ -28,6 +28,7 @@ Environment:
 #include <fltuser.h>
 #include "scanuk.h"
 #include "scanuser.h"
+#include "sigscan.h"
 #include <dontuse.h>
 
 //
@@ -40,6 +41,13 @@ Environment:
 
 UCHAR FoulString[] = "foul";
 
+//
+//  The signatures buffers are scanned for: FoulString plus those of the
+//  optional signature file.
+//
+
+PSIG_SET Signatures;
+
 //
 //  Context passed to worker threads
 //
@@ -74,7 +82,63 @@ Return Value
 {
 
     printf( "Connects to the scanner filter and scans buffers \n" );
-    printf( "Usage: scanuser [requests per thread] [number of threads(1-64)]\n" );
+    printf( "Usage: scanuser [requests per thread] [number of threads(1-64)] [signature file]\n" );
+}
+
+HRESULT
+LoadSignatures (
+    _In_opt_ PCSTR SignatureFile
+    )
+/*++
+
+Routine Description
+
+    Compiles FoulString and the signatures of the signature file into
+    the Signatures set
+
+Arguments
+
+    SignatureFile   -   Optional signature file, see sigscan.h for its format
+
+Return Value
+
+    S_OK or the reason the signatures could not be loaded
+
+--*/
+{
+    PSIG_SET signatures;
+    HRESULT hr;
+
+    hr = SigCreateSet( &signatures );
+
+    if (FAILED( hr )) {
+
+        return hr;
+    }
+
+    hr = SigAddPattern( signatures,
+                        "FoulString",
+                        FoulString,
+                        sizeof(FoulString) - sizeof(UCHAR) );
+
+    if (SUCCEEDED( hr ) && (SignatureFile != NULL)) {
+
+        hr = SigAddPatternsFromFile( signatures, SignatureFile );
+    }
+
+    if (SUCCEEDED( hr )) {
+
+        hr = SigCompileSet( signatures );
+    }
+
+    if (FAILED( hr )) {
+
+        SigDeleteSet( signatures );
+        return hr;
+    }
+
+    Signatures = signatures;
+    return S_OK;
 }
 
 BOOL
@@ -86,10 +150,7 @@ ScanBuffer (
 
 Routine Description
 
-    Scans the supplied buffer for an instance of FoulString.
-
-    Note: Pattern matching algorithm used here is just for illustration purposes,
-    there are many better algorithms available for real world filters
+    Scans the supplied buffer for an instance of any of the Signatures.
 
 Arguments
 
@@ -98,29 +159,25 @@ Arguments
 
 Return Value
 
-    TRUE        -    Found an occurrence of the appropriate FoulString
+    TRUE        -    Found an occurrence of one of the Signatures
     FALSE       -    Buffer is ok
 
 --*/
 {
-    PUCHAR p;
-    ULONG searchStringLength = sizeof(FoulString) - sizeof(UCHAR);
-
-    for (p = Buffer;
-         p <= (Buffer + BufferSize - searchStringLength);
-         p++) {
+    SIG_SCAN_STATE scanState;
+    SIG_MATCH match;
 
-        if (RtlEqualMemory( p, FoulString, searchStringLength )) {
+    SigInitializeScanState( &scanState );
 
-            printf( "Found a string\n" );
+    //
+    //  Once we find a signature, we're not interested in seeing whether
+    //  it or any other appears again.
+    //
 
-            //
-            //  Once we find our search string, we're not interested in seeing
-            //  whether it appears again.
-            //
+    if (SigScanBuffer( Signatures, &scanState, Buffer, BufferSize, &match )) {
 
-            return TRUE;
-        }
+        printf( "Found a string (%s)\n", SigGetPatternName( Signatures, match.PatternIndex ) );
+        return TRUE;
     }
 
     return FALSE;
@@ -302,6 +359,18 @@ main (
         }
     }
 
+    //
+    //  Compile the signatures to scan for.
+    //
+
+    hr = LoadSignatures( (argc > 3) ? argv[3] : NULL );
+
+    if (IS_ERROR( hr )) {
+
+        printf( "ERROR: Loading signatures: 0x%08x\n", hr );
+        return 4;
+    }
+
     //
     //  Open a commuication channel to the filter
     //
@@ -318,6 +387,7 @@ main (
     if (IS_ERROR( hr )) {
 
         printf( "ERROR: Connecting to filter port: 0x%08x\n", hr );
+        SigDeleteSet( Signatures );
         return 2;
     }
 
@@ -334,6 +404,7 @@ main (
 
         printf( "ERROR: Creating completion port: %d\n", GetLastError() );
         CloseHandle( port );
+        SigDeleteSet( Signatures );
         return 3;
     }
 
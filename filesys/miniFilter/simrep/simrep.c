@@ -87,6 +87,7 @@ Environment:
 
 #define SIMREP_STRING_TAG            'tSpR'
 #define SIMREP_REG_TAG               'eRpR'
+#define SIMREP_MAPPING_TAG           'pMpR'
 
 //
 // Constants
@@ -115,8 +116,76 @@ typedef struct _MAPPING_ENTRY {
 
     UNICODE_STRING NewName;
 
+    //
+    //  Upcased copies of the paths, which the mapping tries are built from.
+    //
+
+    UNICODE_STRING UpcaseOldName;
+    UNICODE_STRING UpcaseNewName;
+
 } MAPPING_ENTRY, *PMAPPING_ENTRY;
 
+//
+//  Path components longer than this can not be part of a mapping.
+//
+
+#define MAPPING_MAX_COMPONENT_LENGTH    255
+
+#define MAPPING_NO_ENTRY                ((ULONG)-1)
+
+//
+//  The old paths of the mappings, and their new paths, are each compiled
+//  into a trie of path components so a file name is matched against all
+//  the mappings in one walk down its components.  The nodes are kept in a
+//  single array with the children of a node next to each other, sorted by
+//  their upcased names so they can be binary searched.
+//
+
+typedef struct _MAPPING_TRIE_NODE {
+
+    //
+    //  The component as it was configured, and upcased.  Case sensitive
+    //  opens compare against the configured name, so mappings that share a
+    //  component should spell it with the same case.
+    //
+
+    UNICODE_STRING Name;
+    UNICODE_STRING UpcaseName;
+
+    //
+    //  Index of the first child of the node, and the number of children.
+    //
+
+    ULONG FirstChild;
+    ULONG ChildCount;
+
+    //
+    //  Index of the mapping whose path ends at this node, or
+    //  MAPPING_NO_ENTRY.
+    //
+
+    ULONG Entry;
+
+    //
+    //  Number of components between the root and this node.
+    //
+
+    ULONG Depth;
+
+} MAPPING_TRIE_NODE, *PMAPPING_TRIE_NODE;
+
+typedef struct _MAPPING_TRIE {
+
+    ULONG NodeCount;
+
+    //
+    //  Nodes[0] is the root of the volume.
+    //
+
+    PMAPPING_TRIE_NODE Nodes;
+
+} MAPPING_TRIE, *PMAPPING_TRIE;
+
 
 //
 //  Starting with windows 7, the IO Manager provides IoReplaceFileObjectName,
@@ -158,10 +227,14 @@ typedef struct _SIMREP_GLOBAL_DATA {
     PFLT_FILTER Filter;
 
     //
-    //  Structure to hold mapping information.
+    //  The mappings, and the tries of their old and new paths.
     //
 
-    MAPPING_ENTRY Mapping;
+    ULONG MappingCount;
+    PMAPPING_ENTRY Mappings;
+
+    MAPPING_TRIE OldNameTrie;
+    MAPPING_TRIE NewNameTrie;
 
     //
     //  Pointer to the function we will use to
@@ -271,6 +344,27 @@ SimRepSetConfiguration(
     _In_ PUNICODE_STRING RegistryPath
     );
 
+NTSTATUS
+SimRepQueryValue (
+    _In_ HANDLE Key,
+    _In_ PCWSTR ValueName,
+    _In_ ULONG Type,
+    _Outptr_result_maybenull_ PKEY_VALUE_PARTIAL_INFORMATION *Value
+    );
+
+BOOLEAN
+SimRepNextMultiSzString (
+    _Inout_ PWCHAR *Cursor,
+    _In_ PWCHAR End,
+    _Out_ PUNICODE_STRING String
+    );
+
+NTSTATUS
+SimRepAddMapping (
+    _In_ PUNICODE_STRING OldName,
+    _In_ PUNICODE_STRING NewName
+    );
+
 VOID SimRepFreeGlobals(
     );
 
@@ -347,19 +441,55 @@ SimRepReplaceFileObjectName (
 BOOLEAN
 SimRepCompareMapping(
     _In_ PFLT_FILE_NAME_INFORMATION NameInfo,
-    _In_ PUNICODE_STRING MappingPath,
+    _In_ PMAPPING_TRIE Trie,
     _In_ BOOLEAN IgnoreCase,
+    _Outptr_result_maybenull_ PMAPPING_ENTRY *Mapping,
+    _Out_opt_ PUSHORT MatchLength,
     _Out_opt_ PBOOLEAN ExactMatch
     );
 
 NTSTATUS
 SimRepMungeName(
     _In_ PFLT_FILE_NAME_INFORMATION NameInfo,
-    _In_ PUNICODE_STRING SubPath,
-    _In_ PUNICODE_STRING NewSubPath,
+    _In_ PMAPPING_TRIE Trie,
     _In_ BOOLEAN IgnoreCase,
     _In_ BOOLEAN ExactMatch,
-    _Out_ PUNICODE_STRING MungedPath
+    _Out_ PUNICODE_STRING MungedPath,
+    _Outptr_result_maybenull_ PMAPPING_ENTRY *Mapping
+    );
+
+//
+//  Functions that build the mapping tries
+//
+
+BOOLEAN
+SimRepNextPathComponent (
+    _Inout_ PUNICODE_STRING Remaining,
+    _Out_ PUNICODE_STRING Component
+    );
+
+ULONG
+SimRepGetPathComponent (
+    _In_ PUNICODE_STRING Path,
+    _In_ ULONG Index,
+    _Out_ PUNICODE_STRING Component
+    );
+
+LONG
+SimRepComparePaths (
+    _In_ PUNICODE_STRING Path1,
+    _In_ PUNICODE_STRING Path2
+    );
+
+NTSTATUS
+SimRepBuildMappingTrie (
+    _In_ BOOLEAN NewNames,
+    _Out_ PMAPPING_TRIE Trie
+    );
+
+VOID
+SimRepFreeMappingTrie (
+    _Inout_ PMAPPING_TRIE Trie
     );
 
 //
@@ -532,6 +662,12 @@ SIMREP_GLOBAL_DATA Globals;
 #pragma alloc_text(INIT, SimRepGetIoOpenDriverRegistryKey)
 #pragma alloc_text(INIT, SimRepOpenServiceParametersKey)
 #pragma alloc_text(INIT, SimRepSetConfiguration)
+#pragma alloc_text(INIT, SimRepQueryValue)
+#pragma alloc_text(INIT, SimRepNextMultiSzString)
+#pragma alloc_text(INIT, SimRepAddMapping)
+#pragma alloc_text(INIT, SimRepGetPathComponent)
+#pragma alloc_text(INIT, SimRepComparePaths)
+#pragma alloc_text(INIT, SimRepBuildMappingTrie)
 #pragma alloc_text(PAGE, SimRepUnload)
 #pragma alloc_text(PAGE, SimRepInstanceSetup)
 #pragma alloc_text(PAGE, SimRepInstanceQueryTeardown)
@@ -540,6 +676,8 @@ SIMREP_GLOBAL_DATA Globals;
 #pragma alloc_text(PAGE, SimRepReplaceFileObjectName)
 #pragma alloc_text(PAGE, SimRepCompareMapping)
 #pragma alloc_text(PAGE, SimRepMungeName)
+#pragma alloc_text(PAGE, SimRepNextPathComponent)
+#pragma alloc_text(PAGE, SimRepFreeMappingTrie)
 #pragma alloc_text(PAGE, SimRepPreCreate)
 #pragma alloc_text(PAGE, SimRepPreNetworkQueryOpen)
 #pragma alloc_text(PAGE, SimRepPreSetInformation)
@@ -608,9 +746,11 @@ Return Value:
 
     Globals.RemapRenamesAndLinks = FALSE;
 
-    RtlInitUnicodeString( &Globals.Mapping.NewName, NULL );
+    Globals.MappingCount = 0;
+    Globals.Mappings = NULL;
 
-    RtlInitUnicodeString( &Globals.Mapping.OldName, NULL );
+    RtlZeroMemory( &Globals.OldNameTrie, sizeof( MAPPING_TRIE ) );
+    RtlZeroMemory( &Globals.NewNameTrie, sizeof( MAPPING_TRIE ) );
 
     //
     //  Import function to replace file names.
@@ -859,10 +999,15 @@ Return Value:
     PKEY_VALUE_PARTIAL_INFORMATION value = (PKEY_VALUE_PARTIAL_INFORMATION)buffer;
     ULONG valueLength = sizeof(buffer);
     ULONG resultLength;
-    PKEY_VALUE_PARTIAL_INFORMATION mappingValue = NULL;
-    ULONG mappingValueLength = 0;
-    WCHAR oldMappingTail;
-    WCHAR newMappingTail;
+    PKEY_VALUE_PARTIAL_INFORMATION oldMappingValue = NULL;
+    PKEY_VALUE_PARTIAL_INFORMATION newMappingValue = NULL;
+    PKEY_VALUE_PARTIAL_INFORMATION mappingsValue = NULL;
+    UNICODE_STRING oldName;
+    UNICODE_STRING newName;
+    ULONG mappingCount = 0;
+    ULONG stringCount;
+    PWCHAR cursor;
+    PWCHAR end = NULL;
 
     PAGED_CODE();
 
@@ -922,179 +1067,158 @@ Return Value:
     }
 
     //
-    //  Query the length of the old mapping.
-    //
-
-    RtlInitUnicodeString( &valueName, L"OldMapping" );
-
-    status = ZwQueryValueKey( driverRegKey,
-                              &valueName,
-                              KeyValuePartialInformation,
-                              NULL,
-                              0,
-                              &mappingValueLength );
-
-    if (status!=STATUS_BUFFER_TOO_SMALL && status!=STATUS_BUFFER_OVERFLOW) {
-
-        status = STATUS_INVALID_PARAMETER;
-        goto SimRepSetConfigurationCleanup;
-    }
-
-    //
-    //  Extract the old mapping string.
+    //  Query the mapping given by the OldMapping and NewMapping values, if
+    //  there is one.
     //
 
-    mappingValue = ExAllocatePoolZero( PagedPool,
-                                       mappingValueLength,
-                                       SIMREP_REG_TAG );
+    status = SimRepQueryValue( driverRegKey,
+                               L"OldMapping",
+                               REG_SZ,
+                               &oldMappingValue );
 
-    if (mappingValue == NULL) {
+    if (!NT_SUCCESS( status ) && (status != STATUS_OBJECT_NAME_NOT_FOUND)) {
 
-        status = STATUS_INSUFFICIENT_RESOURCES;
         goto SimRepSetConfigurationCleanup;
     }
 
-    status = ZwQueryValueKey( driverRegKey,
-                              &valueName,
-                              KeyValuePartialInformation,
-                              mappingValue,
-                              mappingValueLength,
-                              &resultLength );
+    status = SimRepQueryValue( driverRegKey,
+                               L"NewMapping",
+                               REG_SZ,
+                               &newMappingValue );
 
-    if (!NT_SUCCESS( status )) {
+    if (!NT_SUCCESS( status ) && (status != STATUS_OBJECT_NAME_NOT_FOUND)) {
 
         goto SimRepSetConfigurationCleanup;
     }
 
-    if (mappingValue->Type != REG_SZ) {
+    if ((oldMappingValue == NULL) != (newMappingValue == NULL)) {
 
         status = STATUS_INVALID_PARAMETER;
         goto SimRepSetConfigurationCleanup;
     }
 
-    Globals.Mapping.OldName.MaximumLength = (USHORT)mappingValue->DataLength;
+    if (oldMappingValue != NULL) {
 
-    status = SimRepAllocateUnicodeString( &Globals.Mapping.OldName );
-
-    if (!NT_SUCCESS( status )) {
-
-        goto SimRepSetConfigurationCleanup;
+        mappingCount = 1;
     }
 
     //
-    //  The length which we receive from ZwQueryValueKey contains size for
-    //  the NULL termination as well. Since we are dealing with unicode
-    //  string we'll chop off the null termination in the length.
+    //  Query the Mappings value, which holds any number of mappings as
+    //  pairs of strings: an old mapping path followed by its new mapping
+    //  path.
     //
 
-    Globals.Mapping.OldName.Length = (USHORT)mappingValue->DataLength - sizeof( UNICODE_NULL );
+    status = SimRepQueryValue( driverRegKey,
+                               L"Mappings",
+                               REG_MULTI_SZ,
+                               &mappingsValue );
 
-    RtlCopyMemory(Globals.Mapping.OldName.Buffer,
-                  mappingValue->Data,
-                  Globals.Mapping.OldName.Length);
+    if (!NT_SUCCESS( status ) && (status != STATUS_OBJECT_NAME_NOT_FOUND)) {
 
-    //
-    //  Query the length of the new mapping.
-    //
-
-    RtlInitUnicodeString( &valueName, L"NewMapping" );
+        goto SimRepSetConfigurationCleanup;
+    }
 
-    status = ZwQueryValueKey( driverRegKey,
-                              &valueName,
-                              KeyValuePartialInformation,
-                              mappingValue,
-                              mappingValueLength,
-                              &mappingValueLength );
+    if (mappingsValue != NULL) {
 
-    if (!NT_SUCCESS( status )) {
+        stringCount = 0;
+        cursor = (PWCHAR)mappingsValue->Data;
+        end = cursor + mappingsValue->DataLength / sizeof( WCHAR );
 
-        if (status!=STATUS_BUFFER_TOO_SMALL && status!=STATUS_BUFFER_OVERFLOW) {
+        while (SimRepNextMultiSzString( &cursor, end, &oldName )) {
 
-            goto SimRepSetConfigurationCleanup;
+            stringCount += 1;
         }
 
-        ExFreePoolWithTag( mappingValue, SIMREP_REG_TAG );
-
-        mappingValue = ExAllocatePoolZero( PagedPool,
-                                           mappingValueLength,
-                                           SIMREP_REG_TAG );
-
-        if (mappingValue == NULL) {
+        if ((stringCount % 2) != 0) {
 
-            status = STATUS_INSUFFICIENT_RESOURCES;
+            status = STATUS_INVALID_PARAMETER;
             goto SimRepSetConfigurationCleanup;
         }
 
+        mappingCount += stringCount / 2;
     }
 
-    //
-    //  Extract the new mapping string.
-    //
-
-    status = ZwQueryValueKey( driverRegKey,
-                              &valueName,
-                              KeyValuePartialInformation,
-                              mappingValue,
-                              mappingValueLength,
-                              &mappingValueLength );
-
-    if (!NT_SUCCESS( status )) {
+    if (mappingCount == 0) {
 
+        status = STATUS_INVALID_PARAMETER;
         goto SimRepSetConfigurationCleanup;
     }
 
+    Globals.Mappings = ExAllocatePoolZero( PagedPool,
+                                           mappingCount * sizeof( MAPPING_ENTRY ),
+                                           SIMREP_MAPPING_TAG );
 
-    if (mappingValue->Type != REG_SZ) {
+    if (Globals.Mappings == NULL) {
 
-        status = STATUS_INVALID_PARAMETER;
+        status = STATUS_INSUFFICIENT_RESOURCES;
         goto SimRepSetConfigurationCleanup;
     }
 
-    Globals.Mapping.NewName.MaximumLength = (USHORT) mappingValue->DataLength;
+    if (oldMappingValue != NULL) {
 
-    status = SimRepAllocateUnicodeString( &Globals.Mapping.NewName );
+        //
+        //  The length which we receive from ZwQueryValueKey contains size
+        //  for the NULL termination as well, which SimRepAddMapping strips.
+        //
 
-    if (!NT_SUCCESS( status )) {
+        oldName.Buffer = (PWCHAR)oldMappingValue->Data;
+        oldName.Length = oldName.MaximumLength = (USHORT)oldMappingValue->DataLength;
 
-        goto SimRepSetConfigurationCleanup;
+        newName.Buffer = (PWCHAR)newMappingValue->Data;
+        newName.Length = newName.MaximumLength = (USHORT)newMappingValue->DataLength;
+
+        status = SimRepAddMapping( &oldName, &newName );
+
+        if (!NT_SUCCESS( status )) {
+
+            goto SimRepSetConfigurationCleanup;
+        }
     }
 
-    //
-    //  The length which we receive from ZwQueryValueKey contains size for
-    //  the NULL termination as well. Since we are dealing with unicode
-    //  string we'll chop off the null termination in the length.
-    //
+    if (mappingsValue != NULL) {
 
-    Globals.Mapping.NewName.Length = (USHORT)mappingValue->DataLength - sizeof( UNICODE_NULL );
+        cursor = (PWCHAR)mappingsValue->Data;
 
-    RtlCopyMemory(Globals.Mapping.NewName.Buffer,
-                  mappingValue->Data,
-                  Globals.Mapping.NewName.Length);
+        while (SimRepNextMultiSzString( &cursor, end, &oldName ) &&
+               SimRepNextMultiSzString( &cursor, end, &newName )) {
 
+            status = SimRepAddMapping( &oldName, &newName );
+
+            if (!NT_SUCCESS( status )) {
+
+                goto SimRepSetConfigurationCleanup;
+            }
+        }
+    }
 
     //
-    //  Ensure the old and new mapping are consistent in specifying either files or directories
-    //  as determined by the presence of a trailing backslash
+    //  Compile the mappings into the tries that creates are matched against.
     //
 
-    oldMappingTail = (WCHAR)Globals.Mapping.OldName.Buffer[Globals.Mapping.OldName.Length / sizeof( WCHAR ) - 1];
-    newMappingTail = (WCHAR)Globals.Mapping.NewName.Buffer[Globals.Mapping.NewName.Length / sizeof( WCHAR ) - 1];
+    status = SimRepBuildMappingTrie( FALSE, &Globals.OldNameTrie );
 
-    if ((oldMappingTail != newMappingTail) &&
-        ((oldMappingTail == OBJ_NAME_PATH_SEPARATOR) ||
-         (newMappingTail == OBJ_NAME_PATH_SEPARATOR))) {
+    if (!NT_SUCCESS( status )) {
 
-        status = STATUS_INVALID_PARAMETER;
         goto SimRepSetConfigurationCleanup;
     }
 
+    status = SimRepBuildMappingTrie( TRUE, &Globals.NewNameTrie );
 
 SimRepSetConfigurationCleanup:
 
-    if (mappingValue != NULL) {
+    if (oldMappingValue != NULL) {
+
+        ExFreePoolWithTag( oldMappingValue, SIMREP_REG_TAG );
+    }
+
+    if (newMappingValue != NULL) {
+
+        ExFreePoolWithTag( newMappingValue, SIMREP_REG_TAG );
+    }
 
-        ExFreePoolWithTag( mappingValue, SIMREP_REG_TAG );
-        mappingValue = NULL;
+    if (mappingsValue != NULL) {
+
+        ExFreePoolWithTag( mappingsValue, SIMREP_REG_TAG );
     }
 
     if (driverRegKey != NULL) {
@@ -1104,162 +1228,470 @@ SimRepSetConfigurationCleanup:
 
     if (!NT_SUCCESS( status )) {
 
-        SimRepFreeUnicodeString( &Globals.Mapping.NewName );
-        SimRepFreeUnicodeString( &Globals.Mapping.OldName );
+        SimRepFreeGlobals();
     }
 
     return status;
 }
 
 
-
-VOID SimRepFreeGlobals(
+NTSTATUS
+SimRepQueryValue (
+    _In_ HANDLE Key,
+    _In_ PCWSTR ValueName,
+    _In_ ULONG Type,
+    _Outptr_result_maybenull_ PKEY_VALUE_PARTIAL_INFORMATION *Value
     )
 /*++
 
 Routine Descrition:
 
-    This routine cleans up the global structure on both
-    teardown and initialization failure.
+    This routine queries a registry value of any length.
 
 Arguments:
 
+    Key - The key to query the value from.
+
+    ValueName - The name of the value.
+
+    Type - The type the value must have.
+
+    Value - Receives the value, allocated from paged pool with
+        SIMREP_REG_TAG, or NULL on failure.
+
 Return Value:
 
-    None.
+    STATUS_OBJECT_NAME_NOT_FOUND if the value does not exist,
+    STATUS_INVALID_PARAMETER if it is not of the given type, or the status
+    of the query.
 
 --*/
 {
+    NTSTATUS status;
+    UNICODE_STRING valueName;
+    PKEY_VALUE_PARTIAL_INFORMATION value = NULL;
+    ULONG valueLength = 0;
+
     PAGED_CODE();
 
-    SimRepFreeUnicodeString( &Globals.Mapping.NewName );
-    SimRepFreeUnicodeString( &Globals.Mapping.OldName );
-}
+    *Value = NULL;
 
-NTSTATUS
-SimRepUnload (
-    FLT_FILTER_UNLOAD_FLAGS Flags
-    )
-/*++
+    RtlInitUnicodeString( &valueName, ValueName );
 
-Routine Description:
+    //
+    //  The value may change between querying its length and querying its
+    //  data, so try until it fits.
+    //
 
-    This is the unload routine for this filter driver. This is called
-    when the minifilter is about to be unloaded. SimRep can unload
-    easily because it does not own any IOs. When the filter is unloaded
-    existing reparsed creates will continue to work, but new creates will
-    not be reparsed. This is fine from the filter's perspective, but could
-    result in unexpected bahavior for apps.
+    for (;;) {
 
-Arguments:
+        status = ZwQueryValueKey( Key,
+                                  &valueName,
+                                  KeyValuePartialInformation,
+                                  value,
+                                  valueLength,
+                                  &valueLength );
 
-    Flags - Indicating if this is a mandatory unload.
+        if ((status != STATUS_BUFFER_TOO_SMALL) && (status != STATUS_BUFFER_OVERFLOW)) {
 
-Return Value:
+            break;
+        }
 
-    Returns the final status of this operation.
+        if (value != NULL) {
 
---*/
-{
-    UNREFERENCED_PARAMETER( Flags );
+            ExFreePoolWithTag( value, SIMREP_REG_TAG );
+        }
 
-    PAGED_CODE();
+        value = ExAllocatePoolZero( PagedPool,
+                                    valueLength,
+                                    SIMREP_REG_TAG );
 
-    DebugTrace( DEBUG_TRACE_LOAD_UNLOAD,
-                ("[SimRep]: Unloading driver\n") );
+        if (value == NULL) {
 
-    FltUnregisterFilter( Globals.Filter );
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
 
-    SimRepFreeGlobals();
+    if (NT_SUCCESS( status ) &&
+        ((value == NULL) ||
+         (value->Type != Type) ||
+         (value->DataLength > UNICODE_STRING_MAX_BYTES))) {
+
+        status = STATUS_INVALID_PARAMETER;
+    }
+
+    if (!NT_SUCCESS( status )) {
+
+        if (value != NULL) {
+
+            ExFreePoolWithTag( value, SIMREP_REG_TAG );
+        }
+
+        return status;
+    }
+
+    *Value = value;
 
     return STATUS_SUCCESS;
 }
 
 
-//
-//  Instance setup/teardown routines.
-//
-
-NTSTATUS
-SimRepInstanceSetup (
-    _In_ PCFLT_RELATED_OBJECTS FltObjects,
-    _In_ FLT_INSTANCE_SETUP_FLAGS Flags,
-    _In_ DEVICE_TYPE VolumeDeviceType,
-    _In_ FLT_FILESYSTEM_TYPE VolumeFilesystemType
+BOOLEAN
+SimRepNextMultiSzString (
+    _Inout_ PWCHAR *Cursor,
+    _In_ PWCHAR End,
+    _Out_ PUNICODE_STRING String
     )
 /*++
 
-Routine Description:
+Routine Descrition:
 
-    This routine is called whenever a new instance is created on a volume. This
-    gives us a chance to decide if we need to attach to this volume or not.
-    SimRep does not attach on automatic attachment, but will attach when asked
-    manually.
+    This routine returns the next string of a REG_MULTI_SZ value.
 
 Arguments:
 
-    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
-        opaque handles to this filter, instance and its associated volume.
+    Cursor - Points to the next string, and is advanced past it.
 
-    Flags - Flags describing the reason for this attach request.
+    End - The end of the value's data.
+
+    String - Receives the string.
 
 Return Value:
 
-    STATUS_SUCCESS - attach
-    STATUS_FLT_DO_NOT_ATTACH - do not attach
+    FALSE if there are no more strings.
 
 --*/
 {
-
-    UNREFERENCED_PARAMETER( FltObjects );
-    UNREFERENCED_PARAMETER( Flags );
-    UNREFERENCED_PARAMETER( VolumeDeviceType );
-    UNREFERENCED_PARAMETER( VolumeFilesystemType );
+    PWCHAR start = *Cursor;
+    PWCHAR current = start;
 
     PAGED_CODE();
 
-    if ( FlagOn( Flags, FLTFL_INSTANCE_SETUP_AUTOMATIC_ATTACHMENT ) ) {
+    while ((current < End) && (*current != UNICODE_NULL)) {
 
-        //
-        //  Do not automatically attach to a volume.
-        //
+        current += 1;
+    }
 
-        DebugTrace( DEBUG_TRACE_INSTANCES,
-                    ("[Simrep]: Instance setup skipped (Volume = %p, Instance = %p)\n",
-                    FltObjects->Volume,
-                    FltObjects->Instance) );
+    if (current == start) {
 
-        return STATUS_FLT_DO_NOT_ATTACH;
+        return FALSE;
     }
 
-    //
-    //  Attach on manual attachment.
-    //
-
-    DebugTrace( DEBUG_TRACE_INSTANCES,
-                ("[SimRep]: Instance setup started (Volume = %p, Instance = %p)\n",
-                 FltObjects->Volume,
-                 FltObjects->Instance) );
+    String->Buffer = start;
+    String->Length = String->MaximumLength = (USHORT)PtrOffset( start, current );
 
+    *Cursor = (current < End) ? current + 1 : current;
 
-    return STATUS_SUCCESS;
+    return TRUE;
 }
 
 
 NTSTATUS
-SimRepInstanceQueryTeardown (
-    _In_ PCFLT_RELATED_OBJECTS FltObjects,
-    _In_ FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags
+SimRepAddMapping (
+    _In_ PUNICODE_STRING OldName,
+    _In_ PUNICODE_STRING NewName
     )
 /*++
 
-Routine Description:
+Routine Descrition:
 
-    This is called when an instance is being manually deleted by a
-    call to FltDetachVolume or FilterDetach thereby giving us a
-    chance to fail that detach request. SimRep only implements it
-    because otherwise calls to FltDetachVolume or FilterDetach would
-    fail to detach.
+    This routine adds a mapping to the global mapping array, which must have
+    room for it.  Trailing NULL and path separator characters are stripped
+    from the paths.
+
+Arguments:
+
+    OldName - Path under which we want to reparse.
+
+    NewName - Path to reparse to.
+
+Return Value:
+
+    STATUS_INVALID_PARAMETER if the paths are not valid, or the status of
+    the allocations.
+
+--*/
+{
+    NTSTATUS status;
+    PMAPPING_ENTRY mapping = &Globals.Mappings[Globals.MappingCount];
+    UNICODE_STRING oldName = *OldName;
+    UNICODE_STRING newName = *NewName;
+    UNICODE_STRING remaining;
+    UNICODE_STRING component;
+    WCHAR oldMappingTail;
+    WCHAR newMappingTail;
+
+    PAGED_CODE();
+
+    while ((oldName.Length > 0) && (oldName.Buffer[oldName.Length / sizeof( WCHAR ) - 1] == UNICODE_NULL)) {
+
+        oldName.Length -= sizeof( WCHAR );
+    }
+
+    while ((newName.Length > 0) && (newName.Buffer[newName.Length / sizeof( WCHAR ) - 1] == UNICODE_NULL)) {
+
+        newName.Length -= sizeof( WCHAR );
+    }
+
+    if ((oldName.Length == 0) || (newName.Length == 0)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    //  Ensure the old and new mapping are consistent in specifying either files or directories
+    //  as determined by the presence of a trailing backslash
+    //
+
+    oldMappingTail = oldName.Buffer[oldName.Length / sizeof( WCHAR ) - 1];
+    newMappingTail = newName.Buffer[newName.Length / sizeof( WCHAR ) - 1];
+
+    if ((oldMappingTail != newMappingTail) &&
+        ((oldMappingTail == OBJ_NAME_PATH_SEPARATOR) ||
+         (newMappingTail == OBJ_NAME_PATH_SEPARATOR))) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    while ((oldName.Length > 0) && (oldName.Buffer[oldName.Length / sizeof( WCHAR ) - 1] == OBJ_NAME_PATH_SEPARATOR)) {
+
+        oldName.Length -= sizeof( WCHAR );
+    }
+
+    while ((newName.Length > 0) && (newName.Buffer[newName.Length / sizeof( WCHAR ) - 1] == OBJ_NAME_PATH_SEPARATOR)) {
+
+        newName.Length -= sizeof( WCHAR );
+    }
+
+    //
+    //  The old path must name something below the root, and no component
+    //  of it can be longer than a component we are able to match.
+    //
+
+    if ((oldName.Length == 0) || (newName.Length == 0)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    remaining = oldName;
+
+    while (SimRepNextPathComponent( &remaining, &component )) {
+
+        if (component.Length > MAPPING_MAX_COMPONENT_LENGTH * sizeof( WCHAR )) {
+
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    Globals.MappingCount += 1;
+
+    mapping->OldName.MaximumLength = oldName.Length;
+    mapping->NewName.MaximumLength = newName.Length;
+    mapping->UpcaseOldName.MaximumLength = oldName.Length;
+    mapping->UpcaseNewName.MaximumLength = newName.Length;
+
+    status = SimRepAllocateUnicodeString( &mapping->OldName );
+
+    if (NT_SUCCESS( status )) {
+
+        status = SimRepAllocateUnicodeString( &mapping->NewName );
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        status = SimRepAllocateUnicodeString( &mapping->UpcaseOldName );
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        status = SimRepAllocateUnicodeString( &mapping->UpcaseNewName );
+    }
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    RtlCopyUnicodeString( &mapping->OldName, &oldName );
+    RtlCopyUnicodeString( &mapping->NewName, &newName );
+
+    status = RtlUpcaseUnicodeString( &mapping->UpcaseOldName, &oldName, FALSE );
+
+    NT_ASSERT( NT_SUCCESS( status ) );
+
+    status = RtlUpcaseUnicodeString( &mapping->UpcaseNewName, &newName, FALSE );
+
+    NT_ASSERT( NT_SUCCESS( status ) );
+
+    return status;
+}
+
+
+VOID SimRepFreeGlobals(
+    )
+/*++
+
+Routine Descrition:
+
+    This routine cleans up the global structure on both
+    teardown and initialization failure.
+
+Arguments:
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    SimRepFreeMappingTrie( &Globals.OldNameTrie );
+    SimRepFreeMappingTrie( &Globals.NewNameTrie );
+
+    if (Globals.Mappings != NULL) {
+
+        for (i = 0; i < Globals.MappingCount; i++) {
+
+            SimRepFreeUnicodeString( &Globals.Mappings[i].NewName );
+            SimRepFreeUnicodeString( &Globals.Mappings[i].OldName );
+            SimRepFreeUnicodeString( &Globals.Mappings[i].UpcaseNewName );
+            SimRepFreeUnicodeString( &Globals.Mappings[i].UpcaseOldName );
+        }
+
+        ExFreePoolWithTag( Globals.Mappings, SIMREP_MAPPING_TAG );
+        Globals.Mappings = NULL;
+    }
+
+    Globals.MappingCount = 0;
+}
+
+NTSTATUS
+SimRepUnload (
+    FLT_FILTER_UNLOAD_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    This is the unload routine for this filter driver. This is called
+    when the minifilter is about to be unloaded. SimRep can unload
+    easily because it does not own any IOs. When the filter is unloaded
+    existing reparsed creates will continue to work, but new creates will
+    not be reparsed. This is fine from the filter's perspective, but could
+    result in unexpected bahavior for apps.
+
+Arguments:
+
+    Flags - Indicating if this is a mandatory unload.
+
+Return Value:
+
+    Returns the final status of this operation.
+
+--*/
+{
+    UNREFERENCED_PARAMETER( Flags );
+
+    PAGED_CODE();
+
+    DebugTrace( DEBUG_TRACE_LOAD_UNLOAD,
+                ("[SimRep]: Unloading driver\n") );
+
+    FltUnregisterFilter( Globals.Filter );
+
+    SimRepFreeGlobals();
+
+    return STATUS_SUCCESS;
+}
+
+
+//
+//  Instance setup/teardown routines.
+//
+
+NTSTATUS
+SimRepInstanceSetup (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ FLT_INSTANCE_SETUP_FLAGS Flags,
+    _In_ DEVICE_TYPE VolumeDeviceType,
+    _In_ FLT_FILESYSTEM_TYPE VolumeFilesystemType
+    )
+/*++
+
+Routine Description:
+
+    This routine is called whenever a new instance is created on a volume. This
+    gives us a chance to decide if we need to attach to this volume or not.
+    SimRep does not attach on automatic attachment, but will attach when asked
+    manually.
+
+Arguments:
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance and its associated volume.
+
+    Flags - Flags describing the reason for this attach request.
+
+Return Value:
+
+    STATUS_SUCCESS - attach
+    STATUS_FLT_DO_NOT_ATTACH - do not attach
+
+--*/
+{
+
+    UNREFERENCED_PARAMETER( FltObjects );
+    UNREFERENCED_PARAMETER( Flags );
+    UNREFERENCED_PARAMETER( VolumeDeviceType );
+    UNREFERENCED_PARAMETER( VolumeFilesystemType );
+
+    PAGED_CODE();
+
+    if ( FlagOn( Flags, FLTFL_INSTANCE_SETUP_AUTOMATIC_ATTACHMENT ) ) {
+
+        //
+        //  Do not automatically attach to a volume.
+        //
+
+        DebugTrace( DEBUG_TRACE_INSTANCES,
+                    ("[Simrep]: Instance setup skipped (Volume = %p, Instance = %p)\n",
+                    FltObjects->Volume,
+                    FltObjects->Instance) );
+
+        return STATUS_FLT_DO_NOT_ATTACH;
+    }
+
+    //
+    //  Attach on manual attachment.
+    //
+
+    DebugTrace( DEBUG_TRACE_INSTANCES,
+                ("[SimRep]: Instance setup started (Volume = %p, Instance = %p)\n",
+                 FltObjects->Volume,
+                 FltObjects->Instance) );
+
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+SimRepInstanceQueryTeardown (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    This is called when an instance is being manually deleted by a
+    call to FltDetachVolume or FilterDetach thereby giving us a
+    chance to fail that detach request. SimRep only implements it
+    because otherwise calls to FltDetachVolume or FilterDetach would
+    fail to detach.
 
 Arguments:
 
@@ -1326,6 +1758,7 @@ Return Value:
     NTSTATUS status;
     FLT_PREOP_CALLBACK_STATUS callbackStatus;
     BOOLEAN match;
+    PMAPPING_ENTRY mapping;
     PIO_STACK_LOCATION irpSp;
 
     UNREFERENCED_PARAMETER( FltObjects );
@@ -1443,8 +1876,10 @@ Return Value:
     //
 
     match = SimRepCompareMapping( nameInfo,
-                                  &Globals.Mapping.OldName,
+                                  &Globals.OldNameTrie,
                                   !FlagOn( irpSp->Flags, SL_CASE_SENSITIVE ),
+                                  &mapping,
+                                  NULL,
                                   NULL );
 
     if (match) {
@@ -1456,8 +1891,8 @@ Return Value:
                      &nameInfo->Name,
                      Cbd,
                      FltObjects->FileObject,
-                     Globals.Mapping.OldName,
-                     Globals.Mapping.NewName) );
+                     &mapping->OldName,
+                     &mapping->NewName) );
 
         //
         // Because the file matched the mapping, we need to redirect this open with a new name.
@@ -1555,6 +1990,7 @@ Return Value:
     NTSTATUS status;
     FLT_PREOP_CALLBACK_STATUS callbackStatus;
     UNICODE_STRING newFileName;
+    PMAPPING_ENTRY mapping;
 
     UNREFERENCED_PARAMETER( FltObjects );
     UNREFERENCED_PARAMETER( CompletionContext );
@@ -1741,11 +2177,11 @@ Return Value:
     //
 
     status = SimRepMungeName( nameInfo,
-                              &Globals.Mapping.OldName,
-                              &Globals.Mapping.NewName,
+                              &Globals.OldNameTrie,
                               !FlagOn( Cbd->Iopb->OperationFlags, SL_CASE_SENSITIVE ),
                               FALSE,
-                              &newFileName);
+                              &newFileName,
+                              &mapping );
 
     if (!NT_SUCCESS( status )) {
 
@@ -1763,8 +2199,8 @@ Return Value:
                  &nameInfo->Name,
                  Cbd,
                  FltObjects->FileObject,
-                 Globals.Mapping.OldName,
-                 Globals.Mapping.NewName) );
+                 &mapping->OldName,
+                 &mapping->NewName) );
 
 
     //
@@ -1888,6 +2324,7 @@ Return Value:
     PFILE_LINK_INFORMATION newLinkInfo = NULL;
     PFLT_FILE_NAME_INFORMATION nameInfo = NULL;
     UNICODE_STRING newFileName;
+    PMAPPING_ENTRY mapping;
 
     struct {
         HANDLE RootDirectory;
@@ -2055,11 +2492,11 @@ Return Value:
     //
 
     status = SimRepMungeName( nameInfo,
-                              &Globals.Mapping.NewName,
-                              &Globals.Mapping.NewName,
+                              &Globals.NewNameTrie,
                               !FlagOn( FltObjects->FileObject->Flags, FO_OPENED_CASE_SENSITIVE ),
                               FALSE,
-                              &newFileName );
+                              &newFileName,
+                              &mapping );
 
     if (status == STATUS_NOT_FOUND) {
 
@@ -2072,11 +2509,11 @@ Return Value:
         //
 
         status = SimRepMungeName( nameInfo,
-                                  &Globals.Mapping.OldName,
-                                  &Globals.Mapping.NewName,
+                                  &Globals.OldNameTrie,
                                   !FlagOn( FltObjects->FileObject->Flags, FO_OPENED_CASE_SENSITIVE ),
                                   TRUE,
-                                  &newFileName );
+                                  &newFileName,
+                                  &mapping );
     }
 
     if (!NT_SUCCESS( status )) {
@@ -2092,6 +2529,16 @@ Return Value:
         goto SimRepPreSetInformationCleanup;
     }
 
+    DebugTrace( DEBUG_TRACE_RENAME_REDIRECTION_OPERATIONS,
+                ("[SimRep]: SimRepPreSetInformation -> Destination %wZ matches mapping. (Cbd = %p, FileObject = %p)\n"
+                 "\tMapping.OldFileName = %wZ\n"
+                 "\tMapping.NewFileName = %wZ\n",
+                 &nameInfo->Name,
+                 Cbd,
+                 FltObjects->FileObject,
+                 &mapping->OldName,
+                 &mapping->NewName) );
+
     //
     //  Explicitly set the munged the name in the set information structure so
     //  lower filters who see this operation will see the correct
@@ -2362,23 +2809,23 @@ CopyAndReturn:
 NTSTATUS
 SimRepMungeName(
     _In_ PFLT_FILE_NAME_INFORMATION NameInfo,
-    _In_ PUNICODE_STRING SubPath,
-    _In_ PUNICODE_STRING NewSubPath,
+    _In_ PMAPPING_TRIE Trie,
     _In_ BOOLEAN IgnoreCase,
     _In_ BOOLEAN ExactMatch,
-    _Out_ PUNICODE_STRING MungedPath
+    _Out_ PUNICODE_STRING MungedPath,
+    _Outptr_result_maybenull_ PMAPPING_ENTRY *Mapping
     )
 /*++
 Routine Description:
 
-    This routine will create a new path by munginging a new subpath
-    over and existing subpath.
+    This routine will create a new path by munginging the new path of the
+    mapping the file matches over the part of the file name that matches it.
 
 Arguments:
 
     NameInfo - Pointer to the name information for the file.
 
-    SubPath - The path to munge.
+    Trie - The trie of mapping paths to match against.
 
     IgnoreCase - If TRUE do a case insenstive comparison.
 
@@ -2387,10 +2834,12 @@ Arguments:
     MungedPath - A unicode string to received the munged path created. The
                  buffer of the string will be allocated in this function.
 
+    Mapping - Receives the mapping that was applied, or NULL.
+
 Return Value:
 
     STATUS_SUCCESS - the path was successfully munged
-    STATUS_NOT_FOUND - the SubPath was not found or is not an exact match
+    STATUS_NOT_FOUND - no mapping path was found or it is not an exact match
     An appropriate NTSTATUS error otherwise.
 
 --*/
@@ -2398,11 +2847,15 @@ Return Value:
     NTSTATUS status = STATUS_NOT_FOUND;
     BOOLEAN match;
     BOOLEAN exactMatch;
-    USHORT length;
+    PMAPPING_ENTRY mapping;
+    USHORT matchLength;
+    ULONG length;
 
     PAGED_CODE();
 
-    match = SimRepCompareMapping( NameInfo, SubPath, IgnoreCase, &exactMatch );
+    *Mapping = NULL;
+
+    match = SimRepCompareMapping( NameInfo, Trie, IgnoreCase, &mapping, &matchLength, &exactMatch );
 
     if (match) {
 
@@ -2411,9 +2864,15 @@ Return Value:
             goto SimRepMungeNameCleanup;
         }
 
-        NT_ASSERT( NameInfo->Name.Length >= SubPath->Length );
+        NT_ASSERT( NameInfo->Name.Length >= NameInfo->Volume.Length + matchLength );
 
-        length = NameInfo->Name.Length - SubPath->Length + NewSubPath->Length;
+        length = NameInfo->Name.Length - matchLength + mapping->NewName.Length;
+
+        if (length > UNICODE_STRING_MAX_BYTES) {
+
+            status = STATUS_NAME_TOO_LONG;
+            goto SimRepMungeNameCleanup;
+        }
 
         RtlInitUnicodeString( MungedPath, NULL );
 
@@ -2436,7 +2895,7 @@ Return Value:
         //  Copy the new file name in place of the matching part of the name
         //
 
-        status = RtlAppendUnicodeStringToString( MungedPath, NewSubPath );
+        status = RtlAppendUnicodeStringToString( MungedPath, &mapping->NewName );
 
         NT_ASSERT( NT_SUCCESS( status ) );
 
@@ -2444,16 +2903,17 @@ Return Value:
         //  Copy the portion of the name following the matching part of the name
         //
 
-        RtlCopyMemory( Add2Ptr( MungedPath->Buffer, NameInfo->Volume.Length + NewSubPath->Length ),
-                       Add2Ptr( NameInfo->Name.Buffer, NameInfo->Volume.Length + SubPath->Length ),
-                       NameInfo->Name.Length - NameInfo->Volume.Length - SubPath->Length );
+        RtlCopyMemory( Add2Ptr( MungedPath->Buffer, NameInfo->Volume.Length + mapping->NewName.Length ),
+                       Add2Ptr( NameInfo->Name.Buffer, NameInfo->Volume.Length + matchLength ),
+                       NameInfo->Name.Length - NameInfo->Volume.Length - matchLength );
 
         //
         //  Compute the final length of the new name
         //
 
-        MungedPath->Length = length;
+        MungedPath->Length = (USHORT)length;
 
+        *Mapping = mapping;
     }
 
 SimRepMungeNameCleanup:
@@ -2464,40 +2924,62 @@ SimRepMungeNameCleanup:
 BOOLEAN
 SimRepCompareMapping(
     _In_ PFLT_FILE_NAME_INFORMATION NameInfo,
-    _In_ PUNICODE_STRING MappingPath,
+    _In_ PMAPPING_TRIE Trie,
     _In_ BOOLEAN IgnoreCase,
+    _Outptr_result_maybenull_ PMAPPING_ENTRY *Mapping,
+    _Out_opt_ PUSHORT MatchLength,
     _Out_opt_ PBOOLEAN ExactMatch
     )
 /*++
 Routine Description:
 
     This routine will compare the file specified by the
-    name information structure to the given mapping path
-    to determine if the file is the mapping path itself
-    or a child of the mapping path.
+    name information structure to the mapping paths in
+    the given trie to find the longest mapping path that
+    is the file itself or one of its parent directories.
+
+    The trie is walked one component of the file name at
+    a time, so the cost of the lookup depends on the depth
+    of the file name and not on the number of mappings.
 
 Arguments:
 
     NameInfo - Pointer to the name information for the file.
 
-    MappingPath - The mapping path to compare against.
+    Trie - The trie of mapping paths to compare against.
 
     IgnoreCase - If TRUE do a case insenstive comparison.
 
+    Mapping - Receives the mapping that matched, or NULL.
+
+    MatchLength - If supplied receives the length in bytes of the
+                  part of the name, after the volume name, that
+                  matches the mapping path.
+
     ExactMatch - If supplied receives TRUE if the name exactly
                  matches the mapping path.
 
 Return Value:
 
-    TRUE - the file matches the mapping path
+    TRUE - the file matches a mapping path
 
-    FALSE - the file is not in the mapping path
+    FALSE - the file is not in any mapping path
 
 --*/
 {
     UNICODE_STRING fileName;
-    BOOLEAN match;
-    BOOLEAN exactMatch;
+    UNICODE_STRING remaining;
+    UNICODE_STRING component;
+    UNICODE_STRING upcaseComponent;
+    WCHAR upcaseBuffer[MAPPING_MAX_COMPONENT_LENGTH];
+    PMAPPING_TRIE_NODE node;
+    PMAPPING_TRIE_NODE child;
+    ULONG entry;
+    USHORT matchLength;
+    ULONG low;
+    ULONG high;
+    ULONG middle;
+    LONG result;
 
     PAGED_CODE();
 
@@ -2517,50 +2999,517 @@ Return Value:
     NT_ASSERT( NameInfo->Name.Buffer == NameInfo->Volume.Buffer );
     NT_ASSERT( NameInfo->Name.Length >= NameInfo->Volume.Length);
 
-    match = FALSE;
-    exactMatch = FALSE;
+    *Mapping = NULL;
+    entry = MAPPING_NO_ENTRY;
+    matchLength = 0;
     fileName.Buffer = Add2Ptr( NameInfo->Name.Buffer, NameInfo->Volume.Length );
     fileName.MaximumLength = NameInfo->Name.Length - NameInfo->Volume.Length;
     fileName.Length = fileName.MaximumLength;
 
+    remaining = fileName;
+    node = (Trie->NodeCount > 0) ? &Trie->Nodes[0] : NULL;
+
+    upcaseComponent.Buffer = upcaseBuffer;
+    upcaseComponent.MaximumLength = sizeof( upcaseBuffer );
+
     //
-    //  Check if the filename matches this mapping entry (is the mapping
-    //  entry itself or some child directory of the mapping entry)
+    //  Walk down the trie one component at a time, remembering the deepest
+    //  node a mapping path ends at. A component that is only a prefix of a
+    //  mapping component, like cd.txt and c in \a\b\cd.txt and \a\b\c,
+    //  does not match.
     //
 
-    if (RtlPrefixUnicodeString( MappingPath, &fileName, IgnoreCase )) {
+    while ((node != NULL) &&
+           (node->ChildCount > 0) &&
+           SimRepNextPathComponent( &remaining, &component )) {
+
+        if (component.Length > upcaseComponent.MaximumLength) {
+
+            break;
+        }
+
+        RtlUpcaseUnicodeString( &upcaseComponent, &component, FALSE );
+
+        //
+        //  The children of a node are sorted by their upcased names
+        //
+
+        child = NULL;
+        low = 0;
+        high = node->ChildCount;
+
+        while (low < high) {
+
+            middle = low + (high - low) / 2;
+
+            result = RtlCompareUnicodeString( &upcaseComponent,
+                                              &Trie->Nodes[node->FirstChild + middle].UpcaseName,
+                                              FALSE );
+
+            if (result == 0) {
+
+                child = &Trie->Nodes[node->FirstChild + middle];
+                break;
+
+            } else if (result < 0) {
+
+                high = middle;
+
+            } else {
+
+                low = middle + 1;
+            }
+        }
+
+        if ((child == NULL) ||
+            (!IgnoreCase && !RtlEqualUnicodeString( &component, &child->Name, FALSE ))) {
+
+            break;
+        }
+
+        node = child;
+
+        if (node->Entry != MAPPING_NO_ENTRY) {
+
+            entry = node->Entry;
+            matchLength = (USHORT)PtrOffset( fileName.Buffer, Add2Ptr( component.Buffer, component.Length ) );
+        }
+    }
+
+    if (entry != MAPPING_NO_ENTRY) {
+
+        *Mapping = &Globals.Mappings[entry];
+    }
+
+    if (ARGUMENT_PRESENT( MatchLength )) {
+        *MatchLength = matchLength;
+    }
+
+    if (ARGUMENT_PRESENT( ExactMatch )) {
+        *ExactMatch = (entry != MAPPING_NO_ENTRY) && (matchLength == fileName.Length);
+    }
+
+    return (entry != MAPPING_NO_ENTRY);
+}
+
+
+BOOLEAN
+SimRepNextPathComponent (
+    _Inout_ PUNICODE_STRING Remaining,
+    _Out_ PUNICODE_STRING Component
+    )
+/*++
+Routine Description:
+
+    This routine splits the next component off a path.
+
+Arguments:
+
+    Remaining - The rest of the path, which is advanced past the component.
+
+    Component - Receives the component, which points into the path.
+
+Return Value:
+
+    FALSE if there are no more components in the path.
 
-        if (fileName.Length == MappingPath->Length) {
+--*/
+{
+    USHORT length;
+
+    PAGED_CODE();
+
+    //
+    //  Skip the separators in front of the component
+    //
+
+    while ((Remaining->Length > 0) && (Remaining->Buffer[0] == OBJ_NAME_PATH_SEPARATOR)) {
+
+        Remaining->Buffer += 1;
+        Remaining->Length -= sizeof( WCHAR );
+    }
+
+    if (Remaining->Length == 0) {
+
+        return FALSE;
+    }
+
+    length = 0;
+
+    while ((length < Remaining->Length) &&
+           (Remaining->Buffer[length / sizeof( WCHAR )] != OBJ_NAME_PATH_SEPARATOR)) {
+
+        length += sizeof( WCHAR );
+    }
+
+    Component->Buffer = Remaining->Buffer;
+    Component->Length = Component->MaximumLength = length;
+
+    Remaining->Buffer = Add2Ptr( Remaining->Buffer, length );
+    Remaining->Length -= length;
+    Remaining->MaximumLength = Remaining->Length;
+
+    return TRUE;
+}
+
+
+ULONG
+SimRepGetPathComponent (
+    _In_ PUNICODE_STRING Path,
+    _In_ ULONG Index,
+    _Out_ PUNICODE_STRING Component
+    )
+/*++
+Routine Description:
+
+    This routine finds a component of a path.
+
+Arguments:
+
+    Path - The path.
+
+    Index - The index of the component to find, from zero.
+
+    Component - Receives the component if the path has one at Index.
+
+Return Value:
+
+    The number of components in the path.
+
+--*/
+{
+    UNICODE_STRING remaining = *Path;
+    UNICODE_STRING component;
+    ULONG count = 0;
+
+    PAGED_CODE();
+
+    RtlInitUnicodeString( Component, NULL );
+
+    while (SimRepNextPathComponent( &remaining, &component )) {
+
+        if (count == Index) {
+
+            *Component = component;
+        }
+
+        count += 1;
+    }
+
+    return count;
+}
+
+
+LONG
+SimRepComparePaths (
+    _In_ PUNICODE_STRING Path1,
+    _In_ PUNICODE_STRING Path2
+    )
+/*++
+Routine Description:
+
+    This routine compares two upcased paths one component at a time, so a
+    path sorts right in front of the paths below it.
+
+Arguments:
+
+    Path1 - The first path.
+
+    Path2 - The second path.
+
+Return Value:
+
+    Less than zero, zero or greater than zero as Path1 sorts before, with
+    or after Path2.
+
+--*/
+{
+    UNICODE_STRING remaining1 = *Path1;
+    UNICODE_STRING remaining2 = *Path2;
+    UNICODE_STRING component1;
+    UNICODE_STRING component2;
+    BOOLEAN more1;
+    BOOLEAN more2;
+    LONG result;
+
+    PAGED_CODE();
+
+    for (;;) {
+
+        more1 = SimRepNextPathComponent( &remaining1, &component1 );
+        more2 = SimRepNextPathComponent( &remaining2, &component2 );
+
+        if (!more1 || !more2) {
+
+            return (LONG)more1 - (LONG)more2;
+        }
+
+        result = RtlCompareUnicodeString( &component1, &component2, FALSE );
+
+        if (result != 0) {
+
+            return result;
+        }
+    }
+}
+
+
+NTSTATUS
+SimRepBuildMappingTrie (
+    _In_ BOOLEAN NewNames,
+    _Out_ PMAPPING_TRIE Trie
+    )
+/*++
+Routine Description:
+
+    This routine compiles the old or new paths of the global mappings into
+    a trie with a node for each distinct path component.
+
+    The mappings are sorted by path first, so the mappings that go through
+    a node are a contiguous range of the sorted mappings, and the children
+    of the node are built by splitting that range wherever the next
+    component changes. Nodes are added in breadth first order, so the
+    children of each node are contiguous and sorted by their upcased names.
+
+Arguments:
+
+    NewNames - If TRUE compile the new paths of the mappings, otherwise
+               compile the old paths.
+
+    Trie - Receives the trie.
+
+Return Value:
+
+    STATUS_INVALID_PARAMETER if two mappings have the same old path, or the
+    status of the allocations.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PULONG order = NULL;
+    PULONG ranges = NULL;
+    PMAPPING_TRIE_NODE nodes = NULL;
+    PMAPPING_TRIE_NODE node;
+    PMAPPING_TRIE_NODE child;
+    PUNICODE_STRING path;
+    PUNICODE_STRING upcasePath;
+    UNICODE_STRING component;
+    UNICODE_STRING nextComponent;
+    ULONG mappingCount = Globals.MappingCount;
+    ULONG maxNodeCount = 1;
+    ULONG nodeCount;
+    ULONG index;
+    ULONG first;
+    ULONG last;
+    ULONG i;
+    ULONG j;
+
+    PAGED_CODE();
+
+    RtlZeroMemory( Trie, sizeof( MAPPING_TRIE ) );
+
+#define SimRepMappingPath(Index) \
+    (NewNames ? &Globals.Mappings[(Index)].NewName : &Globals.Mappings[(Index)].OldName)
+
+#define SimRepUpcaseMappingPath(Index) \
+    (NewNames ? &Globals.Mappings[(Index)].UpcaseNewName : &Globals.Mappings[(Index)].UpcaseOldName)
+
+    //
+    //  Sort the mappings by path. There are few enough of them for an
+    //  insertion sort.
+    //
+
+    order = ExAllocatePoolZero( PagedPool,
+                                mappingCount * sizeof( ULONG ),
+                                SIMREP_MAPPING_TAG );
+
+    if (order == NULL) {
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto SimRepBuildMappingTrieCleanup;
+    }
+
+    for (i = 0; i < mappingCount; i++) {
+
+        index = i;
+
+        for (j = i; (j > 0) && (SimRepComparePaths( SimRepUpcaseMappingPath( index ),
+                                                    SimRepUpcaseMappingPath( order[j - 1] ) ) < 0); j--) {
+
+            order[j] = order[j - 1];
+        }
+
+        order[j] = index;
+
+        maxNodeCount += SimRepGetPathComponent( SimRepUpcaseMappingPath( i ), 0, &component );
+    }
+
+    //
+    //  Each node records the range of sorted mappings that go through it
+    //  while the trie is built.
+    //
+
+    nodes = ExAllocatePoolZero( PagedPool,
+                                maxNodeCount * sizeof( MAPPING_TRIE_NODE ),
+                                SIMREP_MAPPING_TAG );
+
+    ranges = ExAllocatePoolZero( PagedPool,
+                                 maxNodeCount * 2 * sizeof( ULONG ),
+                                 SIMREP_MAPPING_TAG );
+
+    if ((nodes == NULL) || (ranges == NULL)) {
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto SimRepBuildMappingTrieCleanup;
+    }
+
+    nodes[0].Entry = MAPPING_NO_ENTRY;
+    ranges[0] = 0;
+    ranges[1] = mappingCount;
+    nodeCount = 1;
+
+    for (index = 0; index < nodeCount; index++) {
+
+        node = &nodes[index];
+        first = ranges[index * 2];
+        last = ranges[index * 2 + 1];
+
+        node->FirstChild = nodeCount;
+
+        i = first;
+
+        while (i < last) {
+
+            upcasePath = SimRepUpcaseMappingPath( order[i] );
 
             //
-            //  This path is the mapping itself
+            //  A mapping whose path ends at this node sorts in front of the
+            //  mappings below it. An old path must belong to one mapping,
+            //  but several old paths may be redirected to the same new
+            //  path. Names are only munged onto the new path of the entry
+            //  found in the new path trie, which is the same for all of
+            //  them, so its node keeps the first.
             //
 
-            match = TRUE;
+            if (SimRepGetPathComponent( upcasePath, node->Depth, &component ) == node->Depth) {
+
+                if (node->Entry != MAPPING_NO_ENTRY) {
 
-            exactMatch = TRUE;
+                    if (NewNames) {
 
-        } else if (fileName.Buffer[(MappingPath->Length/sizeof( WCHAR ))] == OBJ_NAME_PATH_SEPARATOR) {
+                        i += 1;
+                        continue;
+                    }
+
+                    DebugTrace( DEBUG_TRACE_ERROR,
+                                ("[SimRep]: SimRepBuildMappingTrie -> Duplicate mapping path %wZ\n",
+                                 SimRepMappingPath( order[i] )) );
+
+                    status = STATUS_INVALID_PARAMETER;
+                    goto SimRepBuildMappingTrieCleanup;
+                }
+
+                node->Entry = order[i];
+                i += 1;
+                continue;
+            }
 
             //
-            //  This path is a child of the mapping
+            //  The mappings from i to j share the next component, so they
+            //  go through the same child.
             //
 
-            match = TRUE;
+            for (j = i + 1; j < last; j++) {
+
+                SimRepGetPathComponent( SimRepUpcaseMappingPath( order[j] ), node->Depth, &nextComponent );
+
+                if (!RtlEqualUnicodeString( &component, &nextComponent, FALSE )) {
+
+                    break;
+                }
+            }
+
+            NT_ASSERT( nodeCount < maxNodeCount );
+
+            child = &nodes[nodeCount];
+            ranges[nodeCount * 2] = i;
+            ranges[nodeCount * 2 + 1] = j;
+            nodeCount += 1;
+
+            //
+            //  The upcased path has the same layout as the path, so the
+            //  component has the same offset in both.
+            //
+
+            path = SimRepMappingPath( order[i] );
+
+            child->UpcaseName = component;
+            child->Name.Buffer = Add2Ptr( path->Buffer, PtrOffset( upcasePath->Buffer, component.Buffer ) );
+            child->Name.Length = child->Name.MaximumLength = component.Length;
+            child->Depth = node->Depth + 1;
+            child->Entry = MAPPING_NO_ENTRY;
+
+            node->ChildCount += 1;
+
+            i = j;
         }
+    }
 
-        //
-        //  No match here means the path simply overlaps the mapping like
-        //  \a\b\c overlaps \a\b\cd.txt
-        //
+#undef SimRepMappingPath
+#undef SimRepUpcaseMappingPath
+
+    Trie->NodeCount = nodeCount;
+    Trie->Nodes = nodes;
+    nodes = NULL;
 
+SimRepBuildMappingTrieCleanup:
+
+    if (nodes != NULL) {
+
+        ExFreePoolWithTag( nodes, SIMREP_MAPPING_TAG );
     }
 
-    if (ARGUMENT_PRESENT( ExactMatch )) {
-        *ExactMatch = exactMatch;
+    if (ranges != NULL) {
+
+        ExFreePoolWithTag( ranges, SIMREP_MAPPING_TAG );
+    }
+
+    if (order != NULL) {
+
+        ExFreePoolWithTag( order, SIMREP_MAPPING_TAG );
+    }
+
+    return status;
+}
+
+
+VOID
+SimRepFreeMappingTrie (
+    _Inout_ PMAPPING_TRIE Trie
+    )
+/*++
+Routine Description:
+
+    This routine frees a mapping trie.
+
+Arguments:
+
+    Trie - The trie to free.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    if (Trie->Nodes != NULL) {
+
+        ExFreePoolWithTag( Trie->Nodes, SIMREP_MAPPING_TAG );
     }
 
-    return match;
+    RtlZeroMemory( Trie, sizeof( MAPPING_TRIE ) );
 }
 
 
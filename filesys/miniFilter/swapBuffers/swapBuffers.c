@@ -28,6 +28,7 @@ Environment:
 #include <fltKernel.h>
 #include <dontuse.h>
 #include <suppress.h>
+#include "transform.h"
 
 #pragma prefast(disable:__WARNING_ENCODE_MEMBER_FUNCTION_POINTER, "Not valid for kernel mode drivers")
 
@@ -42,11 +43,74 @@ PFLT_FILTER gFilterHandle;
 #define CONTEXT_TAG         'xcBS'
 #define NAME_TAG            'mnBS'
 #define PRE_2_POST_TAG      'ppBS'
+#define BUFFER_POOL_TAG     'lpBS'
+#define RESERVE_TAG         'rsBS'
 
 /*************************************************************************
     Local structures
 *************************************************************************/
 
+//
+//  Swap buffers of up to SWAP_POOL_MAX_BUFFER_SIZE bytes are kept for reuse
+//  in power-of-two size classes, starting at a page.  Each size class is
+//  allocated whole from pool, so its buffers are page aligned and meet the
+//  alignment requirement of any device.
+//
+
+#define SWAP_POOL_MIN_CLASS_SHIFT   PAGE_SHIFT
+#define SWAP_POOL_CLASS_COUNT       5
+#define SWAP_POOL_MAX_BUFFER_SIZE   (1UL << (SWAP_POOL_MIN_CLASS_SHIFT + SWAP_POOL_CLASS_COUNT - 1))
+
+//
+//  The default limit on the bytes of free buffers a volume keeps.  This can
+//  be changed with the "MaxPooledBytes" registry value.
+//
+
+#define SWAP_POOL_DEFAULT_MAX_BYTES (4 * 1024 * 1024)
+
+//
+//  The free buffers kept by one processor.  Buffers are pushed on the list
+//  of the processor that frees them, which is not necessarily the one that
+//  allocated them.  The counters are updated with interlocked operations,
+//  but since each processor works on its own cache they are rarely
+//  contended.
+//
+
+typedef struct DECLSPEC_CACHEALIGN _SWAP_BUFFER_CACHE {
+
+    SLIST_HEADER FreeLists[SWAP_POOL_CLASS_COUNT];
+
+    //
+    //  Bytes held in the free lists.
+    //
+
+    volatile LONG RetainedBytes;
+
+    volatile LONG64 Hits;
+    volatile LONG64 Misses;
+    volatile LONG64 Trims;
+
+} SWAP_BUFFER_CACHE, *PSWAP_BUFFER_CACHE;
+
+//
+//  The pool of swap buffers of a volume.  It has a cache for every
+//  processor in the system.
+//
+
+typedef struct _SWAP_BUFFER_POOL {
+
+    ULONG ProcessorCount;
+
+    //
+    //  The most bytes of free buffers each processor's cache may hold.
+    //
+
+    LONG MaxRetainedBytes;
+
+    SWAP_BUFFER_CACHE Caches[ANYSIZE_ARRAY];
+
+} SWAP_BUFFER_POOL, *PSWAP_BUFFER_POOL;
+
 //
 //  This is a volume context, one of these are attached to each volume
 //  we monitor.  This is used to get a "DOS" name for debug display.
@@ -66,6 +130,14 @@ typedef struct _VOLUME_CONTEXT {
 
     ULONG SectorSize;
 
+    //
+    //  Swap buffers freed by completed operations, kept for reuse.  This
+    //  is NULL if the pool could not be allocated, in which case every
+    //  swap buffer is allocated from and freed to pool.
+    //
+
+    PSWAP_BUFFER_POOL BufferPool;
+
 } VOLUME_CONTEXT, *PVOLUME_CONTEXT;
 
 #define MIN_SECTOR_SIZE 0x200
@@ -95,6 +167,13 @@ typedef struct _PRE_2_POST_CONTEXT {
 
     PVOID SwappedBuffer;
 
+    //
+    //  The length the swapped buffer was allocated with, needed to return
+    //  it to the buffer pool.
+    //
+
+    ULONG SwappedLength;
+
 } PRE_2_POST_CONTEXT, *PPRE_2_POST_CONTEXT;
 
 //
@@ -103,6 +182,73 @@ typedef struct _PRE_2_POST_CONTEXT {
 
 NPAGED_LOOKASIDE_LIST Pre2PostContextList;
 
+//
+//  Paging I/O can't be failed for lack of memory, since it may be what is
+//  freeing memory, and when the data needs transforming it can't be let
+//  through with its original buffer either.  So when the swap buffer or
+//  pre2Post context of a paging read or write can't be allocated it waits
+//  for this reserve, set aside at load time, and uses it instead.  Only
+//  one operation uses the reserve at a time.
+//
+//  The MDL for the swap buffer is still allocated for each operation,
+//  since FltMgr frees it when the operation completes.  Paging I/O larger
+//  than the reserve buffer is failed if its buffer can't be allocated.
+//
+
+#define SWAP_RESERVE_BUFFER_SIZE    (1024 * 1024)
+
+typedef struct _SWAP_RESERVE {
+
+    //
+    //  Signaled when the reserve is free.
+    //
+
+    KEVENT Available;
+
+    //
+    //  The thread that took the reserve.  Paging I/O it issues before the
+    //  reserve is given back can't wait for it, so it is failed instead.
+    //
+
+    PETHREAD Owner;
+
+    //
+    //  The reserve swap buffer, SWAP_RESERVE_BUFFER_SIZE bytes.  It is
+    //  NULL if data is not transformed, since otherwise an operation that
+    //  can't swap buffers is just let through with its own buffer.
+    //
+
+    PVOID Buffer;
+
+    PRE_2_POST_CONTEXT Pre2PostContext;
+
+} SWAP_RESERVE, *PSWAP_RESERVE;
+
+SWAP_RESERVE SwapReserve;
+
+//
+//  The limit on the bytes of free swap buffers each volume keeps.
+//
+
+ULONG MaxPooledBytes = SWAP_POOL_DEFAULT_MAX_BYTES;
+
+//
+//  The transform stages and key read from the registry.  By default data
+//  is not transformed.
+//
+
+ULONG TransformStageIds = SWAP_TRANSFORM_NONE;
+UCHAR TransformKeyValue[SWAP_TRANSFORM_KEY_LENGTH];
+
+//
+//  The data of non-cached reads and writes is passed through the transform
+//  pipeline.  Cached I/O is not transformed, since it goes through the
+//  cache whose data is read and written with non-cached I/O.
+//
+
+#define SwapShouldTransform( _iopb ) \
+    (FlagOn(IRP_NOCACHE,(_iopb)->IrpFlags) && (SwapGetTransformStageCount() != 0))
+
 /*************************************************************************
     Prototypes
 *************************************************************************/
@@ -127,6 +273,58 @@ InstanceQueryTeardown (
     _In_ FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags
     );
 
+NTSTATUS
+SwapCreateBufferPool (
+    _Outptr_ PSWAP_BUFFER_POOL *BufferPool
+    );
+
+VOID
+SwapDeleteBufferPool (
+    _In_ PVOLUME_CONTEXT VolCtx
+    );
+
+PVOID
+SwapAllocateBuffer (
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ PFLT_INSTANCE Instance,
+    _In_ ULONG Length,
+    _In_ BOOLEAN ZeroBuffer
+    );
+
+VOID
+SwapFreeBuffer (
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PVOID Buffer,
+    _In_ ULONG Length
+    );
+
+VOID
+SwapCopyBuffer (
+    _In_ PFLT_IO_PARAMETER_BLOCK Iopb,
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _Out_writes_bytes_(Length) PVOID Destination,
+    _In_reads_bytes_(Length) CONST VOID *Source,
+    _In_ SIZE_T Length
+    );
+
+PPRE_2_POST_CONTEXT
+SwapAcquireReserve (
+    _In_ PFLT_IO_PARAMETER_BLOCK Iopb,
+    _In_ ULONG Length
+    );
+
+VOID
+SwapReleaseReserve (
+    VOID
+    );
+
+VOID
+SwapFreePre2PostContext (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PPRE_2_POST_CONTEXT P2pCtx
+    );
+
 DRIVER_INITIALIZE DriverEntry;
 NTSTATUS
 DriverEntry (
@@ -213,6 +411,8 @@ ReadDriverParameters (
 #pragma alloc_text(PAGE, InstanceSetup)
 #pragma alloc_text(PAGE, CleanupVolumeContext)
 #pragma alloc_text(PAGE, InstanceQueryTeardown)
+#pragma alloc_text(PAGE, SwapCreateBufferPool)
+#pragma alloc_text(PAGE, SwapDeleteBufferPool)
 #pragma alloc_text(INIT, DriverEntry)
 #pragma alloc_text(INIT, ReadDriverParameters)
 #pragma alloc_text(PAGE, FilterUnload)
@@ -299,6 +499,8 @@ CONST FLT_REGISTRATION FilterRegistration = {
 #define LOGFL_WRITE     0x00000004  // if set, display WRITE operation info
 #define LOGFL_DIRCTRL   0x00000008  // if set, display DIRCTRL operation info
 #define LOGFL_VOLCTX    0x00000010  // if set, display VOLCTX operation info
+#define LOGFL_POOL      0x00000020  // if set, display buffer pool statistics
+#define LOGFL_TRANSFORM 0x00000040  // if set, display transformed transfers
 
 ULONG LoggingFlags = 0;             // all disabled by default
 
@@ -385,6 +587,8 @@ Return Value:
             leave;
         }
 
+        ctx->BufferPool = NULL;
+
         //
         //  Always get the volume properties, so I can get a sector size
         //
@@ -409,6 +613,20 @@ Return Value:
 
         ctx->SectorSize = max(volProp->SectorSize,MIN_SECTOR_SIZE);
 
+        //
+        //  Create the pool swap buffers are reused from.  If we can't, we
+        //  will just allocate every swap buffer from pool.
+        //
+
+        status = SwapCreateBufferPool( &ctx->BufferPool );
+
+        if (!NT_SUCCESS(status)) {
+
+            LOG_PRINT( LOGFL_ERRORS,
+                       ("SwapBuffers!InstanceSetup:                  Failed to create buffer pool, status=%x\n",
+                        status) );
+        }
+
         //
         //  Init the buffer field (which may be allocated later).
         //
@@ -570,14 +788,492 @@ CleanupVolumeContext(
 
 Routine Description:
 
-    The given context is being freed.
-    Free the allocated name buffer if there one.
+    The given context is being freed.
+    Free the allocated name buffer if there one, and the buffer pool.
+
+Arguments:
+
+    Context - The context being freed
+
+    ContextType - The type of context this is
+
+Return Value:
+
+    None
+
+--*/
+{
+    PVOLUME_CONTEXT ctx = Context;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( ContextType );
+
+    FLT_ASSERT(ContextType == FLT_VOLUME_CONTEXT);
+
+    if (ctx->Name.Buffer != NULL) {
+
+        ExFreePool(ctx->Name.Buffer);
+        ctx->Name.Buffer = NULL;
+    }
+
+    if (ctx->BufferPool != NULL) {
+
+        SwapDeleteBufferPool( ctx );
+        ctx->BufferPool = NULL;
+    }
+}
+
+
+NTSTATUS
+InstanceQueryTeardown (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    This is called when an instance is being manually deleted by a
+    call to FltDetachVolume or FilterDetach.  We always return it is OK to
+    detach.
+
+Arguments:
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance and its associated volume.
+
+    Flags - Indicating where this detach request came from.
+
+Return Value:
+
+    Always succeed.
+
+--*/
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( FltObjects );
+    UNREFERENCED_PARAMETER( Flags );
+
+    return STATUS_SUCCESS;
+}
+
+
+/*************************************************************************
+    Swap buffer pool routines.
+*************************************************************************/
+
+#define SwapPoolClassSize( _class ) \
+    (1UL << (SWAP_POOL_MIN_CLASS_SHIFT + (_class)))
+
+FORCEINLINE
+ULONG
+SwapGetBufferClass (
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Returns the size class of a swap buffer of the given length, or
+    SWAP_POOL_CLASS_COUNT if it is too large to pool.
+
+--*/
+{
+    ULONG highBit;
+
+    if (Length <= SwapPoolClassSize( 0 )) {
+
+        return 0;
+    }
+
+    if (Length > SWAP_POOL_MAX_BUFFER_SIZE) {
+
+        return SWAP_POOL_CLASS_COUNT;
+    }
+
+    _BitScanReverse( &highBit, Length - 1 );
+
+    return highBit + 1 - SWAP_POOL_MIN_CLASS_SHIFT;
+}
+
+
+NTSTATUS
+SwapCreateBufferPool (
+    _Outptr_ PSWAP_BUFFER_POOL *BufferPool
+    )
+/*++
+
+Routine Description:
+
+    Allocates an empty swap buffer pool, with a cache for every processor
+    the system can have.
+
+Arguments:
+
+    BufferPool - Receives the pool, or NULL if pooling is turned off.
+
+Return Value:
+
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES.
+
+--*/
+{
+    PSWAP_BUFFER_POOL pool;
+    ULONG processorCount;
+    ULONG i, j;
+
+    PAGED_CODE();
+
+    *BufferPool = NULL;
+
+    if (MaxPooledBytes == 0) {
+
+        return STATUS_SUCCESS;
+    }
+
+    processorCount = KeQueryMaximumProcessorCountEx( ALL_PROCESSOR_GROUPS );
+
+    //
+    //  The caches are cache aligned so processors don't share lines.
+    //
+
+    pool = ExAllocatePoolZero( NonPagedPoolNxCacheAligned,
+                               FIELD_OFFSET( SWAP_BUFFER_POOL, Caches ) +
+                                   processorCount * sizeof(SWAP_BUFFER_CACHE),
+                               BUFFER_POOL_TAG );
+
+    if (pool == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    pool->ProcessorCount = processorCount;
+    pool->MaxRetainedBytes = (LONG)(MaxPooledBytes / processorCount);
+
+    for (i = 0; i < processorCount; i++) {
+
+        for (j = 0; j < SWAP_POOL_CLASS_COUNT; j++) {
+
+            InitializeSListHead( &pool->Caches[i].FreeLists[j] );
+        }
+    }
+
+    *BufferPool = pool;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+SwapDeleteBufferPool (
+    _In_ PVOLUME_CONTEXT VolCtx
+    )
+/*++
+
+Routine Description:
+
+    Frees the swap buffer pool of a volume and the buffers it holds.  All
+    the operations that swapped buffers on the volume must have completed.
+
+Arguments:
+
+    VolCtx - The volume context the pool belongs to.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PSWAP_BUFFER_POOL pool = VolCtx->BufferPool;
+    PSWAP_BUFFER_CACHE cache;
+    PSLIST_ENTRY buffer;
+    LONG64 hits = 0;
+    LONG64 misses = 0;
+    LONG64 trims = 0;
+    ULONG i, j;
+
+    PAGED_CODE();
+
+    for (i = 0; i < pool->ProcessorCount; i++) {
+
+        cache = &pool->Caches[i];
+
+        for (j = 0; j < SWAP_POOL_CLASS_COUNT; j++) {
+
+            while ((buffer = InterlockedPopEntrySList( &cache->FreeLists[j] )) != NULL) {
+
+                ExFreePoolWithTag( buffer, BUFFER_SWAP_TAG );
+            }
+        }
+
+        hits += cache->Hits;
+        misses += cache->Misses;
+        trims += cache->Trims;
+    }
+
+    LOG_PRINT( LOGFL_POOL,
+               ("SwapBuffers!SwapDeleteBufferPool:           %wZ hits=%I64d misses=%I64d trims=%I64d\n",
+                &VolCtx->Name,
+                hits,
+                misses,
+                trims) );
+
+    ExFreePoolWithTag( pool, BUFFER_POOL_TAG );
+}
+
+
+PVOID
+SwapAllocateBuffer (
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ PFLT_INSTANCE Instance,
+    _In_ ULONG Length,
+    _In_ BOOLEAN ZeroBuffer
+    )
+/*++
+
+Routine Description:
+
+    Allocates a swap buffer, reusing one freed on this processor if there
+    is one of the right size class.  Buffers too large to pool are
+    allocated with FltAllocatePoolAlignedWithTag.
+
+    Reused buffers are not zeroed unless asked for, since the data of a
+    read or write is always copied over them before they are looked at.
+
+Arguments:
+
+    VolCtx - The volume context of the operation.
+
+    Instance - The instance the operation is on.
+
+    Length - The length of the buffer.
+
+    ZeroBuffer - If TRUE the buffer is zeroed.
+
+Return Value:
+
+    The buffer, or NULL if it could not be allocated.  It must be freed
+    with SwapFreeBuffer.
+
+--*/
+{
+    PSWAP_BUFFER_POOL pool = VolCtx->BufferPool;
+    PSWAP_BUFFER_CACHE cache;
+    ULONG sizeClass = SwapGetBufferClass( Length );
+    PVOID buffer;
+
+    if ((pool == NULL) || (sizeClass >= SWAP_POOL_CLASS_COUNT)) {
+
+        buffer = FltAllocatePoolAlignedWithTag( Instance,
+                                                NonPagedPool,
+                                                (SIZE_T) Length,
+                                                BUFFER_SWAP_TAG );
+
+        if ((buffer != NULL) && ZeroBuffer) {
+
+            RtlZeroMemory( buffer, Length );
+        }
+
+        return buffer;
+    }
+
+    cache = &pool->Caches[KeGetCurrentProcessorNumberEx( NULL )];
+
+    buffer = InterlockedPopEntrySList( &cache->FreeLists[sizeClass] );
+
+    if (buffer != NULL) {
+
+        InterlockedAdd( &cache->RetainedBytes, -(LONG)SwapPoolClassSize( sizeClass ) );
+        InterlockedIncrement64( &cache->Hits );
+
+        if (ZeroBuffer) {
+
+            RtlZeroMemory( buffer, Length );
+        }
+
+    } else {
+
+        InterlockedIncrement64( &cache->Misses );
+
+        //
+        //  Allocate the whole size class so the buffer can be reused for
+        //  any length in it.
+        //
+
+        if (ZeroBuffer) {
+
+            buffer = ExAllocatePoolZero( NonPagedPool,
+                                         SwapPoolClassSize( sizeClass ),
+                                         BUFFER_SWAP_TAG );
+
+        } else {
+
+            buffer = ExAllocatePoolUninitialized( NonPagedPool,
+                                                  SwapPoolClassSize( sizeClass ),
+                                                  BUFFER_SWAP_TAG );
+        }
+    }
+
+    return buffer;
+}
+
+
+VOID
+SwapFreeBuffer (
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PVOID Buffer,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Frees a swap buffer allocated with SwapAllocateBuffer.  It is kept on
+    this processor's free list unless that would take the processor over
+    its share of the retained memory limit.
+
+Arguments:
+
+    VolCtx - The volume context of the operation.
+
+    Instance - The instance the operation is on.
+
+    Buffer - The buffer to free.
+
+    Length - The length the buffer was allocated with.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PSWAP_BUFFER_POOL pool = VolCtx->BufferPool;
+    PSWAP_BUFFER_CACHE cache;
+    ULONG sizeClass = SwapGetBufferClass( Length );
+    LONG classSize;
+
+    if ((pool == NULL) || (sizeClass >= SWAP_POOL_CLASS_COUNT)) {
+
+        FltFreePoolAlignedWithTag( Instance,
+                                   Buffer,
+                                   BUFFER_SWAP_TAG );
+        return;
+    }
+
+    cache = &pool->Caches[KeGetCurrentProcessorNumberEx( NULL )];
+    classSize = (LONG)SwapPoolClassSize( sizeClass );
+
+    if (InterlockedAdd( &cache->RetainedBytes, classSize ) > pool->MaxRetainedBytes) {
+
+        InterlockedAdd( &cache->RetainedBytes, -classSize );
+        InterlockedIncrement64( &cache->Trims );
+
+        ExFreePoolWithTag( Buffer, BUFFER_SWAP_TAG );
+        return;
+    }
+
+    InterlockedPushEntrySList( &cache->FreeLists[sizeClass], Buffer );
+}
+
+
+PPRE_2_POST_CONTEXT
+SwapAcquireReserve (
+    _In_ PFLT_IO_PARAMETER_BLOCK Iopb,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Waits for the reserve for a paging read or write whose data needs
+    transforming and whose swap buffer or pre2Post context could not be
+    allocated.
+
+Arguments:
+
+    Iopb - The parameters of the operation.
+
+    Length - The length of the swap buffer the operation needs.
+
+Return Value:
+
+    The pre2Post context of the reserve, with SwappedBuffer set to the
+    reserve buffer, or NULL if the operation can't use the reserve.  It is
+    given back with SwapReleaseReserve, or SwapFreePre2PostContext once the
+    operation completes.
+
+--*/
+{
+    if (!FlagOn(Iopb->IrpFlags,IRP_PAGING_IO) ||
+        !SwapShouldTransform( Iopb ) ||
+        (SwapReserve.Buffer == NULL) ||
+        (Length > SWAP_RESERVE_BUFFER_SIZE) ||
+        (SwapReserve.Owner == PsGetCurrentThread())) {
+
+        return NULL;
+    }
+
+    //
+    //  Paging I/O is always issued at APC_LEVEL or below.
+    //
+
+    FLT_ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
+
+    KeWaitForSingleObject( &SwapReserve.Available,
+                           Executive,
+                           KernelMode,
+                           FALSE,
+                           NULL );
+
+    SwapReserve.Owner = PsGetCurrentThread();
+    SwapReserve.Pre2PostContext.SwappedBuffer = SwapReserve.Buffer;
+
+    return &SwapReserve.Pre2PostContext;
+}
+
+
+VOID
+SwapReleaseReserve (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Gives back the reserve, letting the next paging I/O waiting for it
+    have it.  This can be called at DPC level.
+
+--*/
+{
+    SwapReserve.Owner = NULL;
+
+    KeSetEvent( &SwapReserve.Available, IO_NO_INCREMENT, FALSE );
+}
+
+
+VOID
+SwapFreePre2PostContext (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PPRE_2_POST_CONTEXT P2pCtx
+    )
+/*++
+
+Routine Description:
+
+    Frees the swapped buffer of a completed operation, releases its volume
+    context and frees its pre2Post context.  If the operation used the
+    reserve the reserve is given back instead.
 
 Arguments:
 
-    Context - The context being freed
+    Instance - The instance the operation is on.
 
-    ContextType - The type of context this is
+    P2pCtx - The pre2Post context of the operation.
 
 Return Value:
 
@@ -585,54 +1281,79 @@ Return Value:
 
 --*/
 {
-    PVOLUME_CONTEXT ctx = Context;
+    if (P2pCtx == &SwapReserve.Pre2PostContext) {
 
-    PAGED_CODE();
-
-    UNREFERENCED_PARAMETER( ContextType );
+        FltReleaseContext( P2pCtx->VolCtx );
+        SwapReleaseReserve();
+        return;
+    }
 
-    FLT_ASSERT(ContextType == FLT_VOLUME_CONTEXT);
+    SwapFreeBuffer( P2pCtx->VolCtx,
+                    Instance,
+                    P2pCtx->SwappedBuffer,
+                    P2pCtx->SwappedLength );
 
-    if (ctx->Name.Buffer != NULL) {
+    FltReleaseContext( P2pCtx->VolCtx );
 
-        ExFreePool(ctx->Name.Buffer);
-        ctx->Name.Buffer = NULL;
-    }
+    ExFreeToNPagedLookasideList( &Pre2PostContextList,
+                                 P2pCtx );
 }
 
 
-NTSTATUS
-InstanceQueryTeardown (
-    _In_ PCFLT_RELATED_OBJECTS FltObjects,
-    _In_ FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags
+VOID
+SwapCopyBuffer (
+    _In_ PFLT_IO_PARAMETER_BLOCK Iopb,
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _Out_writes_bytes_(Length) PVOID Destination,
+    _In_reads_bytes_(Length) CONST VOID *Source,
+    _In_ SIZE_T Length
     )
 /*++
 
 Routine Description:
 
-    This is called when an instance is being manually deleted by a
-    call to FltDetachVolume or FilterDetach.  We always return it is OK to
-    detach.
+    Copies the data of a read or write between the caller's buffer and the
+    swap buffer, passing it through the transform pipeline if it needs to
+    be transformed.  This must be called inside a try/except if either
+    buffer is a user buffer.
 
 Arguments:
 
-    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
-        opaque handles to this filter, instance and its associated volume.
+    Iopb - The parameters of the operation.
 
-    Flags - Indicating where this detach request came from.
+    VolCtx - The volume context of the operation.
+
+    Destination - The buffer to copy to.
+
+    Source - The buffer to copy from.
+
+    Length - The number of bytes to copy.
 
 Return Value:
 
-    Always succeed.
+    None
 
 --*/
 {
-    PAGED_CODE();
+    if (!SwapShouldTransform( Iopb )) {
 
-    UNREFERENCED_PARAMETER( FltObjects );
-    UNREFERENCED_PARAMETER( Flags );
+        RtlCopyMemory( Destination,
+                       Source,
+                       Length );
+        return;
+    }
 
-    return STATUS_SUCCESS;
+    SwapTransformCopy( (BOOLEAN)(Iopb->MajorFunction == IRP_MJ_WRITE),
+                       Destination,
+                       Source,
+                       Length );
+
+    LOG_PRINT( LOGFL_TRANSFORM,
+               ("SwapBuffers!SwapCopyBuffer:                 %wZ major=%d len=%Iu stages=%d\n",
+                &VolCtx->Name,
+                Iopb->MajorFunction,
+                Length,
+                SwapGetTransformStageCount()) );
 }
 
 
@@ -680,6 +1401,23 @@ Return Value:
 
     ReadDriverParameters( RegistryPath );
 
+    //
+    //  Build the transform pipeline.  If the stages in the registry are not
+    //  valid we don't load, rather than let data through untransformed.
+    //
+
+    status = SwapInitializeTransforms( TransformStageIds,
+                                       TransformKeyValue );
+
+    if (!NT_SUCCESS( status )) {
+
+        LOG_PRINT( LOGFL_ERRORS,
+                   ("SwapBuffers!DriverEntry:                    Invalid transform stages 0x%x\n",
+                    TransformStageIds) );
+
+        return status;
+    }
+
     //
     //  Init lookaside list used to allocate our context structure used to
     //  pass information from out preOperation callback to our postOperation
@@ -694,6 +1432,26 @@ Return Value:
                                      PRE_2_POST_TAG,
                                      0 );
 
+    //
+    //  Set aside the reserve for paging I/O.  It is only needed if data is
+    //  transformed.
+    //
+
+    KeInitializeEvent( &SwapReserve.Available, SynchronizationEvent, TRUE );
+
+    if (SwapGetTransformStageCount() != 0) {
+
+        SwapReserve.Buffer = ExAllocatePoolUninitialized( NonPagedPool,
+                                                          SWAP_RESERVE_BUFFER_SIZE,
+                                                          RESERVE_TAG );
+
+        if (SwapReserve.Buffer == NULL) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto SwapDriverEntryExit;
+        }
+    }
+
     //
     //  Register with FltMgr
     //
@@ -723,6 +1481,11 @@ SwapDriverEntryExit:
 
     if(! NT_SUCCESS( status )) {
 
+        if (SwapReserve.Buffer != NULL) {
+
+            ExFreePoolWithTag( SwapReserve.Buffer, RESERVE_TAG );
+        }
+
         ExDeleteNPagedLookasideList( &Pre2PostContextList );
     }
 
@@ -767,6 +1530,15 @@ Return Value:
 
     ExDeleteNPagedLookasideList( &Pre2PostContextList );
 
+    //
+    //  Free the reserve
+    //
+
+    if (SwapReserve.Buffer != NULL) {
+
+        ExFreePoolWithTag( SwapReserve.Buffer, RESERVE_TAG );
+    }
+
     return STATUS_SUCCESS;
 }
 
@@ -787,7 +1559,10 @@ Routine Description:
 
     This routine demonstrates how to swap buffers for the READ operation.
 
-    Note that it handles all errors by simply not doing the buffer swap.
+    Note that it handles all errors by simply not doing the buffer swap,
+    unless the data needs transforming, in which case it fails the
+    operation.  Paging I/O whose buffers can't be allocated uses the
+    reserve instead.
 
 Arguments:
 
@@ -804,6 +1579,8 @@ Return Value:
 
     FLT_PREOP_SUCCESS_WITH_CALLBACK - we want a postOpeation callback
     FLT_PREOP_SUCCESS_NO_CALLBACK - we don't want a postOperation callback
+    FLT_PREOP_COMPLETE - the data needs transforming and we could not swap
+        buffers
 
 --*/
 {
@@ -812,7 +1589,8 @@ Return Value:
     PVOID newBuf = NULL;
     PMDL newMdl = NULL;
     PVOLUME_CONTEXT volCtx = NULL;
-    PPRE_2_POST_CONTEXT p2pCtx;
+    PPRE_2_POST_CONTEXT p2pCtx = NULL;
+    PPRE_2_POST_CONTEXT reserveCtx;
     NTSTATUS status;
     ULONG readLen = iopb->Parameters.Read.Length;
 
@@ -865,18 +1643,69 @@ Return Value:
         //  don't swap buffers on this operation.
         //
 
-        newBuf = FltAllocatePoolAlignedWithTag( FltObjects->Instance,
-                                                NonPagedPool,
-                                                (SIZE_T) readLen,
-                                                BUFFER_SWAP_TAG );
+        newBuf = SwapAllocateBuffer( volCtx,
+                                     FltObjects->Instance,
+                                     readLen,
+                                     FALSE );
         if (newBuf == NULL) {
 
             LOG_PRINT( LOGFL_ERRORS,
                        ("SwapBuffers!SwapPreReadBuffers:             %wZ Failed to allocate %d bytes of memory\n",
                         &volCtx->Name,
                         readLen) );
+        }
 
-            leave;
+        //
+        //  Get a pre2Post context structure.  We need it to pass the volume
+        //  context and the allocate memory buffer to the post operation
+        //  callback.
+        //
+
+        p2pCtx = ExAllocateFromNPagedLookasideList( &Pre2PostContextList );
+
+        if (p2pCtx == NULL) {
+
+            LOG_PRINT( LOGFL_ERRORS,
+                       ("SwapBuffers!SwapPreReadBuffers:             %wZ Failed to allocate pre2Post context structure\n",
+                        &volCtx->Name) );
+        }
+
+        //
+        //  If either allocation failed, paging I/O whose data needs
+        //  transforming waits for the reserve and uses it instead.  Anything
+        //  else doesn't swap buffers on this operation.
+        //
+
+        if ((newBuf == NULL) || (p2pCtx == NULL)) {
+
+            reserveCtx = SwapAcquireReserve( iopb, readLen );
+
+            if (reserveCtx == NULL) {
+
+                leave;
+            }
+
+            if (newBuf != NULL) {
+
+                SwapFreeBuffer( volCtx,
+                                FltObjects->Instance,
+                                newBuf,
+                                readLen );
+            }
+
+            if (p2pCtx != NULL) {
+
+                ExFreeToNPagedLookasideList( &Pre2PostContextList,
+                                             p2pCtx );
+            }
+
+            p2pCtx = reserveCtx;
+            newBuf = reserveCtx->SwappedBuffer;
+
+            LOG_PRINT( LOGFL_ERRORS,
+                       ("SwapBuffers!SwapPreReadBuffers:             %wZ Using the reserve, len=%d\n",
+                        &volCtx->Name,
+                        readLen) );
         }
 
         //
@@ -914,23 +1743,6 @@ Return Value:
             MmBuildMdlForNonPagedPool( newMdl );
         }
 
-        //
-        //  We are ready to swap buffers, get a pre2Post context structure.
-        //  We need it to pass the volume context and the allocate memory
-        //  buffer to the post operation callback.
-        //
-
-        p2pCtx = ExAllocateFromNPagedLookasideList( &Pre2PostContextList );
-
-        if (p2pCtx == NULL) {
-
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("SwapBuffers!SwapPreReadBuffers:             %wZ Failed to allocate pre2Post context structure\n",
-                        &volCtx->Name) );
-
-            leave;
-        }
-
         //
         //  Log that we are swapping
         //
@@ -958,6 +1770,7 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->SwappedLength = readLen;
         p2pCtx->VolCtx = volCtx;
 
         *CompletionContext = p2pCtx;
@@ -976,11 +1789,25 @@ Return Value:
 
         if (retValue != FLT_PREOP_SUCCESS_WITH_CALLBACK) {
 
-            if (newBuf != NULL) {
+            if (p2pCtx == &SwapReserve.Pre2PostContext) {
+
+                SwapReleaseReserve();
+
+            } else {
+
+                if (newBuf != NULL) {
+
+                    SwapFreeBuffer( volCtx,
+                                    FltObjects->Instance,
+                                    newBuf,
+                                    readLen );
+                }
+
+                if (p2pCtx != NULL) {
 
-                FltFreePoolAlignedWithTag( FltObjects->Instance,
-                                           newBuf,
-                                           BUFFER_SWAP_TAG );
+                    ExFreeToNPagedLookasideList( &Pre2PostContextList,
+                                                 p2pCtx );
+                }
             }
 
             if (newMdl != NULL) {
@@ -992,6 +1819,20 @@ Return Value:
 
                 FltReleaseContext( volCtx );
             }
+
+            //
+            //  If the data needs transforming we can't let the operation
+            //  through with the original buffer, so fail it instead.
+            //
+
+            if ((retValue == FLT_PREOP_SUCCESS_NO_CALLBACK) &&
+                (readLen != 0) &&
+                SwapShouldTransform( iopb )) {
+
+                Data->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+                Data->IoStatus.Information = 0;
+                retValue = FLT_PREOP_COMPLETE;
+            }
         }
     }
 
@@ -1173,9 +2014,11 @@ Return Value:
 
         try {
 
-            RtlCopyMemory( origBuf,
-                           p2pCtx->SwappedBuffer,
-                           Data->IoStatus.Information );
+            SwapCopyBuffer( iopb,
+                            p2pCtx->VolCtx,
+                            origBuf,
+                            p2pCtx->SwappedBuffer,
+                            Data->IoStatus.Information );
 
         } except (EXCEPTION_EXECUTE_HANDLER) {
 
@@ -1209,14 +2052,8 @@ Return Value:
                         p2pCtx->SwappedBuffer,
                         Data->IoStatus.Information) );
 
-            FltFreePoolAlignedWithTag( FltObjects->Instance,
-                                       p2pCtx->SwappedBuffer,
-                                       BUFFER_SWAP_TAG );
-
-            FltReleaseContext( p2pCtx->VolCtx );
-
-            ExFreeToNPagedLookasideList( &Pre2PostContextList,
-                                         p2pCtx );
+            SwapFreePre2PostContext( FltObjects->Instance,
+                                     p2pCtx );
         }
     }
 
@@ -1318,9 +2155,11 @@ Return Value:
             //  buffer address.
             //
 
-            RtlCopyMemory( origBuf,
-                           p2pCtx->SwappedBuffer,
-                           Data->IoStatus.Information );
+            SwapCopyBuffer( iopb,
+                            p2pCtx->VolCtx,
+                            origBuf,
+                            p2pCtx->SwappedBuffer,
+                            Data->IoStatus.Information );
         }
     }
 
@@ -1334,14 +2173,8 @@ Return Value:
                 p2pCtx->SwappedBuffer,
                 Data->IoStatus.Information) );
 
-    FltFreePoolAlignedWithTag( FltObjects->Instance,
-                               p2pCtx->SwappedBuffer,
-                               BUFFER_SWAP_TAG );
-
-    FltReleaseContext( p2pCtx->VolCtx );
-
-    ExFreeToNPagedLookasideList( &Pre2PostContextList,
-                                 p2pCtx );
+    SwapFreePre2PostContext( FltObjects->Instance,
+                             p2pCtx );
 
     return FLT_POSTOP_FINISHED_PROCESSING;
 }
@@ -1424,12 +2257,15 @@ Return Value:
         //
         //  Allocate nonPaged memory for the buffer we are swapping to.
         //  If we fail to get the memory, just don't swap buffers on this
-        //  operation.
+        //  operation.  The buffer is zeroed because the whole of it is
+        //  copied back, not just the part the file system filled in (see
+        //  SwapPostDirCtrlBuffersWhenSafe).
         //
 
-        newBuf = ExAllocatePoolZero( NonPagedPool,
+        newBuf = SwapAllocateBuffer( volCtx,
+                                     FltObjects->Instance,
                                      iopb->Parameters.DirectoryControl.QueryDirectory.Length,
-                                     BUFFER_SWAP_TAG );
+                                     TRUE );
 
         if (newBuf == NULL) {
 
@@ -1515,6 +2351,7 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->SwappedLength = iopb->Parameters.DirectoryControl.QueryDirectory.Length;
         p2pCtx->VolCtx = volCtx;
 
         *CompletionContext = p2pCtx;
@@ -1535,7 +2372,10 @@ Return Value:
 
             if (newBuf != NULL) {
 
-                ExFreePool( newBuf );
+                SwapFreeBuffer( volCtx,
+                                FltObjects->Instance,
+                                newBuf,
+                                iopb->Parameters.DirectoryControl.QueryDirectory.Length );
             }
 
             if (newMdl != NULL) {
@@ -1763,11 +2603,8 @@ Return Value:
                         p2pCtx->SwappedBuffer,
                         Data->IoStatus.Information) );
 
-            ExFreePool( p2pCtx->SwappedBuffer );
-            FltReleaseContext( p2pCtx->VolCtx );
-
-            ExFreeToNPagedLookasideList( &Pre2PostContextList,
-                                         p2pCtx );
+            SwapFreePre2PostContext( FltObjects->Instance,
+                                     p2pCtx );
         }
     }
 
@@ -1888,11 +2725,8 @@ Return Value:
                 p2pCtx->SwappedBuffer,
                 Data->IoStatus.Information) );
 
-    ExFreePool( p2pCtx->SwappedBuffer );
-    FltReleaseContext( p2pCtx->VolCtx );
-
-    ExFreeToNPagedLookasideList( &Pre2PostContextList,
-                                 p2pCtx );
+    SwapFreePre2PostContext( FltObjects->Instance,
+                             p2pCtx );
 
     return FLT_POSTOP_FINISHED_PROCESSING;
 }
@@ -1910,7 +2744,10 @@ Routine Description:
 
     This routine demonstrates how to swap buffers for the WRITE operation.
 
-    Note that it handles all errors by simply not doing the buffer swap.
+    Note that it handles all errors by simply not doing the buffer swap,
+    unless the data needs transforming, in which case it fails the
+    operation.  Paging I/O whose buffers can't be allocated uses the
+    reserve instead.
 
 Arguments:
 
@@ -1935,7 +2772,8 @@ Return Value:
     PVOID newBuf = NULL;
     PMDL newMdl = NULL;
     PVOLUME_CONTEXT volCtx = NULL;
-    PPRE_2_POST_CONTEXT p2pCtx;
+    PPRE_2_POST_CONTEXT p2pCtx = NULL;
+    PPRE_2_POST_CONTEXT reserveCtx;
     PVOID origBuf;
     NTSTATUS status;
     ULONG writeLen = iopb->Parameters.Write.Length;
@@ -1989,10 +2827,10 @@ Return Value:
         //  don't swap buffers on this operation.
         //
 
-        newBuf = FltAllocatePoolAlignedWithTag( FltObjects->Instance,
-                                                NonPagedPool,
-                                                (SIZE_T) writeLen,
-                                                BUFFER_SWAP_TAG );
+        newBuf = SwapAllocateBuffer( volCtx,
+                                     FltObjects->Instance,
+                                     writeLen,
+                                     FALSE );
 
         if (newBuf == NULL) {
 
@@ -2000,8 +2838,59 @@ Return Value:
                        ("SwapBuffers!SwapPreWriteBuffers:            %wZ Failed to allocate %d bytes of memory.\n",
                         &volCtx->Name,
                         writeLen) );
+        }
 
-            leave;
+        //
+        //  Get a pre2Post context structure.  We need it to pass the volume
+        //  context and the allocate memory buffer to the post operation
+        //  callback.
+        //
+
+        p2pCtx = ExAllocateFromNPagedLookasideList( &Pre2PostContextList );
+
+        if (p2pCtx == NULL) {
+
+            LOG_PRINT( LOGFL_ERRORS,
+                       ("SwapBuffers!SwapPreWriteBuffers:            %wZ Failed to allocate pre2Post context structure\n",
+                        &volCtx->Name) );
+        }
+
+        //
+        //  If either allocation failed, paging I/O whose data needs
+        //  transforming waits for the reserve and uses it instead.  Anything
+        //  else doesn't swap buffers on this operation.
+        //
+
+        if ((newBuf == NULL) || (p2pCtx == NULL)) {
+
+            reserveCtx = SwapAcquireReserve( iopb, writeLen );
+
+            if (reserveCtx == NULL) {
+
+                leave;
+            }
+
+            if (newBuf != NULL) {
+
+                SwapFreeBuffer( volCtx,
+                                FltObjects->Instance,
+                                newBuf,
+                                writeLen );
+            }
+
+            if (p2pCtx != NULL) {
+
+                ExFreeToNPagedLookasideList( &Pre2PostContextList,
+                                             p2pCtx );
+            }
+
+            p2pCtx = reserveCtx;
+            newBuf = reserveCtx->SwappedBuffer;
+
+            LOG_PRINT( LOGFL_ERRORS,
+                       ("SwapBuffers!SwapPreWriteBuffers:            %wZ Using the reserve, len=%d\n",
+                        &volCtx->Name,
+                        writeLen) );
         }
 
         //
@@ -2090,9 +2979,11 @@ Return Value:
 
         try {
 
-            RtlCopyMemory( newBuf,
-                           origBuf,
-                           writeLen );
+            SwapCopyBuffer( iopb,
+                            volCtx,
+                            newBuf,
+                            origBuf,
+                            writeLen );
 
         } except (EXCEPTION_EXECUTE_HANDLER) {
 
@@ -2113,23 +3004,6 @@ Return Value:
             leave;
         }
 
-        //
-        //  We are ready to swap buffers, get a pre2Post context structure.
-        //  We need it to pass the volume context and the allocate memory
-        //  buffer to the post operation callback.
-        //
-
-        p2pCtx = ExAllocateFromNPagedLookasideList( &Pre2PostContextList );
-
-        if (p2pCtx == NULL) {
-
-            LOG_PRINT( LOGFL_ERRORS,
-                       ("SwapBuffers!SwapPreWriteBuffers:            %wZ Failed to allocate pre2Post context structure\n",
-                        &volCtx->Name) );
-
-            leave;
-        }
-
         //
         //  Set new buffers
         //
@@ -2152,6 +3026,7 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->SwappedLength = writeLen;
         p2pCtx->VolCtx = volCtx;
 
         *CompletionContext = p2pCtx;
@@ -2171,12 +3046,25 @@ Return Value:
 
         if (retValue != FLT_PREOP_SUCCESS_WITH_CALLBACK) {
 
-            if (newBuf != NULL) {
+            if (p2pCtx == &SwapReserve.Pre2PostContext) {
 
-                FltFreePoolAlignedWithTag( FltObjects->Instance,
-                                           newBuf,
-                                           BUFFER_SWAP_TAG );
+                SwapReleaseReserve();
 
+            } else {
+
+                if (newBuf != NULL) {
+
+                    SwapFreeBuffer( volCtx,
+                                    FltObjects->Instance,
+                                    newBuf,
+                                    writeLen );
+                }
+
+                if (p2pCtx != NULL) {
+
+                    ExFreeToNPagedLookasideList( &Pre2PostContextList,
+                                                 p2pCtx );
+                }
             }
 
             if (newMdl != NULL) {
@@ -2188,6 +3076,20 @@ Return Value:
 
                 FltReleaseContext( volCtx );
             }
+
+            //
+            //  If the data needs transforming we can't let the operation
+            //  through with the original buffer, so fail it instead.
+            //
+
+            if ((retValue == FLT_PREOP_SUCCESS_NO_CALLBACK) &&
+                (writeLen != 0) &&
+                SwapShouldTransform( iopb )) {
+
+                Data->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+                Data->IoStatus.Information = 0;
+                retValue = FLT_PREOP_COMPLETE;
+            }
         }
     }
 
@@ -2229,14 +3131,8 @@ Return Value:
     //  Free allocate POOL and volume context
     //
 
-    FltFreePoolAlignedWithTag( FltObjects->Instance,
-                               p2pCtx->SwappedBuffer,
-                               BUFFER_SWAP_TAG );
-
-    FltReleaseContext( p2pCtx->VolCtx );
-
-    ExFreeToNPagedLookasideList( &Pre2PostContextList,
-                                 p2pCtx );
+    SwapFreePre2PostContext( FltObjects->Instance,
+                             p2pCtx );
 
     return FLT_POSTOP_FINISHED_PROCESSING;
 }
@@ -2269,33 +3165,34 @@ Return Value:
     NTSTATUS status;
     ULONG resultLength;
     UNICODE_STRING valueName;
-    UCHAR buffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + sizeof( LONG )];
+    UCHAR buffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + SWAP_TRANSFORM_KEY_LENGTH];
+    PKEY_VALUE_PARTIAL_INFORMATION value = (PKEY_VALUE_PARTIAL_INFORMATION)buffer;
 
     //
-    //  If this value is not zero then somebody has already explicitly set it
-    //  so don't override those settings.
+    //  Open the desired registry key
     //
 
-    if (0 == LoggingFlags) {
+    InitializeObjectAttributes( &attributes,
+                                RegistryPath,
+                                OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                                NULL,
+                                NULL );
 
-        //
-        //  Open the desired registry key
-        //
+    status = ZwOpenKey( &driverRegKey,
+                        KEY_READ,
+                        &attributes );
 
-        InitializeObjectAttributes( &attributes,
-                                    RegistryPath,
-                                    OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
-                                    NULL,
-                                    NULL );
+    if (!NT_SUCCESS( status )) {
 
-        status = ZwOpenKey( &driverRegKey,
-                            KEY_READ,
-                            &attributes );
+        return;
+    }
 
-        if (!NT_SUCCESS( status )) {
+    //
+    //  If this value is not zero then somebody has already explicitly set it
+    //  so don't override those settings.
+    //
 
-            return;
-        }
+    if (0 == LoggingFlags) {
 
         //
         // Read the given value from the registry.
@@ -2314,12 +3211,67 @@ Return Value:
 
             LoggingFlags = *((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data));
         }
+    }
 
-        //
-        //  Close the registry entry
-        //
+    //
+    //  Read the limit on the free swap buffers kept by each volume.  Zero
+    //  turns buffer pooling off.
+    //
+
+    RtlInitUnicodeString( &valueName, L"MaxPooledBytes" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              buffer,
+                              sizeof(buffer),
+                              &resultLength );
+
+    if (NT_SUCCESS( status )) {
+
+        MaxPooledBytes = min( *((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data)),
+                              MAXLONG );
+    }
+
+    //
+    //  Read the transform stages and the key of the Xor stage.  The key
+    //  must be exactly SWAP_TRANSFORM_KEY_LENGTH bytes.
+    //
+
+    RtlInitUnicodeString( &valueName, L"TransformStages" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              buffer,
+                              sizeof(buffer),
+                              &resultLength );
+
+    if (NT_SUCCESS( status ) && (value->DataLength == sizeof(ULONG))) {
+
+        TransformStageIds = *((PULONG) &value->Data);
+    }
+
+    RtlInitUnicodeString( &valueName, L"TransformKey" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              buffer,
+                              sizeof(buffer),
+                              &resultLength );
+
+    if (NT_SUCCESS( status ) && (value->DataLength == SWAP_TRANSFORM_KEY_LENGTH)) {
 
-        ZwClose(driverRegKey);
+        RtlCopyMemory( TransformKeyValue,
+                       value->Data,
+                       SWAP_TRANSFORM_KEY_LENGTH );
     }
+
+    //
+    //  Close the registry entry
+    //
+
+    ZwClose(driverRegKey);
 }
 
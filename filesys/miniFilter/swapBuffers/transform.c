@@ -0,0 +1,283 @@
+/*++
+
+Copyright (c) 1999 - 2002  Microsoft Corporation
+
+Module Name:
+
+    transform.c
+
+Abstract:
+
+    This is the data transform pipeline of the SwapBuffers filter, and the
+    reference transform stage:
+
+    Xor - XORs the data with a 16 byte key.  Non-cached I/O is always
+        sector aligned, so the key lines up with the same file offsets
+        on every read and write.
+
+    The stage uses SSE2 (x64) or NEON (ARM64) where it is available.
+    Wider vector units are not used because their state must be saved
+    explicitly before kernel code can use them.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include <fltKernel.h>
+#include <intrin.h>
+#if defined(_M_ARM64)
+#include <arm64_neon.h>
+#endif
+#include "transform.h"
+
+//
+//  The stages of the pipeline, in the order they are run on data being
+//  written.  They are run in the opposite order on data being read.
+//
+
+typedef struct _SWAP_TRANSFORM_PIPELINE {
+
+    ULONG StageCount;
+    PCSWAP_TRANSFORM_STAGE Stages[SWAP_MAX_TRANSFORM_STAGES];
+
+} SWAP_TRANSFORM_PIPELINE, *PSWAP_TRANSFORM_PIPELINE;
+
+SWAP_TRANSFORM_PIPELINE TransformPipeline;
+
+DECLSPEC_ALIGN(16) UCHAR TransformKey[SWAP_TRANSFORM_KEY_LENGTH];
+
+SWAP_TRANSFORM_ROUTINE SwapXorTransform;
+
+//
+//  The stages, indexed by stage identifier minus one.
+//
+
+CONST SWAP_TRANSFORM_STAGE TransformStages[] = {
+
+    { SwapXorTransform, SwapXorTransform }
+};
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(INIT, SwapInitializeTransforms)
+#endif
+
+
+NTSTATUS
+SwapInitializeTransforms (
+    _In_ ULONG StageIds,
+    _In_reads_bytes_(SWAP_TRANSFORM_KEY_LENGTH) CONST UCHAR *Key
+    )
+/*++
+
+Routine Description:
+
+    Builds the transform pipeline.
+
+Arguments:
+
+    StageIds - The stages of the pipeline, one identifier in each nibble,
+        lowest first, up to the first zero.
+
+    Key - The key of the Xor stage.
+
+Return Value:
+
+    STATUS_SUCCESS, or STATUS_INVALID_PARAMETER if a stage identifier is
+    not known.
+
+--*/
+{
+    ULONG stageId;
+
+    RtlZeroMemory( &TransformPipeline, sizeof(TransformPipeline) );
+    RtlCopyMemory( TransformKey, Key, SWAP_TRANSFORM_KEY_LENGTH );
+
+    while ((stageId = (StageIds & 0xF)) != SWAP_TRANSFORM_NONE) {
+
+        if ((stageId > ARRAYSIZE(TransformStages)) ||
+            (TransformPipeline.StageCount == SWAP_MAX_TRANSFORM_STAGES)) {
+
+            TransformPipeline.StageCount = 0;
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        TransformPipeline.Stages[TransformPipeline.StageCount++] = &TransformStages[stageId - 1];
+        StageIds >>= 4;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+ULONG
+SwapGetTransformStageCount (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Returns the number of stages in the pipeline, which is zero if data is
+    not transformed.
+
+--*/
+{
+    return TransformPipeline.StageCount;
+}
+
+
+VOID
+SwapTransformCopy (
+    _In_ BOOLEAN Encode,
+    _Out_writes_bytes_(Length) PVOID Destination,
+    _In_reads_bytes_(Length) CONST VOID *Source,
+    _In_ SIZE_T Length
+    )
+/*++
+
+Routine Description:
+
+    Copies data from one buffer to another through the transform pipeline.
+
+    Source is read exactly once, so it may be a buffer the caller can
+    change while it is copied.  It must be called inside a try/except if
+    either buffer is a user buffer.
+
+Arguments:
+
+    Encode - TRUE if the data is being written, FALSE if it is being read.
+
+    Destination - The buffer to copy to.
+
+    Source - The buffer to copy from.  It must not overlap Destination.
+
+    Length - The number of bytes to copy.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PUCHAR destination = Destination;
+    CONST UCHAR *source = Source;
+    CONST UCHAR *blockSource;
+    PSWAP_TRANSFORM_ROUTINE routine;
+    ULONG stageCount = TransformPipeline.StageCount;
+    ULONG blockLength;
+    ULONG stage;
+    ULONG i;
+
+    if (stageCount == 0) {
+
+        RtlCopyMemory( Destination, Source, Length );
+        return;
+    }
+
+    while (Length > 0) {
+
+        blockLength = (ULONG)min( Length, SWAP_TRANSFORM_BLOCK_SIZE );
+
+        //
+        //  The first stage copies the block, the others work on it in
+        //  place.
+        //
+
+        blockSource = source;
+
+        for (i = 0; i < stageCount; i++) {
+
+            stage = Encode ? i : stageCount - 1 - i;
+
+            routine = Encode ?
+                      TransformPipeline.Stages[stage]->Encode :
+                      TransformPipeline.Stages[stage]->Decode;
+
+            routine( destination,
+                     blockSource,
+                     blockLength );
+
+            blockSource = destination;
+        }
+
+        destination += blockLength;
+        source += blockLength;
+        Length -= blockLength;
+    }
+}
+
+
+/*************************************************************************
+    Transform stages.
+*************************************************************************/
+
+VOID
+SwapXorTransform (
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_reads_bytes_(Length) CONST UCHAR *Source,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    XORs the data with the key, from the start of the key.
+
+--*/
+{
+    ULONG i = 0;
+
+#if defined(_M_AMD64)
+
+    {
+        __m128i key = _mm_load_si128( (__m128i *)TransformKey );
+        __m128i a, b, c, d;
+
+        for (; i + 64 <= Length; i += 64) {
+
+            a = _mm_loadu_si128( (__m128i *)(Source + i) );
+            b = _mm_loadu_si128( (__m128i *)(Source + i + 16) );
+            c = _mm_loadu_si128( (__m128i *)(Source + i + 32) );
+            d = _mm_loadu_si128( (__m128i *)(Source + i + 48) );
+
+            _mm_storeu_si128( (__m128i *)(Destination + i), _mm_xor_si128( a, key ) );
+            _mm_storeu_si128( (__m128i *)(Destination + i + 16), _mm_xor_si128( b, key ) );
+            _mm_storeu_si128( (__m128i *)(Destination + i + 32), _mm_xor_si128( c, key ) );
+            _mm_storeu_si128( (__m128i *)(Destination + i + 48), _mm_xor_si128( d, key ) );
+        }
+
+        for (; i + 16 <= Length; i += 16) {
+
+            a = _mm_loadu_si128( (__m128i *)(Source + i) );
+            _mm_storeu_si128( (__m128i *)(Destination + i), _mm_xor_si128( a, key ) );
+        }
+    }
+
+#elif defined(_M_ARM64)
+
+    {
+        uint8x16_t key = vld1q_u8( TransformKey );
+
+        for (; i + 64 <= Length; i += 64) {
+
+            vst1q_u8( Destination + i, veorq_u8( vld1q_u8( Source + i ), key ) );
+            vst1q_u8( Destination + i + 16, veorq_u8( vld1q_u8( Source + i + 16 ), key ) );
+            vst1q_u8( Destination + i + 32, veorq_u8( vld1q_u8( Source + i + 32 ), key ) );
+            vst1q_u8( Destination + i + 48, veorq_u8( vld1q_u8( Source + i + 48 ), key ) );
+        }
+
+        for (; i + 16 <= Length; i += 16) {
+
+            vst1q_u8( Destination + i, veorq_u8( vld1q_u8( Source + i ), key ) );
+        }
+    }
+
+#endif
+
+    for (; i < Length; i++) {
+
+        Destination[i] = Source[i] ^ TransformKey[i % SWAP_TRANSFORM_KEY_LENGTH];
+    }
+}
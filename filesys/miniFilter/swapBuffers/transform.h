@@ -0,0 +1,98 @@
+/*++
+
+Copyright (c) 1999 - 2002  Microsoft Corporation
+
+Module Name:
+
+    transform.h
+
+Abstract:
+
+    Header file which contains the structures, type definitions,
+    constants and function prototypes of the data transform pipeline.
+
+    The pipeline is a list of stages the data of non-cached reads and
+    writes is passed through as it is copied between the caller's buffer
+    and the swap buffer.  The copy is done a block at a time: the first
+    stage copies the block while transforming it, and the other stages
+    transform it in place while it is still in the processor's cache, so
+    the whole pipeline costs one pass over memory.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#ifndef __TRANSFORM_H__
+#define __TRANSFORM_H__
+
+#define SWAP_MAX_TRANSFORM_STAGES   4
+#define SWAP_TRANSFORM_KEY_LENGTH   16
+
+//
+//  The size of the blocks the pipeline is run on.  It is a multiple of
+//  SWAP_TRANSFORM_KEY_LENGTH so every block but the last is a whole number
+//  of keys long.
+//
+
+#define SWAP_TRANSFORM_BLOCK_SIZE   2048
+
+C_ASSERT((SWAP_TRANSFORM_BLOCK_SIZE % SWAP_TRANSFORM_KEY_LENGTH) == 0);
+
+//
+//  Stage identifiers.  The "TransformStages" registry value holds one in
+//  each of its nibbles, lowest first, and ends at the first zero.
+//
+
+#define SWAP_TRANSFORM_NONE         0
+#define SWAP_TRANSFORM_XOR          1
+
+//
+//  Transforms Length bytes of Source into Destination, which is either
+//  the same buffer or one that does not overlap it.
+//
+
+typedef
+VOID
+SWAP_TRANSFORM_ROUTINE (
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_reads_bytes_(Length) CONST UCHAR *Source,
+    _In_ ULONG Length
+    );
+
+typedef SWAP_TRANSFORM_ROUTINE *PSWAP_TRANSFORM_ROUTINE;
+
+typedef struct _SWAP_TRANSFORM_STAGE {
+
+    //
+    //  Encode is run on data being written, Decode on data being read.
+    //
+
+    PSWAP_TRANSFORM_ROUTINE Encode;
+    PSWAP_TRANSFORM_ROUTINE Decode;
+
+} SWAP_TRANSFORM_STAGE, *PSWAP_TRANSFORM_STAGE;
+
+typedef CONST SWAP_TRANSFORM_STAGE *PCSWAP_TRANSFORM_STAGE;
+
+NTSTATUS
+SwapInitializeTransforms (
+    _In_ ULONG StageIds,
+    _In_reads_bytes_(SWAP_TRANSFORM_KEY_LENGTH) CONST UCHAR *Key
+    );
+
+ULONG
+SwapGetTransformStageCount (
+    VOID
+    );
+
+VOID
+SwapTransformCopy (
+    _In_ BOOLEAN Encode,
+    _Out_writes_bytes_(Length) PVOID Destination,
+    _In_reads_bytes_(Length) CONST VOID *Source,
+    _In_ SIZE_T Length
+    );
+
+#endif
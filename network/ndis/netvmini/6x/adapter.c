@@ -129,6 +129,10 @@ NDIS_OID NICSupportedOids[] =
         OID_RECEIVE_FILTER_CLEAR_FILTER,
         OID_RECEIVE_FILTER_SET_FILTER,
 #endif
+#if (NDIS_SUPPORT_NDIS630)
+        OID_TCP_OFFLOAD_PARAMETERS,
+        OID_TCP_RSC_STATISTICS,
+#endif
 };
 
 
@@ -289,10 +293,13 @@ Arguments:
             }
 
             //
-            // Initialize list and lock of the free Rcb list
+            // Initialize the pool of free Rcbs
             //
-            NdisInitializeListHead(&Adapter->FreeRcbList);
-            NdisAllocateSpinLock(&Adapter->FreeRcbListLock);
+            Status = NICInitializeCbPool(Adapter, &Adapter->RcbPool, NIC_MAX_BUSY_RECVS);
+            if(Status != NDIS_STATUS_SUCCESS)
+            {
+                break;
+            }
 
             //
             // Allocate the adapter's non-VMQ RCB & receive NBL data
@@ -301,8 +308,9 @@ Arguments:
                 Adapter,
                 NIC_MAX_BUSY_RECVS,
                 &Adapter->RcbMemoryBlock,
-                &Adapter->FreeRcbList,
-                &Adapter->FreeRcbListLock,
+                NULL,
+                NULL,
+                &Adapter->RcbPool,
                 &Adapter->RecvNblPoolHandle
                 );
             if(Status != NDIS_STATUS_SUCCESS)
@@ -495,6 +503,43 @@ Arguments:
             break;
         }
 
+#if (NDIS_SUPPORT_NDIS630)
+        //
+        // Advertise receive segment coalescing if it is emulated.  It starts
+        // out enabled for both IP versions, until the stack says otherwise
+        // through OID_TCP_OFFLOAD_PARAMETERS.
+        //
+        if (Adapter->fRscEmulation)
+        {
+            NDIS_MINIPORT_ADAPTER_OFFLOAD_ATTRIBUTES AdapterOffload = {0};
+            NDIS_OFFLOAD DefaultOffload;
+            NDIS_OFFLOAD HardwareOffload;
+
+            Adapter->fRscIPv4 = TRUE;
+            Adapter->fRscIPv6 = TRUE;
+
+            NICFillOffload(Adapter, FALSE, &DefaultOffload);
+            NICFillOffload(Adapter, TRUE, &HardwareOffload);
+
+            {C_ASSERT(sizeof(AdapterOffload) >= NDIS_SIZEOF_MINIPORT_ADAPTER_OFFLOAD_ATTRIBUTES_REVISION_1);}
+            AdapterOffload.Header.Type = NDIS_OBJECT_TYPE_MINIPORT_ADAPTER_OFFLOAD_ATTRIBUTES;
+            AdapterOffload.Header.Size = NDIS_SIZEOF_MINIPORT_ADAPTER_OFFLOAD_ATTRIBUTES_REVISION_1;
+            AdapterOffload.Header.Revision = NDIS_MINIPORT_ADAPTER_OFFLOAD_ATTRIBUTES_REVISION_1;
+
+            AdapterOffload.DefaultOffloadConfiguration = &DefaultOffload;
+            AdapterOffload.HardwareOffloadCapabilities = &HardwareOffload;
+
+            Status = NdisMSetMiniportAttributes(
+                    MiniportAdapterHandle,
+                    (PNDIS_MINIPORT_ADAPTER_ATTRIBUTES)&AdapterOffload);
+            if (NDIS_STATUS_SUCCESS != Status)
+            {
+                DEBUGP(MP_ERROR, "[%p] Set offload attributes Status 0x%08x\n", Adapter, Status);
+                break;
+            }
+        }
+#endif
+
 #if (NDIS_SUPPORT_NDIS680)
         //
         // Set miniport attributes for supported and enabled NDIS RSS features.
@@ -1238,13 +1283,20 @@ Arguments:
 
         NdisInitializeListHead(&Adapter->List);
 
+        //
+        // The entry for the adapter's own address matches any VLAN, just like
+        // the packet filter does.  Its address is filled in when the adapter
+        // is attached.
+        //
+        NdisInitializeListHead(&Adapter->ForwardingEntryList);
+        Adapter->AddressForwardingEntry.Adapter = Adapter;
+        Adapter->AddressForwardingEntry.AnyVlan = TRUE;
+        InsertTailList(&Adapter->ForwardingEntryList, &Adapter->AddressForwardingEntry.AdapterLink);
+
         //
         // Initialize Send & Recv listheads and corresponding
         // spinlocks.
         //
-        NdisInitializeListHead(&Adapter->FreeTcbList);
-        NdisAllocateSpinLock(&Adapter->FreeTcbListLock);
-
         NdisInitializeListHead(&Adapter->SendWaitList);
         NdisAllocateSpinLock(&Adapter->SendWaitListLock);
 
@@ -1275,12 +1327,17 @@ Arguments:
             break;
         }
 
+        Status = NICInitializeCbPool(Adapter, &Adapter->TcbPool, NIC_MAX_BUSY_SENDS);
+        if (Status != NDIS_STATUS_SUCCESS)
+        {
+            break;
+        }
+
         for (index = 0; index < NIC_MAX_BUSY_SENDS; index++)
         {
-            NdisInterlockedInsertTailList(
-                    &Adapter->FreeTcbList,
-                    &((PTCB)Adapter->TcbMemoryBlock)[index].TcbLink,
-                    &Adapter->FreeTcbListLock);
+            InterlockedPushEntrySList(
+                    &Adapter->TcbPool.FreeList,
+                    &((PTCB)Adapter->TcbMemoryBlock)[index].CbLink);
         }
 
         //
@@ -1388,6 +1445,7 @@ Arguments:
 --*/
 {
     PLIST_ENTRY pEntry;
+    PSLIST_ENTRY pCbEntry;
 
     DEBUGP(MP_TRACE, "[%p] ---> NICFreeAdapter\n", Adapter);
 
@@ -1421,17 +1479,19 @@ Arguments:
     //
     if(!VMQ_ENABLED(Adapter))
     {
-        if(Adapter->FreeRcbList.Flink)
+        NICCbPoolFlushCaches(&Adapter->RcbPool);
+
+        while (NULL != (pCbEntry = InterlockedPopEntrySList(&Adapter->RcbPool.FreeList)))
         {
-            while (NULL != (pEntry = NdisInterlockedRemoveHeadList(
-                    &Adapter->FreeRcbList,
-                    &Adapter->FreeRcbListLock)))
-            {
-                PRCB Rcb = CONTAINING_RECORD(pEntry, RCB, RcbLink);
-                NdisFreeNetBufferList(Rcb->Nbl);
-            }
+            PRCB Rcb = CONTAINING_RECORD(pCbEntry, RCB, CbLink);
+            NdisFreeNetBufferList(Rcb->Nbl);
+#if (NDIS_SUPPORT_NDIS630)
+            NICFreeRcbRscMdls(Rcb);
+#endif
         }
 
+        NICFreeCbPool(Adapter, &Adapter->RcbPool);
+
         if (Adapter->RecvNblPoolHandle)
         {
             NdisFreeNetBufferListPool(Adapter->RecvNblPoolHandle);
@@ -1458,6 +1518,8 @@ Arguments:
 
     }
 
+    NICFreeCbPool(Adapter, &Adapter->TcbPool);
+
     if (Adapter->TcbMemoryBlock)
     {
         NdisFreeMemory(
@@ -1470,16 +1532,21 @@ Arguments:
     ASSERT(Adapter->SendWaitList.Flink && IsListEmpty(&Adapter->SendWaitList));
     ASSERT(Adapter->BusyTcbList.Flink && IsListEmpty(&Adapter->BusyTcbList));
 
-    NdisFreeSpinLock(&Adapter->FreeTcbListLock);
     NdisFreeSpinLock(&Adapter->SendWaitListLock);
     NdisFreeSpinLock(&Adapter->BusyTcbListLock);
-    NdisFreeSpinLock(&Adapter->FreeRcbListLock);
 
     //
     // Free any remaining VMQ related data
     //
     FreeVMQData(Adapter);
 
+#if (NDIS_SUPPORT_NDIS680)
+    //
+    // Free RSS state, including the RSS processors' receive blocks
+    //
+    FreeRSSConfig(Adapter);
+#endif
+
     //
     // Free receive DPCs
     //
@@ -1825,15 +1892,16 @@ NDIS_STATUS
     _In_ PMP_ADAPTER Adapter,
     ULONG NumberOfRcbs,
     _Outptr_result_bytebuffer_(NumberOfRcbs * sizeof(RCB)) PVOID *RcbMemoryBlock,
-    _Inout_ PLIST_ENTRY FreeRcbList,
-    _Inout_ PNDIS_SPIN_LOCK FreeRcbListLock,
+    _Inout_opt_ PLIST_ENTRY FreeRcbList,
+    _Inout_opt_ PNDIS_SPIN_LOCK FreeRcbListLock,
+    _Inout_opt_ PMP_CB_POOL FreeRcbPool,
     _Inout_ PNDIS_HANDLE RecvNblPoolHandle
     )
 /*++
 Routine Description:
 
     The NICAllocRCBData function allocated NumberOfRcbs worth of RCB and NBL memory for use in receive indication,
-    and populates the passed in FreeRcbList with this data.
+    and populates the passed in FreeRcbList or FreeRcbPool with this data.
 
     IRQL = PASSIVE_LEVEL
 
@@ -1842,8 +1910,9 @@ Arguments:
     Adapter                     Pointer to our adapter
     NumberOfRcbs                Number of RCB structures to allocate (and NBLs as a result)
     RcbMemoryBlock              Receives the allocated memory block that is split up into each individual RCB
-    FreeRcbList                 Initialized blank list to be populated with each individual RCB.
+    FreeRcbList                 Initialized blank list to be populated with each individual RCB, or NULL if FreeRcbPool is used.
     FreeRcbListLock             Initialized lock used when updating the RCB list (and subsequent consumers should use lock).
+    FreeRcbPool                 Initialized empty pool to be populated with each individual RCB, or NULL if FreeRcbList is used.
     RcbNblPoolHandle            Receives the Ndis NBL pool handle for the allocated NBLs (to be used on free).
 
     Return Value:
@@ -1930,10 +1999,35 @@ Arguments:
             //
             RCB_FROM_NBL(Rcb->Nbl) = Rcb;
 
-            NdisInterlockedInsertTailList(
-                    FreeRcbList,
-                    &Rcb->RcbLink,
-                    FreeRcbListLock);
+#if (NDIS_SUPPORT_NDIS630)
+            //
+            // Receive segments are only coalesced on the adapter's non-VMQ
+            // receive path, whose RCBs come from FreeRcbPool.
+            //
+            if (FreeRcbPool && Adapter->fRscEmulation)
+            {
+                Status = NICAllocRcbRscMdls(Adapter, Rcb);
+                if (Status != NDIS_STATUS_SUCCESS)
+                {
+                    NdisFreeNetBufferList(Rcb->Nbl);
+                    Rcb->Nbl = NULL;
+                    break;
+                }
+            }
+#endif
+
+            if (FreeRcbPool)
+            {
+                InterlockedPushEntrySList(&FreeRcbPool->FreeList, &Rcb->CbLink);
+            }
+            else
+            {
+                _Analysis_assume_(FreeRcbList != NULL && FreeRcbListLock != NULL);
+                NdisInterlockedInsertTailList(
+                        FreeRcbList,
+                        &Rcb->RcbLink,
+                        FreeRcbListLock);
+            }
         }
 
     }while(FALSE);
@@ -1968,6 +2062,11 @@ Return Value:
 
     NDIS_CONFIGURATION_OBJECT     ConfigurationParameters;
     NDIS_HANDLE                   ConfigurationHandle;
+    PNDIS_CONFIGURATION_PARAMETER Parameter = NULL;
+    NDIS_STRING                   ZeroCopySendKeyword = NDIS_STRING_CONST("ZeroCopySend");
+#if (NDIS_SUPPORT_NDIS630)
+    NDIS_STRING                   RscEmulationKeyword = NDIS_STRING_CONST("RscEmulation");
+#endif
 
     DEBUGP(MP_TRACE, "[%p] ---> NICReadRegParameters\n", Adapter);
 
@@ -2007,6 +2106,38 @@ Return Value:
     Adapter->ulLinkSendSpeed = NIC_XMIT_SPEED;
     Adapter->ulLinkRecvSpeed = NIC_RECV_SPEED;
 
+    //
+    // Read the ZeroCopySend flag (whether sent frames refer to the sender's
+    // MDLs instead of being copied).  It is enabled unless set to 0.
+    //
+    NdisReadConfiguration(
+            &Status,
+            &Parameter,
+            ConfigurationHandle,
+            &ZeroCopySendKeyword,
+            NdisParameterInteger);
+
+    Adapter->fZeroCopySend = (Status != NDIS_STATUS_SUCCESS || Parameter->ParameterData.IntegerData != 0);
+    Status = NDIS_STATUS_SUCCESS;
+
+#if (NDIS_SUPPORT_NDIS630)
+    //
+    // Read the RscEmulation flag (whether in-order TCP segments received in
+    // the same DPC are coalesced into one NBL).  It is disabled unless set
+    // to a nonzero value; when set, the RSC offload is advertised to the
+    // stack, which enables and disables it per IP version.
+    //
+    NdisReadConfiguration(
+            &Status,
+            &Parameter,
+            ConfigurationHandle,
+            &RscEmulationKeyword,
+            NdisParameterInteger);
+
+    Adapter->fRscEmulation = (Status == NDIS_STATUS_SUCCESS && Parameter->ParameterData.IntegerData != 0);
+    Status = NDIS_STATUS_SUCCESS;
+#endif
+
     //
     // Read VMQ related configuration parameters
     //
@@ -2117,6 +2248,47 @@ Return Value:
     DbgPrintAddress(Adapter->CurrentAddress);
 }
 
+#if (NDIS_SUPPORT_NDIS630)
+
+VOID
+NICFillOffload(
+    _In_  PMP_ADAPTER  Adapter,
+    _In_  BOOLEAN      Capabilities,
+    _Out_ PNDIS_OFFLOAD Offload)
+/*++
+Routine Description:
+
+    The NICFillOffload function describes the task offloads of the NIC: either
+    the offloads it is capable of, or those the stack has currently enabled.
+    Receive segment coalescing is the only offload, and only if emulated.
+
+Arguments:
+
+    Adapter                     Pointer to our adapter
+    Capabilities                TRUE for the capabilities, FALSE for the current configuration
+    Offload                     Receives the offload description
+
+Return Value:
+
+    None.
+
+--*/
+{
+    NdisZeroMemory(Offload, sizeof(*Offload));
+
+    {C_ASSERT(sizeof(*Offload) >= NDIS_SIZEOF_NDIS_OFFLOAD_REVISION_3);}
+    Offload->Header.Type = NDIS_OBJECT_TYPE_OFFLOAD;
+    Offload->Header.Size = NDIS_SIZEOF_NDIS_OFFLOAD_REVISION_3;
+    Offload->Header.Revision = NDIS_OFFLOAD_REVISION_3;
+
+    if (Adapter->fRscEmulation)
+    {
+        Offload->Rsc.IPv4.Enabled = Capabilities || Adapter->fRscIPv4;
+        Offload->Rsc.IPv6.Enabled = Capabilities || Adapter->fRscIPv6;
+    }
+}
+
+#endif
 
 BOOLEAN
 NICIsBusy(
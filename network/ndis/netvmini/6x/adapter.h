@@ -81,6 +81,14 @@ typedef struct _MP_ADAPTER_RECEIVE_DPC
     //
     struct _MP_ADAPTER *Adapter;
 
+#if (NDIS_SUPPORT_NDIS680)
+    //
+    // Receive block of the RSS processor this DPC targets, if the RSS
+    // indirection table steers receives to it.
+    //
+    struct _MP_ADAPTER_RECEIVE_BLOCK *RssReceiveBlock;
+#endif
+
 } MP_ADAPTER_RECEIVE_DPC, * PMP_ADAPTER_RECEIVE_DPC;
 
 //
@@ -98,6 +106,33 @@ typedef struct DECLSPEC_CACHEALIGN _MP_ADAPTER_RECEIVE_BLOCK
     volatile LONG PendingReceives;
 } MP_ADAPTER_RECEIVE_BLOCK, * PMP_ADAPTER_RECEIVE_BLOCK;
 
+//
+// Free TCBs and RCBs are kept in a control block pool: a lock-free stack
+// shared by all processors, in front of which each processor keeps a small
+// cache of its own.  A processor takes and returns control blocks from its
+// cache without any interlocked operation, and only goes to the shared
+// stack when its cache is empty or full.
+//
+typedef struct DECLSPEC_CACHEALIGN _MP_CB_CACHE
+{
+    ULONG Count;
+    PSLIST_ENTRY Entries[NIC_CB_CACHE_DEPTH];
+} MP_CB_CACHE, * PMP_CB_CACHE;
+
+typedef struct _MP_CB_POOL
+{
+    SLIST_HEADER FreeList;
+
+    //
+    // One cache per processor, and the number of control blocks each cache
+    // may hold.  The depth is small enough that at most half of the pool is
+    // ever held in caches.
+    //
+    PMP_CB_CACHE Caches;
+    ULONG CacheCount;
+    ULONG CacheDepth;
+} MP_CB_POOL, * PMP_CB_POOL;
+
 //
 // Each adapter managed by this driver has a MP_ADAPTER struct.
 //
@@ -133,6 +168,14 @@ typedef struct _MP_ADAPTER
     UCHAR                   PermanentAddress[NIC_MACADDR_SIZE];
     UCHAR                   CurrentAddress[NIC_MACADDR_SIZE];
 
+    //
+    // The forwarding table entries of the adapter: AddressForwardingEntry
+    // for CurrentAddress, and one for each VMQ receive filter.  Protected by
+    // GlobalData.Lock.
+    //
+    LIST_ENTRY              ForwardingEntryList;
+    MP_FORWARDING_ENTRY     AddressForwardingEntry;
+
     //
     // Send tracking
     // -------------------------------------------------------------------------
@@ -141,9 +184,8 @@ typedef struct _MP_ADAPTER
     // Pool of unused TCBs
     PVOID                   TcbMemoryBlock;
 
-    // List of unused TCBs (sliced out of TcbMemoryBlock)
-    LIST_ENTRY              FreeTcbList;
-    NDIS_SPIN_LOCK          FreeTcbListLock;
+    // Unused TCBs (sliced out of TcbMemoryBlock)
+    MP_CB_POOL              TcbPool;
 
     // List of net buffers to send that are waiting for a free TCB
     LIST_ENTRY              SendWaitList;
@@ -179,9 +221,8 @@ typedef struct _MP_ADAPTER
     // Pool of unused RCBs
     PVOID                   RcbMemoryBlock;
 
-    // List of unused RCBs (sliced out of RcbMemoryBlock)
-    LIST_ENTRY              FreeRcbList;
-    NDIS_SPIN_LOCK          FreeRcbListLock;
+    // Unused RCBs (sliced out of RcbMemoryBlock)
+    MP_CB_POOL              RcbPool;
 
     NDIS_HANDLE             RecvNblPoolHandle;
 
@@ -211,6 +252,13 @@ typedef struct _MP_ADAPTER
     ULONG64                 ulLinkRecvSpeed;
     ULONG                   ulMaxBusySends;
     ULONG                   ulMaxBusyRecvs;
+    BOOLEAN                 fZeroCopySend;
+    BOOLEAN                 fRscEmulation;
+
+    // RSC currently enabled by the stack through OID_TCP_OFFLOAD_PARAMETERS,
+    // per IP version.  Only ever TRUE if fRscEmulation is set.
+    BOOLEAN                 fRscIPv4;
+    BOOLEAN                 fRscIPv6;
 
     // multicast list
     ULONG                   ulMCListSize;
@@ -238,6 +286,19 @@ typedef struct _MP_ADAPTER
     ULONG64                 BytesTxMulticast;
     ULONG64                 BytesTxBroadcast;
 
+    // Bytes copied to move frames from the sender to the receivers: into the
+    // FRAME on send, and into VMQ shared memory on receive.  Divide by the
+    // frame counts for the bytes copied per packet.
+    ULONG64                 BytesTxCopied;
+    ULONG64                 FramesTxZeroCopy;
+    ULONG64                 BytesRxCopied;
+
+    // Receive segment coalescing, as in NDIS_RSC_STATISTICS_INFO
+    ULONG64                 RscCoalescedPkts;
+    ULONG64                 RscCoalescedOctets;
+    ULONG64                 RscCoalesceEvents;
+    ULONG64                 RscAborts;
+
     // Count of transmit errors
     ULONG                   TxAbortExcessCollisions;
     ULONG                   TxLateCollisions;
@@ -334,8 +395,9 @@ NICAllocRCBData(
     _In_ PMP_ADAPTER Adapter,
     ULONG NumberOfRcbs,
     _Outptr_result_bytebuffer_(NumberOfRcbs * sizeof(RCB)) PVOID *RcbMemoryBlock,
-    _Inout_ PLIST_ENTRY FreeRcbList,
-    _Inout_ PNDIS_SPIN_LOCK FreeRcbListLock,
+    _Inout_opt_ PLIST_ENTRY FreeRcbList,
+    _Inout_opt_ PNDIS_SPIN_LOCK FreeRcbListLock,
+    _Inout_opt_ PMP_CB_POOL FreeRcbPool,
     _Inout_ PNDIS_HANDLE RecvNblPoolHandle);
 
 NDIS_STATUS
@@ -359,6 +421,13 @@ NICDereferenceReceiveBlock(
     _In_ _In_range_(0, NIC_SUPPORTED_NUM_QUEUES-1) ULONG BlockId,
     _Out_opt_ ULONG *RefCount);
 
+#if (NDIS_SUPPORT_NDIS630)
+VOID
+NICFillOffload(
+    _In_  PMP_ADAPTER  Adapter,
+    _In_  BOOLEAN      Capabilities,
+    _Out_ PNDIS_OFFLOAD Offload);
+#endif
 
 BOOLEAN
 NICIsBusy(
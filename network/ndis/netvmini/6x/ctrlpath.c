@@ -104,6 +104,13 @@ NICSetQOSParameters(
     _In_ PMP_ADAPTER        Adapter,
     _In_ PNDIS_OID_REQUEST  NdisMethodRequest);
 
+_IRQL_requires_(PASSIVE_LEVEL)
+static
+NDIS_STATUS
+NICSetOffloadParameters(
+    _In_ PMP_ADAPTER        Adapter,
+    _In_ PNDIS_OID_REQUEST  NdisSetRequest);
+
 #pragma NDIS_PAGEABLE_FUNCTION(NICFreeRxQueue)
 #pragma NDIS_PAGEABLE_FUNCTION(NICClearRxFilter)
 #pragma NDIS_PAGEABLE_FUNCTION(NICUpdateRxQueue)
@@ -111,6 +118,7 @@ NICSetQOSParameters(
 #pragma NDIS_PAGEABLE_FUNCTION(NICCompleteAllocationRxQueue)
 #pragma NDIS_PAGEABLE_FUNCTION(NICSetRxFilter)
 #pragma NDIS_PAGEABLE_FUNCTION(NICSetQOSParameters)
+#pragma NDIS_PAGEABLE_FUNCTION(NICSetOffloadParameters)
 
 #endif
 
@@ -786,6 +794,34 @@ Return Value:
             // simply succeed this.
             break;
 
+#if (NDIS_SUPPORT_NDIS630)
+        case OID_TCP_RSC_STATISTICS:
+
+            if (Query->InformationBufferLength < NDIS_SIZEOF_RSC_STATISTICS_REVISION_1)
+            {
+                Status = NDIS_STATUS_INVALID_LENGTH;
+                Query->BytesNeeded = NDIS_SIZEOF_RSC_STATISTICS_REVISION_1;
+                break;
+            }
+            else
+            {
+                PNDIS_RSC_STATISTICS_INFO Statistics = (PNDIS_RSC_STATISTICS_INFO)Query->InformationBuffer;
+
+                Statistics->Header.Type = NDIS_OBJECT_TYPE_DEFAULT;
+                Statistics->Header.Size = NDIS_SIZEOF_RSC_STATISTICS_REVISION_1;
+                Statistics->Header.Revision = NDIS_RSC_STATISTICS_REVISION_1;
+
+                Statistics->CoalescedPkts = Adapter->RscCoalescedPkts;
+                Statistics->CoalescedOctets = Adapter->RscCoalescedOctets;
+                Statistics->CoalesceEvents = Adapter->RscCoalesceEvents;
+                Statistics->Aborts = Adapter->RscAborts;
+
+                ulInfoLen = NDIS_SIZEOF_RSC_STATISTICS_REVISION_1;
+            }
+
+            break;
+#endif
+
         default:
             Status = NDIS_STATUS_NOT_SUPPORTED;
             break;
@@ -941,6 +977,15 @@ Return Value:
                             NdisSetRequest);             
             break;
 
+#if (NDIS_SUPPORT_NDIS630)
+        case OID_TCP_OFFLOAD_PARAMETERS:
+            //
+            // Enable or disable receive segment coalescing.
+            //
+            Status = NICSetOffloadParameters(Adapter, NdisSetRequest);
+            break;
+#endif
+
 #if (NDIS_SUPPORT_NDIS680)
         case OID_GEN_RECEIVE_SCALE_PARAMETERS_V2:
             //
@@ -1168,7 +1213,7 @@ Return Value:
 
 
         // Save the new packet filter value
-        Adapter->PacketFilter = PacketFilter;
+        MPSetPacketFilter(Adapter, PacketFilter);
     }
 
 
@@ -1701,6 +1746,106 @@ Return Value:
     return Status;
 }
 
+_IRQL_requires_(PASSIVE_LEVEL)
+NDIS_STATUS
+NICSetOffloadParameters(
+    _In_ PMP_ADAPTER        Adapter,
+    _In_ PNDIS_OID_REQUEST  NdisSetRequest)
+/*++
+Routine Description:
+
+    This routine enables or disables receive segment coalescing for each IP
+    version, as requested by the stack, then indicates the resulting offload
+    configuration. The other task offloads are not supported, and their
+    settings are ignored.
+
+Arguments:
+
+    Adapter         - Pointer to adapter block
+    NdisSetRequest  - The OID data for the request
+
+Return Value:
+
+    NDIS_STATUS
+
+--*/
+{
+    NDIS_STATUS Status = NDIS_STATUS_SUCCESS;
+    struct _SET *Set = &NdisSetRequest->DATA.SET_INFORMATION;
+    PNDIS_OFFLOAD_PARAMETERS Params = (PNDIS_OFFLOAD_PARAMETERS)Set->InformationBuffer;
+    NDIS_STATUS_INDICATION StatusIndication = {0};
+    NDIS_OFFLOAD Offload;
+
+    PAGED_CODE();
+
+    DEBUGP(MP_TRACE, "[%p] ---> NICSetOffloadParameters\n", Adapter);
+
+    do
+    {
+        if (Set->InformationBufferLength < NDIS_SIZEOF_OFFLOAD_PARAMETERS_REVISION_1)
+        {
+            Set->BytesNeeded = NDIS_SIZEOF_OFFLOAD_PARAMETERS_REVISION_1;
+            Status = NDIS_STATUS_INVALID_LENGTH;
+            break;
+        }
+
+        if (Params->Header.Type != NDIS_OBJECT_TYPE_DEFAULT
+            || Params->Header.Revision < NDIS_OFFLOAD_PARAMETERS_REVISION_1
+            || Params->Header.Size < NDIS_SIZEOF_OFFLOAD_PARAMETERS_REVISION_1)
+        {
+            Status = NDIS_STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        //
+        // The RSC settings are only present from revision 3.
+        //
+        if (Params->Header.Revision >= NDIS_OFFLOAD_PARAMETERS_REVISION_3
+            && Params->Header.Size >= NDIS_SIZEOF_OFFLOAD_PARAMETERS_REVISION_3
+            && Set->InformationBufferLength >= NDIS_SIZEOF_OFFLOAD_PARAMETERS_REVISION_3)
+        {
+            if (Params->RscIPv4 == NDIS_OFFLOAD_PARAMETERS_RSC_ENABLED)
+            {
+                Adapter->fRscIPv4 = Adapter->fRscEmulation;
+            }
+            else if (Params->RscIPv4 == NDIS_OFFLOAD_PARAMETERS_RSC_DISABLED)
+            {
+                Adapter->fRscIPv4 = FALSE;
+            }
+
+            if (Params->RscIPv6 == NDIS_OFFLOAD_PARAMETERS_RSC_ENABLED)
+            {
+                Adapter->fRscIPv6 = Adapter->fRscEmulation;
+            }
+            else if (Params->RscIPv6 == NDIS_OFFLOAD_PARAMETERS_RSC_DISABLED)
+            {
+                Adapter->fRscIPv6 = FALSE;
+            }
+        }
+
+        //
+        // Report the current offload configuration, as the stack expects
+        // after every OID_TCP_OFFLOAD_PARAMETERS.
+        //
+        NICFillOffload(Adapter, FALSE, &Offload);
+
+        StatusIndication.Header.Type = NDIS_OBJECT_TYPE_STATUS_INDICATION;
+        StatusIndication.Header.Revision = NDIS_STATUS_INDICATION_REVISION_1;
+        StatusIndication.Header.Size = NDIS_SIZEOF_STATUS_INDICATION_REVISION_1;
+        StatusIndication.SourceHandle = Adapter->AdapterHandle;
+        StatusIndication.StatusCode = NDIS_STATUS_TASK_OFFLOAD_CURRENT_CONFIG;
+        StatusIndication.StatusBuffer = &Offload;
+        StatusIndication.StatusBufferSize = Offload.Header.Size;
+
+        NdisMIndicateStatusEx(Adapter->AdapterHandle, &StatusIndication);
+    } while(FALSE);
+
+    DEBUGP(MP_TRACE, "[%p] <--- NICSetOffloadParameters RscIPv4 %d RscIPv6 %d Status 0x%08x\n",
+           Adapter, Adapter->fRscIPv4, Adapter->fRscIPv6, Status);
+
+    return Status;
+}
+
 #endif
 
 static
@@ -41,8 +41,15 @@ Abstract:
 static
 VOID
 TXQueueNetBufferForSend(
-    _In_  PMP_ADAPTER       Adapter,
-    _In_  PNET_BUFFER       NetBuffer);
+    _In_    PMP_ADAPTER       Adapter,
+    _In_    PNET_BUFFER       NetBuffer,
+    _Inout_ PLIST_ENTRY       SendList);
+
+static
+VOID
+NICMoveListToTail(
+    _Inout_ PLIST_ENTRY       ListHead,
+    _Inout_ PLIST_ENTRY       List);
 
 static
 VOID
@@ -66,8 +73,102 @@ static
 VOID
 RXScheduleTheReceiveIndication(
     _In_     PMP_ADAPTER Adapter,
+    _In_opt_ PMP_ADAPTER_RECEIVE_DPC SteeredDpc,
     _In_     PRCB Rcb);
 
+static
+VOID
+RXIndicateReceiveBlock(
+    _In_ PMP_ADAPTER Adapter,
+    _In_ PMP_ADAPTER_RECEIVE_DPC AdapterDpc,
+    _In_ PMP_ADAPTER_RECEIVE_BLOCK ReceiveBlock,
+    ULONG ReceiveFlags,
+    BOOLEAN AtDpc);
+
+#if (NDIS_SUPPORT_NDIS630)
+//
+// A received TCP segment, parsed for receive segment coalescing.  Offsets
+// are from the start of the frame.
+//
+typedef struct _RX_RSC_SEGMENT
+{
+    PRCB                    Rcb;
+    PUCHAR                  Header;         // Headers, in the FRAME's data
+    ULONG                   IpOffset;
+    ULONG                   TcpOffset;
+    ULONG                   HeaderLength;   // Ethernet, IP and TCP headers
+    ULONG                   PayloadLength;
+    ULONG                   Sequence;
+    UCHAR                   TcpFlags;
+    BOOLEAN                 IsIpv6;
+    BOOLEAN                 Coalescible;    // Can be coalesced with others
+} RX_RSC_SEGMENT, *PRX_RSC_SEGMENT;
+
+//
+// A TCP flow whose in-order segments are being coalesced into the NBL of its
+// first segment.  The flow is free if First.Rcb is NULL.
+//
+typedef struct _RX_RSC_FLOW
+{
+    RX_RSC_SEGMENT          First;
+    PRCB                    Last;
+    PUCHAR                  LastHeader;
+    ULONG                   NextSequence;
+    ULONG                   PayloadLength;  // Of all the segments
+    ULONG                   SegmentCount;
+    ULONG                   LastUsed;       // Order of the last segment in the batch
+} RX_RSC_FLOW, *PRX_RSC_FLOW;
+
+static
+BOOLEAN
+RXRscParseSegment(
+    _In_  PRCB Rcb,
+    _Out_ PRX_RSC_SEGMENT Segment);
+
+static
+BOOLEAN
+RXRscIsSameFlow(
+    _In_ PRX_RSC_SEGMENT First,
+    _In_ PRX_RSC_SEGMENT Segment);
+
+static
+BOOLEAN
+RXRscCanCoalesce(
+    _In_ PRX_RSC_FLOW Flow,
+    _In_ PRX_RSC_SEGMENT Segment);
+
+static
+ULONG
+RXRscChecksumAdd(
+    ULONG Sum,
+    _In_reads_bytes_(Length) PUCHAR Data,
+    ULONG Length);
+
+static
+USHORT
+RXRscChecksumFold(
+    ULONG Sum);
+
+static
+BOOLEAN
+RXRscBuildPayloadMdl(
+    _In_ PRX_RSC_SEGMENT Segment);
+
+static
+BOOLEAN
+RXRscCoalesceReceive(
+    _In_ PMP_ADAPTER Adapter,
+    _Inout_updates_(NIC_RSC_MAX_FLOWS) PRX_RSC_FLOW Flows,
+    _In_ PRCB Rcb,
+    ULONG Order);
+
+static
+VOID
+RXRscCloseFlow(
+    _In_ PMP_ADAPTER Adapter,
+    _Inout_ PRX_RSC_FLOW Flow);
+#endif
+
 _Must_inspect_result_
 static
 PTCB
@@ -140,6 +241,7 @@ Return Value:
     BOOLEAN           fAtDispatch = (SendFlags & NDIS_SEND_FLAGS_DISPATCH_LEVEL) ? TRUE:FALSE;
     NDIS_STATUS       Status;
     ULONG             NumNbls=0;
+    LIST_ENTRY        SendList;
 
     DEBUGP(MP_TRACE, "[%p] ---> MPSendNetBufferLists\n", Adapter);
 
@@ -147,6 +249,11 @@ Return Value:
     UNREFERENCED_PARAMETER(SendFlags);
     ASSERT(PortNumber == 0); // Only the default port is supported
 
+    //
+    // The NBs of the whole chain are gathered on a local list first, and
+    // added to the SendWaitList with a single acquisition of its lock.
+    //
+    InitializeListHead(&SendList);
 
     //
     // Each NET_BUFFER_LIST has a list of NET_BUFFERs.
@@ -185,7 +292,7 @@ Return Value:
                 NetBuffer = NET_BUFFER_NEXT_NB(NetBuffer))
             {
                 NBL_FROM_SEND_NB(NetBuffer) = Nbl;
-                TXQueueNetBufferForSend(Adapter, NetBuffer);
+                TXQueueNetBufferForSend(Adapter, NetBuffer, &SendList);
             }
 
             TXNblRelease(Adapter, Nbl, fAtDispatch);
@@ -223,6 +330,13 @@ Return Value:
 
     DEBUGP(MP_TRACE, "[%p] %i NBLs processed.\n", Adapter, NumNbls);
 
+    if (!IsListEmpty(&SendList))
+    {
+        NdisAcquireSpinLock(&Adapter->SendWaitListLock);
+        NICMoveListToTail(&Adapter->SendWaitList, &SendList);
+        NdisReleaseSpinLock(&Adapter->SendWaitListLock);
+    }
+
     //
     // Now actually go send each of the queued NBs.
     //
@@ -233,13 +347,15 @@ Return Value:
 
 VOID
 TXQueueNetBufferForSend(
-    _In_  PMP_ADAPTER       Adapter,
-    _In_  PNET_BUFFER       NetBuffer)
+    _In_    PMP_ADAPTER       Adapter,
+    _In_    PNET_BUFFER       NetBuffer,
+    _Inout_ PLIST_ENTRY       SendList)
 /*++
 
 Routine Description:
 
-    This routine inserts the NET_BUFFER into the SendWaitList, then calls
+    This routine inserts the NET_BUFFER into the caller's SendList.  The
+    caller moves the SendList to the SendWaitList, then calls
     TXTransmitQueuedSends to start sending data from the list.
 
     We use this indirect queue to send data because the miniport should try to
@@ -254,6 +370,7 @@ Arguments:
 
     Adapter                     Adapter that is transmitting this NB
     NetBuffer                   NB to be transfered
+    SendList                    Local list of NBs being queued by the caller
 
 Return Value:
 
@@ -293,13 +410,10 @@ Return Value:
         if(Status == NDIS_STATUS_SUCCESS)
         {
             //
-            // Insert the NB into the queue.  The caller will flush the queue when
-            // it's done adding items to the queue.
+            // Insert the NB into the caller's list.  The caller will move it
+            // to the queue and flush the queue when it's done adding items.
             //
-            NdisInterlockedInsertTailList(
-                    &Adapter->SendWaitList,
-                    SEND_WAIT_LIST_FROM_NB(NetBuffer),
-                    &Adapter->SendWaitListLock);
+            InsertTailList(SendList, SEND_WAIT_LIST_FROM_NB(NetBuffer));
         }
 
     } while (FALSE);
@@ -309,6 +423,43 @@ Return Value:
 }
 
 
+VOID
+NICMoveListToTail(
+    _Inout_ PLIST_ENTRY       ListHead,
+    _Inout_ PLIST_ENTRY       List)
+/*++
+
+Routine Description:
+
+    This routine moves all the entries of List to the tail of ListHead, in
+    order, leaving List empty.  The caller holds the lock of ListHead.
+
+Arguments:
+
+    ListHead                    The list to append to
+    List                        The non-empty list to move
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PLIST_ENTRY First = List->Flink;
+
+    ASSERT(!IsListEmpty(List));
+
+    //
+    // Unlinking the list head leaves the entries in a circular list without
+    // a head, which AppendTailList splices in as a whole.
+    //
+    RemoveEntryList(List);
+    AppendTailList(ListHead, First);
+
+    InitializeListHead(List);
+}
+
+
 VOID
 #pragma prefast(suppress: 28167, "PREfast does not recognize IRQL is conditionally raised and lowered")
 TXTransmitQueuedSends(
@@ -365,20 +516,26 @@ Return Value:
 
     if (KeTryToAcquireSpinLockAtDpcLevel(&Adapter->SendPathSpinLock))
     {
-        for (NumFramesSent = 0; NumFramesSent < NIC_MAX_SENDS_PER_DPC; NumFramesSent++)
-        {
-            PLIST_ENTRY pTcbEntry = NULL;
-            PTCB Tcb = NULL;
-            PLIST_ENTRY pQueuedSend = NULL;
-            PNET_BUFFER NetBuffer;
+        LIST_ENTRY TcbBatch;
+        PLIST_ENTRY pTcbEntry;
+        PTCB Tcb;
+
+        InitializeListHead(&TcbBatch);
+
+        //
+        // Pair as many queued NBs as we have TCBs for with a TCB, under a
+        // single acquisition of the SendWaitListLock.
+        //
+        NdisDprAcquireSpinLock(&Adapter->SendWaitListLock);
 
+        while (NumFramesSent < NIC_MAX_SENDS_PER_DPC &&
+               !IsListEmpty(&Adapter->SendWaitList))
+        {
             //
             // Get the next available TCB.
             //
-            pTcbEntry = NdisInterlockedRemoveHeadList(
-                    &Adapter->FreeTcbList,
-                    &Adapter->FreeTcbListLock);
-            if (!pTcbEntry)
+            Tcb = GetTCB(Adapter);
+            if (!Tcb)
             {
                 //
                 // The adapter can't handle any more simultaneous transmit
@@ -388,28 +545,26 @@ Return Value:
                 break;
             }
 
-            Tcb = CONTAINING_RECORD(pTcbEntry, TCB, TcbLink);
-
             //
             // Get the next NB that needs sending.
             //
-            pQueuedSend = NdisInterlockedRemoveHeadList(
-                    &Adapter->SendWaitList,
-                    &Adapter->SendWaitListLock);
-            if (!pQueuedSend)
-            {
-                //
-                // There's nothing left that needs sending.  We're all done.
-                //
-                NdisInterlockedInsertTailList(
-                        &Adapter->FreeTcbList,
-                        &Tcb->TcbLink,
-                        &Adapter->FreeTcbListLock);
-                break;
-            }
+            Tcb->NetBuffer = NB_FROM_SEND_WAIT_LIST(RemoveHeadList(&Adapter->SendWaitList));
+            InsertTailList(&TcbBatch, &Tcb->TcbLink);
+
+            NumFramesSent++;
+        }
 
-            NetBuffer = NB_FROM_SEND_WAIT_LIST(pQueuedSend);
+        NdisDprReleaseSpinLock(&Adapter->SendWaitListLock);
 
+        for (
+            pTcbEntry = TcbBatch.Flink;
+            pTcbEntry != &TcbBatch;
+            pTcbEntry = pTcbEntry->Flink)
+        {
+            PNET_BUFFER NetBuffer;
+
+            Tcb = CONTAINING_RECORD(pTcbEntry, TCB, TcbLink);
+            NetBuffer = Tcb->NetBuffer;
 
             //
             // We already packed the frame type into the net buffer before accepting
@@ -419,11 +574,13 @@ Return Value:
             Tcb->FrameType = FRAME_TYPE_FROM_SEND_NB(NetBuffer);
 
             HWProgramDmaForSend(Adapter, Tcb, NetBuffer, fAtDispatch);
+        }
 
-            NdisInterlockedInsertTailList(
-                &Adapter->BusyTcbList,
-                    &Tcb->TcbLink,
-                    &Adapter->BusyTcbListLock);
+        if (!IsListEmpty(&TcbBatch))
+        {
+            NdisDprAcquireSpinLock(&Adapter->BusyTcbListLock);
+            NICMoveListToTail(&Adapter->BusyTcbList, &TcbBatch);
+            NdisDprReleaseSpinLock(&Adapter->BusyTcbListLock);
 
             fScheduleTheSendCompleteDpc = TRUE;
         }
@@ -600,6 +757,12 @@ Routine Description:
 
         BytesSent = HWGetBytesSent(Adapter, Tcb);
 
+        Adapter->BytesTxCopied += Tcb->BytesCopied;
+        if (BytesSent > Tcb->BytesCopied)
+        {
+            Adapter->FramesTxZeroCopy++;
+        }
+
         if (BytesSent == 0)
         {
             //
@@ -957,7 +1120,12 @@ RXDeliverFrameToEveryAdapter(
 Routine Description:
 
     This routine sends a TCB to each netvmini 6.x adapter (besides the sending
-    adapter itself)
+    adapter itself) that may receive it.
+
+    Directed frames are only offered to the adapters that have a forwarding
+    entry for their destination, unless some adapter is promiscuous.  Other
+    frames are offered to every adapter.  In both cases the same FRAME is
+    queued on each receiving adapter, which takes its own reference to it.
 
     Runs at IRQL <= DISPATCH_LEVEL
 
@@ -976,6 +1144,11 @@ Return Value:
 {
     MP_LOCK_STATE  LockState;
     PLIST_ENTRY AdapterLink;
+    PLIST_ENTRY Bucket, EntryLink, PriorLink;
+    PMP_FORWARDING_ENTRY Entry, PriorEntry;
+    UCHAR DestAddress[NIC_MACADDR_SIZE];
+    USHORT VlanId;
+    BOOLEAN fForward;
 
 
     DEBUGP(MP_TRACE, "[%p] ---> RXDeliverFrameToEveryAdapter. Frame=0x%p\n", SendAdapter, Frame);
@@ -984,27 +1157,89 @@ Return Value:
     UNREFERENCED_PARAMETER(fAtDispatch);
 
     //
-    // Go through the adapter list and queue packet for
-    // indication on them if there are any. Otherwise
-    // just drop the packet on the floor and tell NDIS that
-    // you have completed send.
+    // Runt frames are offered to every adapter so each counts it as it drops
+    // it, and promiscuous adapters receive all frames.
     //
-
-    for (
-        AdapterLink = GlobalData.AdapterList.Flink;
-        AdapterLink != &GlobalData.AdapterList;
-        AdapterLink = AdapterLink->Flink
-        )
+    fForward = FALSE;
+    if (Frame->ulSize >= HW_MIN_FRAME_SIZE
+        && GlobalData.PromiscuousAdapterCount == 0)
     {
-        PMP_ADAPTER DestAdapter = CONTAINING_RECORD(AdapterLink, MP_ADAPTER, List);
+        GET_DESTINATION_OF_FRAME(DestAddress, Frame->Data);
+        fForward = (NICGetFrameTypeFromDestination(DestAddress) == NDIS_PACKET_TYPE_DIRECTED);
+    }
 
-        if (DestAdapter == SendAdapter)
+    if (fForward)
+    {
+        //
+        // Queue the packet only on the adapters that own its destination.  If
+        // none does, no adapter would accept it, so it is dropped here.  An
+        // adapter can have several entries that match the frame (its own
+        // address and a VMQ filter, say), so the frame is only queued for the
+        // first of them.
+        //
+        VlanId = Nbl1QInfo->Value ? (USHORT)Nbl1QInfo->TagHeader.VlanId : 0;
+        Bucket = &GlobalData.ForwardingTable[NIC_FORWARDING_HASH(DestAddress)];
+
+        for (
+            EntryLink = Bucket->Flink;
+            EntryLink != Bucket;
+            EntryLink = EntryLink->Flink
+            )
         {
-            // Don't loopback packets to the sending adapter.
-            continue;
+            Entry = CONTAINING_RECORD(EntryLink, MP_FORWARDING_ENTRY, BucketLink);
+
+            if (Entry->Adapter == SendAdapter
+                || !MPMatchForwardingEntry(Entry, DestAddress, VlanId))
+            {
+                continue;
+            }
+
+            for (
+                PriorLink = Bucket->Flink;
+                PriorLink != EntryLink;
+                PriorLink = PriorLink->Flink
+                )
+            {
+                PriorEntry = CONTAINING_RECORD(PriorLink, MP_FORWARDING_ENTRY, BucketLink);
+
+                if (PriorEntry->Adapter == Entry->Adapter
+                    && MPMatchForwardingEntry(PriorEntry, DestAddress, VlanId))
+                {
+                    break;
+                }
+            }
+
+            if (PriorLink == EntryLink)
+            {
+                RXQueueFrameOnAdapter(Entry->Adapter, Nbl1QInfo, Frame);
+            }
         }
+    }
+    else
+    {
+        //
+        // Go through the adapter list and queue packet for
+        // indication on them if there are any. Otherwise
+        // just drop the packet on the floor and tell NDIS that
+        // you have completed send.
+        //
+
+        for (
+            AdapterLink = GlobalData.AdapterList.Flink;
+            AdapterLink != &GlobalData.AdapterList;
+            AdapterLink = AdapterLink->Flink
+            )
+        {
+            PMP_ADAPTER DestAdapter = CONTAINING_RECORD(AdapterLink, MP_ADAPTER, List);
 
-        RXQueueFrameOnAdapter(DestAdapter, Nbl1QInfo, Frame);
+            if (DestAdapter == SendAdapter)
+            {
+                // Don't loopback packets to the sending adapter.
+                continue;
+            }
+
+            RXQueueFrameOnAdapter(DestAdapter, Nbl1QInfo, Frame);
+        }
     }
 
     UNLOCK_ADAPTER_LIST(&LockState);
@@ -1048,6 +1283,7 @@ Return Value:
         PRCB          Rcb;
         UCHAR         DestAddress[NIC_MACADDR_SIZE];
         ULONG         FrameType;
+        PMP_ADAPTER_RECEIVE_DPC SteeredDpc = NULL;
 
 
         if (!MP_IS_READY(Adapter))
@@ -1118,7 +1354,8 @@ Return Value:
 
         //
         // If VMQ is enabled, queue Rcb on the owner VMQ, otherwise
-        // use global receive wait list
+        // use the receive block of the RSS processor the frame hashes to,
+        // or the global receive wait list
         //
         if(VMQ_ENABLED(Adapter))
         {
@@ -1129,13 +1366,26 @@ Return Value:
         }
         else
         {
-            //
-            // Queue on global receive block
-            //
-            NdisInterlockedInsertTailList(&Adapter->ReceiveBlock[0].ReceiveList, &Rcb->RcbLink, &Adapter->ReceiveBlock[0].ReceiveListLock);
+#if (NDIS_SUPPORT_NDIS680)
+            SteeredDpc = NICRSSv2SteerReceive(Adapter, Frame, Rcb->Nbl);
+#endif
+            if(SteeredDpc)
+            {
+                //
+                // Queue on the RSS processor's receive block
+                //
+                NdisInterlockedInsertTailList(&SteeredDpc->RssReceiveBlock->ReceiveList, &Rcb->RcbLink, &SteeredDpc->RssReceiveBlock->ReceiveListLock);
+            }
+            else
+            {
+                //
+                // Queue on global receive block
+                //
+                NdisInterlockedInsertTailList(&Adapter->ReceiveBlock[0].ReceiveList, &Rcb->RcbLink, &Adapter->ReceiveBlock[0].ReceiveListLock);
+            }
         }
 
-        RXScheduleTheReceiveIndication(Adapter, Rcb);
+        RXScheduleTheReceiveIndication(Adapter, SteeredDpc, Rcb);
 
 
     } while (FALSE);
@@ -1147,6 +1397,7 @@ Return Value:
 VOID
 RXScheduleTheReceiveIndication(
     _In_     PMP_ADAPTER  Adapter,
+    _In_opt_ PMP_ADAPTER_RECEIVE_DPC SteeredDpc,
     _In_     PRCB Rcb)
 /*++
 
@@ -1156,7 +1407,9 @@ Routine Description:
 
 Arguments:
 
-    FunctionContext             Pointer to the adapter that is receiving frames
+    Adapter                     Pointer to the adapter that is receiving frames
+    SteeredDpc                  DPC of the RSS processor the RCB was steered to, if any
+    Rcb                         RCB that was queued
 
 Return Value:
 
@@ -1166,11 +1419,16 @@ Return Value:
 {
 
     //
-    // Use default DPC unless VMQ is enabled, in which case you use the Queue's DPC
+    // Use default DPC unless VMQ is enabled, in which case you use the Queue's DPC,
+    // or the RCB was steered to an RSS processor
     //
     PMP_ADAPTER_RECEIVE_DPC AdapterDpc = Adapter->DefaultRecvDpc;
 
-    if(VMQ_ENABLED(Adapter))
+    if(SteeredDpc)
+    {
+        AdapterDpc = SteeredDpc;
+    }
+    else if(VMQ_ENABLED(Adapter))
     {
         //
         // Add Rcb to owner Queue's pending List
@@ -1299,8 +1557,6 @@ Return Value:
 
 {
 
-    ULONG NumNblsReceived = 0;
-    PNET_BUFFER_LIST FirstNbl = NULL, LastNbl = NULL;
     USHORT CurrentQueue;
 
     DEBUGP(MP_TRACE, "[%p] ---> RXReceiveIndicate. Processor: %i, AtDpc: %i\n", Adapter, AdapterDpc->ProcessorNumber, AtDpc);
@@ -1324,129 +1580,63 @@ Return Value:
         //
         if(AdapterDpc->RecvBlock[CurrentQueue])
         {
-            PMP_ADAPTER_RECEIVE_BLOCK ReceiveBlock = &Adapter->ReceiveBlock[CurrentQueue];
-            FirstNbl = LastNbl = NULL;
-
-            //
-            // Collect pending NBLs, indicate up to MaxNblCountPerIndicate per receive block
-            //
-            for(NumNblsReceived=0; NumNblsReceived < AdapterDpc->MaxNblCountPerIndicate; ++NumNblsReceived)
-            {
-                PLIST_ENTRY Entry;
-                PRCB Rcb = NULL;
-
-                Entry = NdisInterlockedRemoveHeadList(&ReceiveBlock->ReceiveList, &ReceiveBlock->ReceiveListLock);
-                if(Entry)
-                {
-                    Rcb = CONTAINING_RECORD(Entry, RCB, RcbLink);
-                }
-
-                if(!Rcb)
-                {
-                    break;
-                }
-
-                ASSERT(Rcb->Data);
-
-                //
-                // The recv NBL's data was filled out by the hardware.  Now just update
-                // its bookkeeping.
-                //
-                NET_BUFFER_LIST_STATUS(Rcb->Nbl) = NDIS_STATUS_SUCCESS;
-                Rcb->Nbl->SourceHandle = Adapter->AdapterHandle;
-
-                //
-                // Add this NBL to the chain of NBLs to indicate up.
-                //
-                if (!FirstNbl)
-                {
-                    LastNbl = FirstNbl = Rcb->Nbl;
-                }
-                else
-                {
-                    NET_BUFFER_LIST_NEXT_NBL(LastNbl) = Rcb->Nbl;
-                    LastNbl = Rcb->Nbl;
-                }
-            }
-
-            //
-            // Indicate NBLs
-            //
-            if (FirstNbl)
-            {
-                DEBUGP(MP_TRACE, "[%p] Receive Block %i: %i frames indicated.\n", Adapter, CurrentQueue, NumNblsReceived);
-
-                NET_BUFFER_LIST_NEXT_NBL(LastNbl) = NULL;
-
-                //
-                // Indicate up the NBLs.
-                //
-                // The NDIS_RECEIVE_FLAGS_DISPATCH_LEVEL allows a perf optimization:
-                // NDIS doesn't have to check and raise the current IRQL, since we
-                // promise that the current IRQL is exactly DISPATCH_LEVEL already.
-                //
-                NdisMIndicateReceiveNetBufferLists(
-                        Adapter->AdapterHandle,
-                        FirstNbl,
-                        0,  // default port
-                        NumNblsReceived,
-                        (AtDpc?NDIS_RECEIVE_FLAGS_DISPATCH_LEVEL:0)
-                        | NDIS_RECEIVE_FLAGS_PERFECT_FILTERED
+            RXIndicateReceiveBlock(
+                    Adapter,
+                    AdapterDpc,
+                    &Adapter->ReceiveBlock[CurrentQueue],
+                    NDIS_RECEIVE_FLAGS_PERFECT_FILTERED
 #if (NDIS_SUPPORT_NDIS620)
-                        | NDIS_RECEIVE_FLAGS_SINGLE_QUEUE
-                        | (CurrentQueue?NDIS_RECEIVE_FLAGS_SHARED_MEMORY_INFO_VALID:0) //non-default queues use shared memory
+                    | NDIS_RECEIVE_FLAGS_SINGLE_QUEUE
+                    | (CurrentQueue?NDIS_RECEIVE_FLAGS_SHARED_MEMORY_INFO_VALID:0) //non-default queues use shared memory
 #endif
-                        );
-            }
-
-            if(!AtDpc)
-            {
-                //
-                // Clear work item flag to allow DPCs to be queued
-                //
-                InterlockedExchange(&AdapterDpc->WorkItemQueued, FALSE);
-            }
-
-            if (!IsListEmpty(&ReceiveBlock->ReceiveList))
-            {
-                //
-                // More left to indicate for this receive block, queue this DPC again
-                //
-                DEBUGP(MP_TRACE, "[%p] Receive Block %i: Requeued DPC.\n", Adapter, CurrentQueue);
-                KeInsertQueueDpc(&AdapterDpc->Dpc, AdapterDpc, NULL);
-            }
-
+                    ,
+                    AtDpc);
         }
 
     }
 
+#if (NDIS_SUPPORT_NDIS680)
+    //
+    // Consume RCBs the RSS indirection table steered to this DPC's processor
+    //
+    if(AdapterDpc->RssReceiveBlock)
+    {
+        RXIndicateReceiveBlock(
+                Adapter,
+                AdapterDpc,
+                AdapterDpc->RssReceiveBlock,
+                NDIS_RECEIVE_FLAGS_PERFECT_FILTERED | NDIS_RECEIVE_FLAGS_SINGLE_QUEUE,
+                AtDpc);
+    }
+#endif
+
     DEBUGP(MP_TRACE, "[%p] <--- RXReceiveIndicate. Processor: %i\n", Adapter, AdapterDpc->ProcessorNumber);
 }
 
-
 VOID
-MPReturnNetBufferLists(
-    _In_  NDIS_HANDLE       MiniportAdapterContext,
-    _In_  PNET_BUFFER_LIST  NetBufferLists,
-    _In_  ULONG             ReturnFlags)
+RXIndicateReceiveBlock(
+    _In_ PMP_ADAPTER Adapter,
+    _In_ PMP_ADAPTER_RECEIVE_DPC AdapterDpc,
+    _In_ PMP_ADAPTER_RECEIVE_BLOCK ReceiveBlock,
+    ULONG ReceiveFlags,
+    BOOLEAN AtDpc)
 /*++
 
 Routine Description:
 
-    NDIS Miniport entry point called whenever protocols are done with one or
-    NBLs that we indicated up with NdisMIndicateReceiveNetBufferLists.
+    This function indicates up to MaxNblCountPerIndicate pending receives of a
+    receive block consumed by the specified RECEIVE_DPC structure, and queues the
+    DPC again if more are pending.
 
-    Note that the list of NBLs may be chained together from multiple separate
-    lists that were indicated up individually.
+    Runs at IRQL <= DISPATCH_LEVEL.
 
 Arguments:
 
-    MiniportAdapterContext      Pointer to our adapter
-    NetBufferLists              NBLs being returned
-    ReturnFlags                 May contain the NDIS_RETURN_FLAGS_DISPATCH_LEVEL
-                                flag, which if is set, indicates we can get a
-                                small perf win by not checking or raising the
-                                IRQL
+    Adapter             Pointer to our adapter
+    AdapterDpc          PMP_ADAPTER_RECEIVE_DPC structure for this receive
+    ReceiveBlock        Receive block to consume
+    ReceiveFlags        NDIS_RECEIVE_FLAGS_XXX for the indication
+    AtDpc               TRUE if the function was called from the context of the DPC, FALSE if called from work item (to avoid watchdog)
 
 Return Value:
 
@@ -1454,41 +1644,857 @@ Return Value:
 
 --*/
 {
-    PMP_ADAPTER Adapter = MP_ADAPTER_FROM_CONTEXT(MiniportAdapterContext);
-    UNREFERENCED_PARAMETER(ReturnFlags);
-
-    DEBUGP(MP_TRACE, "[%p] ---> MPReturnNetBufferLists\n", Adapter);
+    ULONG NumRcbsReceived;
+    ULONG NumNblsReceived = 0;
+    PNET_BUFFER_LIST FirstNbl = NULL, LastNbl = NULL;
+#if (NDIS_SUPPORT_NDIS630)
+    RX_RSC_FLOW Flows[NIC_RSC_MAX_FLOWS];
+    BOOLEAN Coalesce = ((Adapter->fRscIPv4 || Adapter->fRscIPv6) && !VMQ_ENABLED(Adapter));
 
-    while (NetBufferLists)
+    if (Coalesce)
     {
-        PRCB Rcb = RCB_FROM_NBL(NetBufferLists);
-        ReturnRCB(Adapter, Rcb);
-        NetBufferLists = NET_BUFFER_LIST_NEXT_NBL(NetBufferLists);
+        NdisZeroMemory(Flows, sizeof(Flows));
     }
+#endif
 
-    DEBUGP(MP_TRACE, "[%p] <--- MPReturnNetBufferLists\n", Adapter);
-}
-
-VOID
-RXFlushReceiveQueue(
-    _In_ PMP_ADAPTER Adapter,
-    _In_ PMP_ADAPTER_RECEIVE_DPC AdapterDpc)
-/*++
-
-Routine Description:
+    //
+    // Collect pending NBLs, indicate up to MaxNblCountPerIndicate per receive block
+    //
+    for(NumRcbsReceived=0; NumRcbsReceived < AdapterDpc->MaxNblCountPerIndicate; ++NumRcbsReceived)
+    {
+        PLIST_ENTRY Entry;
+        PRCB Rcb = NULL;
 
-    This routine is called by the Halt handler to fail all
-    the queued up RecvNbls if it succeeds in cancelling
-    the RecvIndicate timer DPC.
+        Entry = NdisInterlockedRemoveHeadList(&ReceiveBlock->ReceiveList, &ReceiveBlock->ReceiveListLock);
+        if(Entry)
+        {
+            Rcb = CONTAINING_RECORD(Entry, RCB, RcbLink);
+        }
 
-Arguments:
+        if(!Rcb)
+        {
+            break;
+        }
 
-    Adapter                     Our adapter
-    AdapterDpc                  DPC to be flushed
+        ASSERT(Rcb->Data);
 
-Return Value:
+        //
+        // The recv NBL's data was filled out by the hardware.  Now just update
+        // its bookkeeping.
+        //
+        NET_BUFFER_LIST_STATUS(Rcb->Nbl) = NDIS_STATUS_SUCCESS;
+        Rcb->Nbl->SourceHandle = Adapter->AdapterHandle;
 
-    None.
+#if (NDIS_SUPPORT_NDIS630)
+        //
+        // If the frame's TCP segment was coalesced into the NBL of an earlier
+        // segment, that NBL indicates it.
+        //
+        if (Coalesce && RXRscCoalesceReceive(Adapter, Flows, Rcb, NumRcbsReceived))
+        {
+            continue;
+        }
+#endif
+
+        //
+        // Add this NBL to the chain of NBLs to indicate up.
+        //
+        if (!FirstNbl)
+        {
+            LastNbl = FirstNbl = Rcb->Nbl;
+        }
+        else
+        {
+            NET_BUFFER_LIST_NEXT_NBL(LastNbl) = Rcb->Nbl;
+            LastNbl = Rcb->Nbl;
+        }
+        ++NumNblsReceived;
+    }
+
+#if (NDIS_SUPPORT_NDIS630)
+    //
+    // Flows are not held across indications.  Complete the NBLs of the flows
+    // still open before indicating them.
+    //
+    if (Coalesce)
+    {
+        ULONG Index;
+
+        for (Index = 0; Index < NIC_RSC_MAX_FLOWS; ++Index)
+        {
+            if (Flows[Index].First.Rcb)
+            {
+                RXRscCloseFlow(Adapter, &Flows[Index]);
+            }
+        }
+    }
+#endif
+
+    //
+    // Indicate NBLs
+    //
+    if (FirstNbl)
+    {
+        DEBUGP(MP_TRACE, "[%p] Receive Block %p: %i frames indicated.\n", Adapter, ReceiveBlock, NumNblsReceived);
+
+        NET_BUFFER_LIST_NEXT_NBL(LastNbl) = NULL;
+
+        //
+        // Indicate up the NBLs.
+        //
+        // The NDIS_RECEIVE_FLAGS_DISPATCH_LEVEL allows a perf optimization:
+        // NDIS doesn't have to check and raise the current IRQL, since we
+        // promise that the current IRQL is exactly DISPATCH_LEVEL already.
+        //
+        NdisMIndicateReceiveNetBufferLists(
+                Adapter->AdapterHandle,
+                FirstNbl,
+                0,  // default port
+                NumNblsReceived,
+                (AtDpc?NDIS_RECEIVE_FLAGS_DISPATCH_LEVEL:0)
+                | ReceiveFlags
+                );
+    }
+
+    if(!AtDpc)
+    {
+        //
+        // Clear work item flag to allow DPCs to be queued
+        //
+        InterlockedExchange(&AdapterDpc->WorkItemQueued, FALSE);
+    }
+
+    if (!IsListEmpty(&ReceiveBlock->ReceiveList))
+    {
+        //
+        // More left to indicate for this receive block, queue this DPC again
+        //
+        DEBUGP(MP_TRACE, "[%p] Receive Block %p: Requeued DPC.\n", Adapter, ReceiveBlock);
+        KeInsertQueueDpc(&AdapterDpc->Dpc, AdapterDpc, NULL);
+    }
+}
+
+
+#if (NDIS_SUPPORT_NDIS630)
+
+BOOLEAN
+RXRscParseSegment(
+    _In_  PRCB Rcb,
+    _Out_ PRX_RSC_SEGMENT Segment)
+/*++
+
+Routine Description:
+
+    This function parses the headers of a received frame for receive segment
+    coalescing.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+
+    Rcb                 RCB of the received frame
+    Segment             Receives the frame's TCP segment
+
+Return Value:
+
+    TRUE if the frame holds an unfragmented TCP segment over IPv4 or IPv6,
+    in which case Segment->Coalescible tells whether it may be coalesced.
+
+--*/
+{
+    PFRAME Frame = (PFRAME)Rcb->Data;
+    PUCHAR Data = Frame->Data;
+    ULONG Length = Frame->ulSize;
+    ULONG Offset = FIELD_OFFSET(NIC_FRAME_HEADER, EtherType);
+    ULONG IpHeaderLength;
+    ULONG DatagramLength;
+    ULONG TcpHeaderLength;
+
+    NdisZeroMemory(Segment, sizeof(*Segment));
+
+    //
+    // Only the headers of zero-copy frames are in Data.
+    //
+    if (FRAME_IS_ZERO_COPY(Frame))
+    {
+        Length = min(Length, HW_ZERO_COPY_HEADER_SIZE);
+    }
+
+    if (Length < HW_FRAME_HEADER_SIZE + HW_8021Q_TAG_SIZE)
+    {
+        return FALSE;
+    }
+
+    if (HW_GET_NETWORK_USHORT(Data + Offset) == HW_ETHERTYPE_8021Q)
+    {
+        Offset += HW_8021Q_TAG_SIZE;
+    }
+
+    switch (HW_GET_NETWORK_USHORT(Data + Offset))
+    {
+        case HW_ETHERTYPE_IPV4:
+            Offset += sizeof(USHORT);
+            if (Length < Offset + HW_IPV4_MIN_HEADER_SIZE || (Data[Offset] >> 4) != 4)
+            {
+                return FALSE;
+            }
+
+            IpHeaderLength = (Data[Offset] & 0xF) * 4;
+            if (IpHeaderLength < HW_IPV4_MIN_HEADER_SIZE
+                || Data[Offset + HW_IPV4_PROTOCOL_OFFSET] != HW_IP_PROTOCOL_TCP
+                || (HW_GET_NETWORK_USHORT(Data + Offset + HW_IPV4_FRAGMENT_OFFSET) &
+                    (HW_IPV4_MORE_FRAGMENTS | HW_IPV4_FRAGMENT_OFFSET_MASK)) != 0)
+            {
+                return FALSE;
+            }
+
+            DatagramLength = HW_GET_NETWORK_USHORT(Data + Offset + HW_IPV4_TOTAL_LENGTH_OFFSET);
+
+            //
+            // IP options are not coalesced.
+            //
+            Segment->Coalescible = (IpHeaderLength == HW_IPV4_MIN_HEADER_SIZE);
+            break;
+
+        case HW_ETHERTYPE_IPV6:
+            Offset += sizeof(USHORT);
+            if (Length < Offset + HW_IPV6_HEADER_SIZE
+                || (Data[Offset] >> 4) != 6
+                || Data[Offset + HW_IPV6_NEXT_HEADER_OFFSET] != HW_IP_PROTOCOL_TCP)
+            {
+                return FALSE;
+            }
+
+            IpHeaderLength = HW_IPV6_HEADER_SIZE;
+            DatagramLength = HW_IPV6_HEADER_SIZE + 
+                    HW_GET_NETWORK_USHORT(Data + Offset + HW_IPV6_PAYLOAD_LENGTH_OFFSET);
+
+            Segment->IsIpv6 = TRUE;
+            Segment->Coalescible = TRUE;
+            break;
+
+        default:
+            return FALSE;
+    }
+
+    if (Length < Offset + IpHeaderLength + HW_TCP_MIN_HEADER_SIZE)
+    {
+        return FALSE;
+    }
+
+    Segment->Rcb = Rcb;
+    Segment->Header = Data;
+    Segment->IpOffset = Offset;
+    Segment->TcpOffset = Offset + IpHeaderLength;
+    Segment->Sequence = HW_GET_NETWORK_ULONG(Data + Segment->TcpOffset + HW_TCP_SEQUENCE_OFFSET);
+    Segment->TcpFlags = Data[Segment->TcpOffset + HW_TCP_FLAGS_OFFSET];
+
+    TcpHeaderLength = (Data[Segment->TcpOffset + HW_TCP_HEADER_LENGTH_OFFSET] >> 4) * 4;
+    Segment->HeaderLength = Segment->TcpOffset + TcpHeaderLength;
+
+    //
+    // Only segments carrying data, with no flags other than ACK and PSH, whose
+    // headers fit in the RCB are coalesced.  The payload ends at the end of the
+    // IP datagram, which may be followed by padding.
+    //
+    if (TcpHeaderLength < HW_TCP_MIN_HEADER_SIZE
+        || Segment->HeaderLength > Length
+        || Segment->HeaderLength > RTL_FIELD_SIZE(RCB, RscHeader)
+        || Offset + DatagramLength > Frame->ulSize
+        || Offset + DatagramLength <= Segment->HeaderLength
+        || (Segment->TcpFlags & ~HW_TCP_FLAG_PSH) != HW_TCP_FLAG_ACK)
+    {
+        Segment->Coalescible = FALSE;
+    }
+    else
+    {
+        Segment->PayloadLength = Offset + DatagramLength - Segment->HeaderLength;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+RXRscIsSameFlow(
+    _In_ PRX_RSC_SEGMENT First,
+    _In_ PRX_RSC_SEGMENT Segment)
+/*++
+
+Routine Description:
+
+    This function tells whether two TCP segments have the same addresses and
+    ports.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+
+    First               First segment of a flow
+    Segment             A received segment
+
+Return Value:
+
+    TRUE if the segment belongs to the flow.
+
+--*/
+{
+    ULONG AddressesOffset = First->IsIpv6 ? HW_IPV6_ADDRESSES_OFFSET : HW_IPV4_ADDRESSES_OFFSET;
+    ULONG AddressesLength = First->IsIpv6 ? 2 * HW_IPV6_ADDRESS_SIZE : 2 * HW_IPV4_ADDRESS_SIZE;
+
+    return First->IsIpv6 == Segment->IsIpv6
+        && First->IpOffset == Segment->IpOffset
+        && First->TcpOffset == Segment->TcpOffset
+        && NdisEqualMemory(First->Header + First->TcpOffset, 
+                           Segment->Header + Segment->TcpOffset, 
+                           2 * sizeof(USHORT))
+        && NdisEqualMemory(First->Header + First->IpOffset + AddressesOffset, 
+                           Segment->Header + Segment->IpOffset + AddressesOffset, 
+                           AddressesLength);
+}
+
+BOOLEAN
+RXRscCanCoalesce(
+    _In_ PRX_RSC_FLOW Flow,
+    _In_ PRX_RSC_SEGMENT Segment)
+/*++
+
+Routine Description:
+
+    This function tells whether a segment of a flow can be coalesced with
+    the segments before it: it must be the next one in sequence, and its
+    headers must be the same as the first segment's but for the fields that
+    are updated when the segments are coalesced.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+
+    Flow                The segment's flow
+    Segment             A received segment of the flow
+
+Return Value:
+
+    TRUE if the segment can be coalesced.
+
+--*/
+{
+    PRX_RSC_SEGMENT First = &Flow->First;
+    PUCHAR FirstIp = First->Header + First->IpOffset;
+    PUCHAR SegmentIp = Segment->Header + Segment->IpOffset;
+    BOOLEAN SameIpHeader;
+
+    if (!Segment->Coalescible
+        || Segment->Sequence != Flow->NextSequence
+        || Segment->HeaderLength != First->HeaderLength
+        || NET_BUFFER_LIST_INFO(Segment->Rcb->Nbl, Ieee8021QNetBufferListInfo) != 
+                NET_BUFFER_LIST_INFO(First->Rcb->Nbl, Ieee8021QNetBufferListInfo)
+        || !NdisEqualMemory(First->Header, Segment->Header, First->IpOffset))
+    {
+        return FALSE;
+    }
+
+    //
+    // Version, traffic class and flow label, or version, header length and
+    // type of service; then hop limit or TTL, and the protocol.
+    //
+    if (First->IsIpv6)
+    {
+        SameIpHeader = 
+            NdisEqualMemory(FirstIp, SegmentIp, HW_IPV6_PAYLOAD_LENGTH_OFFSET) &&
+            NdisEqualMemory(FirstIp + HW_IPV6_NEXT_HEADER_OFFSET, SegmentIp + HW_IPV6_NEXT_HEADER_OFFSET, 2);
+    }
+    else
+    {
+        SameIpHeader = 
+            NdisEqualMemory(FirstIp, SegmentIp, HW_IPV4_TOTAL_LENGTH_OFFSET) &&
+            NdisEqualMemory(FirstIp + HW_IPV4_TTL_OFFSET, SegmentIp + HW_IPV4_TTL_OFFSET, 2);
+    }
+
+    //
+    // The TCP options, such as timestamps, must be the same.
+    //
+    return SameIpHeader
+        && NdisEqualMemory(First->Header + First->TcpOffset + HW_TCP_MIN_HEADER_SIZE, 
+                           Segment->Header + Segment->TcpOffset + HW_TCP_MIN_HEADER_SIZE, 
+                           First->HeaderLength - First->TcpOffset - HW_TCP_MIN_HEADER_SIZE);
+}
+
+ULONG
+RXRscChecksumAdd(
+    ULONG Sum,
+    _In_reads_bytes_(Length) PUCHAR Data,
+    ULONG Length)
+/*++
+
+Routine Description:
+
+    This function adds data to an Internet checksum as 16-bit words in
+    network byte order.  Only the last data added may have an odd length.
+
+Arguments:
+
+    Sum                 Checksum so far
+    Data                Data to add
+    Length              Length of the data
+
+Return Value:
+
+    The checksum, to be folded by RXRscChecksumFold.
+
+--*/
+{
+    ULONG Index;
+
+    for (Index = 0; Index + 1 < Length; Index += 2)
+    {
+        Sum += HW_GET_NETWORK_USHORT(Data + Index);
+    }
+
+    if (Index < Length)
+    {
+        Sum += (ULONG)Data[Index] << 8;
+    }
+
+    return Sum;
+}
+
+USHORT
+RXRscChecksumFold(
+    ULONG Sum)
+/*++
+
+Routine Description:
+
+    This function folds a checksum computed by RXRscChecksumAdd to 16 bits.
+
+Arguments:
+
+    Sum                 Checksum
+
+Return Value:
+
+    The folded checksum, which is 0xFFFF if the data added included a valid
+    checksum.
+
+--*/
+{
+    while (Sum >> 16)
+    {
+        Sum = (Sum & 0xFFFF) + (Sum >> 16);
+    }
+
+    return (USHORT)Sum;
+}
+
+BOOLEAN
+RXRscBuildPayloadMdl(
+    _In_ PRX_RSC_SEGMENT Segment)
+/*++
+
+Routine Description:
+
+    This function checks the IP and TCP checksums of a segment, and builds
+    the RscPayloadMdl of its RCB to describe its payload, which must be in a
+    single MDL of the FRAME or, for zero-copy frames, of the sender's NB.
+
+    The checksums are checked here, as the segment is coalesced, because the
+    NBL of coalesced segments is indicated with the checksums succeeded.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+
+    Segment             The segment
+
+Return Value:
+
+    TRUE if the segment's payload is described by its RCB's RscPayloadMdl.
+
+--*/
+{
+    PFRAME Frame = (PFRAME)Segment->Rcb->Data;
+    PUCHAR Header = Segment->Header;
+    PMDL Mdl;
+    ULONG Offset;
+    PUCHAR Payload;
+    ULONG Sum;
+
+    //
+    // Find the MDL with the payload
+    //
+    if (FRAME_IS_ZERO_COPY(Frame))
+    {
+        Mdl = NET_BUFFER_CURRENT_MDL(Frame->SendNetBuffer);
+        Offset = NET_BUFFER_CURRENT_MDL_OFFSET(Frame->SendNetBuffer) + Segment->HeaderLength;
+
+        while (Mdl && Offset >= MmGetMdlByteCount(Mdl))
+        {
+            Offset -= MmGetMdlByteCount(Mdl);
+            Mdl = Mdl->Next;
+        }
+    }
+    else
+    {
+        Mdl = Frame->Mdl;
+        Offset = Segment->HeaderLength;
+    }
+
+    if (!Mdl || Offset + Segment->PayloadLength > MmGetMdlByteCount(Mdl))
+    {
+        return FALSE;
+    }
+
+    Payload = MmGetSystemAddressForMdlSafe(Mdl, LowPagePriority | MdlMappingNoExecute);
+    if (!Payload)
+    {
+        return FALSE;
+    }
+    Payload += Offset;
+
+    //
+    // Check the IPv4 header checksum, then the TCP checksum over the pseudo
+    // header, the TCP header and the payload.
+    //
+    if (Segment->IsIpv6)
+    {
+        Sum = RXRscChecksumAdd(0, Header + Segment->IpOffset + HW_IPV6_ADDRESSES_OFFSET, 2 * HW_IPV6_ADDRESS_SIZE);
+    }
+    else
+    {
+        if (RXRscChecksumFold(RXRscChecksumAdd(0, Header + Segment->IpOffset, HW_IPV4_MIN_HEADER_SIZE)) != 0xFFFF)
+        {
+            return FALSE;
+        }
+
+        Sum = RXRscChecksumAdd(0, Header + Segment->IpOffset + HW_IPV4_ADDRESSES_OFFSET, 2 * HW_IPV4_ADDRESS_SIZE);
+    }
+
+    Sum += HW_IP_PROTOCOL_TCP + (Segment->HeaderLength - Segment->TcpOffset) + Segment->PayloadLength;
+    Sum = RXRscChecksumAdd(Sum, Header + Segment->TcpOffset, Segment->HeaderLength - Segment->TcpOffset);
+    Sum = RXRscChecksumAdd(Sum, Payload, Segment->PayloadLength);
+
+    if (RXRscChecksumFold(Sum) != 0xFFFF)
+    {
+        return FALSE;
+    }
+
+    MmPrepareMdlForReuse(Segment->Rcb->RscPayloadMdl);
+    IoBuildPartialMdl(
+            Mdl,
+            Segment->Rcb->RscPayloadMdl,
+            (PUCHAR)MmGetMdlVirtualAddress(Mdl) + Offset,
+            Segment->PayloadLength);
+
+    return TRUE;
+}
+
+BOOLEAN
+RXRscCoalesceReceive(
+    _In_ PMP_ADAPTER Adapter,
+    _Inout_updates_(NIC_RSC_MAX_FLOWS) PRX_RSC_FLOW Flows,
+    _In_ PRCB Rcb,
+    ULONG Order)
+/*++
+
+Routine Description:
+
+    This function runs a received frame through receive segment coalescing.
+    If it holds the next in-order TCP segment of an open flow, the segment is
+    coalesced into the flow's NBL; otherwise the flow is closed, and a flow is
+    opened for the segment if it can be coalesced with those after it.  When
+    all the flows are in use, the least recently used one is closed.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+
+    Adapter             Pointer to our adapter
+    Flows               Flows of the receive batch
+    Rcb                 RCB of the received frame
+    Order               Order of the frame in the receive batch
+
+Return Value:
+
+    TRUE if the segment was coalesced, and its RCB's NBL must not be indicated.
+
+--*/
+{
+    RX_RSC_SEGMENT Segment;
+    PRX_RSC_FLOW Flow = NULL;
+    PRX_RSC_FLOW FreeFlow = NULL;
+    PRX_RSC_FLOW OldestFlow = NULL;
+    ULONG Index;
+
+    if (!RXRscParseSegment(Rcb, &Segment))
+    {
+        return FALSE;
+    }
+
+    //
+    // Only coalesce for the IP versions the stack has currently enabled.
+    //
+    if (Segment.IsIpv6 ? !Adapter->fRscIPv6 : !Adapter->fRscIPv4)
+    {
+        return FALSE;
+    }
+
+    for (Index = 0; Index < NIC_RSC_MAX_FLOWS; ++Index)
+    {
+        if (!Flows[Index].First.Rcb)
+        {
+            if (!FreeFlow)
+            {
+                FreeFlow = &Flows[Index];
+            }
+        }
+        else if (RXRscIsSameFlow(&Flows[Index].First, &Segment))
+        {
+            Flow = &Flows[Index];
+            break;
+        }
+        else if (!OldestFlow || Flows[Index].LastUsed < OldestFlow->LastUsed)
+        {
+            OldestFlow = &Flows[Index];
+        }
+    }
+
+    if (Flow)
+    {
+        if (Flow->First.HeaderLength - Flow->First.IpOffset + Flow->PayloadLength + Segment.PayloadLength > 
+                NIC_RSC_MAX_DATAGRAM_SIZE)
+        {
+            //
+            // The NBL is full.  Start another with this segment.
+            //
+            RXRscCloseFlow(Adapter, Flow);
+        }
+        else if (RXRscCanCoalesce(Flow, &Segment)
+                 && (Flow->SegmentCount > 1 || RXRscBuildPayloadMdl(&Flow->First))
+                 && RXRscBuildPayloadMdl(&Segment))
+        {
+            Flow->Last->RscNext = Rcb;
+            Flow->Last = Rcb;
+            Flow->LastHeader = Segment.Header;
+            Flow->NextSequence += Segment.PayloadLength;
+            Flow->PayloadLength += Segment.PayloadLength;
+            Flow->SegmentCount++;
+            Flow->LastUsed = Order;
+
+            //
+            // Segments pushed by the sender are indicated without waiting for
+            // more.
+            //
+            if (Segment.TcpFlags & HW_TCP_FLAG_PSH)
+            {
+                RXRscCloseFlow(Adapter, Flow);
+            }
+
+            return TRUE;
+        }
+        else
+        {
+            //
+            // Later segments of the flow must not be indicated before this one.
+            //
+            ++Adapter->RscAborts;
+            RXRscCloseFlow(Adapter, Flow);
+        }
+
+        FreeFlow = Flow;
+    }
+
+    if (!Segment.Coalescible || (Segment.TcpFlags & HW_TCP_FLAG_PSH))
+    {
+        return FALSE;
+    }
+
+    if (!FreeFlow)
+    {
+        _Analysis_assume_(OldestFlow != NULL);
+        RXRscCloseFlow(Adapter, OldestFlow);
+        FreeFlow = OldestFlow;
+    }
+
+    FreeFlow->First = Segment;
+    FreeFlow->Last = Rcb;
+    FreeFlow->LastHeader = Segment.Header;
+    FreeFlow->NextSequence = Segment.Sequence + Segment.PayloadLength;
+    FreeFlow->PayloadLength = Segment.PayloadLength;
+    FreeFlow->SegmentCount = 1;
+    FreeFlow->LastUsed = Order;
+
+    return FALSE;
+}
+
+VOID
+RXRscCloseFlow(
+    _In_ PMP_ADAPTER Adapter,
+    _Inout_ PRX_RSC_FLOW Flow)
+/*++
+
+Routine Description:
+
+    This function closes a flow.  If segments were coalesced, the NBL of its
+    first segment is set to indicate the first segment's headers, updated for
+    the coalesced datagram, followed by the payload of every segment.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+
+    Adapter             Pointer to our adapter
+    Flow                The flow, which is free on return
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PRCB First = Flow->First.Rcb;
+    PUCHAR Header = First->RscHeader;
+    ULONG IpOffset = Flow->First.IpOffset;
+    ULONG TcpOffset = Flow->First.TcpOffset;
+    ULONG HeaderLength = Flow->First.HeaderLength;
+    ULONG DatagramLength = HeaderLength - IpOffset + Flow->PayloadLength;
+    PNET_BUFFER NetBuffer = NET_BUFFER_LIST_FIRST_NB(First->Nbl);
+    NDIS_TCP_IP_CHECKSUM_NET_BUFFER_LIST_INFO ChecksumInfo;
+    PRCB Rcb;
+
+    if (Flow->SegmentCount > 1)
+    {
+        DEBUGP(MP_TRACE, "[%p] Coalesced %i segments, %i bytes into NBL %p\n", 
+                Adapter, Flow->SegmentCount, Flow->PayloadLength, First->Nbl);
+
+        //
+        // The acknowledgement, window and push flag are the last segment's.
+        // The TCP checksum is left as it is; the NBL's checksum information
+        // tells the stack it succeeded for every segment.
+        //
+        NdisMoveMemory(Header, Flow->First.Header, HeaderLength);
+        NdisMoveMemory(Header + TcpOffset + HW_TCP_ACKNOWLEDGEMENT_OFFSET, 
+                       Flow->LastHeader + TcpOffset + HW_TCP_ACKNOWLEDGEMENT_OFFSET, 
+                       sizeof(ULONG));
+        NdisMoveMemory(Header + TcpOffset + HW_TCP_WINDOW_OFFSET, 
+                       Flow->LastHeader + TcpOffset + HW_TCP_WINDOW_OFFSET, 
+                       sizeof(USHORT));
+        Header[TcpOffset + HW_TCP_FLAGS_OFFSET] |= 
+                Flow->LastHeader[TcpOffset + HW_TCP_FLAGS_OFFSET] & HW_TCP_FLAG_PSH;
+
+        if (Flow->First.IsIpv6)
+        {
+            HW_SET_NETWORK_USHORT(Header + IpOffset + HW_IPV6_PAYLOAD_LENGTH_OFFSET, 
+                                  DatagramLength - HW_IPV6_HEADER_SIZE);
+        }
+        else
+        {
+            HW_SET_NETWORK_USHORT(Header + IpOffset + HW_IPV4_TOTAL_LENGTH_OFFSET, DatagramLength);
+            HW_SET_NETWORK_USHORT(Header + IpOffset + HW_IPV4_CHECKSUM_OFFSET, 0);
+            HW_SET_NETWORK_USHORT(Header + IpOffset + HW_IPV4_CHECKSUM_OFFSET, 
+                                  (USHORT)~RXRscChecksumFold(RXRscChecksumAdd(0, Header + IpOffset, HW_IPV4_MIN_HEADER_SIZE)));
+        }
+
+        //
+        // Chain the headers and the payload MDLs of the segments.
+        //
+        NdisAdjustMdlLength(First->RscHeaderMdl, HeaderLength);
+        First->RscHeaderMdl->Next = First->RscPayloadMdl;
+        for (Rcb = First; Rcb->RscNext; Rcb = Rcb->RscNext)
+        {
+            Rcb->RscPayloadMdl->Next = Rcb->RscNext->RscPayloadMdl;
+        }
+        Rcb->RscPayloadMdl->Next = NULL;
+
+        NET_BUFFER_FIRST_MDL(NetBuffer) = First->RscHeaderMdl;
+        NET_BUFFER_DATA_OFFSET(NetBuffer) = 0;
+        NET_BUFFER_DATA_LENGTH(NetBuffer) = HeaderLength + Flow->PayloadLength;
+        NET_BUFFER_CURRENT_MDL(NetBuffer) = First->RscHeaderMdl;
+        NET_BUFFER_CURRENT_MDL_OFFSET(NetBuffer) = 0;
+
+        NET_BUFFER_LIST_COALESCED_SEG_COUNT(First->Nbl) = (USHORT)Flow->SegmentCount;
+        NET_BUFFER_LIST_DUP_ACK_COUNT(First->Nbl) = 0;
+
+        ChecksumInfo.Value = 0;
+        ChecksumInfo.Receive.TcpChecksumSucceeded = 1;
+        ChecksumInfo.Receive.IpChecksumSucceeded = !Flow->First.IsIpv6;
+        NET_BUFFER_LIST_INFO(First->Nbl, TcpIpChecksumNetBufferListInfo) = ChecksumInfo.Value;
+
+        Adapter->RscCoalesceEvents++;
+        Adapter->RscCoalescedPkts += Flow->SegmentCount;
+        Adapter->RscCoalescedOctets += Flow->PayloadLength;
+    }
+
+    Flow->First.Rcb = NULL;
+}
+
+#endif
+
+
+VOID
+MPReturnNetBufferLists(
+    _In_  NDIS_HANDLE       MiniportAdapterContext,
+    _In_  PNET_BUFFER_LIST  NetBufferLists,
+    _In_  ULONG             ReturnFlags)
+/*++
+
+Routine Description:
+
+    NDIS Miniport entry point called whenever protocols are done with one or
+    NBLs that we indicated up with NdisMIndicateReceiveNetBufferLists.
+
+    Note that the list of NBLs may be chained together from multiple separate
+    lists that were indicated up individually.
+
+Arguments:
+
+    MiniportAdapterContext      Pointer to our adapter
+    NetBufferLists              NBLs being returned
+    ReturnFlags                 May contain the NDIS_RETURN_FLAGS_DISPATCH_LEVEL
+                                flag, which if is set, indicates we can get a
+                                small perf win by not checking or raising the
+                                IRQL
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PMP_ADAPTER Adapter = MP_ADAPTER_FROM_CONTEXT(MiniportAdapterContext);
+    UNREFERENCED_PARAMETER(ReturnFlags);
+
+    DEBUGP(MP_TRACE, "[%p] ---> MPReturnNetBufferLists\n", Adapter);
+
+    while (NetBufferLists)
+    {
+        PRCB Rcb = RCB_FROM_NBL(NetBufferLists);
+        ReturnRCB(Adapter, Rcb);
+        NetBufferLists = NET_BUFFER_LIST_NEXT_NBL(NetBufferLists);
+    }
+
+    DEBUGP(MP_TRACE, "[%p] <--- MPReturnNetBufferLists\n", Adapter);
+}
+
+VOID
+RXFlushReceiveQueue(
+    _In_ PMP_ADAPTER Adapter,
+    _In_ PMP_ADAPTER_RECEIVE_DPC AdapterDpc)
+/*++
+
+Routine Description:
+
+    This routine is called by the Halt handler to fail all
+    the queued up RecvNbls if it succeeds in cancelling
+    the RecvIndicate timer DPC.
+
+Arguments:
+
+    Adapter                     Our adapter
+    AdapterDpc                  DPC to be flushed
+
+Return Value:
+
+    None.
 
 --*/
 {
@@ -1511,9 +2517,26 @@ Return Value:
     else
     {
         NICFlushReceiveBlock(Adapter, 0);
-        UNREFERENCED_PARAMETER(AdapterDpc);
     }
 
+#if (NDIS_SUPPORT_NDIS680)
+    //
+    // Flush the receives steered to the DPC's RSS processor
+    //
+    if(AdapterDpc->RssReceiveBlock)
+    {
+        PLIST_ENTRY Entry;
+        PMP_ADAPTER_RECEIVE_BLOCK ReceiveBlock = AdapterDpc->RssReceiveBlock;
+
+        for(Entry = NdisInterlockedRemoveHeadList(&ReceiveBlock->ReceiveList, &ReceiveBlock->ReceiveListLock);
+            Entry;
+            Entry = NdisInterlockedRemoveHeadList(&ReceiveBlock->ReceiveList, &ReceiveBlock->ReceiveListLock))
+        {
+            ReturnRCB(Adapter, CONTAINING_RECORD(Entry, RCB, RcbLink));
+        }
+    }
+#endif
+
     DEBUGP(MP_TRACE, "[%p] <--- RXFlushReceiveQueue\n", Adapter);
 
 }
@@ -71,6 +71,13 @@ Abstract:
 #define HW_MAX_FRAME_SIZE                  (HW_FRAME_HEADER_SIZE + HW_FRAME_MAX_DATA_SIZE)
 #define HW_MIN_FRAME_SIZE                  60
 
+//
+// Frames longer than this are sent without copying their data, when zero-copy
+// send is enabled.  Only their first HW_ZERO_COPY_HEADER_SIZE bytes are copied,
+// which is enough for the Ethernet, VLAN, IP and TCP headers.
+//
+#define HW_ZERO_COPY_HEADER_SIZE           128
+
 typedef struct tagNIC_FRAME_HEADER
 {
     UCHAR  DestAddress[NIC_MACADDR_SIZE];
@@ -82,6 +89,58 @@ C_ASSERT(sizeof(NIC_FRAME_HEADER) == HW_FRAME_HEADER_SIZE);
 
 #define GET_DESTINATION_OF_FRAME(_dest, _frame) NdisMoveMemory(_dest, ((PNIC_FRAME_HEADER)(_frame))->DestAddress, NIC_MACADDR_SIZE)
 
+//
+// Protocol headers the NIC parses in received frames.  Multi-byte fields are
+// in network byte order.
+//
+#define HW_ETHERTYPE_8021Q                 0x8100
+#define HW_ETHERTYPE_IPV4                  0x0800
+#define HW_ETHERTYPE_IPV6                  0x86DD
+#define HW_8021Q_TAG_SIZE                  4
+
+#define HW_IPV4_MIN_HEADER_SIZE            20
+#define HW_IPV4_TOTAL_LENGTH_OFFSET        2
+#define HW_IPV4_TTL_OFFSET                 8
+#define HW_IPV4_PROTOCOL_OFFSET            9
+#define HW_IPV4_CHECKSUM_OFFSET            10
+#define HW_IPV4_FRAGMENT_OFFSET            6
+#define HW_IPV4_ADDRESSES_OFFSET           12
+#define HW_IPV4_ADDRESS_SIZE               4
+#define HW_IPV4_MORE_FRAGMENTS             0x2000
+#define HW_IPV4_FRAGMENT_OFFSET_MASK       0x1FFF
+
+#define HW_IPV6_HEADER_SIZE                40
+#define HW_IPV6_PAYLOAD_LENGTH_OFFSET      4
+#define HW_IPV6_NEXT_HEADER_OFFSET         6
+#define HW_IPV6_ADDRESSES_OFFSET           8
+#define HW_IPV6_ADDRESS_SIZE               16
+
+#define HW_IP_PROTOCOL_TCP                 6
+#define HW_IP_PROTOCOL_UDP                 17
+
+#define HW_TCP_MIN_HEADER_SIZE             20
+#define HW_TCP_SEQUENCE_OFFSET             4
+#define HW_TCP_ACKNOWLEDGEMENT_OFFSET      8
+#define HW_TCP_HEADER_LENGTH_OFFSET        12
+#define HW_TCP_FLAGS_OFFSET                13
+#define HW_TCP_WINDOW_OFFSET               14
+#define HW_TCP_CHECKSUM_OFFSET             16
+
+#define HW_TCP_FLAG_FIN                    0x01
+#define HW_TCP_FLAG_SYN                    0x02
+#define HW_TCP_FLAG_RST                    0x04
+#define HW_TCP_FLAG_PSH                    0x08
+#define HW_TCP_FLAG_ACK                    0x10
+
+#define HW_GET_NETWORK_USHORT(_p) \
+        ((USHORT)((((PUCHAR)(_p))[0] << 8) | ((PUCHAR)(_p))[1]))
+
+#define HW_GET_NETWORK_ULONG(_p) \
+        (((ULONG)HW_GET_NETWORK_USHORT(_p) << 16) | HW_GET_NETWORK_USHORT((PUCHAR)(_p) + 2))
+
+#define HW_SET_NETWORK_USHORT(_p, _v) \
+        (((PUCHAR)(_p))[0] = (UCHAR)((_v) >> 8), ((PUCHAR)(_p))[1] = (UCHAR)(_v))
+
 //
 // Medium properties
 // -----------------------------------------------------------------------------
@@ -125,6 +184,9 @@ C_ASSERT(sizeof(NIC_FRAME_HEADER) == HW_FRAME_HEADER_SIZE);
 
 
 
+// Maximum number of free TCBs or RCBs cached by each processor
+#define NIC_CB_CACHE_DEPTH                 16
+
 // Maximum number of send completes that will be processed per DPC.
 #define NIC_MAX_SENDS_PER_DPC              64
 
@@ -134,6 +196,13 @@ C_ASSERT(sizeof(NIC_FRAME_HEADER) == HW_FRAME_HEADER_SIZE);
 //
 #define NIC_MAX_RECVS_PER_DPC              64
 
+//
+// Receive segment coalescing emulation: the number of TCP flows coalesced at
+// once in a receive DPC, and the largest IP datagram a coalesced NBL may hold.
+//
+#define NIC_RSC_MAX_FLOWS                  8
+#define NIC_RSC_MAX_DATAGRAM_SIZE          0xFFFF
+
 #define NIC_MAX_LOOKAHEAD                  HW_FRAME_MAX_DATA_SIZE
 #define NIC_BUFFER_SIZE                    HW_MAX_FRAME_SIZE
 
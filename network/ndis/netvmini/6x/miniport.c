@@ -56,6 +56,16 @@ static
 VOID
 FreeAdapterListLock();
 
+static
+VOID
+MPHashForwardingEntry(
+    _Inout_ PMP_FORWARDING_ENTRY Entry);
+
+static
+VOID
+MPUnhashForwardingEntry(
+    _Inout_ PMP_FORWARDING_ENTRY Entry);
+
 NDIS_STATUS
 DriverEntry(
     _In_  PVOID DriverObject,
@@ -80,6 +90,7 @@ Arguments:
 {
     NDIS_STATUS Status;
     NDIS_MINIPORT_DRIVER_CHARACTERISTICS MPChar;
+    ULONG i;
 
     WPP_INIT_TRACING(DriverObject,RegistryPath);
 
@@ -100,6 +111,15 @@ Arguments:
         //
         NdisInitializeListHead(&GlobalData.AdapterList);
 
+        //
+        // The ForwardingTable is used to deliver directed frames only to the
+        // adapters that own their destination address.
+        //
+        for (i = 0; i < NIC_FORWARDING_TABLE_SIZE; i++)
+        {
+            NdisInitializeListHead(&GlobalData.ForwardingTable[i]);
+        }
+
 
         //
         // The FrameDataLookaside list is used to help emulate an Ethernet hub.
@@ -345,6 +365,7 @@ MPAttachAdapter(
     _In_  PMP_ADAPTER Adapter)
 {
     MP_LOCK_STATE LockState;    
+    PLIST_ENTRY CurrentEntry;
 
     DEBUGP(MP_TRACE, "[%p] ---> MPAttachAdapter\n", Adapter);
 
@@ -353,6 +374,24 @@ MPAttachAdapter(
     if(!MPIsAdapterAttached(Adapter))
     {
         InsertTailList(&GlobalData.AdapterList, &Adapter->List);
+
+        //
+        // Start forwarding frames sent to the adapter's addresses to it.
+        //
+        NIC_COPY_ADDRESS(Adapter->AddressForwardingEntry.MacAddress, Adapter->CurrentAddress);
+
+        for (
+                CurrentEntry = Adapter->ForwardingEntryList.Flink;
+                CurrentEntry != &Adapter->ForwardingEntryList;
+                CurrentEntry = CurrentEntry->Flink)
+        {
+            MPHashForwardingEntry(CONTAINING_RECORD(CurrentEntry, MP_FORWARDING_ENTRY, AdapterLink));
+        }
+
+        if (Adapter->PacketFilter & NDIS_PACKET_TYPE_PROMISCUOUS)
+        {
+            GlobalData.PromiscuousAdapterCount++;
+        }
     }
 
     UNLOCK_ADAPTER_LIST(&LockState);
@@ -365,6 +404,8 @@ MPDetachAdapter(
     _In_  PMP_ADAPTER Adapter)
 {
     MP_LOCK_STATE LockState;
+    PLIST_ENTRY CurrentEntry;
+
     DEBUGP(MP_TRACE, "[%p] ---> MPDetachAdapter\n", Adapter);
 
     LOCK_ADAPTER_LIST_FOR_WRITE(&LockState, 0);
@@ -372,6 +413,19 @@ MPDetachAdapter(
     if(MPIsAdapterAttached(Adapter))
     {
         RemoveEntryList(&Adapter->List);
+
+        for (
+                CurrentEntry = Adapter->ForwardingEntryList.Flink;
+                CurrentEntry != &Adapter->ForwardingEntryList;
+                CurrentEntry = CurrentEntry->Flink)
+        {
+            MPUnhashForwardingEntry(CONTAINING_RECORD(CurrentEntry, MP_FORWARDING_ENTRY, AdapterLink));
+        }
+
+        if (Adapter->PacketFilter & NDIS_PACKET_TYPE_PROMISCUOUS)
+        {
+            GlobalData.PromiscuousAdapterCount--;
+        }
     }
 
     UNLOCK_ADAPTER_LIST(&LockState);
@@ -379,6 +433,219 @@ MPDetachAdapter(
     DEBUGP(MP_TRACE, "[%p] <--- MPDetachAdapter\n", Adapter);
 }
 
+VOID
+MPHashForwardingEntry(
+    _Inout_ PMP_FORWARDING_ENTRY Entry)
+/*++
+
+Routine Description:
+
+    Inserts a forwarding entry of an attached adapter in the forwarding table.
+
+    The caller holds the adapter list lock for write.
+
+Arguments:
+
+    Entry                       The entry to insert
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ASSERT(!Entry->Hashed);
+
+    InsertTailList(&GlobalData.ForwardingTable[NIC_FORWARDING_HASH(Entry->MacAddress)], &Entry->BucketLink);
+    Entry->Hashed = TRUE;
+}
+
+VOID
+MPUnhashForwardingEntry(
+    _Inout_ PMP_FORWARDING_ENTRY Entry)
+/*++
+
+Routine Description:
+
+    Removes a forwarding entry from the forwarding table, if it is in it.
+
+    The caller holds the adapter list lock for write.
+
+Arguments:
+
+    Entry                       The entry to remove
+
+Return Value:
+
+    None.
+
+--*/
+{
+    if (Entry->Hashed)
+    {
+        RemoveEntryList(&Entry->BucketLink);
+        Entry->Hashed = FALSE;
+    }
+}
+
+VOID
+MPAddForwardingEntry(
+    _In_  PMP_ADAPTER          Adapter,
+    _Inout_ PMP_FORWARDING_ENTRY Entry)
+/*++
+
+Routine Description:
+
+    Adds a forwarding entry to an adapter.  Frames that match it are
+    delivered to the adapter while it is attached.
+
+    Runs at IRQL == PASSIVE_LEVEL.
+
+Arguments:
+
+    Adapter                     Pointer to our adapter
+    Entry                       The entry, with its address and VLAN ID set
+
+Return Value:
+
+    None.
+
+--*/
+{
+    MP_LOCK_STATE LockState;
+
+    DEBUGP(MP_TRACE, "[%p] ---> MPAddForwardingEntry\n", Adapter);
+
+    Entry->Adapter = Adapter;
+    Entry->Hashed = FALSE;
+
+    LOCK_ADAPTER_LIST_FOR_WRITE(&LockState, 0);
+
+    InsertTailList(&Adapter->ForwardingEntryList, &Entry->AdapterLink);
+
+    if(MPIsAdapterAttached(Adapter))
+    {
+        MPHashForwardingEntry(Entry);
+    }
+
+    UNLOCK_ADAPTER_LIST(&LockState);
+
+    DEBUGP(MP_TRACE, "[%p] <--- MPAddForwardingEntry\n", Adapter);
+}
+
+VOID
+MPRemoveForwardingEntry(
+    _In_  PMP_ADAPTER          Adapter,
+    _Inout_ PMP_FORWARDING_ENTRY Entry)
+/*++
+
+Routine Description:
+
+    Removes a forwarding entry added with MPAddForwardingEntry.  Once this
+    returns, no more frames are delivered through the entry.
+
+    Runs at IRQL == PASSIVE_LEVEL.
+
+Arguments:
+
+    Adapter                     Pointer to our adapter
+    Entry                       The entry to remove
+
+Return Value:
+
+    None.
+
+--*/
+{
+    MP_LOCK_STATE LockState;
+
+    DEBUGP(MP_TRACE, "[%p] ---> MPRemoveForwardingEntry\n", Adapter);
+
+    LOCK_ADAPTER_LIST_FOR_WRITE(&LockState, 0);
+
+    RemoveEntryList(&Entry->AdapterLink);
+    MPUnhashForwardingEntry(Entry);
+
+    UNLOCK_ADAPTER_LIST(&LockState);
+
+    DEBUGP(MP_TRACE, "[%p] <--- MPRemoveForwardingEntry\n", Adapter);
+}
+
+BOOLEAN
+MPMatchForwardingEntry(
+    _In_  PMP_FORWARDING_ENTRY Entry,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR DestAddress,
+    _In_  USHORT               VlanId)
+/*++
+
+Routine Description:
+
+    Checks whether a frame matches a forwarding entry.
+
+    Runs at IRQL <= DISPATCH_LEVEL
+
+Arguments:
+
+    Entry                       The entry to check
+    DestAddress                 Destination MAC address of the frame
+    VlanId                      VLAN ID of the frame, 0 if it is untagged
+
+Return Value:
+
+    TRUE if the frame matches the entry.
+
+--*/
+{
+    return (NIC_ADDR_EQUAL(Entry->MacAddress, DestAddress)
+            && (Entry->AnyVlan || Entry->VlanId == VlanId));
+}
+
+VOID
+MPSetPacketFilter(
+    _In_  PMP_ADAPTER          Adapter,
+    _In_  ULONG                PacketFilter)
+/*++
+
+Routine Description:
+
+    Changes the packet filter of an adapter.  Directed frames are offered to
+    every adapter while any attached adapter is promiscuous, so the number of
+    those is updated along with the filter.
+
+    Runs at IRQL == PASSIVE_LEVEL.
+
+Arguments:
+
+    Adapter                     Pointer to our adapter
+    PacketFilter                The new packet filter
+
+Return Value:
+
+    None.
+
+--*/
+{
+    MP_LOCK_STATE LockState;
+
+    LOCK_ADAPTER_LIST_FOR_WRITE(&LockState, 0);
+
+    if(MPIsAdapterAttached(Adapter))
+    {
+        if (PacketFilter & ~Adapter->PacketFilter & NDIS_PACKET_TYPE_PROMISCUOUS)
+        {
+            GlobalData.PromiscuousAdapterCount++;
+        }
+        else if (~PacketFilter & Adapter->PacketFilter & NDIS_PACKET_TYPE_PROMISCUOUS)
+        {
+            GlobalData.PromiscuousAdapterCount--;
+        }
+    }
+
+    Adapter->PacketFilter = PacketFilter;
+
+    UNLOCK_ADAPTER_LIST(&LockState);
+}
+
 
 #if (NDIS_SUPPORT_NDIS620)
 
@@ -586,6 +853,9 @@ DbgPrintOidName(
         MAKECASE(OID_TCP_CONNECTION_OFFLOAD_CURRENT_CONFIG)
         MAKECASE(OID_TCP_CONNECTION_OFFLOAD_HARDWARE_CAPABILITIES)
         MAKECASE(OID_OFFLOAD_ENCAPSULATION)
+#if (NDIS_SUPPORT_NDIS630)
+        MAKECASE(OID_TCP_RSC_STATISTICS)
+#endif
 
 #if (NDIS_SUPPORT_NDIS620)
         /* VMQ OIDs for NDIS 6.20 */
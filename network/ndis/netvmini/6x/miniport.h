@@ -72,6 +72,7 @@ Abstract:
 #define NIC_TAG_FRAME                      ((ULONG)'FMVN')  // NVMF
 #define NIC_TAG_DPC                        ((ULONG)'DMVN')  // NVMD
 #define NIC_TAG_TIMER                      ((ULONG)'tMVN')  // NVMt
+#define NIC_TAG_CB_CACHE                   ((ULONG)'cMVN')  // NVMc
 
 #if (NDIS_SUPPORT_NDIS620)
 
@@ -198,6 +199,49 @@ Abstract:
         NdisReleaseSpinLock(_SpinLock);\
     }
 
+//
+// Number of buckets in the forwarding table.  Must be a power of 2.
+//
+#define NIC_FORWARDING_TABLE_SIZE          64
+
+#define NIC_FORWARDING_HASH(_Address) \
+    (((_Address)[5] ^ ((ULONG)(_Address)[4] << 2) ^ ((ULONG)(_Address)[3] << 4)) & (NIC_FORWARDING_TABLE_SIZE - 1))
+
+//
+// An entry in the forwarding table maps a destination MAC address, and
+// optionally a VLAN ID, to the adapter that receives frames sent to it.  Each
+// adapter has an entry for its own address, and one for each of its VMQ
+// receive filters.
+//
+// The table only narrows down which adapters a directed frame is offered to:
+// the adapter still runs the frame through its own packet filter and VMQ
+// filters, so an entry may match more frames than the adapter accepts, but
+// never fewer.
+//
+typedef struct _MP_FORWARDING_ENTRY
+{
+    //
+    // Link in GlobalData.ForwardingTable, while the adapter is attached
+    //
+    LIST_ENTRY              BucketLink;
+
+    //
+    // Link in the adapter's ForwardingEntryList
+    //
+    LIST_ENTRY              AdapterLink;
+
+    struct _MP_ADAPTER     *Adapter;
+    BOOLEAN                 Hashed;
+
+    //
+    // If AnyVlan is not set, only frames tagged with VlanId (or untagged
+    // frames, if VlanId is 0) match
+    //
+    BOOLEAN                 AnyVlan;
+    USHORT                  VlanId;
+    UCHAR                   MacAddress[NIC_MACADDR_SIZE];
+} MP_FORWARDING_ENTRY, *PMP_FORWARDING_ENTRY;
+
 //
 // The driver has exactly one instance of the MP_GLOBAL structure.  NDIS keeps
 // an opaque handle to this data, (it doesn't attempt to read or interpret this
@@ -212,6 +256,14 @@ typedef struct _MP_GLOBAL
 
     NPAGED_LOOKASIDE_LIST   FrameDataLookaside;
 
+    //
+    // Hash table of MP_FORWARDING_ENTRY of the attached adapters, and the
+    // number of attached adapters in promiscuous mode.  Both are protected
+    // by Lock.
+    //
+    LIST_ENTRY              ForwardingTable[NIC_FORWARDING_TABLE_SIZE];
+    ULONG                   PromiscuousAdapterCount;
+
 #define fGLOBAL_LOCK_ALLOCATED        0x0001
 #define fGLOBAL_LOOKASIDE_INITIALIZED 0x0002
 #define fGLOBAL_MINIPORT_REGISTERED   0x0004
@@ -243,6 +295,27 @@ BOOLEAN
 MPIsAdapterAttached(
     _In_ struct _MP_ADAPTER *Adapter);
 
+VOID
+MPAddForwardingEntry(
+    _In_  struct _MP_ADAPTER   *Adapter,
+    _Inout_ PMP_FORWARDING_ENTRY Entry);
+
+VOID
+MPRemoveForwardingEntry(
+    _In_  struct _MP_ADAPTER   *Adapter,
+    _Inout_ PMP_FORWARDING_ENTRY Entry);
+
+BOOLEAN
+MPMatchForwardingEntry(
+    _In_  PMP_FORWARDING_ENTRY Entry,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR DestAddress,
+    _In_  USHORT               VlanId);
+
+VOID
+MPSetPacketFilter(
+    _In_  struct _MP_ADAPTER   *Adapter,
+    _In_  ULONG                PacketFilter);
+
 
 VOID
 DbgPrintOidName(
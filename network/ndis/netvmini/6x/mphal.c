@@ -437,6 +437,21 @@ Return Value:
     {
         DEBUGP(MP_TRACE, "---> Freeing Frame: %p\n", Frame);
 
+        if (FRAME_IS_ZERO_COPY(Frame))
+        {
+            //
+            // Every receiver is done with the sender's data, so its NBL can
+            // be completed now.
+            //
+            TXNblRelease(
+                    Frame->SendAdapter,
+                    NBL_FROM_SEND_NB(Frame->SendNetBuffer),
+                    NDIS_CURRENT_IRQL() == DISPATCH_LEVEL);
+
+            Frame->SendNetBuffer = NULL;
+            Frame->SendAdapter = NULL;
+        }
+
         NdisFreeToNPagedLookasideList(&GlobalData.FrameDataLookaside, Frame);
         Frame = NULL;
     }
@@ -540,6 +555,85 @@ Notes:
 }
 
 
+NDIS_STATUS
+HWCopyBytesFromFrame(
+    _In_  PFRAME  Frame,
+    _In_  ULONG   Offset,
+    _In_  ULONG   cbDest,
+    _Out_writes_bytes_(cbDest) PVOID Dest)
+/*++
+
+Routine Description:
+
+    Copies cbDest bytes of a FRAME, starting Offset bytes into it.  If the
+    frame was sent without copying it, and the bytes are not all in its
+    header, they are copied from the sender's MDL chain.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+
+    Frame                       The FRAME to read
+    Offset                      Offset of the first byte to copy
+    cbDest                      Number of bytes to copy
+    Dest                        Receives the bytes
+
+Return Value:
+
+    NDIS_STATUS_SUCCESS
+    NDIS_STATUS_RESOURCES if an MDL could not be mapped
+
+--*/
+{
+    PNET_BUFFER NetBuffer = Frame->SendNetBuffer;
+    PMDL CurrentMdl;
+    ULONG MdlOffset;
+    ULONG DestOffset = 0;
+
+    ASSERT(Offset + cbDest <= Frame->ulSize);
+
+    if (!FRAME_IS_ZERO_COPY(Frame) || Offset + cbDest <= HW_ZERO_COPY_HEADER_SIZE)
+    {
+        NdisMoveMemory(Dest, Frame->Data + Offset, cbDest);
+        return NDIS_STATUS_SUCCESS;
+    }
+
+    //
+    // Skip to the MDL that holds the first byte, without mapping the MDLs
+    // before it.
+    //
+    CurrentMdl = NET_BUFFER_CURRENT_MDL(NetBuffer);
+    MdlOffset = NET_BUFFER_CURRENT_MDL_OFFSET(NetBuffer) + Offset;
+    while (CurrentMdl && MdlOffset >= MmGetMdlByteCount(CurrentMdl))
+    {
+        MdlOffset -= MmGetMdlByteCount(CurrentMdl);
+        CurrentMdl = NDIS_MDL_LINKAGE(CurrentMdl);
+    }
+
+    while (DestOffset < cbDest && CurrentMdl)
+    {
+        PUCHAR SrcMemory = MmGetSystemAddressForMdlSafe(CurrentMdl, LowPagePriority | MdlMappingNoExecute);
+        ULONG Length;
+
+        if (!SrcMemory)
+        {
+            return NDIS_STATUS_RESOURCES;
+        }
+
+        Length = min(MmGetMdlByteCount(CurrentMdl) - MdlOffset, cbDest - DestOffset);
+        NdisMoveMemory((PUCHAR)Dest + DestOffset, SrcMemory + MdlOffset, Length);
+        DestOffset += Length;
+
+        MdlOffset = 0;
+        CurrentMdl = NDIS_MDL_LINKAGE(CurrentMdl);
+    }
+
+    ASSERT(DestOffset == cbDest);
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+
 NDIS_STATUS
 HWGetDestinationAddress(
     _In_  PNET_BUFFER  NetBuffer,
@@ -758,7 +852,10 @@ Routine Description:
     anymore.
 
     Our hardware, of course, doesn't have any DMA, so it just copies the data
-    to a FRAME structure and transmits that.
+    to a FRAME structure and transmits that.  If zero-copy send is enabled,
+    only the frame's headers are copied, and the FRAME refers to the NB's
+    MDL chain for the rest: the NB's NBL then holds a reference until the
+    last receiver returns the FRAME.
 
 
     Runs at IRQL <= DISPATCH_LEVEL
@@ -792,6 +889,7 @@ Return Value:
 
         Tcb->NetBuffer = NetBuffer;
         Tcb->BytesActuallySent = 0;
+        Tcb->BytesCopied = 0;
 
         Frame = (PFRAME)NdisAllocateFromNPagedLookasideList(&GlobalData.FrameDataLookaside);
 
@@ -812,17 +910,48 @@ Return Value:
         ASSERT(NET_BUFFER_DATA_LENGTH(NetBuffer) <= NIC_BUFFER_SIZE);
 
         Frame->Ref = 1;
+        Frame->SendNetBuffer = NULL;
+        Frame->SendAdapter = NULL;
 
-        //
-        // Copy the data from the NB to the FRAME's data region.  This step roughly
-        // corresponds to a hardware DMA.
-        //
+        Nbl = NBL_FROM_SEND_NB(NetBuffer);
         Frame->ulSize = min(NET_BUFFER_DATA_LENGTH(NetBuffer), NIC_BUFFER_SIZE);
-        Status = HWCopyBytesFromNetBuffer(NetBuffer, &Frame->ulSize, Frame->Data);
-        if(Status != NDIS_STATUS_SUCCESS)
+
+        if (Adapter->fZeroCopySend
+            && Frame->ulSize > HW_ZERO_COPY_HEADER_SIZE
+            && TXNblReference(Adapter, Nbl) == NDIS_STATUS_SUCCESS)
         {
-            DEBUGP(MP_TRACE, "[%p] ---> Failed to copy frame buffer. Result = %u\n", Adapter, Status);
-            break;
+            //
+            // Copy only the headers, which the receiving adapters filter on.
+            //
+            ULONG cbHeader = HW_ZERO_COPY_HEADER_SIZE;
+
+            Status = HWCopyBytesFromNetBuffer(NetBuffer, &cbHeader, Frame->Data);
+            if(Status != NDIS_STATUS_SUCCESS || cbHeader != HW_ZERO_COPY_HEADER_SIZE)
+            {
+                DEBUGP(MP_TRACE, "[%p] ---> Failed to copy frame header. Result = %u\n", Adapter, Status);
+                TXNblRelease(Adapter, Nbl, fAtDispatch);
+                Status = NDIS_STATUS_FAILURE;
+                break;
+            }
+
+            Frame->SendNetBuffer = NetBuffer;
+            Frame->SendAdapter = Adapter;
+            Tcb->BytesCopied = cbHeader;
+        }
+        else
+        {
+            //
+            // Copy the data from the NB to the FRAME's data region.  This step roughly
+            // corresponds to a hardware DMA.
+            //
+            Status = HWCopyBytesFromNetBuffer(NetBuffer, &Frame->ulSize, Frame->Data);
+            if(Status != NDIS_STATUS_SUCCESS)
+            {
+                DEBUGP(MP_TRACE, "[%p] ---> Failed to copy frame buffer. Result = %u\n", Adapter, Status);
+                break;
+            }
+
+            Tcb->BytesCopied = Frame->ulSize;
         }
 
         if (Frame->ulSize < HW_MIN_FRAME_SIZE)
@@ -844,7 +973,6 @@ Return Value:
         // on receive the adapter should detect if the packet is in 802.1Q format and if so convert it back to 802.3 before indicating it up to NDIS
         // (populating the 8021Q info in the NBL being indicated). 
         //
-        Nbl = NBL_FROM_SEND_NB(NetBuffer);
         Nbl1QInfo.Value = NET_BUFFER_LIST_INFO(Nbl, Ieee8021QNetBufferListInfo);
 
         if(Nbl1QInfo.Value)
@@ -972,6 +1100,10 @@ Return Value:
             Status = CopyFrameToRxQueueRcb(Adapter, Frame, Nbl1QInfo, Rcb, &Copied);
             if(Copied || Status != NDIS_STATUS_SUCCESS)
             {
+                if(Copied)
+                {
+                    Adapter->BytesRxCopied += Frame->ulSize;
+                }
                 break;
             }
         }
@@ -986,11 +1118,24 @@ Return Value:
         HWFrameReference(Frame);
         Rcb->Data = Frame;
 
-        NET_BUFFER_FIRST_MDL(NetBuffer) = Frame->Mdl;
+        if (FRAME_IS_ZERO_COPY(Frame))
+        {
+            //
+            // Indicate the sender's own MDLs.  The FRAME reference keeps them
+            // from being returned to the sender until the NBL is returned.
+            //
+            NET_BUFFER_FIRST_MDL(NetBuffer) = NET_BUFFER_CURRENT_MDL(Frame->SendNetBuffer);
+            NET_BUFFER_DATA_OFFSET(NetBuffer) = NET_BUFFER_CURRENT_MDL_OFFSET(Frame->SendNetBuffer);
+        }
+        else
+        {
+            NET_BUFFER_FIRST_MDL(NetBuffer) = Frame->Mdl;
+            NET_BUFFER_DATA_OFFSET(NetBuffer) = 0;
+        }
+
         NET_BUFFER_DATA_LENGTH(NetBuffer) = Frame->ulSize;
-        NET_BUFFER_DATA_OFFSET(NetBuffer) = 0;
         NET_BUFFER_CURRENT_MDL(NetBuffer) = NET_BUFFER_FIRST_MDL(NetBuffer);
-        NET_BUFFER_CURRENT_MDL_OFFSET(NetBuffer) = 0;
+        NET_BUFFER_CURRENT_MDL_OFFSET(NetBuffer) = NET_BUFFER_DATA_OFFSET(NetBuffer);
     
     }
     while(FALSE);
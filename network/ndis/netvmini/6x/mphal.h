@@ -33,9 +33,21 @@ typedef struct _FRAME
     volatile LONG           Ref;
     PMDL                    Mdl;
     ULONG                   ulSize;
+
+    //
+    // If the frame was sent without copying it, the NB it was sent from and
+    // the adapter that sent it.  Data then only holds the first
+    // HW_ZERO_COPY_HEADER_SIZE bytes of the frame, and the NB's NBL is not
+    // completed until the last reference to the FRAME is released.
+    //
+    PNET_BUFFER             SendNetBuffer;
+    PMP_ADAPTER             SendAdapter;
+
     UCHAR                   Data[NIC_BUFFER_SIZE];
 } FRAME, *PFRAME;
 
+#define FRAME_IS_ZERO_COPY(_Frame) ((_Frame)->SendNetBuffer != NULL)
+
 ALLOCATE_FUNCTION HWFrameAllocate;
 FREE_FUNCTION HWFrameFree;
 
@@ -76,6 +88,13 @@ VOID
 HWFrameRelease(
     _In_  PFRAME  Frame);
 
+NDIS_STATUS
+HWCopyBytesFromFrame(
+    _In_  PFRAME  Frame,
+    _In_  ULONG   Offset,
+    _In_  ULONG   cbDest,
+    _Out_writes_bytes_(cbDest) PVOID Dest);
+
 NDIS_STATUS
 HWInitialize(
     _In_  PMP_ADAPTER Adapter,
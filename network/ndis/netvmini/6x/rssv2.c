@@ -27,6 +27,13 @@ Abstract:
 #define RSSV2_MAX_NUMBER_OF_PROCESSORS_IN_RSS_TABLE 64
 #include "rssv2lib.h"
 
+NDIS_STATUS
+NICSetRSSv2InitializeVPortRSS (
+    _In_ PMP_ADAPTER            Adapter,
+    _Inout_ PMP_ADAPTER_VPORT   VPort,
+    _In_ PROCESSOR_NUMBER       PrimaryProcessor
+    );
+
 VOID
 MiniportApplyMoveITECommandToHW(
     _Inout_ PMP_ADAPTER Adapter,
@@ -63,10 +70,30 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER(Adapter);
-    UNREFERENCED_PARAMETER(VPort);
-    UNREFERENCED_PARAMETER(Command);
-    UNREFERENCED_PARAMETER(NewLocalCpuIndex);
+    PMP_ADAPTER_RSS_STEERING Steering = &Adapter->RSSData.Steering;
+    LOCK_STATE_EX LockState;
+
+    //
+    // Only NativeRSS steers receives; the primary processor is not used
+    // while RSS is enabled.
+    //
+    if (VPort != &Adapter->RSSData.NativeVPort || Steering->Lock == NULL)
+    {
+        return;
+    }
+
+    NdisAcquireRWLockWrite(Steering->Lock, &LockState, 0);
+
+    if ((Command->Flags & NDIS_RSS_SET_INDIRECTION_ENTRY_FLAG_DEFAULT_PROCESSOR) != 0)
+    {
+        Steering->DefaultProcessorIndex = NewLocalCpuIndex;
+    }
+    else if (Command->Flags == 0)
+    {
+        Steering->IndirectionTable[Command->IndirectionTableIndex] = NewLocalCpuIndex;
+    }
+
+    NdisReleaseRWLock(Steering->Lock, &LockState);
 }
 
 VOID
@@ -103,13 +130,483 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER(Adapter);
-    UNREFERENCED_PARAMETER(VPort);
-    UNREFERENCED_PARAMETER(IsRssEnabled);
-    UNREFERENCED_PARAMETER(NewITCount);
+    PMP_ADAPTER_RSS_STEERING Steering = &Adapter->RSSData.Steering;
+    PRSSV2_TOEPLITZ_TABLE ToeplitzTable;
+    BOOLEAN IsKeyChanged;
+    LOCK_STATE_EX LockState;
+
     UNREFERENCED_PARAMETER(NewNumberOfQueues);
+
+    if (VPort != &Adapter->RSSData.NativeVPort || Steering->Lock == NULL)
+    {
+        return;
+    }
+
+    //
+    // Build the table for a new key before taking the lock, so receives are
+    // not held up while it is built.
+    //
+    IsKeyChanged = !RtlEqualMemory(Steering->Key, 
+                                   VPort->RssV2Key, 
+                                   sizeof(Steering->Key));
+    if (IsKeyChanged)
+    {
+        RssV2InitializeToeplitzTable(Steering->SpareToeplitzTable,
+                                     VPort->RssV2Key,
+                                     sizeof(VPort->RssV2Key));
+        NdisMoveMemory(Steering->Key, VPort->RssV2Key, sizeof(Steering->Key));
+    }
+
+    NdisAcquireRWLockWrite(Steering->Lock, &LockState, 0);
+
+    if (IsKeyChanged)
+    {
+        ToeplitzTable = Steering->ToeplitzTable;
+        Steering->ToeplitzTable = Steering->SpareToeplitzTable;
+        Steering->SpareToeplitzTable = ToeplitzTable;
+    }
+
+    Steering->HashInformation = VPort->RssV2Params.HashInformation;
+    Steering->IndirectionTableSize = NewITCount;
+    NdisMoveMemory(Steering->IndirectionTable, VPort->RssV2IndexTable, NewITCount);
+    Steering->DefaultProcessorIndex = VPort->DefaultProcessorIndex;
+    Steering->Enabled = IsRssEnabled;
+
+    NdisReleaseRWLock(Steering->Lock, &LockState);
 }
-    
+
+
+_IRQL_requires_(PASSIVE_LEVEL)
+NDIS_STATUS
+NICRSSv2InitializeSteering(
+    _Inout_ PMP_ADAPTER Adapter
+    )
+/*++
+Routine Description:
+
+    This routine allocates the NativeRSS receive steering state: the lock,
+    the Toeplitz tables, and a receive block and DPC for each RSS processor.
+
+    Receive blocks are only needed when VMQ is disabled, since VMQ queues
+    have their own receive blocks and DPCs.
+
+Arguments:
+
+    Adapter               - Pointer to our adapter
+
+Return Value:
+
+    NDIS_STATUS
+
+--*/
+{
+    PMP_ADAPTER_RSS_STEERING Steering = &Adapter->RSSData.Steering;
+    PMP_ADAPTER_RECEIVE_DPC ReceiveDpc;
+    PROCESSOR_NUMBER ProcessorNumber;
+    ULONG LaneCount;
+    ULONG Lane;
+    NDIS_STATUS Status;
+
+    PAGED_CODE();
+
+    Steering->Lock = NdisAllocateRWLock(Adapter->AdapterHandle);
+    if (Steering->Lock == NULL)
+    {
+        DEBUGP(MP_ERROR, "%s: Failed to allocate the steering lock\n", __FUNCTION__);
+        Status = NDIS_STATUS_RESOURCES;
+        goto Cleanup;
+    }
+
+    //
+    // The tables start zeroed, which is the table for the zeroed key.
+    //
+    Steering->ToeplitzTable = (PRSSV2_TOEPLITZ_TABLE)
+        ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(RSSV2_TOEPLITZ_TABLE), 'HRMT');
+    Steering->SpareToeplitzTable = (PRSSV2_TOEPLITZ_TABLE)
+        ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(RSSV2_TOEPLITZ_TABLE), 'HRMT');
+    if (Steering->ToeplitzTable == NULL || Steering->SpareToeplitzTable == NULL)
+    {
+        DEBUGP(MP_ERROR, "%s: Failed to allocate memory for Toeplitz tables\n", __FUNCTION__);
+        Status = NDIS_STATUS_RESOURCES;
+        goto Cleanup;
+    }
+
+    if (VMQ_ENABLED(Adapter))
+    {
+        Status = NDIS_STATUS_SUCCESS;
+        goto Cleanup;
+    }
+
+    LaneCount = min(Adapter->RSSData.RssProcessorInfo->RssProcessorCount,
+                    RSSV2_MAX_NUMBER_OF_PROCESSORS_IN_RSS_TABLE);
+
+    Steering->ReceiveLaneBlock = (PMP_ADAPTER_RECEIVE_BLOCK)
+        ExAllocatePool2(POOL_FLAG_NON_PAGED, 
+                        LaneCount * sizeof(MP_ADAPTER_RECEIVE_BLOCK), 
+                        'LRMT');
+    if (Steering->ReceiveLaneBlock == NULL)
+    {
+        DEBUGP(MP_ERROR, "%s: Failed to allocate memory for receive lanes\n", __FUNCTION__);
+        Status = NDIS_STATUS_RESOURCES;
+        goto Cleanup;
+    }
+
+    for (Lane = 0; Lane < LaneCount; Lane++)
+    {
+        NdisInitializeListHead(&Steering->ReceiveLaneBlock[Lane].ReceiveList);
+        NdisAllocateSpinLock(&Steering->ReceiveLaneBlock[Lane].ReceiveListLock);
+    }
+    Steering->ReceiveLaneCount = LaneCount;
+
+    for (Lane = 0; Lane < LaneCount; Lane++)
+    {
+        ProcessorNumber = Adapter->RSSData.RssProcessorArray[Lane].ProcNum;
+
+        ReceiveDpc = NICAllocReceiveDpc(Adapter, 
+                                        ProcessorNumber.Number, 
+                                        ProcessorNumber.Group, 
+                                        0);
+        if (ReceiveDpc == NULL)
+        {
+            DEBUGP(MP_ERROR, "%s: Failed to allocate receive DPC for processor %d:%d\n", 
+                        __FUNCTION__, ProcessorNumber.Group, ProcessorNumber.Number);
+            Status = NDIS_STATUS_RESOURCES;
+            goto Cleanup;
+        }
+
+        //
+        // The DPC only consumes the default receive block if it is the
+        // default DPC.
+        //
+        if (ReceiveDpc != Adapter->DefaultRecvDpc)
+        {
+            NICReceiveDpcRemoveOwnership(ReceiveDpc, 0);
+        }
+
+        ReceiveDpc->RssReceiveBlock = &Steering->ReceiveLaneBlock[Lane];
+        Steering->ReceiveLaneDpc[Lane] = ReceiveDpc;
+    }
+
+    Status = NDIS_STATUS_SUCCESS;
+
+Cleanup:
+
+    return Status;
+}
+
+
+_IRQL_requires_(PASSIVE_LEVEL)
+VOID
+FreeRSSConfig(
+    _Inout_ PMP_ADAPTER Adapter
+    )
+/*++
+Routine Description:
+
+    This routine frees the RSS state allocated by InitializeRSSConfig. The
+    receive DPCs are freed with the adapter's other DPCs.
+
+Arguments:
+
+    Adapter               - Pointer to our adapter
+
+Return Value:
+
+    None
+
+--*/
+{
+    PMP_ADAPTER_RSS_STEERING Steering = &Adapter->RSSData.Steering;
+    ULONG Lane;
+
+    PAGED_CODE();
+
+    for (Lane = 0; Lane < Steering->ReceiveLaneCount; Lane++)
+    {
+        ASSERT(IsListEmpty(&Steering->ReceiveLaneBlock[Lane].ReceiveList));
+        NdisFreeSpinLock(&Steering->ReceiveLaneBlock[Lane].ReceiveListLock);
+    }
+    Steering->ReceiveLaneCount = 0;
+
+    if (Steering->ReceiveLaneBlock != NULL)
+    {
+        ExFreePool(Steering->ReceiveLaneBlock);
+        Steering->ReceiveLaneBlock = NULL;
+    }
+
+    if (Steering->ToeplitzTable != NULL)
+    {
+        ExFreePool(Steering->ToeplitzTable);
+        Steering->ToeplitzTable = NULL;
+    }
+
+    if (Steering->SpareToeplitzTable != NULL)
+    {
+        ExFreePool(Steering->SpareToeplitzTable);
+        Steering->SpareToeplitzTable = NULL;
+    }
+
+    if (Steering->Lock != NULL)
+    {
+        NdisFreeRWLock(Steering->Lock);
+        Steering->Lock = NULL;
+    }
+
+    if (Adapter->RSSData.NativeVPort.QueueMap != NULL)
+    {
+        ExFreePool(Adapter->RSSData.NativeVPort.QueueMap);
+        Adapter->RSSData.NativeVPort.QueueMap = NULL;
+    }
+
+    if (Adapter->RSSData.RssProcessorInfo != NULL)
+    {
+        ExFreePool(Adapter->RSSData.RssProcessorInfo);
+        Adapter->RSSData.RssProcessorInfo = NULL;
+        Adapter->RSSData.RssProcessorArray = NULL;
+    }
+}
+
+
+ULONG
+NICRSSv2GetHashInput(
+    _In_ PFRAME Frame,
+    _In_ ULONG HashTypes,
+    _Out_writes_bytes_(RSSV2_TOEPLITZ_MAX_INPUT_LENGTH) PUCHAR HashInput,
+    _Out_ PULONG HashInputLength
+    )
+/*++
+Routine Description:
+
+    This routine parses the headers of a received frame and gathers the
+    fields to hash for the most specific enabled hash type: the source and
+    destination addresses, followed by the source and destination ports for
+    TCP and UDP. IPv4 fragments are hashed on their addresses only.
+
+Arguments:
+
+    Frame                 - Received frame
+
+    HashTypes             - Enabled NDIS_HASH_xxx types
+
+    HashInput             - Receives the fields to hash
+
+    HashInputLength       - Receives the length of the fields
+
+Return Value:
+
+    The NDIS_HASH_xxx type of the fields, or 0 if the frame cannot be hashed.
+
+--*/
+{
+    PUCHAR Data = Frame->Data;
+    ULONG Length = Frame->ulSize;
+    ULONG Offset = FIELD_OFFSET(NIC_FRAME_HEADER, EtherType);
+    ULONG HeaderLength;
+    ULONG AddressLength;
+    ULONG AddressHashType;
+    ULONG Protocol;
+    BOOLEAN HasPorts;
+    ULONG HashType = 0;
+
+    *HashInputLength = 0;
+
+    //
+    // Only the headers of zero-copy frames are in Data.
+    //
+    if (FRAME_IS_ZERO_COPY(Frame))
+    {
+        Length = min(Length, HW_ZERO_COPY_HEADER_SIZE);
+    }
+
+    if (Length < HW_FRAME_HEADER_SIZE + HW_8021Q_TAG_SIZE)
+    {
+        return 0;
+    }
+
+    if (HW_GET_NETWORK_USHORT(Data + Offset) == HW_ETHERTYPE_8021Q)
+    {
+        Offset += HW_8021Q_TAG_SIZE;
+    }
+
+    switch (HW_GET_NETWORK_USHORT(Data + Offset))
+    {
+        case HW_ETHERTYPE_IPV4:
+            Offset += sizeof(USHORT);
+            if (Length < Offset + HW_IPV4_MIN_HEADER_SIZE || (Data[Offset] >> 4) != 4)
+            {
+                return 0;
+            }
+
+            HeaderLength = (Data[Offset] & 0xF) * 4;
+            if (HeaderLength < HW_IPV4_MIN_HEADER_SIZE)
+            {
+                return 0;
+            }
+
+            Protocol = Data[Offset + HW_IPV4_PROTOCOL_OFFSET];
+            HasPorts = 
+                (HW_GET_NETWORK_USHORT(Data + Offset + HW_IPV4_FRAGMENT_OFFSET) & 
+                 (HW_IPV4_MORE_FRAGMENTS | HW_IPV4_FRAGMENT_OFFSET_MASK)) == 0;
+
+            AddressLength = 2 * HW_IPV4_ADDRESS_SIZE;
+            AddressHashType = NDIS_HASH_IPV4;
+            NdisMoveMemory(HashInput, Data + Offset + HW_IPV4_ADDRESSES_OFFSET, AddressLength);
+
+            if (Protocol == HW_IP_PROTOCOL_TCP && (HashTypes & NDIS_HASH_TCP_IPV4))
+            {
+                HashType = NDIS_HASH_TCP_IPV4;
+            }
+            else if (Protocol == HW_IP_PROTOCOL_UDP && (HashTypes & NDIS_HASH_UDP_IPV4))
+            {
+                HashType = NDIS_HASH_UDP_IPV4;
+            }
+            break;
+
+        case HW_ETHERTYPE_IPV6:
+            Offset += sizeof(USHORT);
+            if (Length < Offset + HW_IPV6_HEADER_SIZE || (Data[Offset] >> 4) != 6)
+            {
+                return 0;
+            }
+
+            HeaderLength = HW_IPV6_HEADER_SIZE;
+            Protocol = Data[Offset + HW_IPV6_NEXT_HEADER_OFFSET];
+            HasPorts = TRUE;
+
+            AddressLength = 2 * HW_IPV6_ADDRESS_SIZE;
+            AddressHashType = NDIS_HASH_IPV6;
+            NdisMoveMemory(HashInput, Data + Offset + HW_IPV6_ADDRESSES_OFFSET, AddressLength);
+
+            if (Protocol == HW_IP_PROTOCOL_TCP && (HashTypes & NDIS_HASH_TCP_IPV6))
+            {
+                HashType = NDIS_HASH_TCP_IPV6;
+            }
+            else if (Protocol == HW_IP_PROTOCOL_UDP && (HashTypes & NDIS_HASH_UDP_IPV6))
+            {
+                HashType = NDIS_HASH_UDP_IPV6;
+            }
+            break;
+
+        default:
+            return 0;
+    }
+
+    //
+    // Fall back to the addresses if the ports are not available.
+    //
+    if (HashType != 0 && 
+        (!HasPorts || Length < Offset + HeaderLength + 2 * sizeof(USHORT)))
+    {
+        HashType = 0;
+    }
+
+    if (HashType != 0)
+    {
+        NdisMoveMemory(HashInput + AddressLength, 
+                       Data + Offset + HeaderLength, 
+                       2 * sizeof(USHORT));
+        *HashInputLength = AddressLength + 2 * sizeof(USHORT);
+    }
+    else if ((HashTypes & AddressHashType) != 0)
+    {
+        HashType = AddressHashType;
+        *HashInputLength = AddressLength;
+    }
+
+    return HashType;
+}
+
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+PMP_ADAPTER_RECEIVE_DPC
+NICRSSv2SteerReceive(
+    _In_ PMP_ADAPTER        Adapter,
+    _In_ PFRAME             Frame,
+    _In_ PNET_BUFFER_LIST   Nbl
+    )
+/*++
+Routine Description:
+
+    This routine hashes a received frame and looks up the RSS processor the
+    indirection table steers it to. The hash is set on the receive NBL.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+
+    Adapter               - Pointer to our adapter
+
+    Frame                 - Received frame
+
+    Nbl                   - NBL the frame is indicated in
+
+Return Value:
+
+    The receive DPC of the processor, whose RssReceiveBlock the frame should
+    be queued on, or NULL if RSS is not steering receives.
+
+--*/
+{
+    PMP_ADAPTER_RSS_STEERING Steering = &Adapter->RSSData.Steering;
+    PMP_ADAPTER_RECEIVE_DPC ReceiveDpc = NULL;
+    UCHAR HashInput[RSSV2_TOEPLITZ_MAX_INPUT_LENGTH];
+    ULONG HashInputLength;
+    ULONG HashType;
+    ULONG HashValue;
+    UINT8 CpuIndex;
+    LOCK_STATE_EX LockState;
+
+    //
+    // The NBL is reused, clear the hash of its previous receive.
+    //
+    NET_BUFFER_LIST_INFO(Nbl, NetBufferListHashValue) = 0;
+    NET_BUFFER_LIST_INFO(Nbl, NetBufferListHashInfo) = 0;
+
+    if (Steering->ReceiveLaneCount == 0)
+    {
+        return NULL;
+    }
+
+    NdisAcquireRWLockRead(Steering->Lock, &LockState, 0);
+
+    if (Steering->Enabled)
+    {
+        CpuIndex = Steering->DefaultProcessorIndex;
+
+        HashType = NICRSSv2GetHashInput(Frame,
+                                        NDIS_RSS_HASH_TYPE_FROM_HASH_INFO(Steering->HashInformation),
+                                        HashInput,
+                                        &HashInputLength);
+        if (HashType != 0)
+        {
+            HashValue = RssV2ComputeToeplitzHash(Steering->ToeplitzTable, 
+                                                 HashInput, 
+                                                 HashInputLength);
+
+            NET_BUFFER_LIST_SET_HASH_VALUE(Nbl, HashValue);
+            NET_BUFFER_LIST_SET_HASH_TYPE(Nbl, HashType);
+            NET_BUFFER_LIST_SET_HASH_FUNCTION(Nbl, NdisHashFunctionToeplitz);
+
+            if (Steering->IndirectionTableSize != 0)
+            {
+                //
+                // The indirection table size is a power of 2.
+                //
+                CpuIndex = Steering->IndirectionTable[HashValue & (Steering->IndirectionTableSize - 1)];
+            }
+        }
+
+        if (CpuIndex < Steering->ReceiveLaneCount)
+        {
+            ReceiveDpc = Steering->ReceiveLaneDpc[CpuIndex];
+        }
+    }
+
+    NdisReleaseRWLock(Steering->Lock, &LockState);
+
+    return ReceiveDpc;
+}
+
 
 _IRQL_requires_(PASSIVE_LEVEL)
 NDIS_STATUS
@@ -177,7 +674,25 @@ Return Value:
         ((PUCHAR)Adapter->RSSData.RssProcessorInfo + 
          Adapter->RSSData.RssProcessorInfo->RssProcessorArrayOffset);
 
-    Status = NDIS_STATUS_SUCCESS;
+    if (Adapter->RSSData.RssProcessorInfo->RssProcessorCount == 0)
+    {
+        Status = NDIS_STATUS_SUCCESS;
+        goto Cleanup;
+    }
+
+    //
+    // NativeRSS starts disabled, with the first RSS processor as primary.
+    //
+    Status = NICSetRSSv2InitializeVPortRSS(Adapter,
+                                           &Adapter->RSSData.NativeVPort,
+                                           Adapter->RSSData.RssProcessorArray[0].ProcNum);
+    if (Status != NDIS_STATUS_SUCCESS)
+    {
+        DEBUGP(MP_ERROR, "%s: Unable to initialize NativeRSS\n", __FUNCTION__);
+        goto Cleanup;
+    }
+
+    Status = NICRSSv2InitializeSteering(Adapter);
 
 Cleanup:
 
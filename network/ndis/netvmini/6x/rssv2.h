@@ -36,6 +36,7 @@ Revision History:
 #define RSSV2_MAX_NUMBER_OF_PROCESSORS_IN_RSS_TABLE 64
 
 typedef struct _RSSV2_QUEUE_MAP* PRSSV2_QUEUE_MAP;
+typedef struct _RSSV2_TOEPLITZ_TABLE* PRSSV2_TOEPLITZ_TABLE;
 typedef struct _MP_ADAPTER_VPORT
 {
     //
@@ -85,6 +86,44 @@ typedef struct _MP_ADAPTER_VPORT
 
 } MP_ADAPTER_VPORT, *PMP_ADAPTER_VPORT;
 
+//
+// The receive steering state programmed into the "hardware" for NativeRSS.
+// Received frames are Toeplitz-hashed, and the low bits of the hash select
+// the indirection table entry whose processor indicates the frame.  Frames
+// that cannot be hashed go to the default processor.
+//
+typedef struct _MP_ADAPTER_RSS_STEERING
+{
+    //
+    // Taken for read by the receive path, and for write when the
+    // configuration or an indirection table entry is applied to the HW.
+    //
+    PNDIS_RW_LOCK_EX            Lock;
+
+    BOOLEAN                     Enabled;
+    ULONG                       HashInformation;
+    ULONG                       IndirectionTableSize;
+    UINT8                       DefaultProcessorIndex;
+    UINT8                       IndirectionTable[MAX_NUMBER_OF_INDIRECTION_TABLE_ENTRIES];
+
+    //
+    // Key the Toeplitz table was built for.  A new table is built in the
+    // spare one and the two are swapped under the lock.
+    //
+    UCHAR                       Key[NDIS_RSS_HASH_SECRET_KEY_MAX_SIZE_REVISION_2];
+    PRSSV2_TOEPLITZ_TABLE       ToeplitzTable;
+    PRSSV2_TOEPLITZ_TABLE       SpareToeplitzTable;
+
+    //
+    // One receive block per RSS processor (indexed by local CPU index), and
+    // the receive DPC targeted at the processor that consumes it.
+    //
+    ULONG                               ReceiveLaneCount;
+    struct _MP_ADAPTER_RECEIVE_BLOCK*   ReceiveLaneBlock;
+    struct _MP_ADAPTER_RECEIVE_DPC*     ReceiveLaneDpc[RSSV2_MAX_NUMBER_OF_PROCESSORS_IN_RSS_TABLE];
+
+} MP_ADAPTER_RSS_STEERING, *PMP_ADAPTER_RSS_STEERING;
+
 //
 // The MP_ADAPTER_RSS_DATA structure is used to track RSS state
 //
@@ -111,6 +150,11 @@ typedef struct _MP_ADAPTER_RSS_DATA
     //
     MP_ADAPTER_VPORT            VPort[MAX_NIC_SWITCH_VPORTS];
 
+    //
+    // Receive steering for NativeRSS
+    //
+    MP_ADAPTER_RSS_STEERING     Steering;
+
 } MP_ADAPTER_RSS_DATA, *PMP_ADAPTER_RSS_DATA;
 
 
@@ -120,6 +164,20 @@ InitializeRSSConfig(
     _Inout_ struct _MP_ADAPTER* Adapter
     );
 
+_IRQL_requires_(PASSIVE_LEVEL)
+VOID
+FreeRSSConfig(
+    _Inout_ struct _MP_ADAPTER* Adapter
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+struct _MP_ADAPTER_RECEIVE_DPC*
+NICRSSv2SteerReceive(
+    _In_ struct _MP_ADAPTER*    Adapter,
+    _In_ struct _FRAME*         Frame,
+    _In_ PNET_BUFFER_LIST       Nbl
+    );
+
 _IRQL_requires_(PASSIVE_LEVEL)
 NDIS_STATUS
 NICSetRSSv2Parameters(
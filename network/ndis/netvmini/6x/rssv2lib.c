@@ -280,6 +280,120 @@ Return Value:
 }
 
 
+VOID
+RssV2InitializeToeplitzTable (
+    _Out_ PRSSV2_TOEPLITZ_TABLE ToeplitzTable,
+    _In_reads_bytes_(KeySize) CONST UCHAR* Key,
+    _In_ ULONG KeySize
+    )
+/*++
+Routine Description:
+
+    This routine builds the Toeplitz lookup table for a secret key.
+
+    Entry [i][v] is the hash contribution of value v in input byte i: the
+    XOR of the 32-bit key windows starting at the bit position of each set
+    bit of v, most significant bit first.
+
+Arguments:
+
+    ToeplitzTable - Table to build
+
+    Key - Secret hash key
+
+    KeySize - Size of the key in bytes. Key bytes past its end are zero.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG byteIndex;
+    ULONG bit;
+    ULONG keyIndex;
+    ULONG value;
+    ULONG lowBit;
+    ULONG64 keyBits;
+    ULONG window[8];
+
+    for (byteIndex = 0; byteIndex < RSSV2_TOEPLITZ_MAX_INPUT_LENGTH; byteIndex++)
+    {
+        //
+        // Load the 40 key bits that cover the windows of all eight bits of
+        // this input byte.
+        //
+        keyBits = 0;
+        for (keyIndex = byteIndex; keyIndex < byteIndex + 5; keyIndex++)
+        {
+            keyBits = (keyBits << 8) | ((keyIndex < KeySize) ? Key[keyIndex] : 0);
+        }
+
+        for (bit = 0; bit < 8; bit++)
+        {
+            window[bit] = (ULONG)(keyBits >> (8 - bit));
+        }
+
+        //
+        // Each value is a smaller value (itself without its lowest set bit)
+        // plus the window of that bit.
+        //
+        ToeplitzTable->Table[byteIndex][0] = 0;
+
+        for (value = 1; value < 256; value++)
+        {
+            for (lowBit = 0; (value & (1 << lowBit)) == 0; lowBit++)
+            {
+                NOTHING;
+            }
+
+            ToeplitzTable->Table[byteIndex][value] =
+                ToeplitzTable->Table[byteIndex][value & (value - 1)] ^ window[7 - lowBit];
+        }
+    }
+}
+
+
+ULONG
+RssV2ComputeToeplitzHash (
+    _In_ CONST RSSV2_TOEPLITZ_TABLE* ToeplitzTable,
+    _In_reads_bytes_(Length) CONST UCHAR* Input,
+    _In_range_(0, RSSV2_TOEPLITZ_MAX_INPUT_LENGTH) ULONG Length
+    )
+/*++
+Routine Description:
+
+    This routine computes the Toeplitz hash of the input with the key the
+    table was built for.
+
+Arguments:
+
+    ToeplitzTable - Table built by RssV2InitializeToeplitzTable
+
+    Input - Input to hash, in network byte order
+
+    Length - Length of the input in bytes
+
+Return Value:
+
+    32-bit hash value.
+
+--*/
+{
+    ULONG hash = 0;
+    ULONG index;
+
+    ASSERT(Length <= RSSV2_TOEPLITZ_MAX_INPUT_LENGTH);
+
+    for (index = 0; index < Length; index++)
+    {
+        hash ^= ToeplitzTable->Table[index][Input[index]];
+    }
+
+    return hash;
+}
+
+
 FORCEINLINE
 PULONG_PTR
 RssV2NQEnforcerGetBitfield (
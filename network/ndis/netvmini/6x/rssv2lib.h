@@ -89,6 +89,42 @@ RssV2SetCommandRangeStatus (
     _In_ NDIS_STATUS Status
     );
 
+//
+// Table-driven Toeplitz hash.
+//
+// The hash of an input is the XOR, over every set bit of the input, of the
+// 32 bits of the secret key starting at that bit's position.  The table holds
+// that XOR precomputed for every value of every input byte, so hashing costs
+// one lookup per input byte.  It is rebuilt whenever the key changes.
+//
+// The longest input hashed is the IPv6 source and destination addresses
+// followed by the source and destination ports.
+//
+#define RSSV2_TOEPLITZ_MAX_INPUT_LENGTH     36
+
+C_ASSERT(RSSV2_TOEPLITZ_MAX_INPUT_LENGTH * 8 + 32 <=
+         NDIS_RSS_HASH_SECRET_KEY_MAX_SIZE_REVISION_2 * 8);
+
+typedef struct _RSSV2_TOEPLITZ_TABLE
+{
+    ULONG Table[RSSV2_TOEPLITZ_MAX_INPUT_LENGTH][256];
+
+} RSSV2_TOEPLITZ_TABLE, *PRSSV2_TOEPLITZ_TABLE;
+
+VOID
+RssV2InitializeToeplitzTable (
+    _Out_ PRSSV2_TOEPLITZ_TABLE ToeplitzTable,
+    _In_reads_bytes_(KeySize) CONST UCHAR* Key,
+    _In_ ULONG KeySize
+    );
+
+ULONG
+RssV2ComputeToeplitzHash (
+    _In_ CONST RSSV2_TOEPLITZ_TABLE* ToeplitzTable,
+    _In_reads_bytes_(Length) CONST UCHAR* Input,
+    _In_range_(0, RSSV2_TOEPLITZ_MAX_INPUT_LENGTH) ULONG Length
+    );
+
 //
 // Conditionally include support for example RSSV2_QUEUE_MAP implementation.
 // Miniports don't have to use this implementation (as they may have different
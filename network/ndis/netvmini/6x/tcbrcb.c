@@ -36,6 +36,53 @@ Notes:
 #include "tcbrcb.tmh"
 
 
+//
+// Index of the current processor, used to pick its control block cache.
+//
+#if (NDIS_SUPPORT_NDIS620)
+#define NIC_CURRENT_PROCESSOR_INDEX()   KeGetCurrentProcessorNumberEx(NULL)
+#define NIC_MAX_PROCESSOR_COUNT()       KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS)
+#else
+#define NIC_CURRENT_PROCESSOR_INDEX()   KeGetCurrentProcessorNumber()
+#define NIC_MAX_PROCESSOR_COUNT()       ((ULONG)NdisSystemProcessorCount())
+#endif
+
+
+_Must_inspect_result_
+_Success_(return != NULL)
+PTCB
+GetTCB(
+    _In_  PMP_ADAPTER  Adapter)
+/*++
+
+Routine Description:
+
+    This routine gets an unused TCB from the pool.
+
+    Runs at IRQL <= DISPATCH_LEVEL
+
+Arguments:
+
+    Adapter                     The sending adapter
+
+Return Value:
+
+    NULL if all the TCBs are in use.
+    Else, a pointer to an unused TCB.
+
+--*/
+{
+    PSLIST_ENTRY pEntry = NICCbPoolPop(&Adapter->TcbPool);
+
+    if (!pEntry)
+    {
+        return NULL;
+    }
+
+    return CONTAINING_RECORD(pEntry, TCB, CbLink);
+}
+
+
 VOID
 ReturnTCB(
     _In_  PMP_ADAPTER  Adapter,
@@ -44,10 +91,7 @@ ReturnTCB(
     TXNblRelease(Adapter, NBL_FROM_SEND_NB(Tcb->NetBuffer), TRUE);
     Tcb->NetBuffer = NULL;
 
-    NdisInterlockedInsertTailList(
-            &Adapter->FreeTcbList,
-            &Tcb->TcbLink,
-            &Adapter->FreeTcbListLock);
+    NICCbPoolPush(&Adapter->TcbPool, &Tcb->CbLink);
 }
 
 
@@ -97,12 +141,10 @@ Return Value:
         //
         // Retrieve the RCB from the global RCB pool
         //
-        PLIST_ENTRY pEntry = NdisInterlockedRemoveHeadList(
-                &Adapter->FreeRcbList,
-                &Adapter->FreeRcbListLock);
+        PSLIST_ENTRY pEntry = NICCbPoolPop(&Adapter->RcbPool);
         if (pEntry)
         {
-            Rcb = CONTAINING_RECORD(pEntry, RCB, RcbLink);
+            Rcb = CONTAINING_RECORD(pEntry, RCB, CbLink);
             //
             // Receiving on the default receive queue, increment its pending count
             //
@@ -113,10 +155,7 @@ Return Value:
                 // The adapter is no longer in a ready state, so we were not able to take a reference on the
                 // receive block. Add the RCB back to the free list and fail this receive. 
                 //
-                NdisInterlockedInsertTailList(
-                    &Adapter->FreeRcbList,
-                    &Rcb->RcbLink,
-                    &Adapter->FreeRcbListLock);
+                NICCbPoolPush(&Adapter->RcbPool, &Rcb->CbLink);
                 Rcb = NULL;
             }
         }
@@ -190,6 +229,30 @@ Return Value:
 
     DEBUGP(MP_TRACE, "[%p] ---> ReturnRCB. RCB: %p\n", Adapter, Rcb);
 
+#if (NDIS_SUPPORT_NDIS630)
+    //
+    // If other segments were coalesced into this RCB's NBL, return their RCBs
+    // too, and clear the coalescing information before the NBL is reused.
+    //
+    if(Rcb->RscNext)
+    {
+        PRCB Coalesced = Rcb->RscNext;
+
+        NET_BUFFER_LIST_INFO(Rcb->Nbl, TcpRecvSegCoalesceInfo) = NULL;
+        NET_BUFFER_LIST_INFO(Rcb->Nbl, TcpIpChecksumNetBufferListInfo) = NULL;
+        Rcb->RscNext = NULL;
+
+        while(Coalesced)
+        {
+            PRCB Next = Coalesced->RscNext;
+
+            Coalesced->RscNext = NULL;
+            ReturnRCB(Adapter, Coalesced);
+            Coalesced = Next;
+        }
+    }
+#endif
+
     if(VMQ_ENABLED(Adapter))
     {
         //
@@ -202,10 +265,7 @@ Return Value:
         //
         // Recover RCB to global RCB pool
         //
-        NdisInterlockedInsertTailList(
-                &Adapter->FreeRcbList,
-                &Rcb->RcbLink,
-                &Adapter->FreeRcbListLock);
+        NICCbPoolPush(&Adapter->RcbPool, &Rcb->CbLink);
         Rcb = NULL;
         //
         // We receive on the default receive queue, decrement its pending count
@@ -218,4 +278,323 @@ Return Value:
 
 }
 
+#if (NDIS_SUPPORT_NDIS630)
+
+NDIS_STATUS
+NICAllocRcbRscMdls(
+    _In_  PMP_ADAPTER   Adapter,
+    _Inout_ PRCB        Rcb)
+/*++
+
+Routine Description:
+
+    This routine allocates the MDLs an RCB needs to indicate coalesced TCP
+    segments: one describing its copy of the segment headers, and one that is
+    built to describe the payload of its segment.
+
+    IRQL = PASSIVE_LEVEL
+
+Arguments:
+
+    Adapter     - The receiving adapter (the one that owns the RCB).
+    Rcb         - The RCB.
+
+Return Value:
+
+    NDIS_STATUS_SUCCESS or NDIS_STATUS_RESOURCES.  On failure, the RCB's
+    MDLs are freed with NICFreeRcbRscMdls.
+
+--*/
+{
+    //
+    // The payload of a frame spans at most two pages.
+    //
+    C_ASSERT(HW_FRAME_MAX_DATA_SIZE <= PAGE_SIZE);
+
+    Rcb->RscHeaderMdl = NdisAllocateMdl(
+            Adapter->AdapterHandle,
+            Rcb->RscHeader,
+            sizeof(Rcb->RscHeader));
+
+    Rcb->RscPayloadMdl = IoAllocateMdl(
+            NULL,
+            2 * PAGE_SIZE,
+            FALSE,
+            FALSE,
+            NULL);
+
+    if (!Rcb->RscHeaderMdl || !Rcb->RscPayloadMdl)
+    {
+        DEBUGP(MP_ERROR, "[%p] Failed to allocate the RSC MDLs of RCB %p\n", Adapter, Rcb);
+        NICFreeRcbRscMdls(Rcb);
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+
+VOID
+NICFreeRcbRscMdls(
+    _Inout_ PRCB        Rcb)
+/*++
+
+Routine Description:
+
+    This routine frees the MDLs allocated by NICAllocRcbRscMdls, if any.
+
+Arguments:
+
+    Rcb         - The RCB, which must not be indicated.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    if (Rcb->RscHeaderMdl)
+    {
+        NdisFreeMdl(Rcb->RscHeaderMdl);
+        Rcb->RscHeaderMdl = NULL;
+    }
+
+    if (Rcb->RscPayloadMdl)
+    {
+        IoFreeMdl(Rcb->RscPayloadMdl);
+        Rcb->RscPayloadMdl = NULL;
+    }
+}
+
+#endif
+
+
+NDIS_STATUS
+NICInitializeCbPool(
+    _In_  PMP_ADAPTER  Adapter,
+    _Out_ PMP_CB_POOL  Pool,
+    _In_  ULONG        NumberOfCbs)
+/*++
+
+Routine Description:
+
+    This routine initializes an empty control block pool, with a cache for
+    each processor that can be present in the system.
+
+    Runs at IRQL = PASSIVE_LEVEL
+
+Arguments:
+
+    Adapter                     The adapter that owns the pool
+    Pool                        The pool to initialize
+    NumberOfCbs                 The number of control blocks that will be
+                                added to the pool
+
+Return Value:
+
+    NDIS_STATUS_xxx code
+
+--*/
+{
+    ULONG CacheCount = NIC_MAX_PROCESSOR_COUNT();
+
+    InitializeSListHead(&Pool->FreeList);
+
+    Pool->CacheCount = 0;
+    Pool->CacheDepth = min(NIC_CB_CACHE_DEPTH, NumberOfCbs / (2 * CacheCount));
+
+    Pool->Caches = NdisAllocateMemoryWithTagPriority(
+            Adapter->AdapterHandle,
+            sizeof(MP_CB_CACHE) * CacheCount,
+            NIC_TAG_CB_CACHE,
+            NormalPoolPriority);
+
+    if (!Pool->Caches)
+    {
+        DEBUGP(MP_ERROR, "[%p] NdisAllocateMemoryWithTagPriority failed\n", Adapter);
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    NdisZeroMemory(Pool->Caches, sizeof(MP_CB_CACHE) * CacheCount);
+    Pool->CacheCount = CacheCount;
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+
+VOID
+NICFreeCbPool(
+    _In_    PMP_ADAPTER  Adapter,
+    _Inout_ PMP_CB_POOL  Pool)
+/*++
+
+Routine Description:
+
+    This routine frees the caches of a control block pool.  The control
+    blocks themselves belong to the caller, which must have taken them all
+    out of the pool.
+
+    Runs at IRQL = PASSIVE_LEVEL
+
+Arguments:
+
+    Adapter                     The adapter that owns the pool
+    Pool                        The pool to free
+
+Return Value:
+
+    None.
+
+--*/
+{
+    UNREFERENCED_PARAMETER(Adapter);
+
+    if (Pool->Caches)
+    {
+        NdisFreeMemory(
+                Pool->Caches,
+                sizeof(MP_CB_CACHE) * Pool->CacheCount,
+                0);
+        Pool->Caches = NULL;
+        Pool->CacheCount = 0;
+    }
+}
+
+
+_Must_inspect_result_
+PSLIST_ENTRY
+NICCbPoolPop(
+    _Inout_ PMP_CB_POOL  Pool)
+/*++
+
+Routine Description:
+
+    This routine takes a control block from the current processor's cache,
+    or from the shared stack if the cache is empty.
+
+    Runs at IRQL <= DISPATCH_LEVEL
+
+Arguments:
+
+    Pool                        The pool to take a control block from
+
+Return Value:
+
+    NULL if the pool is empty.
+    Else, the link of the control block taken.
+
+--*/
+{
+    PSLIST_ENTRY pEntry = NULL;
+    PMP_CB_CACHE Cache;
+    ULONG ProcessorIndex;
+    KIRQL OldIrql;
+
+    //
+    // The cache is only used by its own processor, so running at
+    // DISPATCH_LEVEL is all the synchronization it needs.
+    //
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+    ProcessorIndex = NIC_CURRENT_PROCESSOR_INDEX();
+    if (ProcessorIndex < Pool->CacheCount)
+    {
+        Cache = &Pool->Caches[ProcessorIndex];
+        if (Cache->Count > 0)
+        {
+            pEntry = Cache->Entries[--Cache->Count];
+        }
+    }
+
+    if (!pEntry)
+    {
+        pEntry = InterlockedPopEntrySList(&Pool->FreeList);
+    }
+
+    KeLowerIrql(OldIrql);
+
+    return pEntry;
+}
+
+
+VOID
+NICCbPoolPush(
+    _Inout_ PMP_CB_POOL  Pool,
+    _In_    PSLIST_ENTRY Entry)
+/*++
+
+Routine Description:
+
+    This routine returns a control block to the current processor's cache,
+    or to the shared stack if the cache is full.
+
+    Runs at IRQL <= DISPATCH_LEVEL
+
+Arguments:
+
+    Pool                        The pool to return the control block to
+    Entry                       The link of the control block
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PMP_CB_CACHE Cache;
+    ULONG ProcessorIndex;
+    KIRQL OldIrql;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+    ProcessorIndex = NIC_CURRENT_PROCESSOR_INDEX();
+    if (ProcessorIndex < Pool->CacheCount &&
+        Pool->Caches[ProcessorIndex].Count < Pool->CacheDepth)
+    {
+        Cache = &Pool->Caches[ProcessorIndex];
+        Cache->Entries[Cache->Count++] = Entry;
+    }
+    else
+    {
+        InterlockedPushEntrySList(&Pool->FreeList, Entry);
+    }
+
+    KeLowerIrql(OldIrql);
+}
+
+
+VOID
+NICCbPoolFlushCaches(
+    _Inout_ PMP_CB_POOL  Pool)
+/*++
+
+Routine Description:
+
+    This routine moves the control blocks held in the processors' caches to
+    the shared stack, so they can all be popped from it.  It is called when
+    the pool is torn down, once no other processor can be using it.
+
+Arguments:
+
+    Pool                        The pool to flush
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG ProcessorIndex;
+    PMP_CB_CACHE Cache;
+
+    for (ProcessorIndex = 0; ProcessorIndex < Pool->CacheCount; ProcessorIndex++)
+    {
+        Cache = &Pool->Caches[ProcessorIndex];
+
+        while (Cache->Count > 0)
+        {
+            InterlockedPushEntrySList(&Pool->FreeList, Cache->Entries[--Cache->Count]);
+        }
+    }
+}
 
@@ -33,14 +33,22 @@ Abstract:
 
 typedef struct _TCB
 {
+    SLIST_ENTRY             CbLink;     // Link in the adapter's TcbPool
     LIST_ENTRY              TcbLink;
     PNET_BUFFER             NetBuffer;
     ULONG                   FrameType;
     ULONG                   BytesActuallySent;
+    ULONG                   BytesCopied;
 } TCB, *PTCB;
 
 
 
+_Must_inspect_result_
+_Success_(return != NULL)
+PTCB
+GetTCB(
+    _In_  PMP_ADAPTER  Adapter);
+
 VOID
 ReturnTCB(
     _In_  PMP_ADAPTER  Adapter,
@@ -54,12 +62,26 @@ ReturnTCB(
 
 typedef struct _RCB
 {
+    SLIST_ENTRY             CbLink;     // Link in the adapter's RcbPool
     LIST_ENTRY              RcbLink;
     PNET_BUFFER_LIST        Nbl;
     PVOID                   Data;
 #if (NDIS_SUPPORT_NDIS620)    
     PVOID                   LookaheadData;
 #endif
+#if (NDIS_SUPPORT_NDIS630)
+    //
+    // Receive segment coalescing.  When TCP segments are coalesced, the
+    // first segment's RCB indicates a copy of its headers in RscHeader
+    // followed by the payload of every segment, each described by the
+    // RscPayloadMdl of its RCB.  The other RCBs are chained from the first
+    // through RscNext and are returned with it.
+    //
+    struct _RCB            *RscNext;
+    PMDL                    RscHeaderMdl;
+    PMDL                    RscPayloadMdl;
+    UCHAR                   RscHeader[HW_ZERO_COPY_HEADER_SIZE];
+#endif
 } RCB, *PRCB;
 
 _Must_inspect_result_
@@ -75,6 +97,48 @@ ReturnRCB(
     _In_  PMP_ADAPTER   Adapter,
     _In_  PRCB          Rcb);
 
+#if (NDIS_SUPPORT_NDIS630)
+NDIS_STATUS
+NICAllocRcbRscMdls(
+    _In_  PMP_ADAPTER   Adapter,
+    _Inout_ PRCB        Rcb);
+
+VOID
+NICFreeRcbRscMdls(
+    _Inout_ PRCB        Rcb);
+#endif
+
+
+//
+// Control block pools
+// -----------------------------------------------------------------------------
+//
+
+NDIS_STATUS
+NICInitializeCbPool(
+    _In_  PMP_ADAPTER  Adapter,
+    _Out_ PMP_CB_POOL  Pool,
+    _In_  ULONG        NumberOfCbs);
+
+VOID
+NICFreeCbPool(
+    _In_    PMP_ADAPTER  Adapter,
+    _Inout_ PMP_CB_POOL  Pool);
+
+_Must_inspect_result_
+PSLIST_ENTRY
+NICCbPoolPop(
+    _Inout_ PMP_CB_POOL  Pool);
+
+VOID
+NICCbPoolPush(
+    _Inout_ PMP_CB_POOL  Pool,
+    _In_    PSLIST_ENTRY Entry);
+
+VOID
+NICCbPoolFlushCaches(
+    _Inout_ PMP_CB_POOL  Pool);
+
 
 
 #endif // _TCBRCB_H
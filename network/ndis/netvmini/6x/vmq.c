@@ -1509,6 +1509,7 @@ Return Value:
                     &QueueInfo->RcbMemoryBlock,
                     &QueueInfo->FreeRcbList,
                     &QueueInfo->FreeRcbListLock,
+                    NULL,
                     &QueueInfo->RecvNblPoolHandle
                     );
 
@@ -2380,6 +2381,15 @@ Return Value:
         //
         VMQData->RxFilters[FilterIndex].Valid = TRUE;
 
+        //
+        // Have frames sent to the filter's address forwarded to this adapter. A filter
+        // that matches untagged frames matches those with VLAN ID 0 too.
+        //
+        NIC_COPY_ADDRESS(VMQData->RxFilters[FilterIndex].ForwardingEntry.MacAddress, VMQData->RxFilters[FilterIndex].MacAddress);
+        VMQData->RxFilters[FilterIndex].ForwardingEntry.VlanId =
+            VMQData->RxFilters[FilterIndex].VlanUntaggedOrZero ? 0 : VMQData->RxFilters[FilterIndex].VlanId;
+        MPAddForwardingEntry(Adapter, &VMQData->RxFilters[FilterIndex].ForwardingEntry);
+
 
     } while(FALSE);
 
@@ -2444,8 +2454,9 @@ Return Value:
         else
         {
             //
-            // Reset the filter to invalid
+            // Stop forwarding frames to the filter, then reset it to invalid
             //
+            MPRemoveForwardingEntry(Adapter, &VMQData->RxFilters[FilterIndex].ForwardingEntry);
             VMQData->RxFilters[FilterIndex].Valid = FALSE;
         }
 
@@ -2888,6 +2899,7 @@ Return Value:
 
     NDIS_STATUS_SUCCESS if copy succeeded.
     NDIS_STATUS_ADAPTER_NOT_READY if we can no longer copy data to the RCB due to the queue being in freeing state (DMA stopped)
+    NDIS_STATUS_RESOURCES if the sender's MDLs of a zero-copy frame could not be mapped
 
 --*/
 {
@@ -2968,35 +2980,42 @@ Return Value:
                 LookaheadSize = Queue->LookaheadSize;
             }
 
+            //
+            // The shared memory belongs to the queue's owner, so the frame is always copied into it,
+            // from the sender's MDLs if it was sent without copying.
+            //
             if(LookaheadSize < Frame->ulSize)
             {
 
                 //
                 // Copy the PostLookahead data
                 //
-                memcpy(((PUCHAR)PostLookaheadBlock->Buffer) + LookaheadSize, ((PUCHAR)Frame->Data) + LookaheadSize, Frame->ulSize - LookaheadSize);
+                Status = HWCopyBytesFromFrame(Frame, LookaheadSize, Frame->ulSize - LookaheadSize, ((PUCHAR)PostLookaheadBlock->Buffer) + LookaheadSize);
                 //
                 // Update the MDL to reflect the amount of data present
                 //
                 NdisAdjustMdlLength(PostLookaheadBlock->Mdl, Frame->ulSize - LookaheadSize);
             }
 
-            if(LookaheadSize)
+            if(LookaheadSize && Status == NDIS_STATUS_SUCCESS)
             {
                 //
                 // Copy the Lookahead
                 //
                 ULONG DataSize = min(LookaheadSize,Frame->ulSize);
-                memcpy(LookaheadBlock->Buffer, Frame->Data, DataSize);
+                Status = HWCopyBytesFromFrame(Frame, 0, DataSize, LookaheadBlock->Buffer);
                 //
                 // Update MDL to reflect the amount of data present
                 //
                 NdisAdjustMdlLength(LookaheadBlock->Mdl, DataSize);
             }
 
-            *Copied = TRUE;
+            if(Status == NDIS_STATUS_SUCCESS)
+            {
+                *Copied = TRUE;
 
-            NET_BUFFER_DATA_LENGTH(NetBuffer) = Frame->ulSize;
+                NET_BUFFER_DATA_LENGTH(NetBuffer) = Frame->ulSize;
+            }
 
         }
 
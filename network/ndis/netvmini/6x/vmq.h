@@ -197,6 +197,10 @@ typedef struct _MP_ADAPTER_FILTER
     USHORT QueueId;
     USHORT VlanId;
     UCHAR MacAddress[NIC_MACADDR_SIZE];
+    //
+    // Forwards frames that match the filter to the adapter while the filter is valid
+    //
+    MP_FORWARDING_ENTRY ForwardingEntry;
 } MP_ADAPTER_FILTER, *PMP_ADAPTER_FILTER;
 
 #define MP_ADAPTER_FILTER_INDEX(_FilterId_)\